@@ -1,6 +1,6 @@
 import shm_wrapper as shm
 from vegas_hpc.GBTStatus import GBTStatus
-import time, pyfits
+import os, struct, time, pyfits
 import vegas_hpc.possem as possem
 import numpy as n
 #import psr_utils as psr
@@ -49,6 +49,14 @@ def cardlist_from_string(str):
 
 VEGAS_STATUS_KEY = int('0x01001840', 16)
 VEGAS_STATUS_SEMID = "/vegas_status"
+VEGAS_STATUS_SIZE = 2880*64
+# As in vegas_status.h: the keyword index (struct hindex) and then the
+# sequence counter (struct vegas_status_seq) follow the cards
+VEGAS_STATUS_INDEX_OFFSET = VEGAS_STATUS_SIZE
+VEGAS_STATUS_INDEX_SIZE = 16 + 4096*12
+VEGAS_STATUS_SEQ_OFFSET = VEGAS_STATUS_INDEX_OFFSET + VEGAS_STATUS_INDEX_SIZE
+VEGAS_STATUS_SEQ_FORMAT = "=Iid" # seq, pid, lock_time
+VEGAS_STATUS_SNAP_TRIES = 16 # lock-free copies read() tries before locking
 
 class vegas_status:
 
@@ -76,11 +84,32 @@ class vegas_status:
         return self.hdr.items()
 
     def lock(self):
-        return possem.sem_wait(self.sem)
+        rv = possem.sem_wait(self.sem)
+        seq = self.read_seq()
+        if seq is not None and not seq & 1:
+            self.stat_buf.write(struct.pack(VEGAS_STATUS_SEQ_FORMAT, seq + 1,
+                                            os.getpid(), time.time()),
+                                VEGAS_STATUS_SEQ_OFFSET)
+        return rv
 
     def unlock(self):
+        seq = self.read_seq()
+        if seq is not None and seq & 1:
+            self.stat_buf.write(struct.pack("=I", (seq + 1) & 0xffffffff),
+                                VEGAS_STATUS_SEQ_OFFSET)
         return possem.sem_post(self.sem)
 
+    def read_seq(self):
+        """
+        read_seq():
+            The sequence counter that writers make odd while they hold
+            the lock, or None if the segment predates it.
+        """
+        try:
+            return struct.unpack("=I", self.stat_buf.read(4, VEGAS_STATUS_SEQ_OFFSET))[0]
+        except ValueError:
+            return None
+
     def data_buffer_format(self):
         """
         Returns true if the vegas data buffer format is in use and False otherwise
@@ -91,16 +120,55 @@ class vegas_status:
                 self.new_databuf_format=False # GUPPI mode
         return self.new_databuf_format
         
+    def unlocked(self):
+        """
+        unlocked():
+            Whether nobody holds the lock.
+        """
+        rv, val = possem.sem_getvalue(self.sem)
+        return rv == 0 and val > 0
+
     def read(self):
+        # As vegas_status_snapshot(): writers that do not keep the counter
+        # still hold the lock while they write, so a copy taken with the
+        # counter even and the lock free at both ends, that is the same
+        # as the cards after it, is whole.
+        for ntry in range(VEGAS_STATUS_SNAP_TRIES):
+            seq = self.read_seq()
+            if seq is None:
+                break
+            if not seq & 1 and self.unlocked():
+                buf = self.stat_buf.read(VEGAS_STATUS_SIZE)
+                if buf == self.stat_buf.read(VEGAS_STATUS_SIZE) and \
+                        self.unlocked() and self.read_seq() == seq:
+                    self.hdr = header_from_string(buf)
+                    return
+            # A writer is at it: give it the processor
+            time.sleep(0)
+        # Without the counter, or with a writer at it throughout, only the
+        # lock keeps the copy whole
         self.lock()
-        self.hdr = header_from_string(self.stat_buf.read())
+        buf = self.stat_buf.read(VEGAS_STATUS_SIZE)
         self.unlock()
+        self.hdr = header_from_string(buf)
 
     def write(self):
         self.lock()
         self.stat_buf.write(repr(self.hdr.ascard)+"END"+" "*77)
+        self.invalidate_index()
         self.unlock()
 
+    def invalidate_index(self):
+        """
+        invalidate_index():
+            The C side keeps a keyword index of the cards after them in
+            the segment; after rewriting the cards, mark it stale.
+        """
+        try:
+            self.stat_buf.write("\0"*4, VEGAS_STATUS_INDEX_OFFSET)
+        except ValueError:
+            pass # segment created without an index
+
     def update(self, key, value, comment=None):
         self.hdr.update(key, value, comment)
 
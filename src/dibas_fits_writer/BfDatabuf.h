@@ -0,0 +1,268 @@
+//# Copyright (C) 2013 Associated Universities, Inc. Washington DC, USA.
+//#
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//#
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//#
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//#
+//# Correspondence concerning GBT software should be addressed as follows:
+//#	GBT Operations
+//#	National Radio Astronomy Observatory
+//#	P. O. Box 2
+//#	Green Bank, WV 24944-0002 USA
+
+#ifndef BfDatabuf_h
+#define BfDatabuf_h
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/sem.h>
+#include <type_traits>
+
+extern "C"
+{
+#include "vegas_error.h"
+#include "bf_databuf.h"
+#include "hashpipe_ipckey.h"
+}
+
+/// Typed access to a beamformer output databuf.
+/// The beamformer output databufs, one per mode, differ only in the
+/// payload of their blocks.  Databuf describes one with the payload type
+/// and number of blocks, lays it out exactly as the C structs in
+/// bf_databuf.h do, and gives typed access to its blocks.
+///
+/// A Lease holds a filled block for as long as it is in scope, and frees
+/// it for the producer when it goes, however the scope is left:
+///
+///    BfHiDatabuf db;
+///    if (!db.attach(4, instance_id)) ...
+///    BfHiDatabuf::Lease lease(db, block);
+///    if (lease.held())
+///        write(lease->header.mcnt, lease->data);
+///
+/// A new mode is a typedef below, with a layout check against the
+/// producer's struct if it has one.
+template <typename Payload, int Depth = NUM_BLOCKS>
+class Databuf
+{
+public:
+    typedef typename std::remove_extent<Payload>::type Sample;
+
+    struct Block
+    {
+        bf_databuf_block_header_t header;
+        bf_databuf_block_header_cache_alignment padding;
+        Payload data;
+    };
+
+    struct Layout
+    {
+        bf_databuf_header_t header;
+        bf_databuf_cache_alignment padding;
+        Block block[Depth];
+    };
+
+    /// A filled block, freed when the lease goes out of scope
+    class Lease
+    {
+    public:
+        /// Waits for the block to be filled; held() says if it was
+        /// before the wait timed out.
+        Lease(Databuf &db, int block_id) :
+            _db(db), _block_id(block_id),
+            _held(db.wait_filled(block_id) == VEGAS_OK)
+        {
+        }
+        ~Lease() { release(); }
+
+        bool held() const { return _held; }
+        Block &operator*() { return _db.block(_block_id); }
+        Block *operator->() { return &_db.block(_block_id); }
+
+        /// Free the block now, rather than when the lease goes
+        int release()
+        {
+            if (!_held)
+                return VEGAS_OK;
+            _held = false;
+            return _db.set_free(_block_id);
+        }
+
+    private:
+        Lease(const Lease &);
+        Lease &operator=(const Lease &);
+
+        Databuf &_db;
+        int _block_id;
+        bool _held;
+    };
+
+    Databuf() : _db(0), _shmid(-1), _owner(false) {}
+    ~Databuf() { detach(); }
+
+    /// Attach to the producer's databuf.  Returns false, having said
+    /// why, if it is not there or does not look like this layout.
+    bool attach(int databuf_id, int instance_id)
+    {
+        detach();
+        int shmid = databuf_get_shmid(databuf_id, instance_id);
+        if (shmid == -1)
+            return false;
+        return map(shmid, false);
+    }
+
+    /// Create the databuf, as a producer would, for simulators and
+    /// tests.  It is removed again when this object detaches.
+    bool create(int databuf_id, int instance_id)
+    {
+        detach();
+        key_t key = hashpipe_databuf_key(instance_id);
+        if (key == HASHPIPE_KEY_ERROR)
+        {
+            vegas_error("Databuf::create", "hashpipe_databuf_key error");
+            return false;
+        }
+        int shmid = shmget(key + databuf_id - 1, sizeof(Layout), IPC_CREAT | IPC_EXCL | 0666);
+        if (shmid == -1)
+        {
+            vegas_error("Databuf::create", "shmget error");
+            return false;
+        }
+        if (!map(shmid, true))
+        {
+            shmctl(shmid, IPC_RMID, NULL);
+            return false;
+        }
+        memset(_db, 0, sizeof(Layout));
+        strncpy(_db->header.data_type, "FORMAT", sizeof(_db->header.data_type) - 1);
+        _db->header.header_size = sizeof(bf_databuf_block_header_t);
+        _db->header.block_size = sizeof(Block);
+        _db->header.n_block = Depth;
+        _db->header.shmid = shmid;
+        _db->header.semid = semget(IPC_PRIVATE, Depth, IPC_CREAT | 0666);
+        if (_db->header.semid == -1)
+        {
+            vegas_error("Databuf::create", "semget error");
+            detach();
+            return false;
+        }
+        return true;
+    }
+
+    void detach()
+    {
+        if (_db == 0)
+            return;
+        if (_owner)
+            semctl(_db->header.semid, 0, IPC_RMID);
+        databuf_detach(_db);
+        if (_owner)
+            shmctl(_shmid, IPC_RMID, NULL);
+        _db = 0;
+        _shmid = -1;
+        _owner = false;
+    }
+
+    bool attached() const { return _db != 0; }
+    int n_block() const { return _db->header.n_block; }
+    int semid() const { return _db->header.semid; }
+    Layout *layout() { return _db; }
+    Block &block(int block_id) { return _db->block[block_id]; }
+    Sample *data(int block_id) { return _db->block[block_id].data; }
+
+    int wait_filled(int block_id) { return databuf_wait_filled(semid(), block_id); }
+    int set_free(int block_id) { return databuf_set_free(semid(), block_id); }
+    int set_filled(int block_id)
+    {
+        union semun arg;
+        arg.val = 1;
+        if (semctl(semid(), block_id, SETVAL, arg) == -1)
+        {
+            vegas_error("Databuf::set_filled", "semctl error");
+            return VEGAS_ERR_SYS;
+        }
+        return VEGAS_OK;
+    }
+
+private:
+    Databuf(const Databuf &);
+    Databuf &operator=(const Databuf &);
+
+    bool map(int shmid, bool owner)
+    {
+        struct shmid_ds ds;
+        if (shmctl(shmid, IPC_STAT, &ds) == -1)
+        {
+            vegas_error("Databuf::attach", "shmctl error");
+            return false;
+        }
+        if (ds.shm_segsz < sizeof(Layout))
+        {
+            vegas_error("Databuf::attach", "databuf is smaller than its layout");
+            return false;
+        }
+        void *p = shmat(shmid, NULL, 0);
+        if (p == (void *)-1)
+        {
+            vegas_error("Databuf::attach", "shmat error");
+            return false;
+        }
+        _db = (Layout *)p;
+        _shmid = shmid;
+        _owner = owner;
+        if (!owner && (n_block() < 1 || n_block() > Depth))
+        {
+            vegas_error("Databuf::attach", "databuf has an unexpected number of blocks");
+            detach();
+            return false;
+        }
+        return true;
+    }
+
+    Layout *_db;
+    int _shmid;
+    bool _owner;
+};
+
+/// Check at compile time that a Databuf lays out a mode's buffer as the
+/// producer's C struct does.
+#define BF_DATABUF_CHECK_LAYOUT(Type, cstruct, cblock) \
+    static_assert(sizeof(Type::Layout) == sizeof(struct cstruct), \
+                  #Type " is not the size of " #cstruct); \
+    static_assert(offsetof(Type::Layout, block) == offsetof(struct cstruct, block), \
+                  #Type " blocks are not where " #cstruct " has them"); \
+    static_assert(sizeof(Type::Block) == sizeof(struct cblock), \
+                  #Type " blocks are not the size of " #cblock); \
+    static_assert(offsetof(Type::Block, data) == offsetof(struct cblock, data), \
+                  #Type " payload is not where " #cblock " has it")
+
+/// Covariance matrix, fine channel correlator (HI) mode
+typedef Databuf<float[TOTAL_GPU_DATA_SIZE]> BfHiDatabuf;
+/// PAF calibration correlator mode
+typedef Databuf<float[TOTAL_GPU_DATA_SIZE_PAF]> BfPafDatabuf;
+/// FRB correlator mode
+typedef Databuf<float[TOTAL_GPU_DATA_SIZE_FRB]> BfFrbDatabuf;
+/// Pulsar/real time beamformer mode
+typedef Databuf<float[TOTAL_GPU_PULSAR_DATA_SIZE]> BfPulsarDatabuf;
+
+BF_DATABUF_CHECK_LAYOUT(BfHiDatabuf, bf_databuf, bf_databuf_block);
+BF_DATABUF_CHECK_LAYOUT(BfPafDatabuf, bfpaf_databuf, bfpaf_databuf_block);
+BF_DATABUF_CHECK_LAYOUT(BfFrbDatabuf, bffrb_databuf, bffrb_databuf_block);
+BF_DATABUF_CHECK_LAYOUT(BfPulsarDatabuf, bfp_databuf, bfp_databuf_block);
+
+#endif
@@ -44,6 +44,7 @@ extern "C"
 #include "fifo.h"
 };
 #include "DiskBufferChunk.h"
+#include "BfDatabuf.h"
 #include "BfFitsIO.h"
 #include "BfFitsThread.h"
 #include "FitsIO.h"
@@ -81,109 +82,34 @@ void *runGbtFitsWriter(void *ptr)
     return BfFitsThread::run(args);
 }
 
-//primary function
-void *
-BfFitsThread::run(struct vegas_thread_args *args)
+typedef int (BfFitsIO::*BfWriteFn)(int mcnt, int64_t good_data, float *data);
+
+/// Attach to a mode's databuf and write its blocks to FITS until the scan
+/// is complete.  DB is the mode's Databuf, Write the BfFitsIO method that
+/// writes one of its blocks, and fits_mode the mode number BfFitsIO takes.
+template <class DB, BfWriteFn Write>
+static void
+write_scan(struct vegas_status *st, int instance_id, int databufid, int fits_mode)
 {
-    bool cov_mode1 = (bool)args->cov_mode1;
-    bool cov_mode2 = (bool)args->cov_mode2;
-    bool cov_mode3 = (bool)args->cov_mode3;
-    int rv;
     //create BfFitsIO pointer (the "fits writer")
     std::unique_ptr<BfFitsIO> fitsio;
 
     timespec loop_start, loop_stop;
     timespec fits_start, fits_stop;
 
-
-    // pass on the instance id from the args to our class member
-    int instance_id = args->input_buffer;
-
-    printf("BfFitsThread::run, instance_id = %d\n", instance_id);
-
-    pthread_cleanup_push((void (*)(void*))&BfFitsThread::set_finished, args);
-
-    /* Set cpu affinity */
-    ///cpu_set_t cpuset, cpuset_orig;
-    //sched_getaffinity(0, sizeof(cpu_set_t), &cpuset_orig);
-    //CPU_ZERO(&cpuset);
-    //CPU_SET(6, &cpuset);
-    //rv = sched_setaffinity(0, sizeof(cpu_set_t), &cpuset);
-    rv=0;
-    if (rv<0)
-    {
-        vegas_error("BfFitsThread::run", "Error setting cpu affinity.");
-        perror("sched_setaffinity");
-    }
-
-    /* Set priority */
-    if (rv<0)
-    {
-        vegas_error("BfFitsThread::run", "Error setting priority level.");
-        perror("set_priority");
-    }
-
-    /* Attach to status shared mem area */
-    struct vegas_status st;
-    rv = vegas_status_attach_inst(&st, instance_id);
-    if (rv!=VEGAS_OK)
-    {
-        vegas_error("BfFitsThread::run",
-                    "Error attaching to status shared memory.");
-        pthread_exit(NULL);
-    }
-    pthread_cleanup_push((void (*)(void*))&BfFitsThread::status_detach, &st);
-    pthread_cleanup_push((void (*)(void*))&BfFitsThread::setExitStatus, &st);
-
-    int databufid = 3; // disk buffer; default for CALCORRMODE
-
-    // Attach to the data buffer shared memory.
-    // Different modes are taken into account due to the different buffer sizes
-    void *gdb;
-    int shmid, semid;
-    // HI/PFB mode
-    if (cov_mode1) {
-	databufid = 4; // this is for FINE CHANNEL CORRELATOR ONLY
-        gdb = (void *)bf_databuf_attach(databufid, instance_id);
-        if (gdb != 0)
-            semid = ((bf_databuf *)gdb)->header.semid;
-    } 
-    // CALCORR mode
-    else if (cov_mode2){
-        gdb = (void *)bfpaf_databuf_attach(databufid, instance_id);
-        if (gdb != 0)
-            semid = ((bfpaf_databuf *)gdb)->header.semid;
-    }
-    //FRB mode
-    else if (cov_mode3){
-        gdb = (void *)bffrb_databuf_attach(databufid, instance_id);
-        if (gdb != 0)
-            semid = ((bffrb_databuf *)gdb)->header.semid;
-    }
-    //PULSAR/RTBF mode
-    else {
-        databufid = 2;
-        gdb = (void *)bfp_databuf_attach(databufid, instance_id);
-        if (gdb != 0)
-            semid = ((bfp_databuf *)gdb)->header.semid;
-    }
-
-
-    // If we couldn't attach, exit
-    if(gdb == 0)
+    // Attach to the data buffer shared memory.  It is detached when db
+    // goes out of scope, however the thread leaves.
+    DB db;
+    if (!db.attach(databufid, instance_id))
     {
         vegas_error("BfFitsThread::run", "databuffer attach error cannot continue");
         pthread_exit(NULL);
     }
 
-
-    // make sure we detach from this buffer when the thread exits
-    pthread_cleanup_push((void (*)(void*))&BfFitsThread::databuf_detach, gdb);
-
     /* Set the thread status to init */
-    vegas_status_lock_safe(&st);
-    hputs(st.buf, STATUS_KEYW, "Init");
-    vegas_status_unlock_safe(&st);
+    vegas_status_lock_safe(st);
+    hputs(st->buf, STATUS_KEYW, "Init");
+    vegas_status_unlock_safe(st);
 
 
     /* Initialize some key parameters */
@@ -196,9 +122,7 @@ BfFitsThread::run(struct vegas_thread_args *args)
     // If keyword does not exist, attempt to fill-in a default value.
     char status_buf[VEGAS_STATUS_SIZE];
     char datadir[64] = {0};
-    vegas_status_lock_safe(&st);
-    memcpy(status_buf, st.buf, VEGAS_STATUS_SIZE);
-    vegas_status_unlock_safe(&st);
+    vegas_status_snapshot(st, status_buf);
 
     // Look for the DATADIR keyword, this forms the first portion of the path
     if (!hgets(status_buf, "DATADIR", sizeof(datadir), datadir))
@@ -206,19 +130,8 @@ BfFitsThread::run(struct vegas_thread_args *args)
         vegas_error("Vegas FITS writer", "DATADIR status memory keyword not set");
         pthread_exit(0);
     }
-    // Create a BfFitsIO writer subclass based on mode
-    if (cov_mode1){
-        fitsio.reset( new BfFitsIO(datadir, false, instance_id,0) );
-    } 
-    else if (cov_mode2){
-        fitsio.reset( new BfFitsIO(datadir, false, instance_id,1) );
-    }
-    else if (cov_mode3){
-        fitsio.reset( new BfFitsIO(datadir, false, instance_id,2) );
-    }
-    else {
-        fitsio.reset( new BfFitsIO(datadir, false, instance_id,3) );
-    }
+    // Create a BfFitsIO writer for the mode
+    fitsio.reset( new BfFitsIO(datadir, false, instance_id, fits_mode) );
     pthread_cleanup_push((void (*)(void*))&BfFitsThread::close, fitsio.get());
 
     // pass a copy of the status memory to the writer
@@ -241,7 +154,6 @@ BfFitsThread::run(struct vegas_thread_args *args)
         printf("goes back to secs: %lu\n", secs);
     }
     hgetr8(status_buf, "STRTDMJD", &start_time);
-    unsigned long secs = BfFitsIO::dmjd_2_secs(start_time);
     fitsio->set_startTime(start_time);
 
     // Starttime & DATADIR must be set as it is used to determine the file name
@@ -264,9 +176,8 @@ BfFitsThread::run(struct vegas_thread_args *args)
         pthread_exit(0);
     }
 
-    int block = 0,num_iter=0;
+    int block = 0;
     char scan_status[96];
-    int rx_some_data = 0;
     scan_finished = 0;
 
     int rowsWritten = 0;
@@ -278,9 +189,9 @@ BfFitsThread::run(struct vegas_thread_args *args)
     signal(SIGTERM, stop_thread);
     signal(SIGKILL, stop_thread);
 
-    vegas_status_lock_safe(&st);
-    hputi4(st.buf, "DSKBLKIN", block);
-    vegas_status_unlock_safe(&st);
+    vegas_status_lock_safe(st);
+    hputi4(st->buf, "DSKBLKIN", block);
+    vegas_status_unlock_safe(st);
     int scanLen;
      
     hgeti4(status_buf,"SCANLEN",&scanLen);
@@ -291,25 +202,26 @@ BfFitsThread::run(struct vegas_thread_args *args)
     {
         
         clock_gettime(CLOCK_MONOTONIC, &loop_start);
-        // Wait for a data buffer from the HPC program
-        if (databuf_wait_filled(semid, block))
+        // Wait for a data buffer from the HPC program.  The lease frees
+        // it again when it goes out of scope.
+        typename DB::Lease lease(db, block);
+        if (!lease.held())
         {
             //printf("Timed out\n");
             // Waiting timed out - check the scan status
-            vegas_status_lock_safe(&st);
-            hgets(st.buf, "SCANSTAT", sizeof(scan_status), scan_status);
-            vegas_status_unlock_safe(&st);
+            vegas_status_lock_safe(st);
+            hgets(st->buf, "SCANSTAT", sizeof(scan_status), scan_status);
+            vegas_status_unlock_safe(st);
             /*change process status to waiting*/            
-            vegas_status_lock_safe(&st);
-            hputs(st.buf, STATUS_KEYW, "Waiting");
-            vegas_status_unlock_safe(&st);
+            vegas_status_lock_safe(st);
+            hputs(st->buf, STATUS_KEYW, "Waiting");
+            vegas_status_unlock_safe(st);
             continue;
         }
-        rx_some_data = 1;
         /*change process status to waiting*/
-        vegas_status_lock_safe(&st);
-        hputs(st.buf, STATUS_KEYW, "Writing");
-        vegas_status_unlock_safe(&st);
+        vegas_status_lock_safe(st);
+        hputs(st->buf, STATUS_KEYW, "Writing");
+        vegas_status_unlock_safe(st);
 
         
         // Start the timer for how long it takes to write to FITS
@@ -317,58 +229,24 @@ BfFitsThread::run(struct vegas_thread_args *args)
         //   from the gpu table to the fits table
         clock_gettime(CLOCK_MONOTONIC, &fits_start);
 
-        // collect some mode dependent info about the databuffer blocks
-        uint64_t mcnt,n_block;
-        int64_t gd;
-        float *data;
-        if (cov_mode1) {
-            mcnt = ((bf_databuf *)gdb)->block[block].header.mcnt;
-            n_block = ((bf_databuf *)gdb)->header.n_block;
-            gd = ((bf_databuf *)gdb)->block[block].header.good_data;
-            data = ((bf_databuf *)gdb)->block[block].data;
-            fitsio->write_HI(mcnt, gd, data);
-	    printf("mcnt: %llu, good_data = %lld\n",(long long unsigned int) mcnt, (long long int) gd);
-        }
-
-        else if (cov_mode2) {
-            mcnt = ((bfpaf_databuf *)gdb)->block[block].header.mcnt;
-            n_block = ((bfpaf_databuf *)gdb)->header.n_block;
-            gd = ((bfpaf_databuf *)gdb)->block[block].header.good_data;
-            data = ((bfpaf_databuf *)gdb)->block[block].data;
-            fitsio->write_PAF(mcnt, gd, data);
-	    printf("mcnt: %llu, good_data = %lld\n",(long long unsigned int) mcnt, (long long int) gd);
-        }
+        uint64_t mcnt = lease->header.mcnt;
+        int64_t gd = lease->header.good_data;
+        (fitsio.get()->*Write)(mcnt, gd, lease->data);
+        printf("mcnt: %llu, good_data = %lld\n",(long long unsigned int) mcnt, (long long int) gd);
 
-        else if (cov_mode3){
-            mcnt = ((bffrb_databuf *)gdb)->block[block].header.mcnt;
-            n_block = ((bffrb_databuf *)gdb)->header.n_block;
-            gd = ((bffrb_databuf *)gdb)->block[block].header.good_data;
-            data = ((bffrb_databuf *)gdb)->block[block].data;
-            fitsio->write_FRB(mcnt, gd, data);
-            printf("mcnt: %llu, good_data = %lld\n",(long long unsigned int) mcnt, (long long int) gd);
-        }
-        else {
-            mcnt = ((bfp_databuf *)gdb)->block[block].header.mcnt;
-            n_block = ((bfp_databuf *)gdb)->header.n_block;
-            gd = ((bfp_databuf *)gdb)->block[block].header.good_data;
-            data = ((bfp_databuf *)gdb)->block[block].data;
-            printf("mcnt: %llu, good_data = %lld\n",(long long unsigned int) mcnt, (long long int) gd);
-            num_iter++;
-            fitsio->write_RTBF(mcnt, gd, data);
-        }    
         clock_gettime(CLOCK_MONOTONIC, &fits_stop);
         total_write_time += ELAPSED_NS(fits_start, fits_stop);
         
         rowsWritten++;
 
         // Free the datablock for the HPC program
-        if(databuf_set_free(semid, block))
+        if(lease.release())
         {
             vegas_warn("BfFitsThread::run", "failed to set block free");
             printf("block=%d\n", block);
         }
 
-        block = (block + 1) % n_block;
+        block = (block + 1) % db.n_block();
 
         
         // Scan completed (We have more than SCANLEN of data)
@@ -376,7 +254,7 @@ BfFitsThread::run(struct vegas_thread_args *args)
         {
             printf("Ending fits writer because scan is complete\n");
             scan_finished = 1;
-            databuf_set_free(semid, block);
+            db.set_free(block);
         }
 
         // Check for a thread cancellation
@@ -393,14 +271,76 @@ BfFitsThread::run(struct vegas_thread_args *args)
     fitsio->close();
 
     // Set our process status to exiting
-    vegas_status_lock_safe(&st);
-    hputs(st.buf, STATUS_KEYW, "Exiting");
-    vegas_status_unlock_safe(&st);
-    
-    // cleanup on exit
-    // TBF: is this the correct number of pops?
-    pthread_cleanup_pop(0);
+    vegas_status_lock_safe(st);
+    hputs(st->buf, STATUS_KEYW, "Exiting");
+    vegas_status_unlock_safe(st);
+
     pthread_cleanup_pop(0);
+}
+
+//primary function
+void *
+BfFitsThread::run(struct vegas_thread_args *args)
+{
+    bool cov_mode1 = (bool)args->cov_mode1;
+    bool cov_mode2 = (bool)args->cov_mode2;
+    bool cov_mode3 = (bool)args->cov_mode3;
+    int rv;
+
+    // pass on the instance id from the args to our class member
+    int instance_id = args->input_buffer;
+
+    printf("BfFitsThread::run, instance_id = %d\n", instance_id);
+
+    pthread_cleanup_push((void (*)(void*))&BfFitsThread::set_finished, args);
+
+    /* Set cpu affinity */
+    ///cpu_set_t cpuset, cpuset_orig;
+    //sched_getaffinity(0, sizeof(cpu_set_t), &cpuset_orig);
+    //CPU_ZERO(&cpuset);
+    //CPU_SET(6, &cpuset);
+    //rv = sched_setaffinity(0, sizeof(cpu_set_t), &cpuset);
+    rv=0;
+    if (rv<0)
+    {
+        vegas_error("BfFitsThread::run", "Error setting cpu affinity.");
+        perror("sched_setaffinity");
+    }
+
+    /* Set priority */
+    if (rv<0)
+    {
+        vegas_error("BfFitsThread::run", "Error setting priority level.");
+        perror("set_priority");
+    }
+
+    /* Attach to status shared mem area */
+    struct vegas_status st;
+    rv = vegas_status_attach_inst(&st, instance_id);
+    if (rv!=VEGAS_OK)
+    {
+        vegas_error("BfFitsThread::run",
+                    "Error attaching to status shared memory.");
+        pthread_exit(NULL);
+    }
+    pthread_cleanup_push((void (*)(void*))&BfFitsThread::status_detach, &st);
+    pthread_cleanup_push((void (*)(void*))&BfFitsThread::setExitStatus, &st);
+
+    // The modes' databufs differ in their block sizes and ids
+    // HI/PFB mode: FINE CHANNEL CORRELATOR ONLY
+    if (cov_mode1)
+        write_scan<BfHiDatabuf, &BfFitsIO::write_HI>(&st, instance_id, 4, 0);
+    // CALCORR mode
+    else if (cov_mode2)
+        write_scan<BfPafDatabuf, &BfFitsIO::write_PAF>(&st, instance_id, 3, 1);
+    //FRB mode
+    else if (cov_mode3)
+        write_scan<BfFrbDatabuf, &BfFitsIO::write_FRB>(&st, instance_id, 3, 2);
+    //PULSAR/RTBF mode
+    else
+        write_scan<BfPulsarDatabuf, &BfFitsIO::write_RTBF>(&st, instance_id, 2, 3);
+
+    // cleanup on exit
     pthread_cleanup_pop(0);
     pthread_cleanup_pop(0);
     pthread_cleanup_pop(0);
@@ -428,18 +368,6 @@ BfFitsThread::setExitStatus(vegas_status *st)
     vegas_status_unlock(st);
 }
 
-void
-BfFitsThread::databuf_detach(void *db)
-{
-    databuf_detach(db);
-}
-
-void
-BfFitsThread::databuf_detach(bf_databuf *db)
-{
-    bf_databuf_detach(db);
-}
-
 void
 BfFitsThread::free_sdfits(vegas_status *st)
 {
@@ -48,8 +48,6 @@ public:
     static void set_finished(struct vegas_thread_args *args);
     static void status_detach(vegas_status *st);
     static void setExitStatus(vegas_status *st);
-    static void databuf_detach(bf_databuf *);
-    static void databuf_detach(void *);
     static void free_sdfits(vegas_status *st);
     static void close(BfFitsIO *f);
     //virtual void *databuf_attach(int id) = 0;
@@ -79,8 +79,13 @@ DiskBufferChunk::DiskBufferChunk(const char *fits_header,
     int array_len = data_dims[0] * 4 * data_dims[2];
     data_len = array_len * (int)sizeof(float);
     // Fill out data array while doing transpose, keep dims straight!
+    // An accumulator run with ACCORDER=FITS has already done it for us.
     data = new float[array_len];
-    transpose(in_data, data, data_dims[0], data_dims[2]); //, data_dims[1]);
+    char order[16];
+    if (hgets(fits_header, "ACCORDER", sizeof(order), order) && strcmp(order, "FITS") == 0)
+        memcpy(data, in_data, data_len);
+    else
+        transpose(in_data, data, data_dims[0], data_dims[2]); //, data_dims[1]);
 }
 
 DiskBufferChunk::~DiskBufferChunk()
@@ -2,6 +2,7 @@
 %{
 #include <semaphore.h>
 %}
+%include "typemaps.i"
 
 // Treat a mode_t as an unsigned integer
 typedef int mode_t;
@@ -16,3 +17,6 @@ sem_t *sem_open(const char *name, int oflag,
 int sem_post(sem_t *sem);
 int sem_wait(sem_t *sem);
 int sem_close(sem_t *sem);
+// Returns [rv, value]
+%apply int *OUTPUT { int *sval };
+int sem_getvalue(sem_t *sem, int *sval);
@@ -1,42 +1,65 @@
 
 #ifndef DataBlockInfoCache_h
 #define DataBlockInfoCache_h
+
+/*
+ The index and spead headers of the last two input blocks, addressed as
+ one run of 2 * MAX_HEAPS_PER_BLK heaps: heap i of the older block is i,
+ heap i of the newer one MAX_HEAPS_PER_BLK + i.
+
+ Each block is copied once into a ring of two slots; a new block takes
+ the older one's slot, so nothing is shifted.  As a block is stored,
+ prefix counts of its invalid heaps, blanked heaps and switching state
+ changes are built, so that the validity and blanking of any run of
+ heaps is answered from a few lookups rather than a scan.
+ */
 class DataBlockInfoCache
 {
 public:
-    cpu_gpu_buf_index   _heap_idx[2 * MAX_HEAPS_PER_BLK];
-    time_spead_heap     _heap_hdr[2 * MAX_HEAPS_PER_BLK];
-    
     DataBlockInfoCache()
     {
-        memset(_heap_idx, 0, sizeof(_heap_idx));
-        memset(_heap_hdr, 0, sizeof(_heap_hdr));
+        memset(_slot, 0, sizeof(_slot));
+        // Until they are filled, no heap of either half is valid
+        for (int i = 0; i <= MAX_HEAPS_PER_BLK; ++i)
+        {
+            _slot[0].invalid[i] = _slot[1].invalid[i] = i;
+        }
+        _newest = 1;
     }
     /*
      Take an input block and cache its index and spead header info.
-     This does a upper to lower shift prior to loading the upper half
+     The block becomes the upper half, and the previous one the lower.
      */
     void input(time_spead_heap *hdr_base, databuf_index *idx)
     {
-        // shift upper to lower buffer
-        memcpy(&_heap_hdr[0], &_heap_hdr[MAX_HEAPS_PER_BLK], MAX_HEAPS_PER_BLK * sizeof(time_spead_heap));
-        memcpy(&_heap_idx[0], &_heap_idx[MAX_HEAPS_PER_BLK], MAX_HEAPS_PER_BLK * sizeof(cpu_gpu_buf_index)); 
-        // store new input data in upper half
-        memcpy(&_heap_hdr[MAX_HEAPS_PER_BLK], hdr_base, MAX_HEAPS_PER_BLK * sizeof(time_spead_heap));
-        memcpy(&_heap_idx[MAX_HEAPS_PER_BLK], &idx->cpu_gpu_buf[0], MAX_HEAPS_PER_BLK * sizeof(cpu_gpu_buf_index)); 
+        const Slot &prev = _slot[_newest];
+        _newest ^= 1;
+        Slot &s = _slot[_newest];
+        unsigned int last = prev.hdr[MAX_HEAPS_PER_BLK - 1].status_bits;
+        unsigned short invalid = 0, blanked = 0, changed = 0;
+
+        memcpy(s.hdr, hdr_base, sizeof(s.hdr));
+        memcpy(s.idx, &idx->cpu_gpu_buf[0], sizeof(s.idx));
+
+        // Heap 0's state change is against the last heap of the previous block
+        s.invalid[0] = s.blanked[0] = s.changed[0] = 0;
+        for (int i = 0; i < MAX_HEAPS_PER_BLK; ++i)
+        {
+            unsigned int bits = s.hdr[i].status_bits;
+            invalid += (s.idx[i].heap_valid == 0);
+            blanked += ((bits & (BLANKING_BIT | SCAN_NOT_STARTED)) != 0);
+            changed += ((bits ^ last) & 0x3) != 0;
+            s.invalid[i + 1] = invalid;
+            s.blanked[i + 1] = blanked;
+            s.changed[i + 1] = changed;
+            last = bits;
+        }
     }
 
     /* verify the next num_heaps of data is valid according to the index */
     int is_valid(int heap_start, int num_heaps)
     {
-        for (int i = heap_start; i < (heap_start + num_heaps); ++i)
-        {
-            if (!_heap_idx[i].heap_valid)
-            {
-                return FALSE;
-            }
-        }
-        return TRUE;
+        return count(&Slot::invalid, heap_start, heap_start + num_heaps) == 0 ? TRUE : FALSE;
     }
 
 /*
@@ -48,9 +71,9 @@ public:
     status_bits[34] = t0 + dt + dt
     ...
     status_bits[N+32] = t0 + dt * N;
-    
+
     So when we think about labeling the frequency heap outputs, the convention
-    is to use the '1st' non-blanked time-series (e.g. index 32 above) to fill 
+    is to use the '1st' non-blanked time-series (e.g. index 32 above) to fill
     in the timestamp, counter, mjd etc.
 
     However, when we think about how to process blanking, we need to use the
@@ -61,7 +84,7 @@ public:
 /*
  * Check the input time series for blanking and encode
  * the result.
- * Return value: 
+ * Return value:
  *  - bit 0x4 -- indicates cal or sig/ref state changed during input
  *  - bit 0x2 -- indicates if the most recent time sample had blanking asserted
  *  - bit 0x1 -- indicates if any of the time samples had blanking asserted
@@ -70,30 +93,68 @@ public:
     /* check the switching and blanking status */
     int is_blanked(int heap_start, int num_heaps)
     {
-        int state_changed = 0;
-        int banked_at_start = (_heap_hdr[heap_start + num_heaps- 1].status_bits & 0x8)  ? 0x2 : 0x0;
-        int is_blanked = (banked_at_start || (_heap_hdr[heap_start].status_bits & 0x8)) ? 0x1 : 0x0;
+        int end = heap_start + num_heaps;
+        int banked_at_start = (status(end - 1) & 0x8)  ? 0x2 : 0x0;
+        int is_blanked = (banked_at_start || (status(heap_start) & 0x8)) ? 0x1 : 0x0;
+        int state_changed = count(&Slot::changed, heap_start + 1, end) ? 0x4 : 0x0;
 
-        for (int i = heap_start + 1; i < (heap_start + num_heaps); ++i)
+        if (count(&Slot::blanked, heap_start + 1, end))
         {
-            if ((_heap_hdr[i].status_bits & 0x3) != (_heap_hdr[i-1].status_bits & 0x3))
-            {
-                state_changed = 0x4;
-            }
-            if (_heap_hdr[i].status_bits & (BLANKING_BIT | SCAN_NOT_STARTED))
-            {
-                is_blanked = 0x1;
-            }
+            is_blanked = 0x1;
         }
-        return (banked_at_start | state_changed | is_blanked);  
+        return (banked_at_start | state_changed | is_blanked);
     }
     int status(int heapidx)
     {
-        return _heap_hdr[heapidx].status_bits;
+        return header(heapidx)->status_bits;
     }
     double mjd(int heapidx)
     {
-        return _heap_idx[heapidx].heap_rcvd_mjd;
+        return slot(heapidx).idx[heapidx % MAX_HEAPS_PER_BLK].heap_rcvd_mjd;
+    }
+    const time_spead_heap *header(int heapidx)
+    {
+        return &slot(heapidx).hdr[heapidx % MAX_HEAPS_PER_BLK];
+    }
+
+private:
+    typedef unsigned short Prefix[MAX_HEAPS_PER_BLK + 1];
+
+    struct Slot
+    {
+        time_spead_heap     hdr[MAX_HEAPS_PER_BLK];
+        cpu_gpu_buf_index   idx[MAX_HEAPS_PER_BLK];
+        // Heaps before i that are invalid, blanked, or in a different
+        // switching state from the heap before them
+        Prefix              invalid;
+        Prefix              blanked;
+        Prefix              changed;
+    };
+
+    Slot _slot[2];
+    int  _newest;           // slot of the upper half
+
+    Slot &slot(int heapidx)
+    {
+        return _slot[(_newest + 1 + heapidx / MAX_HEAPS_PER_BLK) & 1];
+    }
+
+    /* Heaps from lo to hi-1 counted by one of the prefix arrays */
+    int count(Prefix Slot::*prefix, int lo, int hi)
+    {
+        int n = 0;
+        if (hi > 2 * MAX_HEAPS_PER_BLK)
+            hi = 2 * MAX_HEAPS_PER_BLK;
+        if (hi <= lo)
+            return 0;
+        if (lo < MAX_HEAPS_PER_BLK && hi > MAX_HEAPS_PER_BLK)
+        {
+            n = count(prefix, lo, MAX_HEAPS_PER_BLK);
+            lo = MAX_HEAPS_PER_BLK;
+        }
+        const unsigned short *p = slot(lo).*prefix;
+        int base = lo / MAX_HEAPS_PER_BLK * MAX_HEAPS_PER_BLK;
+        return n + p[hi - base] - p[lo - base];
     }
 };
 
@@ -10,6 +10,8 @@
 #include <sys/shm.h>
 #include <sys/sem.h>
 #include <errno.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include "fitshead.h"
 #include "vegas_error.h"
@@ -28,10 +30,156 @@ void usage() {
             "  -i n, --id=n  (1)\n"
             "  -s n, --size=n (32768)\n"
             "  -n n, --nblock=n (24)\n"
+            "  -H s, --hugepage=s  Create with huge pages of size s (2M or 1G)\n"
+            "  -m n, --monitor=n   Follow n blocks (0 for ever) as a lossy consumer\n"
+            "  -S n, --stats=n     Ring telemetry, every n seconds (0 once); every\n"
+            "                      databuf unless -i is given\n"
+            "  -R, --reset-stats   Zero the ring telemetry\n"
             );
 }
 
+static volatile int monitoring = 1;
+static void stop_monitor(int sig) { monitoring = 0; }
+
+/* Read blocks alongside the buffer's consumers, without holding the
+   producer up, and print what is in them */
+static int monitor(struct vegas_databuf *db, int nblocks) {
+    struct vegas_databuf_consumer *c;
+    struct databuf_index *index;
+    int id, block, rv, n = 0;
+
+    id = vegas_databuf_add_consumer(db, 1);
+    if (id < 0) {
+        fprintf(stderr, "Error adding a consumer to the databuf.\n");
+        return(1);
+    }
+    c = &db->consumer[id];
+    signal(SIGINT, stop_monitor);
+    signal(SIGTERM, stop_monitor);
+    while (monitoring && (nblocks == 0 || n < nblocks)) {
+        rv = vegas_databuf_consumer_wait_filled(db, id, &block);
+        if (rv == VEGAS_TIMEOUT || rv == VEGAS_ERR_SYS)
+            continue;
+        if (rv != VEGAS_OK)
+            break;
+        index = (struct databuf_index *)vegas_databuf_index(db, block);
+        printf("block %d: %u heaps of %u bytes, %llu read, %llu skipped\n",
+               block, index->num_heaps, index->heap_size,
+               c->nread + 1, c->nskipped);
+        vegas_databuf_consumer_set_free(db, id, block);
+        n++;
+    }
+    vegas_databuf_remove_consumer(db, id);
+    return(0);
+}
+
+/* Databuf ids 1 to this are looked at for the telemetry of every ring */
+#define STATS_MAX_ID 16
+
+/* What a ring did between two snapshots, or since its counters were
+   reset if there is no earlier one */
+static void print_stats(int db_id, const struct vegas_databuf_stats *s,
+        const struct vegas_databuf_stats *prev) {
+    struct vegas_databuf_stats zero;
+    double elapsed, nfill, nfree, nsample = 0.0;
+    char bins[16 * VEGAS_DATABUF_OCC_BINS], share[16 * VEGAS_DATABUF_OCC_BINS];
+    int i, nb = 0, ns = 0;
+
+    if (prev == NULL) {
+        memset(&zero, 0, sizeof(zero));
+        zero.time = s->reset_time;
+        prev = &zero;
+    }
+    elapsed = s->time - prev->time;
+    nfill = (double)(s->nfill - prev->nfill);
+    nfree = (double)(s->nfree - prev->nfree);
+    for (i=0; i<VEGAS_DATABUF_OCC_BINS; i++)
+        nsample += (double)(s->occupancy_hist[i] - prev->occupancy_hist[i]);
+    if (elapsed <= 0.0)
+        elapsed = 1e-9;
+
+    printf("databuf %d: %d blocks of %zd bytes, %d filled, over %.1f s:\n",
+           db_id, s->n_block, s->block_size, s->occupancy, elapsed);
+    printf("  %.0f filled, %.0f freed: %.1f blocks/s, %.1f MB/s\n",
+           nfill, nfree, nfill / elapsed, nfill * s->block_size / elapsed * 1e-6);
+    printf("  waiting: producer %.1f%%, consumer %.1f%%\n",
+           100.0 * (s->producer_wait - prev->producer_wait) / elapsed,
+           100.0 * (s->consumer_wait - prev->consumer_wait) / elapsed);
+    if (nfree > 0)
+        printf("  per block: queued %.3f ms, held %.3f ms, longest filled %.3f ms\n",
+               1e3 * (s->queue_time - prev->queue_time) / nfree,
+               1e3 * (s->hold_time - prev->hold_time) / nfree,
+               1e3 * s->max_dwell);
+    /* Each printf is time stamped, so build the lines whole */
+    for (i=0; i<VEGAS_DATABUF_OCC_BINS; i++) {
+        nb += snprintf(bins + nb, sizeof(bins) - nb, " %5d%%",
+                       100 * i / (VEGAS_DATABUF_OCC_BINS - 1));
+        ns += snprintf(share + ns, sizeof(share) - ns, " %5.1f%%", nsample > 0 ?
+                       100.0 * (s->occupancy_hist[i] - prev->occupancy_hist[i]) / nsample : 0.0);
+    }
+    printf("  occupancy:%s\n", bins);
+    printf("  samples:  %s\n", share);
+}
+
+/* Report the telemetry of one databuf, or of every one there is, once
+   or every interval seconds until interrupted */
+static int stats(int db_id, int interval, int reset) {
+    struct vegas_databuf *db[STATS_MAX_ID];
+    struct vegas_databuf_stats prev[STATS_MAX_ID], s;
+    int have_prev[STATS_MAX_ID];
+    int i, lo = db_id, hi = db_id, n = 0;
+
+    if (db_id <= 0) {
+        lo = 1;
+        hi = STATS_MAX_ID;
+    }
+    for (i=0; i<=hi-lo; i++) {
+        db[i] = vegas_databuf_attach(lo + i);
+        have_prev[i] = 0;
+        if (db[i] == NULL)
+            continue;
+        if (vegas_databuf_stats(db[i], &s) != VEGAS_OK) {
+            fprintf(stderr, "databuf %d keeps no telemetry.\n", lo + i);
+            vegas_databuf_detach(db[i]);
+            db[i] = NULL;
+            continue;
+        }
+        if (reset)
+            vegas_databuf_stats_reset(db[i]);
+        n++;
+    }
+    if (n == 0) {
+        fprintf(stderr, "No databuf with telemetry found.\n");
+        return(1);
+    }
+
+    signal(SIGINT, stop_monitor);
+    signal(SIGTERM, stop_monitor);
+    while (!reset) {
+        for (i=0; i<=hi-lo; i++) {
+            if (db[i] == NULL || vegas_databuf_stats(db[i], &s) != VEGAS_OK)
+                continue;
+            print_stats(lo + i, &s, have_prev[i] ? &prev[i] : NULL);
+            prev[i] = s;
+            have_prev[i] = 1;
+        }
+        if (interval > 0) {
+            printf("\n");
+            fflush(stdout);
+            sleep(interval);
+        }
+        if (interval <= 0 || !monitoring)
+            break;
+    }
+
+    for (i=0; i<=hi-lo; i++)
+        if (db[i] != NULL)
+            vegas_databuf_detach(db[i]);
+    return(0);
+}
+
 int main(int argc, char *argv[]) {
+    int i;
 
     /* Loop over cmd line to fill in params */
     static struct option long_opts[] = {
@@ -44,6 +192,10 @@ int main(int argc, char *argv[]) {
         {"size",   1, NULL, 's'},
         {"nblock", 1, NULL, 'n'},
         {"type",   1, NULL, 't'},
+        {"hugepage", 1, NULL, 'H'},
+        {"monitor", 1, NULL, 'm'},
+        {"stats",  1, NULL, 'S'},
+        {"reset-stats", 0, NULL, 'R'},
         {0,0,0,0}
     };
     int opt,opti;
@@ -55,8 +207,14 @@ int main(int argc, char *argv[]) {
     int type = 1;
     int deletebuf=0;
     int print_status_mem = 1;
+    size_t page_size = 0;
+    int monitor_blocks = -1;
+    int stats_interval = -1;
+    int reset_stats = 0;
+    int id_given = 0;
+    char *unit;
 
-    while ((opt=getopt_long(argc,argv,"hzqcdi:s:n:t:",long_opts,&opti))!=-1) {
+    while ((opt=getopt_long(argc,argv,"hzqcdi:s:n:t:H:m:S:R",long_opts,&opti))!=-1) {
         switch (opt) {
             case 'c':
                 create=1;
@@ -73,6 +231,7 @@ int main(int argc, char *argv[]) {
                 break;
             case 'i':
                 db_id = atoi(optarg);
+                id_given = 1;
                 break;
             case 's':
                 blocksize = atoi(optarg);
@@ -83,6 +242,21 @@ int main(int argc, char *argv[]) {
             case 't':
                 type = atoi(optarg);
                 break;
+            case 'H':
+                page_size = strtoul(optarg, &unit, 0);
+                if (*unit=='k' || *unit=='K') page_size <<= 10;
+                if (*unit=='m' || *unit=='M') page_size <<= 20;
+                if (*unit=='g' || *unit=='G') page_size <<= 30;
+                break;
+            case 'm':
+                monitor_blocks = atoi(optarg);
+                break;
+            case 'S':
+                stats_interval = atoi(optarg);
+                break;
+            case 'R':
+                reset_stats = 1;
+                break;
             case 'h':
             default:
                 usage();
@@ -91,10 +265,15 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if ((stats_interval >= 0 || reset_stats) && !create && !deletebuf)
+    {
+        exit(stats(id_given ? db_id : 0, stats_interval, reset_stats));
+    }
+
     /* Create mem if asked, otherwise attach */
     struct vegas_databuf *db=NULL;
     if (create) { 
-        db = vegas_databuf_create(nblock, blocksize*1024, db_id, type);
+        db = vegas_databuf_create_paged(nblock, blocksize*1024, db_id, type, page_size);
 
         if (db==NULL) {
             fprintf(stderr, "Error creating databuf %d (may already exist).\n",
@@ -114,10 +293,11 @@ int main(int argc, char *argv[]) {
             /* attach worked so it exists. Now clear it and detach in
                preparation to delete.
             */
-            int shmid, semid, rtnval;
+            int shmid, semid, csemid, rtnval;
             vegas_databuf_clear(db);            
             shmid = db->shmid;
             semid = db->semid;
+            csemid = db->max_consumer > 0 ? db->csemid : -1;
             rtnval = 0;
             if (shmctl(shmid,IPC_RMID, 0) != 0)
             {
@@ -135,12 +315,22 @@ int main(int argc, char *argv[]) {
                 perror("removal of semaphores failed:");
                 rtnval = -1;
             }
+            if (csemid != -1 && semctl(csemid, 0, IPC_RMID) != 0)
+            {
+                perror("removal of consumer semaphores failed:");
+                rtnval = -1;
+            }
             printf("sems deleted successfully\n");            
             exit (rtnval);
         }
         
     }
 
+    if (monitor_blocks >= 0)
+    {
+        exit(monitor(db, monitor_blocks));
+    }
+
     if (quiet)
     {
         /* skip the verbose stats */
@@ -156,9 +346,19 @@ int main(int argc, char *argv[]) {
     printf("  struct_size=%zd\n", db->struct_size);
     printf("  block_size=%zd\n", db->block_size);
     printf("  header_size=%zd\n", db->header_size);
-    printf("  index_size=%zd\n\n", db->index_size);
+    printf("  index_size=%zd\n", db->index_size);
+    printf("  page_size=%zd\n", vegas_databuf_page_size(db));
+    printf("  max_consumer=%d\n", db->max_consumer);
+    for (i=1; i<db->max_consumer; i++)
+    {
+        struct vegas_databuf_consumer *c = &db->consumer[i];
+        if (c->active)
+            printf("  consumer %d: pid %d %s, at block %d, %llu read, %llu skipped\n",
+                   i, c->pid, c->lossy ? "lossy" : "lossless", c->block,
+                   c->nread, c->nskipped);
+    }
+    printf("\n");
     /* loop over blocks */
-    int i;
     char buf[81];
     char *hdr, *ptr, *hend;
     for (i=0; i<db->n_block; i++) 
@@ -106,13 +106,15 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    /* If not quiet, print out buffer */
+    vegas_status_unlock(&s);
+
+    /* If not quiet, print out buffer, without holding up the writers */
     if (!quiet) { 
-        printf(s.buf); printf("\n"); 
+        static char status_buf[VEGAS_STATUS_SIZE + 1];
+        vegas_status_snapshot(&s, status_buf);
+        printf("%s\n", status_buf); 
     }
 
-    vegas_status_unlock(&s);
-
     if (clear) 
         vegas_status_clear(&s);
 
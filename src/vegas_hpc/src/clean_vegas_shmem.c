@@ -55,6 +55,14 @@ int main(int argc, char *argv[]) {
                 ex=1;
             }
         }
+        if (d->max_consumer > 0) {
+            rv = semctl(d->csemid, 0, IPC_RMID);
+            if (rv==-1) {
+                fprintf(stderr, "Error removing databuf consumer semaphores\n");
+                perror("semctl");
+                ex=1;
+            }
+        }
         rv = shmctl(d->shmid, IPC_RMID, NULL);
         if (rv==-1) {
             fprintf(stderr, "Error deleting databuf segment.\n");
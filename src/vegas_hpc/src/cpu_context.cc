@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fftw3.h>
+
+#include "vegas_error.h"
+#include "vegas_databuf.h"
+#include "vegas_pfb_coeff.h"
+#include "vegas_pfb_kernels.h"
+#include "pfb_gpu.h"
+#include "cpu_context.h"
+
+/// Samples per cache line
+#define CPU_PFB_LINE_SAMPLES (64 / (4 * sizeof(float)))
+
+static void *alloc_aligned(size_t size)
+{
+    void *p = NULL;
+    if (posix_memalign(&p, 64, size) != 0)
+        return NULL;
+    return p;
+}
+
+CpuContext::CpuContext(int nsubband, int nchan, int in_blok_siz, int out_blok_siz,
+                       int nthread) :
+        PfbBackend(nsubband, nchan, in_blok_siz, out_blok_siz),
+        _pc4Data(0),
+        _pf4FFTIn(0),
+        _pf4FFTOut(0),
+        _pfPFBCoeff(0),
+        _pf4SumStokes(0),
+        _nthread(0),
+        _nstarted(0),
+        _chunk(0),
+        _gen(0),
+        _pending(0),
+        _quit(0),
+        _stage(StagePFB)
+{
+    memset(_plans, 0, sizeof(_plans));
+    pthread_mutex_init(&_lock, NULL);
+    pthread_cond_init(&_start, NULL);
+    pthread_cond_init(&_done, NULL);
+
+    if (init_resources() == EXIT_SUCCESS &&
+        set_threads(nthread) == VEGAS_OK)
+    {
+        _init_status = EXIT_SUCCESS;
+    }
+}
+
+CpuContext::~CpuContext()
+{
+    stop_threads();
+    destroy_plans();
+    release_resources();
+    pthread_mutex_destroy(&_lock);
+    pthread_cond_destroy(&_start);
+    pthread_cond_destroy(&_done);
+}
+
+int CpuContext::init_resources()
+{
+    size_t n = nsamples();
+
+    _pfPFBCoeff = (float *) alloc_aligned(VEGAS_NUM_TAPS * n * sizeof(float));
+    /* Room for two entire input blocks, as on the GPU */
+    _pc4Data = (int8_t *) alloc_aligned(2 * (size_t)_in_block_size);
+    _pf4FFTIn = (float *) fftwf_malloc(n * 4 * sizeof(float));
+    _pf4FFTOut = (float *) fftwf_malloc(n * 4 * sizeof(float));
+    _pf4SumStokes = (float *) alloc_aligned(n * 4 * sizeof(float));
+    if (_pfPFBCoeff == NULL || _pc4Data == NULL || _pf4FFTIn == NULL ||
+        _pf4FFTOut == NULL || _pf4SumStokes == NULL)
+    {
+        (void) fprintf(stderr,
+                       "ERROR: CpuContext Memory allocation failed! %s.\n",
+                       strerror(errno));
+        return EXIT_FAILURE;
+    }
+    memset(_pc4Data, 0, 2 * (size_t)_in_block_size);
+    memset(_pf4SumStokes, 0, n * 4 * sizeof(float));
+
+    if (vegas_pfb_read_coeff(_pfPFBCoeff, VEGAS_NUM_TAPS, _nchan, _nsubband) != VEGAS_OK)
+    {
+        return EXIT_FAILURE;
+    }
+    printf("CPU PFB resized for %d subbands and %d channels (%s kernels)\n",
+           _nsubband, _nchan, vegas_pfb_kernel_name());
+    return EXIT_SUCCESS;
+}
+
+void
+CpuContext::release_resources()
+{
+    free(_pc4Data);
+    _pc4Data = NULL;
+    free(_pfPFBCoeff);
+    _pfPFBCoeff = NULL;
+    fftwf_free(_pf4FFTIn);
+    _pf4FFTIn = NULL;
+    fftwf_free(_pf4FFTOut);
+    _pf4FFTOut = NULL;
+    free(_pf4SumStokes);
+    _pf4SumStokes = NULL;
+}
+
+/* One FFTW plan per member, each covering a contiguous run of the
+   interleaved subband/polarisation batches.  FFTW_MEASURE scribbles over
+   the arrays, which hold nothing yet. */
+int CpuContext::make_plans()
+{
+    int nbatch = fft_batch();
+    int rank, b0, nb;
+
+    for (rank = 0; rank <= _nthread; ++rank)
+    {
+        _batch0[rank] = (int)((long)rank * nbatch / _nthread);
+    }
+    for (rank = 0; rank < _nthread; ++rank)
+    {
+        b0 = _batch0[rank];
+        nb = _batch0[rank + 1] - b0;
+        if (nb == 0)
+            continue;
+        _plans[rank] = fftwf_plan_many_dft(1, &_nchan, nb,
+                                           (fftwf_complex *) _pf4FFTIn + b0,
+                                           NULL, fft_in_stride(), 1,
+                                           (fftwf_complex *) _pf4FFTOut + b0,
+                                           NULL, fft_out_stride(), 1,
+                                           FFTW_FORWARD, FFTW_MEASURE);
+        if (_plans[rank] == NULL)
+        {
+            (void) fprintf(stderr, "ERROR: Plan creation failed!\n");
+            return VEGAS_ERR_GEN;
+        }
+    }
+    return VEGAS_OK;
+}
+
+void CpuContext::destroy_plans()
+{
+    int rank;
+    for (rank = 0; rank < CPU_PFB_MAX_THREADS; ++rank)
+    {
+        if (_plans[rank] != NULL)
+        {
+            fftwf_destroy_plan(_plans[rank]);
+            _plans[rank] = NULL;
+        }
+    }
+}
+
+int CpuContext::set_threads(int nthread)
+{
+    int i;
+
+    if (nthread < 1)
+        nthread = 1;
+    if (nthread > CPU_PFB_MAX_THREADS)
+        nthread = CPU_PFB_MAX_THREADS;
+    if (nthread == _nthread)
+        return VEGAS_OK;
+
+    stop_threads();
+    destroy_plans();
+    _nthread = nthread;
+
+    /* Whole cache lines of samples per member */
+    _chunk = (nsamples() + _nthread - 1) / _nthread;
+    _chunk = (_chunk + CPU_PFB_LINE_SAMPLES - 1) / CPU_PFB_LINE_SAMPLES * CPU_PFB_LINE_SAMPLES;
+    if (make_plans() != VEGAS_OK)
+        return VEGAS_ERR_GEN;
+
+    /* The caller is rank 0.  Members inherit its cpu affinity. */
+    _quit = 0;
+    for (i = 1; i < _nthread; ++i)
+    {
+        Member *m = &_members[_nstarted + 1];
+        m->ctx = this;
+        m->rank = _nstarted + 1;
+        m->gen = _gen;
+        if (pthread_create(&m->id, NULL, member_thread, m))
+        {
+            vegas_warn("CpuContext::set_threads", "Error creating PFB thread");
+            break;
+        }
+        _nstarted++;
+    }
+    return VEGAS_OK;
+}
+
+void CpuContext::stop_threads()
+{
+    int i;
+
+    pthread_mutex_lock(&_lock);
+    _quit = 1;
+    pthread_cond_broadcast(&_start);
+    pthread_mutex_unlock(&_lock);
+    for (i = 1; i <= _nstarted; ++i)
+        pthread_join(_members[i].id, NULL);
+    _nstarted = 0;
+}
+
+void *CpuContext::member_thread(void *_m)
+{
+    Member *m = (Member *) _m;
+    CpuContext *c = m->ctx;
+    unsigned int gen = m->gen;
+    Stage stage;
+
+    while (1)
+    {
+        pthread_mutex_lock(&c->_lock);
+        while (c->_gen == gen && !c->_quit)
+            pthread_cond_wait(&c->_start, &c->_lock);
+        gen = c->_gen;
+        stage = c->_stage;
+        if (c->_quit)
+        {
+            pthread_mutex_unlock(&c->_lock);
+            break;
+        }
+        pthread_mutex_unlock(&c->_lock);
+
+        c->do_stage(stage, m->rank);
+
+        pthread_mutex_lock(&c->_lock);
+        if (--c->_pending == 0)
+            pthread_cond_signal(&c->_done);
+        pthread_mutex_unlock(&c->_lock);
+    }
+    return NULL;
+}
+
+void CpuContext::do_stage(Stage stage, int rank)
+{
+    size_t n = nsamples();
+    size_t i0 = rank * _chunk;
+    size_t i1 = i0 + _chunk < n ? i0 + _chunk : n;
+
+    switch (stage)
+    {
+        case StagePFB:
+            if (i0 < n)
+                vegas_pfb_fir(_pf4FFTIn, _pc4Data + _read_offset, _pfPFBCoeff,
+                              VEGAS_NUM_TAPS, n, i0, i1);
+            break;
+        case StageFFT:
+            if (_plans[rank] != NULL)
+                fftwf_execute(_plans[rank]);
+            break;
+        case StageAccum:
+            if (i0 < n)
+                vegas_pfb_stokes(_pf4SumStokes, _pf4FFTOut, i0, i1);
+            break;
+    }
+}
+
+void CpuContext::run_stage(Stage stage)
+{
+    int rank;
+
+    if (_nstarted > 0)
+    {
+        pthread_mutex_lock(&_lock);
+        _stage = stage;
+        _pending = _nstarted;
+        _gen++;
+        pthread_cond_broadcast(&_start);
+        pthread_mutex_unlock(&_lock);
+    }
+    /* Our own share, and those of any members that did not start */
+    do_stage(stage, 0);
+    for (rank = _nstarted + 1; rank < _nthread; ++rank)
+        do_stage(stage, rank);
+    if (_nstarted > 0)
+    {
+        pthread_mutex_lock(&_lock);
+        while (_pending > 0)
+            pthread_cond_wait(&_done, &_lock);
+        pthread_mutex_unlock(&_lock);
+    }
+}
+
+int CpuContext::load_block_impl(const char *payload, size_t size, int first)
+{
+    if (!first)
+        memcpy(_pc4Data, _pc4Data + size, size);
+    memcpy(_pc4Data + size, payload, size);
+    return VEGAS_OK;
+}
+
+const char *CpuContext::kernel_name()
+{
+    return vegas_pfb_kernel_name();
+}
+
+void CpuContext::fill_window(size_t offset, size_t len, int value)
+{
+    size_t window = 2 * (size_t)_in_block_size;
+
+    if (offset >= window)
+        return;
+    memset(_pc4Data + offset, value, len < window - offset ? len : window - offset);
+}
+
+/* Filter one spectrum's worth of samples at the read offset */
+int CpuContext::pfb_impl()
+{
+    run_stage(StagePFB);
+    return VEGAS_OK;
+}
+
+int CpuContext::fft_impl()
+{
+    run_stage(StageFFT);
+    return VEGAS_OK;
+}
+
+int CpuContext::accumulate_impl()
+{
+    run_stage(StageAccum);
+    return VEGAS_OK;
+}
+
+void CpuContext::zero_accumulator()
+{
+    memset(_pf4SumStokes, 0, nsamples() * 4 * sizeof(float));
+}
+
+int CpuContext::get_accumulated_spectrum_impl(char *out)
+{
+    size_t half = (size_t)_nsubband * (_nchan / 2) * 4 * sizeof(float);
+
+    /* copy the negative frequencies out first */
+    memcpy(out, _pf4SumStokes + nsamples() / 2 * 4, half);
+    /* then the positive frequencies */
+    memcpy(out + half, _pf4SumStokes, half);
+    return VEGAS_OK;
+}
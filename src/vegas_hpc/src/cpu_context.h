@@ -0,0 +1,89 @@
+#ifndef cpu_context_h
+#define cpu_context_h
+
+#include <stdint.h>
+#include <pthread.h>
+#include <fftw3.h>
+
+#include "pfb_backend.h"
+
+#define CPU_PFB_MAX_THREADS 16
+
+/*
+ * The host backend: the same polyphase filterbank, FFT and Stokes
+ * accumulation as GpuContext, done with the kernels in vegas_pfb_kernels.c
+ * and FFTW.
+ *
+ * Each stage is split across a team of threads.  The filter and the
+ * accumulation are divided by channel, each thread owning a fixed range of
+ * samples, and the FFT by batch, each thread transforming a fixed set of
+ * subband/polarisation pairs with its own plan.  The calling thread is
+ * always a member, so with one thread nothing is handed off.
+ */
+class CpuContext : public PfbBackend
+{
+public:
+    CpuContext(int nsubbands, int nchan, int inblocksz, int outblksz, int nthread);
+    ~CpuContext();
+
+    int8_t* _pc4Data;                /* two input blocks of raw samples */
+    float * _pf4FFTIn;               /* filter output, complex pairs */
+    float * _pf4FFTOut;
+    float * _pfPFBCoeff;
+    float * _pf4SumStokes;
+
+    const char *name()   { return "cpu"; }
+    const char *kernel_name();
+    int fft_in_stride()  { return 2*_nsubband; };
+    int fft_out_stride() { return 2*_nsubband; };
+    int fft_batch()      { return 2*_nsubband; };
+    void fill_window(size_t offset, size_t len, int value);
+    void zero_accumulator();
+    int init_resources();
+    void release_resources();
+
+    // Resize the thread team and replan the FFTs.  Must not be called
+    // while a stage is running.
+    int  set_threads(int nthread);
+    int  nthreads()      { return _nthread; }
+
+protected:
+    int load_block_impl(const char *payload, size_t size, int first);
+    int pfb_impl();
+    int fft_impl();
+    int accumulate_impl();
+    int get_accumulated_spectrum_impl(char *out);
+
+private:
+    enum Stage { StagePFB, StageFFT, StageAccum };
+
+    struct Member {
+        CpuContext *ctx;
+        int rank;
+        unsigned int gen;           // the last stage it ran
+        pthread_t id;
+    };
+
+    void run_stage(Stage stage);
+    void do_stage(Stage stage, int rank);
+    int  make_plans();
+    void destroy_plans();
+    void stop_threads();
+    static void *member_thread(void *);
+
+    int        _nthread;            // members, including the caller
+    int        _nstarted;           // member threads running; the caller covers the rest
+    size_t     _chunk;              // samples owned by each member
+    int        _batch0[CPU_PFB_MAX_THREADS + 1];  // first FFT batch of each member
+    fftwf_plan _plans[CPU_PFB_MAX_THREADS];
+    Member     _members[CPU_PFB_MAX_THREADS];
+    pthread_mutex_t _lock;
+    pthread_cond_t  _start;          // signalled when _gen moves on or _quit is set
+    pthread_cond_t  _done;           // signalled when _pending reaches zero
+    unsigned int    _gen;
+    int             _pending;
+    int             _quit;
+    Stage           _stage;
+};
+
+#endif
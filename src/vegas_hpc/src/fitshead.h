@@ -388,6 +388,48 @@ extern char *getutime(); /* Return current UT as an ISO-format string */
 
 #endif  /* __STDC__ */
 
+/* Keyword index of a header (hget.c).  ksearch() of a header with an
+ * index looks keywords up in an open-addressed hash of its cards instead
+ * of scanning it.  An index may be attached to a header that everyone
+ * shares, such as the status buffer, with the index alongside it, or
+ * opened privately by one thread for a run of lookups.  Lookups and
+ * changes need the same locking as the header itself; a shared index is
+ * only built by its writer, which calls hindex_refresh() as it takes the
+ * lock.
+ */
+#define HINDEX_SLOTS 4096       /* Power of 2, well above the cards */
+
+struct hindex_slot {
+    char key[8];                /* Upper case, blank padded */
+    int card;                   /* Card number + 1, 0 if the slot is free */
+};
+
+struct hindex {
+    int valid;                  /* 0 until built; zeroed when stale */
+    int end;                    /* Card holding END */
+    int nkey;
+    int nbuild;                 /* Times built, for diagnostics */
+    struct hindex_slot slot[HINDEX_SLOTS];
+};
+
+    int hindex_attach(          /* Attach a shared index; 0 if OK */
+        const char *hstring,    /* FITS header */
+        int lhead,              /* Allocated length of FITS header */
+        struct hindex *index);  /* Index, built by hindex_refresh() */
+    void hindex_refresh(        /* Rebuild a stale shared index */
+        const char *hstring);   /* FITS header, with its writer's lock held */
+    void hindex_detach(         /* Stop using a shared index */
+        const char *hstring);   /* FITS header */
+    struct hindex *hindex_open( /* Index a header for this thread */
+        const char *hstring,    /* FITS header */
+        int lhead);             /* Allocated length of FITS header */
+    void hindex_close(          /* Drop an index from hindex_open() */
+        struct hindex *index);  /* NULL if the header was indexed already */
+    void hindex_added(          /* Note a new keyword card (hput.c) */
+        const char *card);      /* The new card, END moved below it */
+    void hindex_changed(        /* Note cards moved or renamed (hput.c) */
+        const char *hplace);    /* Anywhere in the header */
+
 #ifdef __cplusplus
 }
 #endif  /* __cplusplus */
@@ -1491,6 +1491,420 @@ or '$'.  it is truncated to 8 characters. */
 }
 
 
+/* Keyword index.  The index is checked as it is used: it is stale when
+ * END is not where it was, or a slot points at a card that no longer
+ * holds its keyword, so headers rewritten other than through hput*()
+ * are caught.  A private index is then rebuilt on the spot.  A shared
+ * one is only rebuilt by hindex_refresh(), under the writer's lock, and
+ * until then lookups scan the header; nor is it trusted to say that a
+ * keyword is absent, as other programs on the segment add cards without
+ * it.  Like ksearch(), it looks no further than the first null; unlike
+ * it, it does not look past END.  --VEGAS
+ */
+
+#define HINDEX_NSHARED 32   /* Shared indexes, one per status attach */
+#define HINDEX_NPRIVATE 4   /* Private indexes open at once in a thread */
+
+struct hindex_reg {
+    const char *hstring;
+    int lhead;
+    struct hindex *index;
+};
+
+static struct hindex_reg hindex_shared[HINDEX_NSHARED];
+static int hindex_nshared = 0;      /* Slots ever used */
+static int hindex_reglock = 0;
+static __thread struct hindex_reg hindex_private[HINDEX_NPRIVATE];
+static __thread int hindex_nprivate = 0;
+
+/* Keyword at the start of s, at most n characters, in key.  Returns its
+   length, or 0 if there is none or it is longer than 8. */
+static int
+hindex_key(const char *s, int n, char *key)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        unsigned char c = s[i];
+        if (c == '=' || c <= 32 || c >= 127)
+        {
+            break;
+        }
+        if (i == 8)
+        {
+            return (0);
+        }
+        key[i] = (c >= 'a' && c <= 'z') ? c - 32 : c;
+    }
+    if (i == 0)
+    {
+        return (0);
+    }
+    memset (key + i, ' ', 8 - i);
+    return (i);
+}
+
+/* Keyword of a card, which ksearch() would find it by */
+static int
+hindex_cardkey(const char *card, char *key)
+{
+    int icol;
+
+    for (icol = 0; icol < 8 && card[icol] == ' '; icol++)
+        ;
+    return (icol < 8 ? hindex_key (card + icol, 80 - icol, key) : 0);
+}
+
+static struct hindex_slot *
+hindex_probe(struct hindex *index, const char *key)
+{
+    unsigned int h = 2166136261u;
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        h = (h ^ (unsigned char) key[i]) * 16777619u;
+    }
+    for (i = h & (HINDEX_SLOTS - 1); ; i = (i + 1) & (HINDEX_SLOTS - 1))
+    {
+        struct hindex_slot *slot = &index->slot[i];
+        if (slot->card == 0 || memcmp (slot->key, key, 8) == 0)
+        {
+            return (slot);
+        }
+    }
+}
+
+/* Add a keyword, unless an earlier card has it.  The table is never
+   allowed to fill, so that a probe always ends. */
+static void
+hindex_insert(struct hindex *index, const char *key, int card)
+{
+    struct hindex_slot *slot = hindex_probe (index, key);
+
+    if (slot->card != 0)
+    {
+        return;
+    }
+    if (index->nkey >= HINDEX_SLOTS / 2)
+    {
+        index->valid = 0;
+        return;
+    }
+    memcpy (slot->key, key, 8);
+    slot->card = card + 1;
+    index->nkey++;
+}
+
+static void
+hindex_build(const char *hstring, int lhead, struct hindex *index)
+{
+    char key[8];
+    const char *card;
+    int c;
+
+    memset (index->slot, 0, sizeof (index->slot));
+    index->nkey = 0;
+    index->end = -1;
+    index->valid = 1;
+    index->nbuild++;
+    for (c = 0; c < lhead / 80 && index->valid; c++)
+    {
+        card = hstring + c * 80;
+        if (memchr (card, 0, 80) != NULL)
+        {
+            break;
+        }
+        if (hindex_cardkey (card, key) == 0)
+        {
+            continue;
+        }
+        if (memcmp (key, "END     ", 8) == 0)
+        {
+            index->end = c;
+            break;
+        }
+        hindex_insert (index, key, c);
+    }
+    if (index->end < 0)
+    {
+        index->valid = 0;
+    }
+}
+
+/* Whether END is still where the index has it */
+static int
+hindex_end_ok(const char *hstring, const struct hindex_reg *r)
+{
+    char key[8];
+    int end = r->index->end;
+
+    return (end >= 0 && end < r->lhead / 80 &&
+            hindex_cardkey (hstring + end * 80, key) &&
+            memcmp (key, "END     ", 8) == 0);
+}
+
+/* The index of a header, if it has one */
+static struct hindex_reg *
+hindex_find(const char *hstring)
+{
+    int i, n;
+
+    for (i = hindex_nprivate - 1; i >= 0; i--)
+    {
+        if (hindex_private[i].hstring == hstring)
+        {
+            return (&hindex_private[i]);
+        }
+    }
+    n = hindex_nshared;
+    for (i = 0; i < n; i++)
+    {
+        if (hindex_shared[i].hstring == hstring)
+        {
+            return (&hindex_shared[i]);
+        }
+    }
+    return (NULL);
+}
+
+static int
+hindex_is_shared(const struct hindex_reg *r)
+{
+    return (r >= hindex_shared && r < hindex_shared + HINDEX_NSHARED);
+}
+
+/* Calls fn for the index of every header that p lies in */
+static void
+hindex_foreach(const char *p, void (*fn)(const char *, struct hindex_reg *))
+{
+    struct hindex_reg *r;
+    int i, n = hindex_nshared;
+
+    for (i = 0; i < hindex_nprivate + n; i++)
+    {
+        r = i < hindex_nprivate ? &hindex_private[i] : &hindex_shared[i - hindex_nprivate];
+        if (r->hstring != NULL && p >= r->hstring && p < r->hstring + r->lhead)
+        {
+            fn (p, r);
+        }
+    }
+}
+
+/* Look a keyword up.  Returns 1, with the card or NULL in *found, if the
+   index could answer, or 0 if the header must be searched. */
+static int
+hindex_search(const char *hstring, const char *keyword, char **found)
+{
+    struct hindex_reg *r;
+    struct hindex_slot *slot;
+    char key[8], cardkey[8];
+    const char *card;
+    int pass, shared;
+
+    if (hindex_nprivate == 0 && hindex_nshared == 0)
+    {
+        return (0);
+    }
+    r = hindex_find (hstring);
+    if (r == NULL || keyword[0] == 0 ||
+        hindex_key (keyword, 9, key) != (int) strlen (keyword))
+    {
+        return (0);
+    }
+    shared = hindex_is_shared (r);
+    for (pass = 0; pass < 2; pass++)
+    {
+        if (!r->index->valid || !hindex_end_ok (hstring, r))
+        {
+            if (shared)
+            {
+                return (0);
+            }
+            hindex_build (hstring, r->lhead, r->index);
+            if (!r->index->valid)
+            {
+                return (0);
+            }
+        }
+        if (memcmp (key, "END     ", 8) == 0)
+        {
+            *found = (char *) hstring + r->index->end * 80;
+            return (1);
+        }
+        slot = hindex_probe (r->index, key);
+        if (slot->card == 0)
+        {
+            if (shared)
+            {
+                return (0);
+            }
+            *found = NULL;
+            return (1);
+        }
+        card = hstring + (slot->card - 1) * 80;
+        if (hindex_cardkey (card, cardkey) && memcmp (cardkey, key, 8) == 0)
+        {
+            *found = (char *) card;
+            return (1);
+        }
+        if (shared)
+        {
+            return (0);
+        }
+        r->index->valid = 0;
+    }
+    return (0);
+}
+
+void
+hindex_refresh(const char *hstring)
+{
+    struct hindex_reg *r = hindex_find (hstring);
+
+    if (r != NULL && (!r->index->valid || !hindex_end_ok (hstring, r)))
+    {
+        hindex_build (hstring, r->lhead, r->index);
+    }
+}
+
+int
+hindex_attach(const char *hstring, int lhead, struct hindex *index)
+{
+    int i, rv = -1;
+
+    while (__sync_lock_test_and_set (&hindex_reglock, 1))
+        ;
+    for (i = 0; i < HINDEX_NSHARED; i++)
+    {
+        if (hindex_shared[i].hstring == NULL)
+        {
+            hindex_shared[i].lhead = lhead;
+            hindex_shared[i].index = index;
+            __sync_synchronize ();
+            hindex_shared[i].hstring = hstring;
+            if (i >= hindex_nshared)
+            {
+                hindex_nshared = i + 1;
+            }
+            rv = 0;
+            break;
+        }
+    }
+    __sync_lock_release (&hindex_reglock);
+    return (rv);
+}
+
+void
+hindex_detach(const char *hstring)
+{
+    int i;
+
+    while (__sync_lock_test_and_set (&hindex_reglock, 1))
+        ;
+    for (i = 0; i < hindex_nshared; i++)
+    {
+        if (hindex_shared[i].hstring == hstring)
+        {
+            hindex_shared[i].hstring = NULL;
+            break;
+        }
+    }
+    __sync_lock_release (&hindex_reglock);
+}
+
+struct hindex *
+hindex_open(const char *hstring, int lhead)
+{
+    struct hindex *index;
+
+    if (hindex_find (hstring) != NULL || hindex_nprivate == HINDEX_NPRIVATE)
+    {
+        return (NULL);
+    }
+    index = (struct hindex *) malloc (sizeof (struct hindex));
+    if (index == NULL)
+    {
+        return (NULL);
+    }
+    index->valid = 0;
+    index->nbuild = 0;
+    hindex_private[hindex_nprivate].hstring = hstring;
+    hindex_private[hindex_nprivate].lhead = lhead;
+    hindex_private[hindex_nprivate].index = index;
+    hindex_nprivate++;
+    return (index);
+}
+
+void
+hindex_close(struct hindex *index)
+{
+    int i;
+
+    if (index == NULL)
+    {
+        return;
+    }
+    for (i = 0; i < hindex_nprivate; i++)
+    {
+        if (hindex_private[i].index == index)
+        {
+            hindex_nprivate--;
+            memmove (&hindex_private[i], &hindex_private[i + 1],
+                     (hindex_nprivate - i) * sizeof (struct hindex_reg));
+            break;
+        }
+    }
+    free (index);
+}
+
+/* A card has taken a keyword the header did not have, at END or in a
+   blank card before it; END may have moved down a card. */
+static void
+hindex_note_added(const char *card, struct hindex_reg *r)
+{
+    struct hindex *index = r->index;
+    char key[8];
+
+    if (!index->valid)
+    {
+        return;
+    }
+    if (!hindex_end_ok (r->hstring, r))
+    {
+        index->end++;
+        if (!hindex_end_ok (r->hstring, r))
+        {
+            index->valid = 0;
+            return;
+        }
+    }
+    if (hindex_cardkey (card, key))
+    {
+        hindex_insert (index, key, (card - r->hstring) / 80);
+    }
+}
+
+static void
+hindex_note_changed(const char *hplace, struct hindex_reg *r)
+{
+    r->index->valid = 0;
+}
+
+void
+hindex_added(const char *card)
+{
+    hindex_foreach (card, hindex_note_added);
+}
+
+void
+hindex_changed(const char *hplace)
+{
+    hindex_foreach (hplace, hindex_note_changed);
+}
+
+
 /* Find FITS header line containing specified keyword */
 
 char *
@@ -1522,6 +1936,12 @@ or '$'.  it is truncated to 8 characters. */
     if( !use_saolib ){
 #endif
 
+    /* An indexed header needs no search */
+    if (hindex_search (hstring, keyword, &pval))
+    {
+        return (pval);
+    }
+
     pval = 0;
 
 /* Find current length of header string */
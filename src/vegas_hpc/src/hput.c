@@ -466,6 +466,7 @@ keyword.  trailing and leading blanks are removed.  */
     char newcom[50];
     char *vp, *v1, *v2, *q1, *q2, *c1, *ve;
     int lkeyword, lcom, lval, lc, lv1, lhead, lblank, ln, nc, i;
+    int added = 0;
 
     /* Find length of keyword, value, and header */
     lkeyword = (int) strlen (keyword);
@@ -533,6 +534,7 @@ keyword.  trailing and leading blanks are removed.  */
 
         /* Insert comment */
         strncpy (v1+9,value,lv1);
+        hindex_added (v1);
         return (0);
     }
 
@@ -545,6 +547,7 @@ keyword.  trailing and leading blanks are removed.  */
     /*  If parameter is not found, find a place to put it */
     if (v1 == NULL)
     {
+        added = 1;
 
         /* First look for blank lines before END */
         v1 = blsearch (hstring, "END");
@@ -707,6 +710,10 @@ keyword.  trailing and leading blanks are removed.  */
         }
     }
 
+    if (added)
+    {
+        hindex_added (v1);
+    }
     return (0);
 }
 
@@ -720,6 +727,7 @@ hputcom (char *hstring, const char *keyword, const char *comment)
     char line[100];
     int lkeyword, lcom, lhead, i, lblank, ln, nc, lc;
     char *vp, *v1, *v2, *c0, *c1, *q1, *q2=NULL;
+    int added = 0;
 
     squot = (char) 39;
     slash = (char) 47;
@@ -761,6 +769,7 @@ hputcom (char *hstring, const char *keyword, const char *comment)
         }
         strncpy (v1, keyword, lkeyword);
         c0 = v1 + lkeyword;
+        added = 1;
     }
 
     /* Search header string for variable name */
@@ -876,6 +885,10 @@ hputcom (char *hstring, const char *keyword, const char *comment)
     {
         fprintf (stderr,"HPUTCOM: %s / %s\n",keyword,comment);
     }
+    if (added)
+    {
+        hindex_added (v1);
+    }
     return (0);
 }
 
@@ -963,6 +976,7 @@ hdel (char *hstring, const char *keyword)
         }
     }
 
+    hindex_changed (hstring);
     return (1);
 }
 
@@ -1016,6 +1030,7 @@ hadd (char *hplace, const char *keyword)
         hplace[i] = ' ';
     }
 
+    hindex_changed (hplace);
     return (1);
 }
 
@@ -1061,6 +1076,7 @@ hchange (char *hstring, const char *keyword1, const char *keyword2)
                 v[i] = ' ';
             }
         }
+        hindex_changed (v1);
     }
 
     return (1);
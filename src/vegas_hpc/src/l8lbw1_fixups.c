@@ -1,5 +1,11 @@
 
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "vegas_error.h"
 #include "l8lbw1_fixups.h"
 
 #if defined(SIMPLE_LONGWORD_SWAP)
@@ -50,7 +56,7 @@ void fixup_l8lbw1_block(struct vegas_databuf *db, int curblock_in)
 // This uses L8LBW8 packets to form a L8LBW1 input block for the GPU
 // Since the high channel modes need more data, eight input blocks
 // are used to form a full gpu input block.
-void fixup_l8lbw1_block_merge(struct vegas_databuf *db, int input_blks[8])
+void fixup_l8lbw1_block_merge_scalar(struct vegas_databuf *db, int input_blks[8])
 {
     struct time_spead_heap *l8_hdr;
     struct time_spead_heap *l1_hdr;
@@ -110,9 +116,272 @@ void fixup_l8lbw1_block_merge(struct vegas_databuf *db, int input_blks[8])
     for (; out_heap<4096; ++out_heap)
     {
         index_out->cpu_gpu_buf[out_heap].heap_valid = 0;
+        index_out->cpu_gpu_buf[out_heap].heap_pkts_lost = L8LBW1_HEAP_PKTS;
     }
     // Record the new size of the (1st) input buffer
     index_out->num_heaps = 4096;   
 }
 
+// The same merge, a heap at a time with SIMD and shared across a team.
+//
+// Every heap of the eight blocks is numbered g, counting from the start
+// of block 0, and its 256 subband 0 samples go to output heap g/8 from
+// sample (g%8)*256.  The output overwrites the payloads of block 0, heap
+// slot for heap slot, so the heaps of block 0 are taken in passes that
+// never overwrite a payload still to be read: heaps [0,8) in order by one
+// thread, then [8,64), [64,512) and [512,4096), each pass writing only
+// the slots the one before it has finished reading.  The other seven
+// blocks go to slots block 0 no longer needs, all in one pass.  The
+// headers are done first, one thread, exactly as before.
+
+static inline void merge_heap(struct time_sample *dst,
+                              const struct l8_time_sample *src)
+{
+    int s;
+#ifdef __SSE2__
+    // Four samples at a time: the first 32 bits of each of four rows
+    for (s=0; s<256; s+=4)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)&src[s + 0]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&src[s + 1]);
+        __m128i c = _mm_loadu_si128((const __m128i *)&src[s + 2]);
+        __m128i d = _mm_loadu_si128((const __m128i *)&src[s + 3]);
+        _mm_storeu_si128((__m128i *)&dst[s],
+                         _mm_unpacklo_epi64(_mm_unpacklo_epi32(a, b),
+                                            _mm_unpacklo_epi32(c, d)));
+    }
+#else
+    for (s=0; s<256; ++s)
+        dst[s] = src[s].subband[0];
+#endif
+}
+
+static void merge_heaps(struct time_spead_heap_packet_l1 *out,
+                        const struct l8lbw1_merge_range *r, int lo, int hi)
+{
+    int heap, g;
+
+    for (heap=lo; heap<hi; ++heap)
+    {
+        g = r->g0 + heap;
+        merge_heap(&out[g / 8].data[(g % 8) * 256], r->in[heap].data);
+    }
+}
+
+// One member's share of every range in the pass
+static void merge_share(struct l8lbw1_merge_team *t, int rank)
+{
+    const struct l8lbw1_merge_range *r;
+    long n;
+    int i;
+
+    for (i=0; i<t->nrange; ++i)
+    {
+        r = &t->ranges[i];
+        n = r->hi - r->lo;
+        merge_heaps(t->out, r, r->lo + (int)(n * rank / t->nthread),
+                    r->lo + (int)(n * (rank + 1) / t->nthread));
+    }
+}
+
+static void merge_pass(struct l8lbw1_merge_team *t)
+{
+    int rank;
+
+    if (t->nstarted > 0)
+    {
+        pthread_mutex_lock(&t->lock);
+        t->pending = t->nstarted;
+        t->gen++;
+        pthread_cond_broadcast(&t->start);
+        pthread_mutex_unlock(&t->lock);
+    }
+
+    /* Our own share, and those of any members that did not start */
+    merge_share(t, 0);
+    for (rank = t->nstarted + 1; rank < t->nthread; ++rank)
+        merge_share(t, rank);
+
+    if (t->nstarted > 0)
+    {
+        pthread_mutex_lock(&t->lock);
+        while (t->pending > 0)
+            pthread_cond_wait(&t->done, &t->lock);
+        pthread_mutex_unlock(&t->lock);
+    }
+}
+
+static void *merge_member_thread(void *_m)
+{
+    struct l8lbw1_merge_member *m = (struct l8lbw1_merge_member *)_m;
+    struct l8lbw1_merge_team *t = m->team;
+    unsigned int gen = 0;
+
+    while (1)
+    {
+        pthread_mutex_lock(&t->lock);
+        while (t->gen == gen && !t->quit)
+            pthread_cond_wait(&t->start, &t->lock);
+        gen = t->gen;
+        if (t->quit)
+        {
+            pthread_mutex_unlock(&t->lock);
+            break;
+        }
+        pthread_mutex_unlock(&t->lock);
+
+        merge_share(t, m->rank);
+
+        pthread_mutex_lock(&t->lock);
+        if (--t->pending == 0)
+            pthread_cond_signal(&t->done);
+        pthread_mutex_unlock(&t->lock);
+    }
+    return NULL;
+}
+
+int l8lbw1_merge_team_init(struct l8lbw1_merge_team *t, int nthread)
+{
+    int i;
+
+    memset(t, 0, sizeof(*t));
+    if (nthread < 1)
+        nthread = 1;
+    if (nthread > L8LBW1_MERGE_MAX_THREADS)
+        nthread = L8LBW1_MERGE_MAX_THREADS;
+    t->nthread = nthread;
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->start, NULL);
+    pthread_cond_init(&t->done, NULL);
+
+    /* The caller is rank 0.  Members inherit its cpu affinity. */
+    for (i=1; i<nthread; i++)
+    {
+        struct l8lbw1_merge_member *m = &t->members[t->nstarted + 1];
+        m->team = t;
+        m->rank = t->nstarted + 1;
+        if (pthread_create(&m->id, NULL, merge_member_thread, m))
+        {
+            vegas_warn("l8lbw1_merge_team_init", "Error creating merge thread");
+            break;
+        }
+        t->nstarted++;
+    }
+    return(VEGAS_OK);
+}
+
+void l8lbw1_merge_team_destroy(struct l8lbw1_merge_team *t)
+{
+    int i;
+
+    pthread_mutex_lock(&t->lock);
+    t->quit = 1;
+    pthread_cond_broadcast(&t->start);
+    pthread_mutex_unlock(&t->lock);
+    for (i=1; i<=t->nstarted; i++)
+        pthread_join(t->members[i].id, NULL);
+    t->nstarted = 0;
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->start);
+    pthread_cond_destroy(&t->done);
+}
+
+void fixup_l8lbw1_block_merge_team(struct l8lbw1_merge_team *t,
+                                   struct vegas_databuf *db, int input_blks[8])
+{
+    struct l8lbw1_merge_team solo;
+    struct time_spead_heap *l8_hdr;
+    struct time_spead_heap *l1_hdr;
+    struct l8lbw1_merge_range *r;
+    int out_heap, out_sample, heap, lo, g;
+    struct databuf_index *index_in, *index_out;
+    int in_blk_idx;
+    int blank_present = 0;
+
+    if (t == NULL)
+    {
+        memset(&solo, 0, sizeof(solo));
+        solo.nthread = 1;
+        t = &solo;
+    }
+
+    // We are collapsing 8 blocks into 1. The first block gets the results
+    l1_hdr = (struct time_spead_heap *)vegas_databuf_data(db, input_blks[0]);
+    index_out = (struct databuf_index*)vegas_databuf_index(db, input_blks[0]);
+    t->out = (struct time_spead_heap_packet_l1 *)&l1_hdr[MAX_HEAPS_PER_BLK];
+
+    // The headers: every 8th heap's goes to the output heap it completes,
+    // with the blanking bits of all 8
+    out_heap = 0;
+    out_sample = 0;
+    for (in_blk_idx=0; in_blk_idx<L8LBW1_MERGE_BLOCKS; ++in_blk_idx)
+    {
+        l8_hdr = (struct time_spead_heap *)vegas_databuf_data(db, input_blks[in_blk_idx]);
+        index_in = (struct databuf_index*)vegas_databuf_index(db, input_blks[in_blk_idx]);
+        for (heap=0; heap<index_in->num_heaps; ++heap)
+        {
+            out_sample += 256;
+            blank_present |= (l8_hdr[heap].status_bits & 0x8);
+            if (out_sample % 2048 == 0)
+            {
+                if (out_heap != 0)
+                {
+                    l1_hdr[out_heap] = l8_hdr[heap];
+                    l1_hdr[out_heap].status_bits |= blank_present;
+                }
+                out_heap++;
+                out_sample = 0;
+                blank_present = 0;
+            }
+        }
+    }
+
+    // Block 0, in place
+    r = &t->ranges[0];
+    r->in = (const struct time_spead_heap_packet_l8 *)t->out;
+    r->g0 = 0;
+    r->lo = 0;
+    r->hi = index_out->num_heaps < 8 ? index_out->num_heaps : 8;
+    merge_heaps(t->out, r, r->lo, r->hi);
+    t->nrange = 1;
+    for (lo=8; lo<(int)index_out->num_heaps; lo*=8)
+    {
+        r->lo = lo;
+        r->hi = 8 * lo < (int)index_out->num_heaps ? 8 * lo : (int)index_out->num_heaps;
+        merge_pass(t);
+    }
+
+    // Blocks 1 to 7
+    g = index_out->num_heaps;
+    t->nrange = 0;
+    for (in_blk_idx=1; in_blk_idx<L8LBW1_MERGE_BLOCKS; ++in_blk_idx)
+    {
+        l8_hdr = (struct time_spead_heap *)vegas_databuf_data(db, input_blks[in_blk_idx]);
+        index_in = (struct databuf_index*)vegas_databuf_index(db, input_blks[in_blk_idx]);
+        r = &t->ranges[t->nrange++];
+        r->in = (const struct time_spead_heap_packet_l8 *)&l8_hdr[MAX_HEAPS_PER_BLK];
+        r->g0 = g;
+        r->lo = 0;
+        r->hi = index_in->num_heaps;
+        g += index_in->num_heaps;
+    }
+    merge_pass(t);
+
+    // invalidate any heaps which are missing to make a full block
+    if (out_heap < 4095)
+        printf("not enough out heaps invalidating last %d\n", 4096-out_heap);
+    for (; out_heap<4096; ++out_heap)
+    {
+        index_out->cpu_gpu_buf[out_heap].heap_valid = 0;
+        index_out->cpu_gpu_buf[out_heap].heap_pkts_lost = L8LBW1_HEAP_PKTS;
+    }
+    // Record the new size of the (1st) input buffer
+    index_out->num_heaps = 4096;
+}
+
+void fixup_l8lbw1_block_merge(struct vegas_databuf *db, int input_blks[8])
+{
+    fixup_l8lbw1_block_merge_team(NULL, db, input_blks);
+}
+
 #endif
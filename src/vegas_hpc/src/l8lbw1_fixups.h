@@ -1,6 +1,9 @@
 #ifndef l8lbw1_fixups_h
 #define l8lbw1_fixups_h
 
+#include <pthread.h>
+
+#include "vegas_defines.h"
 #include "vegas_databuf.h"
 #include "spead_heap.h"
 
@@ -37,6 +40,69 @@ struct time_spead_heap_packet_l1
 
 void fixup_l8lbw1_block(struct vegas_databuf *, int curblk);
 
+#define L8LBW1_MERGE_BLOCKS      8  ///< l8/lbw8 blocks merged into one l8/lbw1 block
+#define L8LBW1_HEAP_PKTS         8  ///< l8/lbw8 packets (one per heap) in each l8/lbw1 heap
+#define L8LBW1_MERGE_MAX_THREADS 8
+
+/// A run of heaps of one input block, heap lo to hi-1, the first of
+/// which is heap g0 + lo counting from the start of the merge
+struct l8lbw1_merge_range
+{
+    const struct time_spead_heap_packet_l8 *in;
+    int lo, hi;
+    int g0;
+};
+
+struct l8lbw1_merge_team;
+
+struct l8lbw1_merge_member
+{
+    struct l8lbw1_merge_team *team;
+    int rank;
+    pthread_t id;
+};
+
+/* A team of threads sharing the merge.  Each pass hands every member an
+   equal share of each range; the caller is rank 0. */
+struct l8lbw1_merge_team
+{
+    int nthread;           ///< Members, including the caller
+    int nstarted;          ///< Member threads running; the caller covers the rest
+    struct time_spead_heap_packet_l1 *out;
+    struct l8lbw1_merge_range ranges[L8LBW1_MERGE_BLOCKS];
+    int nrange;
+    struct l8lbw1_merge_member members[L8LBW1_MERGE_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t start;  ///< Signalled when gen moves on or quit is set
+    pthread_cond_t done;   ///< Signalled when pending reaches zero
+    unsigned int gen;
+    int pending;
+    int quit;
+};
+
+#ifdef __cplusplus /* C++ prototypes */
+extern "C" {
+#endif
+
+/** Merge the subband 0 samples of eight l8/lbw8 blocks into one l8/lbw1
+ * block, written over the first of them.  With a team the copying is
+ * shared between its members; team may be NULL.
+ */
+void fixup_l8lbw1_block_merge(struct vegas_databuf *db, int input_blks[8]);
+void fixup_l8lbw1_block_merge_team(struct l8lbw1_merge_team *t,
+                                   struct vegas_databuf *db, int input_blks[8]);
 
+/** The merge one sample at a time, for comparison */
+void fixup_l8lbw1_block_merge_scalar(struct vegas_databuf *db, int input_blks[8]);
+
+/** Start a merge team of nthread members, the caller being one of them */
+int l8lbw1_merge_team_init(struct l8lbw1_merge_team *t, int nthread);
+
+/** Stop and join the members */
+void l8lbw1_merge_team_destroy(struct l8lbw1_merge_team *t);
+
+#ifdef __cplusplus /* C++ prototypes */
+}
+#endif
 
 #endif
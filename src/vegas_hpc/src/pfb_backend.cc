@@ -0,0 +1,151 @@
+/* pfb_backend.cc
+ *
+ * The parts of PfbBackend common to every engine: per stage timing, the
+ * setup check and the choice of engine at runtime.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vegas_error.h"
+#include "vegas_pfb_coeff.h"
+#include "pfb_backend.h"
+#ifndef NO_CPU_PFB
+#include "cpu_context.h"
+#endif
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+PfbBackend::PfbBackend(int nsubband, int nchan, int inblocksz, int outblksz) :
+        _nchan(nchan),
+        _nsubband(nsubband),
+        _in_block_size(inblocksz),
+        _out_block_size(outblksz),
+        _init_status(EXIT_FAILURE),
+        _first_time_heap_in_accum_status_bits(0),
+        _first_time_heap_mjd(0.0),
+        _window(vegas_pfb_get_window()),
+        _read_offset(0)
+{
+    memset(&_first_time_heap_in_accum, 0, sizeof(_first_time_heap_in_accum));
+    clear_times();
+}
+
+bool
+PfbBackend::verify_setup(int num_subbands, int num_chans,
+                         int input_block_sz, int output_block_sz)
+{
+    // Start a new scan with a clean blanker
+    _blanker.reset();
+    _first_time_heap_in_accum_status_bits = 0;
+    _first_time_heap_mjd = 0.0;
+    memset(&_first_time_heap_in_accum, 0, sizeof(_first_time_heap_in_accum));
+
+    return _init_status == EXIT_SUCCESS &&
+           _nsubband == num_subbands &&
+           _nchan == num_chans &&
+           _in_block_size == input_block_sz &&
+           _out_block_size == output_block_sz &&
+           _window == vegas_pfb_get_window();
+}
+
+void PfbBackend::clear_times()
+{
+    memset(_stage_sec, 0, sizeof(_stage_sec));
+}
+
+int PfbBackend::load_block(const char *payload, size_t size, int first)
+{
+    double t0 = now_sec();
+    int rtn = load_block_impl(payload, size, first);
+    _stage_sec[PfbStageH2D] += now_sec() - t0;
+    return rtn;
+}
+
+int PfbBackend::pfb()
+{
+    double t0 = now_sec();
+    int rtn = pfb_impl();
+    _stage_sec[PfbStagePFB] += now_sec() - t0;
+    return rtn;
+}
+
+int PfbBackend::do_fft()
+{
+    double t0 = now_sec();
+    int rtn = fft_impl();
+    _stage_sec[PfbStageFFT] += now_sec() - t0;
+    return rtn;
+}
+
+int PfbBackend::accumulate()
+{
+    double t0 = now_sec();
+    int rtn = accumulate_impl();
+    _stage_sec[PfbStageAccum] += now_sec() - t0;
+    return rtn;
+}
+
+int PfbBackend::get_accumulated_spectrum(char *out)
+{
+    double t0 = now_sec();
+    int rtn = get_accumulated_spectrum_impl(out);
+    _stage_sec[PfbStageD2H] += now_sec() - t0;
+    return rtn;
+}
+
+PfbBackend *pfb_backend_create(int nsubband, int nchan, int inblocksz,
+                               int outblksz, int nthread)
+{
+    const char *want = getenv("VEGAS_PFB_BACKEND");
+    PfbBackend *ctx = NULL;
+
+    if (want == NULL || strcmp(want, "cpu") != 0)
+    {
+        int forced = want != NULL && strcmp(want, "cuda") == 0;
+
+        if (gpu_backend_create)
+            ctx = gpu_backend_create(nsubband, nchan, inblocksz, outblksz);
+        /* A device that fails to set up is no reason to stop the bank */
+        if (ctx != NULL && ctx->init_status() != EXIT_SUCCESS)
+        {
+            delete ctx;
+            ctx = NULL;
+            if (!forced)
+                vegas_warn("pfb_backend_create",
+                           "CUDA PFB setup failed, falling back to the host");
+        }
+        if (ctx == NULL && forced)
+        {
+            vegas_error("pfb_backend_create",
+                        "VEGAS_PFB_BACKEND=cuda but the CUDA PFB is not available");
+            return NULL;
+        }
+    }
+#ifndef NO_CPU_PFB
+    if (ctx == NULL)
+        ctx = new CpuContext(nsubband, nchan, inblocksz, outblksz, nthread);
+#else
+    (void) nthread;
+    if (ctx == NULL)
+    {
+        vegas_error("pfb_backend_create",
+                    "no usable CUDA device, and built without the host PFB (NO_CPU_PFB)");
+        return NULL;
+    }
+#endif
+
+    if (ctx->init_status() != EXIT_SUCCESS)
+    {
+        delete ctx;
+        return NULL;
+    }
+    printf("PFB backend: %s (%s)\n", ctx->name(), ctx->kernel_name());
+    return ctx;
+}
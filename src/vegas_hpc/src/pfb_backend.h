@@ -0,0 +1,120 @@
+#ifndef pfb_backend_h
+#define pfb_backend_h
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "vegas_error.h"
+#include "BlankingStateMachine.h"
+#include "spead_heap.h"
+
+/*
+ * The compute side of the PFB thread: the 8-tap polyphase filter, FFT,
+ * Stokes accumulation and the copy of an accumulated spectrum out to a
+ * frequency heap.  The driver in pfb_driver.cc is written against this
+ * interface only; GpuContext does the work with CUDA and CpuContext on the
+ * host.  pfb_backend_create() picks one at runtime: CUDA when the binary
+ * was linked with it and a device is present, the host otherwise.
+ *
+ * Input is staged through a window two blocks long.  Each block is copied
+ * into the upper half after the previous one is moved to the lower half,
+ * so that the filter taps of the last spectra in a block can reach into
+ * the next one.  The read offset selects where the next spectrum starts.
+ *
+ * Every stage is timed, so that the driver can publish where the time
+ * goes, whether on a device or on the host.
+ */
+
+enum PfbStage
+{
+    PfbStageH2D,        // input block into the window
+    PfbStagePFB,        // polyphase filter
+    PfbStageFFT,
+    PfbStageAccum,      // Stokes products into the accumulator
+    PfbStageD2H,        // accumulated spectrum out to a heap
+    PfbNumStages
+};
+
+class PfbBackend
+{
+public:
+    PfbBackend(int nsubband, int nchan, int inblocksz, int outblksz);
+    virtual ~PfbBackend() {}
+
+    int     _nchan;
+    int     _nsubband;
+    int     _in_block_size;
+    int     _out_block_size;
+    int     _init_status;
+    int     _first_time_heap_in_accum_status_bits;
+    double  _first_time_heap_mjd;
+    int     _window;                 // the coefficients' window, VEGAS_PFB_WIN_*
+
+    BlankingStateMachine _blanker;
+
+    struct time_spead_heap _first_time_heap_in_accum;
+
+    virtual const char *name() = 0;
+    // The kernels the stages run on, for the status display
+    virtual const char *kernel_name() { return name(); }
+
+    size_t nsamples()    { return (size_t)_nsubband * _nchan; };
+    int init_status()    { return _init_status; }
+    bool verify_setup(int num_subbands, int num_chans,
+                      int input_block_sz, int output_block_sz);
+
+    // Copy size bytes of input into the upper half of the window,
+    // first moving the upper half down unless this is the first block.
+    int load_block(const char *payload, size_t size, int first);
+    // Fill len bytes of the window from offset with value
+    virtual void fill_window(size_t offset, size_t len, int value) = 0;
+    void rewind()              { _read_offset = 0; }
+    void advance(size_t bytes) { _read_offset += bytes; }
+
+    int pfb();
+    int do_fft();
+    int accumulate();
+    virtual void zero_accumulator() = 0;
+    // Copy the accumulated spectrum out with the negative frequencies first
+    int get_accumulated_spectrum(char *out);
+
+    // Size of the host thread team, where the backend has one.  Resizing
+    // may replan the FFTs, so it is done at setup and not between blocks.
+    virtual int set_threads(int nthread) { return VEGAS_OK; }
+    virtual int nthreads()               { return 1; }
+
+    void blanking_inputs(int status)  { _blanker.new_input(status); }
+    int  blank_current_fft()          { return _blanker.blank_current_fft(); }
+    int  needs_flush()                { return _blanker.needs_flush(); }
+    int  sw_status_changed(int swstat) { return _blanker.sw_status_changed(swstat); }
+
+    // Seconds spent in a stage since the last call to clear_times()
+    double stage_time(PfbStage s)     { return _stage_sec[s]; }
+    void clear_times();
+
+protected:
+    virtual int load_block_impl(const char *payload, size_t size, int first) = 0;
+    virtual int pfb_impl() = 0;
+    virtual int fft_impl() = 0;
+    virtual int accumulate_impl() = 0;
+    virtual int get_accumulated_spectrum_impl(char *out) = 0;
+
+    size_t  _read_offset;            // bytes into the window of the next spectrum
+
+private:
+    double  _stage_sec[PfbNumStages];
+};
+
+/** Create the backend for a geometry: CUDA if it is linked in and a device
+ * is present, the host otherwise.  $VEGAS_PFB_BACKEND set to "cpu" or
+ * "cuda" forces the choice.  Returns NULL if the backend failed to set up.
+ */
+PfbBackend *pfb_backend_create(int nsubband, int nchan, int inblocksz,
+                               int outblksz, int nthread);
+
+/** Provided by gpu_context.cu when CUDA is linked in */
+PfbBackend *gpu_backend_create(int nsubband, int nchan, int inblocksz,
+                               int outblksz) __attribute__((weak));
+int gpu_backend_warmup(void) __attribute__((weak));
+
+#endif
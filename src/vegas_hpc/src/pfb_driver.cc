@@ -0,0 +1,457 @@
+/* pfb_driver.cc
+ *
+ * The PFB thread's entry points, written against PfbBackend so that the
+ * same driver runs the CUDA and the host engines.  The engine is chosen
+ * when a context is created; see pfb_backend_create().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fitshead.h"
+#include "vegas_error.h"
+#include "vegas_status.h"
+#include "vegas_databuf.h"
+#include "vegas_stats.h"
+#include "vegas_defines.h"
+#include "pfb_gpu.h"
+#include "spead_heap.h"
+
+#include "pfb_backend.h"
+#include "DataBlockInfoCache.h"
+
+#define STATUS_KEY "GPUSTAT"
+
+/// Status keywords for the time spent in each stage, ms per block
+static const char *stage_keys[PfbNumStages] =
+{
+    "PFBTH2D", "PFBTPFB", "PFBTFFT", "PFBTACC", "PFBTD2H"
+};
+
+extern int run;
+
+PfbBackend *pfbCtx = 0;
+
+static int g_iTotHeapOut = 0;
+static int g_iMaxNumHeapOut = 0;
+static int g_iHeapOut = 0;
+static DataBlockInfoCache blk_info_cache;
+
+static int g_iSpecPerAcc = 0;
+
+/// Threads the host context is set up with; set from PFBTHRDS
+static int g_iNumThreads = 1;
+
+/* Heap addresses within a block: the spead headers of every heap slot
+   come first, followed by the payloads. */
+static char *
+time_heap_data(struct vegas_databuf *db, int iblk, int iHeap)
+{
+    struct databuf_index *index = (struct databuf_index*)vegas_databuf_index(db, iblk);
+    return vegas_databuf_data(db, iblk)
+           + sizeof(struct time_spead_heap) * MAX_HEAPS_PER_BLK
+           + (size_t)(index->heap_size - sizeof(struct time_spead_heap)) * iHeap;
+}
+
+static struct freq_spead_heap *
+freq_heap_header(struct vegas_databuf *db, int iblk, int iHeap)
+{
+    return (struct freq_spead_heap *)(vegas_databuf_data(db, iblk)
+                                      + sizeof(struct freq_spead_heap) * iHeap);
+}
+
+static char *
+freq_heap_data(struct vegas_databuf *db, int iblk, int iHeap)
+{
+    struct databuf_index *index = (struct databuf_index*)vegas_databuf_index(db, iblk);
+    return vegas_databuf_data(db, iblk)
+           + sizeof(struct freq_spead_heap) * MAX_HEAPS_PER_BLK
+           + (size_t)(index->heap_size - sizeof(struct freq_spead_heap)) * iHeap;
+}
+
+extern "C"
+void set_pfb_threads(int nthread)
+{
+    g_iNumThreads = nthread;
+}
+
+/* Resizing the team of a context that is kept replans its FFTs, which is
+   slow with FFTW: it is done here, while the context is set up, rather than
+   on the first block of a scan. */
+static int resize_team()
+{
+    if (pfbCtx->set_threads(g_iNumThreads) != VEGAS_OK)
+    {
+        (void) fprintf(stderr, "ERROR: Resizing the PFB thread team failed!\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+extern "C"
+int init_cuda_context(int subbands, int chans, int inBlokSz, int outBlokSz)
+{
+    if (subbands == 0 || chans == 0)
+    {
+        /* Only warm up the device, if there is one */
+        if (gpu_backend_warmup)
+            return gpu_backend_warmup();
+        return EXIT_SUCCESS;
+    }
+    // Keep the existing context if it already fits: setting up is not free
+    if (pfbCtx != 0 &&
+        pfbCtx->verify_setup(subbands, chans, inBlokSz, outBlokSz))
+    {
+        printf("### No PFB reallocations necessary\n");
+        return resize_team();
+    }
+    delete pfbCtx;
+    pfbCtx = pfb_backend_create(subbands, chans, inBlokSz, outBlokSz, g_iNumThreads);
+    return pfbCtx != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+extern "C"
+int reset_state(size_t input_block_sz, size_t output_block_sz, int num_subbands, int num_chans)
+{
+    g_iTotHeapOut = 0;
+    g_iHeapOut = 0;
+    g_iSpecPerAcc = 0;
+
+    if (pfbCtx == 0 ||
+        true != pfbCtx->verify_setup(num_subbands, num_chans, input_block_sz, output_block_sz))
+    {
+        return init_cuda_context(num_subbands, num_chans, input_block_sz, output_block_sz);
+    }
+    return resize_team();
+}
+
+/* dump to buffer */
+static int dump_to_buffer(struct vegas_databuf *db_out,
+                          int curblk_out,
+                          int iHeapOut,
+                          struct time_spead_heap *firsttimeheap,
+                          int iTotHeapOut,
+                          int iSpecPerAcc,
+                          double heap_mjd,
+                          int first_t_series_status)
+{
+    struct freq_spead_heap *freq_heap_out;
+    struct databuf_index *index_out;
+    int rtn;
+
+    freq_heap_out = freq_heap_header(db_out, curblk_out, iHeapOut);
+    index_out = (struct databuf_index*)vegas_databuf_index(db_out, curblk_out);
+
+    if (sizeof(struct freq_spead_heap) * MAX_HEAPS_PER_BLK +
+        index_out->heap_size*(index_out->num_heaps+1) > db_out->block_size ||
+        iHeapOut >= (int)db_out->index_size)
+    {
+        printf("DATABUF ERROR: heapsize*nheaps > blocksize!! (%d > %zd) index_size=%zd\n",
+            index_out->heap_size*index_out->num_heaps, db_out->block_size, db_out->index_size);
+        printf("DATABUF ERROR: blocknum=%d, iHeapOut=%d,iTotHeapOut=%d,iSpecPerAcc=%d\n",
+            curblk_out, iHeapOut,iTotHeapOut, iSpecPerAcc);
+    }
+
+    /* Write new heap header fields */
+    freq_heap_out->time_cntr_id = 0x20;
+    freq_heap_out->time_cntr_top8 = firsttimeheap->time_cntr_top8;
+    freq_heap_out->time_cntr = firsttimeheap->time_cntr;
+    freq_heap_out->spectrum_cntr_id = 0x21;
+    freq_heap_out->spectrum_cntr = iTotHeapOut;
+    freq_heap_out->integ_size_id = 0x22;
+    freq_heap_out->integ_size = iSpecPerAcc;
+    freq_heap_out->mode_id = 0x23;
+    freq_heap_out->mode = firsttimeheap->mode;
+    freq_heap_out->status_bits_id = 0x24;
+    freq_heap_out->status_bits = first_t_series_status;
+    freq_heap_out->payload_data_off_addr_mode = 0;
+    freq_heap_out->payload_data_off_id = 0x25;
+    freq_heap_out->payload_data_off = 0;
+
+    memset(firsttimeheap, 0, sizeof(struct time_spead_heap));
+
+    /* Update output index */
+    index_out->cpu_gpu_buf[iHeapOut].heap_valid = 1;
+    index_out->cpu_gpu_buf[iHeapOut].heap_pkts_lost = 0;
+    index_out->cpu_gpu_buf[iHeapOut].heap_cntr = iTotHeapOut;
+    index_out->cpu_gpu_buf[iHeapOut].heap_rcvd_mjd = heap_mjd;
+
+    rtn = pfbCtx->get_accumulated_spectrum(freq_heap_data(db_out, curblk_out, iHeapOut));
+    index_out->num_heaps += (rtn == VEGAS_OK ? 1 : 0);
+    return rtn;
+}
+
+/* Do the PFB on one input block */
+extern "C"
+void do_pfb(struct vegas_databuf *db_in,
+            int curblock_in,
+            struct vegas_databuf *db_out,
+            int *curblock_out,
+            int first,
+            struct vegas_status st,
+            int acc_len)
+{
+    char *hdr_out = NULL;
+    struct databuf_index *index_in = NULL;
+    struct databuf_index *index_out = NULL;
+    int heap_in = 0;
+
+    int iProcData = 0;
+    int iRet = VEGAS_OK;
+    char* payload_addr_in = NULL;
+    int pfb_count = 0;
+    int iBlockInDataSize;
+    size_t nsubband_x_nchan;
+    size_t nsubband_x_nchan_fsize;
+    size_t nsubband_x_nchan_csize;
+    int num_in_heaps_per_fft = 0;
+    int num_in_heaps_per_pfb;
+    int s;
+    static struct vegas_stat *stat_state = NULL, *stat_blkout = NULL;
+    static struct vegas_stat *stat_stage[PfbNumStages];
+
+    if (stat_blkout == NULL)
+    {
+        stat_state = vegas_stat_register(STATUS_KEY, VEGAS_STAT_STR);
+        stat_blkout = vegas_stat_register("PFBBLKOU", VEGAS_STAT_INT);
+        for (s = 0; s < PfbNumStages; ++s)
+            stat_stage[s] = vegas_stat_register(stage_keys[s], VEGAS_STAT_DOUBLE);
+    }
+
+    if (pfbCtx == 0)
+    {
+        run = 0;
+        return;
+    }
+
+    if (first)
+    {
+        vegas_status_lock(&st);
+        hputs(st.buf, "PFBBACK", pfbCtx->name());
+        hputs(st.buf, "PFBKERN", pfbCtx->kernel_name());
+        vegas_status_unlock(&st);
+    }
+
+    nsubband_x_nchan = pfbCtx->nsamples();
+    nsubband_x_nchan_fsize = nsubband_x_nchan * 4 * sizeof(float);
+    nsubband_x_nchan_csize = nsubband_x_nchan * 4 * sizeof(int8_t);
+
+    /* Setup input and first output data block stuff */
+    index_in = (struct databuf_index*)vegas_databuf_index(db_in, curblock_in);
+    num_in_heaps_per_fft = nsubband_x_nchan_csize / (index_in->heap_size - sizeof(struct time_spead_heap));
+    num_in_heaps_per_pfb = VEGAS_NUM_TAPS * num_in_heaps_per_fft;
+
+    iBlockInDataSize = index_in->num_heaps * (index_in->heap_size - sizeof(struct time_spead_heap));
+
+    /* Calculate the maximum number of output heaps per block */
+    g_iMaxNumHeapOut = (pfbCtx->_out_block_size - (sizeof(struct freq_spead_heap) * MAX_HEAPS_PER_BLK)) / nsubband_x_nchan_fsize;
+
+    hdr_out = vegas_databuf_header(db_out, *curblock_out);
+    index_out = (struct databuf_index*)vegas_databuf_index(db_out, *curblock_out);
+    memcpy(hdr_out, vegas_databuf_header(db_in, curblock_in), VEGAS_STATUS_SIZE);
+
+    /* Set basic params in output index */
+    index_out->heap_size = sizeof(struct freq_spead_heap) + (nsubband_x_nchan_fsize);
+
+    payload_addr_in = time_heap_data(db_in, curblock_in, heap_in);
+
+    if (iBlockInDataSize == 0)
+    {
+        fprintf(stderr, "iBlockInDataSize == 0! no data to process\n");
+        run = 0;
+        return;
+    }
+
+    if (first)
+    {
+        /* Sanity check for the first iteration */
+        if ((iBlockInDataSize % (nsubband_x_nchan_csize)) != 0)
+        {
+            (void) fprintf(stderr, "ERROR: Data size mismatch on first block!\n  "
+                                   "    BlockInDataSize=%d NumSubBands=%d nchan=%d %d heaps\n"
+                                   "    skipping the entire block\n",
+                                    iBlockInDataSize, pfbCtx->_nsubband, pfbCtx->_nchan,
+                                    index_in->num_heaps);
+            pfbCtx->fill_window(iBlockInDataSize,
+                                pfbCtx->_in_block_size - iBlockInDataSize,
+                                0x2); // something other than exactly zero
+            pfbCtx->zero_accumulator();
+            return;
+        }
+        pfbCtx->load_block(payload_addr_in, iBlockInDataSize, first);
+
+        /* Load the status data into the upper half for use in the next cycle */
+        struct time_spead_heap* time_heap = (struct time_spead_heap*) vegas_databuf_data(db_in, curblock_in);
+        blk_info_cache.input(time_heap, index_in);
+
+        // Zero out accumulators for 1st integration
+        pfbCtx->zero_accumulator();
+        printf("num_heaps per block = %d\n", index_in->num_heaps);
+        // We don't do anything yet, we have just primed the pump ....
+        return;
+    }
+    else
+    {
+        /* Move the previous block to the low half for processing, and
+           put the new one in the high half */
+        pfbCtx->load_block(payload_addr_in, iBlockInDataSize, first);
+
+        struct time_spead_heap* time_heap = (struct time_spead_heap*) vegas_databuf_data(db_in, curblock_in);
+        blk_info_cache.input(time_heap, index_in);
+    }
+
+    /* now begin processing the 'old' data in the lower half of the buffers */
+    pfbCtx->rewind();
+    iProcData = 0;
+    while (iBlockInDataSize > iProcData)  /* loop till (num_heaps * heap_size) of data is processed */
+    {
+        if (0 == pfb_count)
+        {
+            /* Check if all heaps necessary for this PFB are valid */
+            if (!(blk_info_cache.is_valid(heap_in, num_in_heaps_per_pfb)))
+            {
+                /* Skip all heaps that go into this PFB if there is an invalid heap */
+                iProcData += (VEGAS_NUM_TAPS * nsubband_x_nchan_csize);
+                pfbCtx->advance(VEGAS_NUM_TAPS * nsubband_x_nchan_csize);
+                if (iProcData >= iBlockInDataSize)
+                {
+                    break;
+                }
+
+                heap_in += num_in_heaps_per_pfb;
+                fprintf(stderr, "Invalid data detected -- stepping to heap %d\n", heap_in);
+
+                if (heap_in > 2 * MAX_HEAPS_PER_BLK)
+                {
+                    (void) fprintf(stdout,
+                                   "WARNING: Heap count %d exceeds available number of heaps %d!\n",
+                                   heap_in,
+                                   2 * MAX_HEAPS_PER_BLK);
+                }
+                continue;
+            }
+        }
+
+        /* Perform polyphase filtering and the FFT */
+        iRet = pfbCtx->pfb();
+        if (iRet == VEGAS_OK)
+            iRet = pfbCtx->do_fft();
+        if (iRet != VEGAS_OK)
+        {
+            (void) fprintf(stdout, "ERROR: FFT failed!\n");
+            run = 0;
+            break;
+        }
+        // Check for 8 FFT cycles worth of data (the size of the PFB time window) for blanking.
+        // Note that this check may access data in the upper half of the buffer (i.e the next block)
+        pfbCtx->blanking_inputs(blk_info_cache.is_blanked(heap_in, num_in_heaps_per_pfb));
+
+        ++g_iTotHeapOut; // unconditional spectrum counter
+
+        /* Accumulate power x, power y, stokes real and imag, if the blanking
+           bit is not set */
+        if (!(pfbCtx->blank_current_fft()))
+        {
+            iRet = pfbCtx->accumulate();
+            if (iRet != VEGAS_OK)
+            {
+                (void) fprintf(stdout, "ERROR: Accumulation failed!\n");
+                run = 0;
+                break;
+            }
+            ++g_iSpecPerAcc;
+            // record the first unblanked state in this accumulation sequence
+            if (1 == g_iSpecPerAcc)
+            {
+                pfbCtx->_first_time_heap_in_accum_status_bits = blk_info_cache.status(heap_in);
+
+                memcpy(&pfbCtx->_first_time_heap_in_accum,
+                       blk_info_cache.header(heap_in),
+                       sizeof(pfbCtx->_first_time_heap_in_accum));
+                pfbCtx->_first_time_heap_mjd = blk_info_cache.mjd(heap_in);
+            }
+        }
+
+        if (g_iSpecPerAcc == acc_len || pfbCtx->needs_flush())
+        {
+            // If no accumulations have occurred, then just clear the accumulator and start again.
+            if (g_iSpecPerAcc > 0)
+            {
+                iRet = dump_to_buffer(db_out,
+                                      *curblock_out,
+                                      g_iHeapOut,
+                                      &pfbCtx->_first_time_heap_in_accum,
+                                      g_iTotHeapOut,
+                                      g_iSpecPerAcc,
+                                      pfbCtx->_first_time_heap_mjd,
+                                      pfbCtx->_first_time_heap_in_accum_status_bits);
+
+                if (iRet != VEGAS_OK)
+                {
+                    (void) fprintf(stdout, "ERROR: Getting accumulated spectrum failed!\n");
+                    run = 0;
+                    break;
+                }
+                ++g_iHeapOut;
+            }
+            else
+            {
+                printf("Scanlength: CPU:asked to dump buffer but no accumulations present\n");
+            }
+
+            pfbCtx->zero_accumulator();
+            g_iSpecPerAcc = 0;
+        }
+
+        iProcData += nsubband_x_nchan_csize;
+        pfbCtx->advance(nsubband_x_nchan_csize);
+
+        heap_in += num_in_heaps_per_fft;
+
+        /* if output block is full */
+        if (g_iHeapOut == g_iMaxNumHeapOut)
+        {
+            /* Mark output buffer as filled */
+            vegas_databuf_set_filled(db_out, *curblock_out);
+
+            /* Note current output block */
+            vegas_stat_set_int(stat_blkout, *curblock_out);
+
+            /*  Wait for next output block */
+            *curblock_out = (*curblock_out + 1) % db_out->n_block;
+            while ((vegas_databuf_wait_free(db_out, *curblock_out)!=0) && run) {
+                vegas_stat_set_str(stat_state, "blocked");
+            }
+
+            g_iHeapOut = 0;
+
+            hdr_out = vegas_databuf_header(db_out, *curblock_out);
+            index_out = (struct databuf_index*)vegas_databuf_index(db_out, *curblock_out);
+            index_out->num_heaps = 0;
+            memcpy(hdr_out, vegas_databuf_header(db_in, curblock_in),
+                    VEGAS_STATUS_SIZE);
+
+            index_out->heap_size = sizeof(struct freq_spead_heap) + (nsubband_x_nchan_fsize);
+        }
+
+        pfb_count = (pfb_count + 1) % VEGAS_NUM_TAPS;
+    }
+
+    /* Milliseconds in each stage for this block */
+    for (s = 0; s < PfbNumStages; ++s)
+        vegas_stat_set_double(stat_stage[s], 1e3 * pfbCtx->stage_time((PfbStage)s));
+    pfbCtx->clear_times();
+
+    return;
+}
+
+
+/*
+ * Frees up any allocated memory.
+ */
+extern "C"
+void cleanup_gpu()
+{
+    delete pfbCtx;
+    pfbCtx = 0;
+}
@@ -14,6 +14,13 @@ extern "C"
 #endif
 int init_cuda_context(int, int, int, int);
 
+/* Size of the host PFB thread team (PFBTHRDS), taken up when the context
+   is next set up by init_cuda_context() or reset_state() */
+#if defined __cplusplus
+extern "C"
+#endif
+void set_pfb_threads(int nthread);
+
 #if defined __cplusplus
 extern "C"
 #endif
@@ -30,18 +37,6 @@ void do_pfb(struct vegas_databuf *db_in,
             struct vegas_status st,
             int acc_len);
 
-int do_fft();
-
-int accumulate();
-
-void zero_accumulator();
-
-int get_accumulated_spectrum_from_device(char *out);
-
-int is_valid(int heap_start, int num_heaps);
-
-int is_blanked(int heap_start, int num_heaps);
-
 /* Free up any allocated memory */
 #if defined __cplusplus
 extern "C"
@@ -18,6 +18,7 @@
 #include "vegas_status.h"
 #include "vegas_databuf.h"
 #include "vegas_params.h"
+#include "vegas_stats.h"
 
 #include "vegas_thread_main.h"
 #include "vegas_defines.h"
@@ -77,6 +78,9 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Error connecting to vegas_status\n");
         exit(1);
     }
+
+    /* Publish the thread statistics */
+    vegas_stat_flusher_start(&stat, VEGAS_STAT_FLUSH_INTERVAL);
     dbuf = vegas_databuf_attach(net_args.output_buffer);
     /* If attach fails, first try to create the databuf */
     if (dbuf==NULL) 
@@ -137,6 +141,7 @@ int main(int argc, char *argv[]) {
         printf("Joined disk thread\n"); fflush(stdout); fflush(stderr);
     }
 
+    vegas_stat_flusher_stop();
     vegas_thread_args_destroy(&null_args);
 
     exit(0);
@@ -0,0 +1,402 @@
+/* vegas_accum_kernels.c
+ *
+ * Heap accumulation kernels, with runtime selection of the widest
+ * instruction set available.
+ */
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "vegas_accum_kernels.h"
+
+typedef void (*accum_int32_fn)(float *, const int32_t *, size_t);
+typedef void (*accum_float_fn)(float *, const float *, size_t);
+typedef void (*accum_int64_fn)(int64_t *, const int32_t *, size_t);
+typedef void (*accum_int32_fits_fn)(float *, const int32_t *, int, int, int, int);
+typedef void (*accum_float_fits_fn)(float *, const float *, int, int, int, int);
+
+static accum_int32_fn accum_int32_kernel = NULL;
+static accum_float_fn accum_float_kernel = NULL;
+static accum_int64_fn accum_int64_kernel = NULL;
+static accum_int32_fits_fn accum_int32_fits_kernel = NULL;
+static accum_float_fits_fn accum_float_fits_kernel = NULL;
+static const char *accum_name = "none";
+
+void vegas_accum_add_int32_scalar(float *acc, const int32_t *in, size_t n)
+{
+    size_t i;
+    for (i=0; i<n; ++i)
+        acc[i] += (float)in[i];
+}
+
+void vegas_accum_add_float_scalar(float *acc, const float *in, size_t n)
+{
+    size_t i;
+    for (i=0; i<n; ++i)
+        acc[i] += in[i];
+}
+
+__attribute__((target("avx2")))
+void vegas_accum_add_int32_avx2(float *acc, const int32_t *in, size_t n)
+{
+    size_t i = 0;
+
+    // Four vectors per iteration to keep the load/store ports busy
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256 a = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(in + i)));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(in + i + 8)));
+        __m256 c = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(in + i + 16)));
+        __m256 d = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(in + i + 24)));
+        _mm256_storeu_ps(acc + i,      _mm256_add_ps(_mm256_loadu_ps(acc + i), a));
+        _mm256_storeu_ps(acc + i + 8,  _mm256_add_ps(_mm256_loadu_ps(acc + i + 8), b));
+        _mm256_storeu_ps(acc + i + 16, _mm256_add_ps(_mm256_loadu_ps(acc + i + 16), c));
+        _mm256_storeu_ps(acc + i + 24, _mm256_add_ps(_mm256_loadu_ps(acc + i + 24), d));
+    }
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 a = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(in + i)));
+        _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), a));
+    }
+    vegas_accum_add_int32_scalar(acc + i, in + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void vegas_accum_add_float_avx2(float *acc, const float *in, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256 a = _mm256_loadu_ps(in + i);
+        __m256 b = _mm256_loadu_ps(in + i + 8);
+        __m256 c = _mm256_loadu_ps(in + i + 16);
+        __m256 d = _mm256_loadu_ps(in + i + 24);
+        _mm256_storeu_ps(acc + i,      _mm256_add_ps(_mm256_loadu_ps(acc + i), a));
+        _mm256_storeu_ps(acc + i + 8,  _mm256_add_ps(_mm256_loadu_ps(acc + i + 8), b));
+        _mm256_storeu_ps(acc + i + 16, _mm256_add_ps(_mm256_loadu_ps(acc + i + 16), c));
+        _mm256_storeu_ps(acc + i + 24, _mm256_add_ps(_mm256_loadu_ps(acc + i + 24), d));
+    }
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i),
+                                                _mm256_loadu_ps(in + i)));
+    vegas_accum_add_float_scalar(acc + i, in + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+void vegas_accum_add_int32_avx512(float *acc, const int32_t *in, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 64 <= n; i += 64)
+    {
+        __m512 a = _mm512_cvtepi32_ps(_mm512_loadu_si512(in + i));
+        __m512 b = _mm512_cvtepi32_ps(_mm512_loadu_si512(in + i + 16));
+        __m512 c = _mm512_cvtepi32_ps(_mm512_loadu_si512(in + i + 32));
+        __m512 d = _mm512_cvtepi32_ps(_mm512_loadu_si512(in + i + 48));
+        _mm512_storeu_ps(acc + i,      _mm512_add_ps(_mm512_loadu_ps(acc + i), a));
+        _mm512_storeu_ps(acc + i + 16, _mm512_add_ps(_mm512_loadu_ps(acc + i + 16), b));
+        _mm512_storeu_ps(acc + i + 32, _mm512_add_ps(_mm512_loadu_ps(acc + i + 32), c));
+        _mm512_storeu_ps(acc + i + 48, _mm512_add_ps(_mm512_loadu_ps(acc + i + 48), d));
+    }
+    // The tail is done under a mask rather than element by element
+    for (; i < n; i += 16)
+    {
+        __mmask16 m = n - i >= 16 ? 0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        __m512 a = _mm512_cvtepi32_ps(_mm512_maskz_loadu_epi32(m, in + i));
+        _mm512_mask_storeu_ps(acc + i, m,
+                _mm512_add_ps(_mm512_maskz_loadu_ps(m, acc + i), a));
+    }
+}
+
+__attribute__((target("avx512f")))
+void vegas_accum_add_float_avx512(float *acc, const float *in, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 64 <= n; i += 64)
+    {
+        __m512 a = _mm512_loadu_ps(in + i);
+        __m512 b = _mm512_loadu_ps(in + i + 16);
+        __m512 c = _mm512_loadu_ps(in + i + 32);
+        __m512 d = _mm512_loadu_ps(in + i + 48);
+        _mm512_storeu_ps(acc + i,      _mm512_add_ps(_mm512_loadu_ps(acc + i), a));
+        _mm512_storeu_ps(acc + i + 16, _mm512_add_ps(_mm512_loadu_ps(acc + i + 16), b));
+        _mm512_storeu_ps(acc + i + 32, _mm512_add_ps(_mm512_loadu_ps(acc + i + 32), c));
+        _mm512_storeu_ps(acc + i + 48, _mm512_add_ps(_mm512_loadu_ps(acc + i + 48), d));
+    }
+    for (; i < n; i += 16)
+    {
+        __mmask16 m = n - i >= 16 ? 0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        _mm512_mask_storeu_ps(acc + i, m,
+                _mm512_add_ps(_mm512_maskz_loadu_ps(m, acc + i),
+                              _mm512_maskz_loadu_ps(m, in + i)));
+    }
+}
+
+void vegas_accum_add_int32_int64_scalar(int64_t *acc, const int32_t *in, size_t n)
+{
+    size_t i;
+    for (i=0; i<n; ++i)
+        acc[i] += in[i];
+}
+
+__attribute__((target("avx2")))
+void vegas_accum_add_int32_int64_avx2(int64_t *acc, const int32_t *in, size_t n)
+{
+    size_t i = 0;
+
+    // Each eight inputs widen to two vectors of four sums
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i a = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(in + i)));
+        __m256i b = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(in + i + 4)));
+        __m256i c = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(in + i + 8)));
+        __m256i d = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(in + i + 12)));
+        __m256i *p = (__m256i *)(acc + i);
+        _mm256_storeu_si256(p,     _mm256_add_epi64(_mm256_loadu_si256(p), a));
+        _mm256_storeu_si256(p + 1, _mm256_add_epi64(_mm256_loadu_si256(p + 1), b));
+        _mm256_storeu_si256(p + 2, _mm256_add_epi64(_mm256_loadu_si256(p + 2), c));
+        _mm256_storeu_si256(p + 3, _mm256_add_epi64(_mm256_loadu_si256(p + 3), d));
+    }
+    vegas_accum_add_int32_int64_scalar(acc + i, in + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+void vegas_accum_add_int32_int64_avx512(int64_t *acc, const int32_t *in, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32)
+    {
+        __m512i x = _mm512_loadu_si512(in + i);
+        __m512i y = _mm512_loadu_si512(in + i + 16);
+        __m512i a = _mm512_cvtepi32_epi64(_mm512_castsi512_si256(x));
+        __m512i b = _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(x, 1));
+        __m512i c = _mm512_cvtepi32_epi64(_mm512_castsi512_si256(y));
+        __m512i d = _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(y, 1));
+        _mm512_storeu_si512(acc + i,      _mm512_add_epi64(_mm512_loadu_si512(acc + i), a));
+        _mm512_storeu_si512(acc + i + 8,  _mm512_add_epi64(_mm512_loadu_si512(acc + i + 8), b));
+        _mm512_storeu_si512(acc + i + 16, _mm512_add_epi64(_mm512_loadu_si512(acc + i + 16), c));
+        _mm512_storeu_si512(acc + i + 24, _mm512_add_epi64(_mm512_loadu_si512(acc + i + 24), d));
+    }
+    for (; i < n; i += 8)
+    {
+        __mmask8 m = n - i >= 8 ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+        __m512i a = _mm512_cvtepi32_epi64(_mm512_castsi512_si256(
+                        _mm512_maskz_loadu_epi32((__mmask16)m, in + i)));
+        _mm512_mask_storeu_epi64(acc + i, m,
+                _mm512_add_epi64(_mm512_maskz_loadu_epi64(m, acc + i), a));
+    }
+}
+
+void vegas_accum_int64_to_float(float *out, const int64_t *acc, int nchan,
+                                int nsubband, int fits_order)
+{
+    const int stride = nsubband * VEGAS_ACCUM_NSTOKES;
+    size_t i, n = (size_t)nchan * stride;
+    int s, p, c;
+
+    if (!fits_order)
+    {
+        for (i=0; i<n; ++i)
+            out[i] = (float)acc[i];
+        return;
+    }
+    for (s=0; s<nsubband; ++s)
+        for (p=0; p<VEGAS_ACCUM_NSTOKES; ++p)
+        {
+            float *o = out + (s * VEGAS_ACCUM_NSTOKES + p) * nchan;
+            const int64_t *a = acc + s * VEGAS_ACCUM_NSTOKES + p;
+            for (c=0; c<nchan; ++c)
+                o[c] = (float)a[c * stride];
+        }
+}
+
+void vegas_accum_add_int32_fits_scalar(float *acc, const int32_t *in, int nchan,
+                                       int nsubband, int c0, int c1)
+{
+    const int stride = nsubband * VEGAS_ACCUM_NSTOKES;
+    int s, p, c;
+
+    for (s=0; s<nsubband; ++s)
+        for (p=0; p<VEGAS_ACCUM_NSTOKES; ++p)
+        {
+            float *a = acc + (s * VEGAS_ACCUM_NSTOKES + p) * nchan;
+            const int32_t *x = in + s * VEGAS_ACCUM_NSTOKES + p;
+            for (c=c0; c<c1; ++c)
+                a[c] += (float)x[c * stride];
+        }
+}
+
+void vegas_accum_add_float_fits_scalar(float *acc, const float *in, int nchan,
+                                       int nsubband, int c0, int c1)
+{
+    const int stride = nsubband * VEGAS_ACCUM_NSTOKES;
+    int s, p, c;
+
+    for (s=0; s<nsubband; ++s)
+        for (p=0; p<VEGAS_ACCUM_NSTOKES; ++p)
+        {
+            float *a = acc + (s * VEGAS_ACCUM_NSTOKES + p) * nchan;
+            const float *x = in + s * VEGAS_ACCUM_NSTOKES + p;
+            for (c=c0; c<c1; ++c)
+                a[c] += x[c * stride];
+        }
+}
+
+/** Add eight channels of one subband, given as the four stokes of
+ * channels c and c+4 in each 256 bit lane of r0..r3, to the four stokes
+ * rows of acc.  The transpose is done within each lane, which leaves the
+ * eight channels of each product in order.
+ */
+__attribute__((target("avx2")))
+static inline void accum_fits_tile(float *acc, int nchan, __m256 r0, __m256 r1,
+                                   __m256 r2, __m256 r3)
+{
+    __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+    __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+    __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+    __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+    __m256 p0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1,0,1,0));
+    __m256 p1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3,2,3,2));
+    __m256 p2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1,0,1,0));
+    __m256 p3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3,2,3,2));
+    _mm256_storeu_ps(acc,             _mm256_add_ps(_mm256_loadu_ps(acc), p0));
+    _mm256_storeu_ps(acc + nchan,     _mm256_add_ps(_mm256_loadu_ps(acc + nchan), p1));
+    _mm256_storeu_ps(acc + 2 * nchan, _mm256_add_ps(_mm256_loadu_ps(acc + 2 * nchan), p2));
+    _mm256_storeu_ps(acc + 3 * nchan, _mm256_add_ps(_mm256_loadu_ps(acc + 3 * nchan), p3));
+}
+
+/// Load the stokes of channels c and c+4 into the two lanes
+#define FITS_LOAD_INT32(x, c, stride) \
+    _mm256_cvtepi32_ps(_mm256_inserti128_si256( \
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)((x) + (c) * (stride)))), \
+        _mm_loadu_si128((const __m128i *)((x) + ((c) + 4) * (stride))), 1))
+#define FITS_LOAD_FLOAT(x, c, stride) \
+    _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps((x) + (c) * (stride))), \
+        _mm_loadu_ps((x) + ((c) + 4) * (stride)), 1)
+
+__attribute__((target("avx2")))
+void vegas_accum_add_int32_fits_avx2(float *acc, const int32_t *in, int nchan,
+                                     int nsubband, int c0, int c1)
+{
+    const int stride = nsubband * VEGAS_ACCUM_NSTOKES;
+    int s, p, c;
+
+    for (s=0; s<nsubband; ++s)
+    {
+        float *a = acc + s * VEGAS_ACCUM_NSTOKES * nchan;
+        const int32_t *x = in + s * VEGAS_ACCUM_NSTOKES;
+        for (c=c0; c + 8 <= c1; c += 8)
+            accum_fits_tile(a + c, nchan,
+                            FITS_LOAD_INT32(x, c, stride),
+                            FITS_LOAD_INT32(x, c + 1, stride),
+                            FITS_LOAD_INT32(x, c + 2, stride),
+                            FITS_LOAD_INT32(x, c + 3, stride));
+        for (; c < c1; ++c)
+            for (p=0; p<VEGAS_ACCUM_NSTOKES; ++p)
+                a[p * nchan + c] += (float)x[c * stride + p];
+    }
+}
+
+__attribute__((target("avx2")))
+void vegas_accum_add_float_fits_avx2(float *acc, const float *in, int nchan,
+                                     int nsubband, int c0, int c1)
+{
+    const int stride = nsubband * VEGAS_ACCUM_NSTOKES;
+    int s, p, c;
+
+    for (s=0; s<nsubband; ++s)
+    {
+        float *a = acc + s * VEGAS_ACCUM_NSTOKES * nchan;
+        const float *x = in + s * VEGAS_ACCUM_NSTOKES;
+        for (c=c0; c + 8 <= c1; c += 8)
+            accum_fits_tile(a + c, nchan,
+                            FITS_LOAD_FLOAT(x, c, stride),
+                            FITS_LOAD_FLOAT(x, c + 1, stride),
+                            FITS_LOAD_FLOAT(x, c + 2, stride),
+                            FITS_LOAD_FLOAT(x, c + 3, stride));
+        for (; c < c1; ++c)
+            for (p=0; p<VEGAS_ACCUM_NSTOKES; ++p)
+                a[p * nchan + c] += x[c * stride + p];
+    }
+}
+
+/// Pick the widest kernels supported by the cpu we are running on
+static void accum_select_kernel(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        accum_name = "avx512";
+        accum_float_kernel = vegas_accum_add_float_avx512;
+        accum_int32_kernel = vegas_accum_add_int32_avx512;
+        accum_int64_kernel = vegas_accum_add_int32_int64_avx512;
+        /* The strided loads gain nothing from the wider registers */
+        accum_float_fits_kernel = vegas_accum_add_float_fits_avx2;
+        accum_int32_fits_kernel = vegas_accum_add_int32_fits_avx2;
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        accum_name = "avx2";
+        accum_float_kernel = vegas_accum_add_float_avx2;
+        accum_int32_kernel = vegas_accum_add_int32_avx2;
+        accum_int64_kernel = vegas_accum_add_int32_int64_avx2;
+        accum_float_fits_kernel = vegas_accum_add_float_fits_avx2;
+        accum_int32_fits_kernel = vegas_accum_add_int32_fits_avx2;
+    }
+    else
+    {
+        accum_name = "scalar";
+        accum_float_kernel = vegas_accum_add_float_scalar;
+        accum_int32_kernel = vegas_accum_add_int32_scalar;
+        accum_int64_kernel = vegas_accum_add_int32_int64_scalar;
+        accum_float_fits_kernel = vegas_accum_add_float_fits_scalar;
+        accum_int32_fits_kernel = vegas_accum_add_int32_fits_scalar;
+    }
+}
+
+void vegas_accum_add_int32(float *acc, const int32_t *in, size_t n)
+{
+    // The selection is idempotent, so a race between threads is harmless
+    if (accum_int32_kernel == NULL)
+        accum_select_kernel();
+    accum_int32_kernel(acc, in, n);
+}
+
+void vegas_accum_add_float(float *acc, const float *in, size_t n)
+{
+    if (accum_float_kernel == NULL)
+        accum_select_kernel();
+    accum_float_kernel(acc, in, n);
+}
+
+void vegas_accum_add_int32_int64(int64_t *acc, const int32_t *in, size_t n)
+{
+    if (accum_int64_kernel == NULL)
+        accum_select_kernel();
+    accum_int64_kernel(acc, in, n);
+}
+
+void vegas_accum_add_int32_fits(float *acc, const int32_t *in, int nchan,
+                                int nsubband, int c0, int c1)
+{
+    if (accum_int32_fits_kernel == NULL)
+        accum_select_kernel();
+    accum_int32_fits_kernel(acc, in, nchan, nsubband, c0, c1);
+}
+
+void vegas_accum_add_float_fits(float *acc, const float *in, int nchan,
+                                int nsubband, int c0, int c1)
+{
+    if (accum_float_fits_kernel == NULL)
+        accum_select_kernel();
+    accum_float_fits_kernel(acc, in, nchan, nsubband, c0, c1);
+}
+
+const char *vegas_accum_kernel_name(void)
+{
+    if (accum_int32_kernel == NULL)
+        accum_select_kernel();
+    return accum_name;
+}
@@ -0,0 +1,82 @@
+/** vegas_accum_kernels.h
+ *
+ * Kernels adding one heap's payload into a switching state accumulator.
+ * The widest kernel the cpu supports (AVX-512, AVX2 or scalar) is selected
+ * the first time one of vegas_accum_add_int32() or vegas_accum_add_float()
+ * is called.  Each element is converted and added on its own, exactly as
+ * in the scalar loop, so all the kernels give bit-identical sums.
+ *
+ * Payloads are always laid out [chan][subband][stokes].  The plain kernels
+ * add them into accumulators of the same layout; the _fits kernels add
+ * them into the [subband][stokes][chan] order of the SDFITS DATA column,
+ * so that an integration can be written out without a transpose.
+ *
+ * HBW integer payloads can instead be summed exactly into int64
+ * accumulators, which are converted to float once per integration.
+ */
+#ifndef _VEGAS_ACCUM_KERNELS_H
+#define _VEGAS_ACCUM_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VEGAS_ACCUM_NSTOKES 4 ///< Stokes products in every payload
+
+#ifdef __cplusplus /* C++ prototypes */
+extern "C" {
+#endif
+
+/** acc[i] += (float)in[i] for n elements (HBW integer payloads) */
+void vegas_accum_add_int32(float *acc, const int32_t *in, size_t n);
+
+/** acc[i] += in[i] for n elements (LBW float payloads from the GPU) */
+void vegas_accum_add_float(float *acc, const float *in, size_t n);
+
+/** acc[i] += in[i] for n elements, exactly (HBW integer payloads) */
+void vegas_accum_add_int32_int64(int64_t *acc, const int32_t *in, size_t n);
+
+/** Convert an nchan x nsubband int64 accumulator, in payload order, to
+ * float in payload order, or with fits_order set in SDFITS order.
+ */
+void vegas_accum_int64_to_float(float *out, const int64_t *acc, int nchan,
+                                int nsubband, int fits_order);
+
+/** As vegas_accum_add_int32(), for channels c0 to c1-1 of an nchan x
+ * nsubband payload, with acc in SDFITS order.
+ */
+void vegas_accum_add_int32_fits(float *acc, const int32_t *in, int nchan,
+                                int nsubband, int c0, int c1);
+
+/** As vegas_accum_add_float(), with acc in SDFITS order */
+void vegas_accum_add_float_fits(float *acc, const float *in, int nchan,
+                                int nsubband, int c0, int c1);
+
+/** The individual kernels, exposed for testing and benchmarking.
+ * Calling a SIMD kernel on a cpu without the instruction set is fatal.
+ */
+void vegas_accum_add_int32_scalar(float *acc, const int32_t *in, size_t n);
+void vegas_accum_add_int32_avx2(float *acc, const int32_t *in, size_t n);
+void vegas_accum_add_int32_avx512(float *acc, const int32_t *in, size_t n);
+void vegas_accum_add_float_scalar(float *acc, const float *in, size_t n);
+void vegas_accum_add_float_avx2(float *acc, const float *in, size_t n);
+void vegas_accum_add_float_avx512(float *acc, const float *in, size_t n);
+void vegas_accum_add_int32_int64_scalar(int64_t *acc, const int32_t *in, size_t n);
+void vegas_accum_add_int32_int64_avx2(int64_t *acc, const int32_t *in, size_t n);
+void vegas_accum_add_int32_int64_avx512(int64_t *acc, const int32_t *in, size_t n);
+void vegas_accum_add_int32_fits_scalar(float *acc, const int32_t *in, int nchan,
+                                       int nsubband, int c0, int c1);
+void vegas_accum_add_int32_fits_avx2(float *acc, const int32_t *in, int nchan,
+                                     int nsubband, int c0, int c1);
+void vegas_accum_add_float_fits_scalar(float *acc, const float *in, int nchan,
+                                       int nsubband, int c0, int c1);
+void vegas_accum_add_float_fits_avx2(float *acc, const float *in, int nchan,
+                                     int nsubband, int c0, int c1);
+
+/** Return the name of the kernels in use */
+const char *vegas_accum_kernel_name(void);
+
+#ifdef __cplusplus /* C++ prototypes */
+}
+#endif
+
+#endif
@@ -0,0 +1,257 @@
+/* vegas_accum_team.c
+ *
+ * Channel partitioned accumulation across a team of threads.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "vegas_error.h"
+#include "vegas_accum_kernels.h"
+#include "vegas_accum_team.h"
+
+/// Elements per cache line
+#define ACCUM_LINE_ELEMS (64 / sizeof(float))
+
+/// Accumulator bytes worked on at a time within a run, small enough to
+/// stay in the L1 cache while each heap of the run is added to it
+#define ACCUM_TILE_BYTES 16384
+
+/// Payload bytes prefetched ahead of the next heap's tile
+#define ACCUM_PREFETCH_BYTES 512
+
+/// Add units lo to hi-1 of one payload to an accumulator.  A unit is an
+/// element, or in SDFITS order a channel.
+static void accum_range(struct vegas_accum_team *t, int accumid,
+                        const void *payload, size_t lo, size_t hi)
+{
+    if (t->accum64 != NULL)
+        vegas_accum_add_int32_int64(t->accum64[accumid] + lo,
+                                    (const int32_t *)payload + lo, hi - lo);
+    else if (t->fits_order && t->is_int)
+        vegas_accum_add_int32_fits(t->accumulator[accumid], (const int32_t *)payload,
+                                   t->nchan, t->nsubband, (int)lo, (int)hi);
+    else if (t->fits_order)
+        vegas_accum_add_float_fits(t->accumulator[accumid], (const float *)payload,
+                                   t->nchan, t->nsubband, (int)lo, (int)hi);
+    else if (t->is_int)
+        vegas_accum_add_int32(t->accumulator[accumid] + lo,
+                              (const int32_t *)payload + lo, hi - lo);
+    else
+        vegas_accum_add_float(t->accumulator[accumid] + lo,
+                              (const float *)payload + lo, hi - lo);
+}
+
+static inline void accum_prefetch(const char *p, size_t len)
+{
+    size_t i;
+    for (i=0; i<len; i+=64)
+        __builtin_prefetch(p + i, 0, 0);
+}
+
+/** Add every queued heap to one member's slice of the accumulators.
+ * Runs of heaps for the same switching state, which are the common case,
+ * are fused: the slice is taken a tile at a time and every heap of the
+ * run is added to the tile while it is in cache, so the accumulator is
+ * read and written once per run rather than once per heap.  The elements
+ * still see the heaps in queue order, so the sums do not change.
+ */
+static void accum_slice(struct vegas_accum_team *t, int rank)
+{
+    size_t first = rank * t->chunk;
+    size_t units, unit_bytes, acc_bytes, tile, lo, hi;
+    int j, k, run;
+
+    /* Payload bytes and accumulator bytes per unit */
+    if (t->fits_order && t->accum64 == NULL)
+    {
+        units = t->nchan;
+        unit_bytes = (size_t)t->nsubband * VEGAS_ACCUM_NSTOKES * sizeof(int32_t);
+        acc_bytes = unit_bytes;
+    }
+    else
+    {
+        units = t->nelem;
+        unit_bytes = sizeof(int32_t);
+        acc_bytes = t->accum64 != NULL ? sizeof(int64_t) : sizeof(float);
+    }
+    if (first >= units)
+        return;
+    units = units - first < t->chunk ? units : first + t->chunk;
+    tile = ACCUM_TILE_BYTES / acc_bytes;
+    if (tile < 16)
+        tile = 16;
+
+    for (j=0; j<t->njob; j+=run)
+    {
+        for (run=1; j + run < t->njob && run < t->max_run; run++)
+            if (t->jobs[j + run].accumid != t->jobs[j].accumid)
+                break;
+        for (lo=first; lo<units; lo=hi)
+        {
+            hi = lo + tile < units ? lo + tile : units;
+            for (k=j; k<j+run; k++)
+            {
+                /* Start pulling in the next heap's tile, or the first
+                 * heap's next one.
+                 */
+                if (k + 1 < j + run)
+                    accum_prefetch((const char *)t->jobs[k + 1].payload + lo * unit_bytes,
+                                   ACCUM_PREFETCH_BYTES);
+                else if (hi < units)
+                    accum_prefetch((const char *)t->jobs[j].payload + hi * unit_bytes,
+                                   ACCUM_PREFETCH_BYTES);
+                accum_range(t, t->jobs[k].accumid, t->jobs[k].payload, lo, hi);
+            }
+        }
+    }
+}
+
+static void *accum_member_thread(void *_m)
+{
+    struct vegas_accum_member *m = (struct vegas_accum_member *)_m;
+    struct vegas_accum_team *t = m->team;
+    unsigned int gen = 0;
+
+    while (1)
+    {
+        pthread_mutex_lock(&t->lock);
+        while (t->gen == gen && !t->quit)
+            pthread_cond_wait(&t->start, &t->lock);
+        gen = t->gen;
+        if (t->quit)
+        {
+            pthread_mutex_unlock(&t->lock);
+            break;
+        }
+        pthread_mutex_unlock(&t->lock);
+
+        accum_slice(t, m->rank);
+
+        pthread_mutex_lock(&t->lock);
+        if (--t->pending == 0)
+            pthread_cond_signal(&t->done);
+        pthread_mutex_unlock(&t->lock);
+    }
+    return NULL;
+}
+
+int vegas_accum_team_init(struct vegas_accum_team *t, int nthread,
+                          float **accumulator, int64_t **accum64,
+                          int nchan, int nsubband,
+                          int is_int, int fits_order, int max_jobs)
+{
+    const int elem_per_chan = nsubband * VEGAS_ACCUM_NSTOKES;
+    size_t chans;
+    int i;
+
+    memset(t, 0, sizeof(*t));
+    if (nthread < 1)
+        nthread = 1;
+    if (nthread > VEGAS_ACCUM_MAX_THREADS)
+        nthread = VEGAS_ACCUM_MAX_THREADS;
+    t->nthread = nthread;
+    t->is_int = is_int;
+    t->fits_order = fits_order;
+    t->nchan = nchan;
+    t->nsubband = nsubband;
+    t->accumulator = accumulator;
+    t->accum64 = accum64;
+    t->nelem = (size_t)nchan * elem_per_chan;
+    t->max_jobs = max_jobs > 0 ? max_jobs : 1;
+    t->max_run = VEGAS_ACCUM_MAX_RUN;
+    t->jobs = malloc(t->max_jobs * sizeof(struct vegas_accum_job));
+    if (t->jobs == NULL)
+    {
+        vegas_error("vegas_accum_team_init", "malloc failed");
+        return(VEGAS_ERR_SYS);
+    }
+
+    /* Whole channels per member, rounded up to whole cache lines.  In
+     * SDFITS order a line holds that many channels of one product.
+     */
+    chans = (nchan + nthread - 1) / nthread;
+    t->chunk = t->fits_order && accum64 == NULL ? chans : chans * elem_per_chan;
+    t->chunk = (t->chunk + ACCUM_LINE_ELEMS - 1) / ACCUM_LINE_ELEMS * ACCUM_LINE_ELEMS;
+    if (t->chunk == 0)
+        t->chunk = ACCUM_LINE_ELEMS;
+
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->start, NULL);
+    pthread_cond_init(&t->done, NULL);
+
+    /* The caller is rank 0.  Members inherit its cpu affinity. */
+    for (i=1; i<nthread; i++)
+    {
+        struct vegas_accum_member *m = &t->members[t->nstarted + 1];
+        m->team = t;
+        m->rank = t->nstarted + 1;
+        if (pthread_create(&m->id, NULL, accum_member_thread, m))
+        {
+            vegas_warn("vegas_accum_team_init", "Error creating accumulator thread");
+            break;
+        }
+        t->nstarted++;
+    }
+    return(VEGAS_OK);
+}
+
+void vegas_accum_team_add(struct vegas_accum_team *t, int accumid,
+                          const void *payload)
+{
+    if (t->njob == t->max_jobs)
+        vegas_accum_team_flush(t);
+    t->jobs[t->njob].accumid = accumid;
+    t->jobs[t->njob].payload = payload;
+    t->njob++;
+}
+
+void vegas_accum_team_flush(struct vegas_accum_team *t)
+{
+    int rank;
+
+    if (t->njob == 0)
+        return;
+    if (t->nstarted > 0)
+    {
+        pthread_mutex_lock(&t->lock);
+        t->pending = t->nstarted;
+        t->gen++;
+        pthread_cond_broadcast(&t->start);
+        pthread_mutex_unlock(&t->lock);
+    }
+
+    /* Our own range, and those of any members that did not start */
+    accum_slice(t, 0);
+    for (rank = t->nstarted + 1; rank < t->nthread; rank++)
+        accum_slice(t, rank);
+
+    if (t->nstarted > 0)
+    {
+        pthread_mutex_lock(&t->lock);
+        while (t->pending > 0)
+            pthread_cond_wait(&t->done, &t->lock);
+        pthread_mutex_unlock(&t->lock);
+    }
+    t->njob = 0;
+}
+
+void vegas_accum_team_destroy(struct vegas_accum_team *t)
+{
+    int i;
+
+    pthread_mutex_lock(&t->lock);
+    t->quit = 1;
+    pthread_cond_broadcast(&t->start);
+    pthread_mutex_unlock(&t->lock);
+    for (i=1; i<=t->nstarted; i++)
+        pthread_join(t->members[i].id, NULL);
+    t->nstarted = 0;
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->start);
+    pthread_cond_destroy(&t->done);
+    free(t->jobs);
+    t->jobs = NULL;
+}
@@ -0,0 +1,95 @@
+/** vegas_accum_team.h
+ *
+ * A small team of threads sharing the accumulation of heaps.  Each
+ * member owns a fixed, disjoint channel range of every switching state
+ * accumulator, so they never write the same memory.  The accumulator
+ * thread queues heaps as it reads them, and the team adds up everything
+ * queued only when it is flushed: at integration boundaries, before an
+ * accumulator is read, and before the input block holding the payloads
+ * is released.  Every element sees the same adds in the same order as
+ * with one thread, so the sums are identical.
+ */
+#ifndef _VEGAS_ACCUM_TEAM_H
+#define _VEGAS_ACCUM_TEAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define VEGAS_ACCUM_MAX_THREADS 16
+#define VEGAS_ACCUM_MAX_RUN     32 ///< Most heaps fused into one pass
+
+struct vegas_accum_team;
+
+/** A member thread of a team */
+struct vegas_accum_member {
+    struct vegas_accum_team *team;
+    int rank;              /**< Which channel range it owns */
+    pthread_t id;
+};
+
+/** One queued heap */
+struct vegas_accum_job {
+    int accumid;           /**< Accumulator to add to */
+    const void *payload;   /**< Payload, int32 or float by the team's type */
+};
+
+struct vegas_accum_team {
+    int nthread;           /**< Members, including the caller */
+    int nstarted;          /**< Member threads running; the caller covers the rest */
+    int is_int;            /**< Payloads are int32 (HBW) rather than float */
+    int fits_order;        /**< Accumulators are in SDFITS order */
+    int nchan;
+    int nsubband;
+    float **accumulator;   /**< accumulator[accumid][element] */
+    int64_t **accum64;     /**< Exact int64 accumulators in payload order, or NULL */
+    size_t nelem;          /**< Elements in each spectrum */
+    size_t chunk;          /**< Elements, or in SDFITS order channels, owned by each member */
+    struct vegas_accum_job *jobs;
+    int njob;
+    int max_jobs;
+    int max_run;           /**< Longest run of same-state heaps fused; 1 turns fusion off */
+    struct vegas_accum_member members[VEGAS_ACCUM_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t start;  /**< Signalled when gen moves on or quit is set */
+    pthread_cond_t done;   /**< Signalled when pending reaches zero */
+    unsigned int gen;      /**< Flush number */
+    int pending;           /**< Members still working on this flush */
+    int quit;
+};
+
+#ifdef __cplusplus /* C++ prototypes */
+extern "C" {
+#endif
+
+/** Set up a team of nthread members, the calling thread being one of
+ * them, for spectra of nchan channels by nsubband subbands.  fits_order
+ * selects accumulators in SDFITS [subband][stokes][chan] order rather
+ * than the payload order.  If accum64 is given, int32 payloads are summed
+ * exactly into it, in payload order, instead.  The channel split is rounded so that no two members share a cache
+ * line.  If some member threads cannot be started the caller does their
+ * share, with a warning.  Returns VEGAS_OK, or VEGAS_ERR_SYS if the job
+ * queue cannot be allocated.
+ */
+int vegas_accum_team_init(struct vegas_accum_team *t, int nthread,
+                          float **accumulator, int64_t **accum64,
+                          int nchan, int nsubband,
+                          int is_int, int fits_order, int max_jobs);
+
+/** Queue a heap to be added to accumulator accumid.  The payload must
+ * stay valid until the next flush; the queue flushes itself when full.
+ */
+void vegas_accum_team_add(struct vegas_accum_team *t, int accumid,
+                          const void *payload);
+
+/** Add up every queued heap, returning once all members are done */
+void vegas_accum_team_flush(struct vegas_accum_team *t);
+
+/** Stop and join the members.  Anything still queued is dropped. */
+void vegas_accum_team_destroy(struct vegas_accum_team *t);
+
+#ifdef __cplusplus /* C++ prototypes */
+}
+#endif
+
+#endif
@@ -26,6 +26,8 @@
 #include "vegas_databuf.h"
 #include "spead_heap.h"
 #include "SwitchingStateMachine.h"
+#include "vegas_accum_kernels.h"
+#include "vegas_accum_team.h"
 
 #define STATUS_KEY "ACCSTAT"
 #include "vegas_threads.h"
@@ -88,7 +90,8 @@ void write_full_integration(struct vegas_databuf *db_out, int *cur_block_out,
                        struct vegas_databuf *db_in,  int  cur_block_in, 
                        char *accum_dirty, float **accumulator, 
                        struct sdfits_data_columns* data_cols,
-                       struct sdfits *sdf,struct BlockStats *blkstat);
+                       struct sdfits *sdf,struct BlockStats *blkstat,
+                       const struct vegas_accum_team *team);
 void flush_end_of_scan(struct vegas_databuf *db_out, int *cur_block_out, 
                        struct vegas_databuf *db_in, int cur_block_in);                       
 
@@ -129,10 +132,43 @@ void destroy_accumulators(float **accumulator)
     free(accumulator);
 }
 
+/* Allocates the exact int64 accumulators, in payload order */
+void create_int64_accumulators(int64_t ***accum64, int num_chans, int num_subbands)
+{
+    int i;
+
+    *accum64 = calloc(NUM_SW_STATES, sizeof(int64_t*));
+    if(*accum64 == NULL) {
+        vegas_error("vegas_accum_thread", "malloc failed");
+        pthread_exit(NULL);
+    }
+
+    for(i = 0; i < NUM_SW_STATES; i++)
+    {
+        (*accum64)[i] = calloc((size_t)num_chans * num_subbands * NUM_STOKES, sizeof(int64_t));
+        if((*accum64)[i] == NULL) {
+            vegas_error("vegas_accum_thread", "malloc failed");
+            pthread_exit(NULL);
+        }
+    }
+}
+
+void destroy_int64_accumulators(int64_t **accum64)
+{
+    int i;
+
+    if (accum64 == NULL)
+        return;
+    for(i = 0; i < NUM_SW_STATES; i++)
+        free(accum64[i]);
+    free(accum64);
+}
+
 
 
 /* Resets the vector accumulators */
-void reset_accumulators(float **accumulator, struct sdfits_data_columns* data_cols,
+void reset_accumulators(float **accumulator, int64_t **accum64,
+                        struct sdfits_data_columns* data_cols,
                         char* accum_dirty, int num_subbands, int num_chans)
 {
     int i, j, k, l;
@@ -142,12 +178,19 @@ void reset_accumulators(float **accumulator, struct sdfits_data_columns* data_co
     {
         if(accum_dirty[i])
         {
-            for(j = 0; j < num_chans; j++)
+            /* Only the exact sums are used if there are any */
+            if (accum64 != NULL)
+                memset(accum64[i], 0,
+                       (size_t)num_chans * num_subbands * NUM_STOKES * sizeof(int64_t));
+            else
             {
-                for(k = 0; k < num_subbands; k++)
+                for(j = 0; j < num_chans; j++)
                 {
-                    for(l = 0; l < NUM_STOKES; l++)
-                        accumulator[i][j*num_subbands*NUM_STOKES + k*NUM_STOKES + l] = 0.0;
+                    for(k = 0; k < num_subbands; k++)
+                    {
+                        for(l = 0; l < NUM_STOKES; l++)
+                            accumulator[i][j*num_subbands*NUM_STOKES + k*NUM_STOKES + l] = 0.0;
+                    }
                 }
             }
 
@@ -206,10 +249,15 @@ int32_t read_phase_table_info(char *statbuf, int32_t *sigref, int32_t *calnoc,
 void vegas_accum_thread(void *_args) {
 
     float **accumulator;      //indexed accumulator[accum_id][chan][subband][stokes]
+    struct vegas_accum_team team;
+    int accum_threads;
+    char accum_order[16];
+    int64_t **accum64 = NULL; //exact HBW sums, indexed like accumulator
+    int accum_exact;
     char accum_dirty[NUM_SW_STATES];
     struct sdfits_data_columns data_cols[NUM_SW_STATES];
     int payload_type = 0;
-    int i, j, k, rv;
+    int i, rv;
     int use_scanlen;
     double scan_length_seconds;
     int accumid_xor_mask = 0;
@@ -265,14 +313,25 @@ void vegas_accum_thread(void *_args) {
         pthread_exit(NULL);
     }
     pthread_cleanup_push((void *)vegas_status_detach, &st);
-    pthread_cleanup_push((void *)set_exit_status, &st);
+    /* The keywords carry the net pipeline's number after the first */
+    struct vegas_thread_state ts;
+    char blkin_key[9], blkout_key[9];
+    vegas_thread_state_init(&ts, &st, args->pipe);
+    vegas_pipe_key(blkin_key, "ACCBLKIN", args->pipe);
+    vegas_pipe_key(blkout_key, "ACCBLKOU", args->pipe);
+    pthread_cleanup_push((void *)set_pipe_exit_status, &ts);
     pthread_cleanup_push((void *)vegas_thread_set_finished, args);
 
     /* Init status */
     vegas_status_lock_safe(&st);
-    hputs(st.buf, STATUS_KEY, "init");
+    hputs(st.buf, ts.key, "init");
     vegas_status_unlock_safe(&st);
 
+    /* Per block status, published by the stats flusher */
+    struct vegas_stat *stat_state = vegas_stat_register(ts.key, VEGAS_STAT_STR);
+    struct vegas_stat *stat_blkin = vegas_stat_register(blkin_key, VEGAS_STAT_INT);
+    struct vegas_stat *stat_blkout = vegas_stat_register(blkout_key, VEGAS_STAT_INT);
+
     /* Read in general parameters */
     struct vegas_params gp;
     struct sdfits sf;
@@ -403,9 +462,44 @@ void vegas_accum_thread(void *_args) {
     }
     pthread_cleanup_push((void *)destroy_switching_state_machine, ssm);
     
+    /* The kernels that add up spectra, and how many threads share the
+     * work.  Each thread takes a range of channels.  ACCORDER=FITS
+     * accumulates straight into the SDFITS [subband][stokes][chan] order,
+     * so the FITS writer need not transpose each integration.
+     * ACCEXACT=1 sums HBW integer spectra exactly in int64, converting
+     * them to float only as each integration is written out.
+     */
+    vegas_status_lock_safe(&st);
+    hputs(st.buf, "ACCKERN", vegas_accum_kernel_name());
+    if (hgeti4(st.buf, "ACCTHRDS", &accum_threads) == 0)
+        accum_threads = 1;
+    if (hgets(st.buf, "ACCORDER", sizeof(accum_order), accum_order) == 0)
+        strcpy(accum_order, "CHAN");
+    if (hgeti4(st.buf, "ACCEXACT", &accum_exact) == 0)
+        accum_exact = 0;
+    vegas_status_unlock_safe(&st);
+    if (accum_exact && payload_type != INT_PAYLOAD)
+    {
+        vegas_warn("vegas_accum_thread", "ACCEXACT only applies to integer payloads");
+        accum_exact = 0;
+    }
+    if (accum_exact)
+        create_int64_accumulators(&accum64, sf.hdr.nchan, sf.hdr.nsubband);
+    pthread_cleanup_push((void *)destroy_int64_accumulators, accum64);
+    if (vegas_accum_team_init(&team, accum_threads, accumulator, accum64, sf.hdr.nchan,
+                              sf.hdr.nsubband, payload_type == INT_PAYLOAD,
+                              strcmp(accum_order, "FITS") == 0,
+                              MAX_HEAPS_PER_BLK) != VEGAS_OK)
+    {
+        vegas_error("vegas_accum_thread", "error creating accumulator threads");
+        pthread_exit(0);
+    }
+    pthread_cleanup_push((void *)vegas_accum_team_destroy, &team);
+
     /* Clear the vector accumulators */
     for(i = 0; i < NUM_SW_STATES; i++) accum_dirty[i] = 1;
-    reset_accumulators(accumulator, data_cols, accum_dirty, sf.hdr.nsubband, sf.hdr.nchan);
+    reset_accumulators(accumulator, accum64, data_cols, accum_dirty,
+                       sf.hdr.nsubband, sf.hdr.nchan);
 
     /* Loop */
     int curblock_in=0, curblock_out=0;
@@ -430,19 +524,15 @@ void vegas_accum_thread(void *_args) {
     while (run) {
 
         /* Note waiting status */
-        vegas_status_lock_safe(&st);
-        hputs(st.buf, STATUS_KEY, "waiting");
-        vegas_status_unlock_safe(&st);
+        vegas_stat_set_str(stat_state, "waiting");
 
         /* Wait for buf to have data */
         rv = vegas_databuf_wait_filled(db_in, curblock_in);
         if (rv!=0) continue;
 
         /* Note waiting status and current block*/
-        vegas_status_lock_safe(&st);
-        hputs(st.buf, STATUS_KEY, "accumulating");
-        hputi4(st.buf, "ACCBLKIN", curblock_in);
-        vegas_status_unlock_safe(&st);
+        vegas_stat_set_str(stat_state, "accumulating");
+        vegas_stat_set_int(stat_blkin, curblock_in);
 
         /* Read param struct for this block */
         hdr_in = vegas_databuf_header(db_in, curblock_in);
@@ -459,6 +549,7 @@ void vegas_accum_thread(void *_args) {
             hdr_out = vegas_databuf_header(db_out, curblock_out);
             memcpy(hdr_out, vegas_databuf_header(db_in, curblock_in),
                     VEGAS_STATUS_SIZE);
+            hputs(hdr_out, "ACCORDER", team.fits_order ? "FITS" : "CHAN");
 
             /* Read required exposure and PFB rate from status shared memory */
             reqd_exposure = sf.data_columns.exposure;
@@ -497,8 +588,6 @@ void vegas_accum_thread(void *_args) {
             char* payload_addr = (char*)(vegas_databuf_data(db_in, curblock_in) +
                                 sizeof(struct freq_spead_heap) * MAX_HEAPS_PER_BLK +
                                 (index_in->heap_size - sizeof(struct freq_spead_heap)) * heap );
-            int32_t *i_payload = (int32_t*)(payload_addr);
-            float *f_payload = (float*)(payload_addr);
 
             if (freq_heap->status_bits & SCAN_NOT_STARTED)
             {
@@ -587,13 +676,14 @@ void vegas_accum_thread(void *_args) {
                 // end debug
 #endif                 
                 /* Write block number to status buffer */
-                vegas_status_lock_safe(&st);
-                hputi4(st.buf, "ACCBLKOU", curblock_out);
-                vegas_status_unlock_safe(&st);
-                
+                vegas_stat_set_int(stat_blkout, curblock_out);
+
+                /* Finish adding up this integration */
+                vegas_accum_team_flush(&team);
                 write_full_integration(db_out, &curblock_out, 
                                        db_in,   curblock_in, 
-                                       accum_dirty, accumulator, data_cols, &sf, &blkstats);
+                                       accum_dirty, accumulator, data_cols, &sf, &blkstats,
+                                       &team);
                 accum_time = 0;
                 integ_num += 1;
                 exposure_complete = 0;
@@ -611,7 +701,7 @@ void vegas_accum_thread(void *_args) {
                     }
                 }
 
-                reset_accumulators(accumulator, data_cols, accum_dirty,
+                reset_accumulators(accumulator, accum64, data_cols, accum_dirty,
                                 sf.hdr.nsubband, sf.hdr.nchan);
             }
             
@@ -651,39 +741,11 @@ void vegas_accum_thread(void *_args) {
                 accum_time += (double)freq_heap->integ_size / pfb_rate;
                 // data_cols[accumid].stpspec = freq_heap->spectrum_cntr;
 
-                /* Add spectrum to appropriate vector accumulator (high-bw mode) */
-                if(payload_type == INT_PAYLOAD)
-                {
-                    for(i = 0; i < sf.hdr.nchan; i++)
-                    {
-                        for(j = 0; j < sf.hdr.nsubband; j++)
-                        {
-                            for(k = 0; k < NUM_STOKES; k++)
-                            {
-                                accumulator[accumid]
-                                           [i*sf.hdr.nsubband*NUM_STOKES + j*NUM_STOKES + k] +=
-                                    (float)i_payload[i*sf.hdr.nsubband*NUM_STOKES + j*NUM_STOKES + k];
-                            }
-                        }
-                    }
-                }
-
-                /* Add spectrum to appropriate vector accumulator (low-bw mode) */
-                else
-                {
-                    for(i = 0; i < sf.hdr.nchan; i++)
-                    {
-                        for(j = 0; j < sf.hdr.nsubband; j++)
-                        {
-                            for(k = 0; k < NUM_STOKES; k++)
-                            {
-                                accumulator[accumid]
-                                           [i*sf.hdr.nsubband*NUM_STOKES + j*NUM_STOKES + k] +=
-                                    f_payload[i*sf.hdr.nsubband*NUM_STOKES + j*NUM_STOKES + k];
-                            }
-                        }
-                    }
-                }
+                /* Add spectrum to appropriate vector accumulator.  Both are
+                 * laid out [chan][subband][stokes], so this is one pass over
+                 * the whole spectrum, split by channel across the team.
+                 */
+                vegas_accum_team_add(&team, accumid, payload_addr);
             }
             data_cols[accumid].stpspec = freq_heap->spectrum_cntr;
         }
@@ -694,7 +756,8 @@ void vegas_accum_thread(void *_args) {
         blkstats.n_pkt_drop += gp.num_pkts_dropped;
 
         
-        /* Done with current input block */
+        /* Done with current input block, once the team has read it */
+        vegas_accum_team_flush(&team);
         vegas_databuf_set_free(db_in, curblock_in);
         curblock_in = (curblock_in + 1) % db_in->n_block;
 
@@ -703,10 +766,12 @@ void vegas_accum_thread(void *_args) {
     }
 
     pthread_exit(NULL);
-    pthread_cleanup_pop(0); /* Closes set_exit_status */
+    pthread_cleanup_pop(0); /* Closes set_pipe_exit_status */
     pthread_cleanup_pop(0); /* Closes set_finished */
     pthread_cleanup_pop(0); /* Closes vegas_free_sdfits */
     pthread_cleanup_pop(0); /* Closes ? */
+    pthread_cleanup_pop(0); /* Closes vegas_accum_team_destroy */
+    pthread_cleanup_pop(0); /* Closes destroy_int64_accumulators */
     pthread_cleanup_pop(0); /* frees switching_state_machine */
     pthread_cleanup_pop(0); /* Closes destroy_accumulators */
     pthread_cleanup_pop(0); /* Closes vegas_status_detach */
@@ -751,7 +816,8 @@ void write_full_integration(struct vegas_databuf *db_out, int *cur_block_out,
                        struct vegas_databuf *db_in,  int  curblock_in, 
                        char *accum_dirty, float **accumulator, 
                        struct sdfits_data_columns* data_cols,
-                       struct sdfits *sdf, struct BlockStats *blkstat)
+                       struct sdfits *sdf, struct BlockStats *blkstat,
+                       const struct vegas_accum_team *team)
 {
     int i;
     struct databuf_index* index_out;
@@ -804,6 +870,7 @@ void write_full_integration(struct vegas_databuf *db_out, int *cur_block_out,
                 hdr_out = vegas_databuf_header(db_out, curblock_out);
                 memcpy(hdr_out, vegas_databuf_header(db_in, curblock_in),
                         VEGAS_STATUS_SIZE);
+                hputs(hdr_out, "ACCORDER", team->fits_order ? "FITS" : "CHAN");
 
                 /* Initialise the index in new output block */
                 index_out = (struct databuf_index*)vegas_databuf_index(db_out, curblock_out);
@@ -855,9 +922,15 @@ void write_full_integration(struct vegas_databuf *db_out, int *cur_block_out,
             }
             // END DEBUG
 #endif
-            /*Copy data array to disk buffer */
-            memcpy(vegas_databuf_data(db_out, curblock_out) + array_offset,
-                    accumulator[i], index_out->array_size);
+            /*Copy data array to disk buffer, converting exact sums to float */
+            if (team->accum64 != NULL)
+                vegas_accum_int64_to_float(
+                        (float *)(vegas_databuf_data(db_out, curblock_out) + array_offset),
+                        team->accum64[i], sdf->hdr.nchan, sdf->hdr.nsubband,
+                        team->fits_order);
+            else
+                memcpy(vegas_databuf_data(db_out, curblock_out) + array_offset,
+                        accumulator[i], index_out->array_size);
             
             /*Update SDFITS data_columns pointer to data array */
             ((struct sdfits_data_columns*)
@@ -0,0 +1,128 @@
+/* vegas_bswap.c
+ *
+ * Copy-and-byteswap kernels for 32 bit big-endian payloads, with
+ * runtime selection of the widest instruction set available.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <byteswap.h>
+#include <immintrin.h>
+
+#include "vegas_bswap.h"
+
+typedef void (*bswap32_copy_fn)(void *, const void *, size_t);
+
+static bswap32_copy_fn bswap32_kernel = NULL;
+static const char *bswap32_name = "none";
+
+void vegas_bswap32_copy_scalar(void *dst, const void *src, size_t nbytes)
+{
+    const uint8_t *in = (const uint8_t *)src;
+    uint8_t *out = (uint8_t *)dst;
+    size_t i, nwords = nbytes / sizeof(uint32_t);
+    uint32_t w;
+
+    // memcpy keeps this safe for unaligned packet payloads
+    for (i=0; i<nwords; ++i)
+    {
+        memcpy(&w, in + i*sizeof(w), sizeof(w));
+        w = bswap_32(w);
+        memcpy(out + i*sizeof(w), &w, sizeof(w));
+    }
+}
+
+__attribute__((target("ssse3")))
+void vegas_bswap32_copy_ssse3(void *dst, const void *src, size_t nbytes)
+{
+    const uint8_t *in = (const uint8_t *)src;
+    uint8_t *out = (uint8_t *)dst;
+    const __m128i mask = _mm_set_epi8(12, 13, 14, 15,  8,  9, 10, 11,
+                                       4,  5,  6,  7,  0,  1,  2,  3);
+    size_t i = 0;
+
+    // Four vectors per iteration to keep the load/store ports busy
+    for (; i + 64 <= nbytes; i += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(in + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(in + i + 48));
+        _mm_storeu_si128((__m128i *)(out + i),      _mm_shuffle_epi8(a, mask));
+        _mm_storeu_si128((__m128i *)(out + i + 16), _mm_shuffle_epi8(b, mask));
+        _mm_storeu_si128((__m128i *)(out + i + 32), _mm_shuffle_epi8(c, mask));
+        _mm_storeu_si128((__m128i *)(out + i + 48), _mm_shuffle_epi8(d, mask));
+    }
+    for (; i + 16 <= nbytes; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(in + i));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_shuffle_epi8(a, mask));
+    }
+    vegas_bswap32_copy_scalar(out + i, in + i, nbytes - i);
+}
+
+__attribute__((target("avx2")))
+void vegas_bswap32_copy_avx2(void *dst, const void *src, size_t nbytes)
+{
+    const uint8_t *in = (const uint8_t *)src;
+    uint8_t *out = (uint8_t *)dst;
+    // vpshufb works within each 128 bit lane, so the mask repeats
+    const __m256i mask = _mm256_set_epi8(12, 13, 14, 15,  8,  9, 10, 11,
+                                          4,  5,  6,  7,  0,  1,  2,  3,
+                                         12, 13, 14, 15,  8,  9, 10, 11,
+                                          4,  5,  6,  7,  0,  1,  2,  3);
+    size_t i = 0;
+
+    for (; i + 128 <= nbytes; i += 128)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(in + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(in + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(in + i + 96));
+        _mm256_storeu_si256((__m256i *)(out + i),      _mm256_shuffle_epi8(a, mask));
+        _mm256_storeu_si256((__m256i *)(out + i + 32), _mm256_shuffle_epi8(b, mask));
+        _mm256_storeu_si256((__m256i *)(out + i + 64), _mm256_shuffle_epi8(c, mask));
+        _mm256_storeu_si256((__m256i *)(out + i + 96), _mm256_shuffle_epi8(d, mask));
+    }
+    for (; i + 32 <= nbytes; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(in + i));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_shuffle_epi8(a, mask));
+    }
+    vegas_bswap32_copy_scalar(out + i, in + i, nbytes - i);
+}
+
+/// Pick the widest kernel supported by the cpu we are running on
+static void bswap32_select_kernel(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        bswap32_name = "avx2";
+        bswap32_kernel = vegas_bswap32_copy_avx2;
+    }
+    else if (__builtin_cpu_supports("ssse3"))
+    {
+        bswap32_name = "ssse3";
+        bswap32_kernel = vegas_bswap32_copy_ssse3;
+    }
+    else
+    {
+        bswap32_name = "scalar";
+        bswap32_kernel = vegas_bswap32_copy_scalar;
+    }
+}
+
+void vegas_bswap32_copy(void *dst, const void *src, size_t nbytes)
+{
+    // The selection is idempotent, so a race between threads is harmless
+    if (bswap32_kernel == NULL)
+        bswap32_select_kernel();
+    bswap32_kernel(dst, src, nbytes);
+}
+
+const char *vegas_bswap32_kernel_name(void)
+{
+    if (bswap32_kernel == NULL)
+        bswap32_select_kernel();
+    return bswap32_name;
+}
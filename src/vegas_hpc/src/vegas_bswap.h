@@ -0,0 +1,36 @@
+/** vegas_bswap.h
+ *
+ * Copy-and-byteswap kernels for the big-endian int32 HBW SPEAD payload.
+ * The fastest kernel the cpu supports (AVX2, SSSE3 or scalar) is selected
+ * the first time vegas_bswap32_copy() is called.
+ */
+#ifndef _VEGAS_BSWAP_H
+#define _VEGAS_BSWAP_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus /* C++ prototypes */
+extern "C" {
+#endif
+
+/** Copy nbytes from src to dst, byte swapping each 32 bit word.
+ * nbytes should be a multiple of 4; any trailing bytes are ignored.
+ * src and dst must either not overlap or be identical (in place swap).
+ */
+void vegas_bswap32_copy(void *dst, const void *src, size_t nbytes);
+
+/** The individual kernels, exposed for testing and benchmarking.
+ * Calling a SIMD kernel on a cpu without the instruction set is fatal.
+ */
+void vegas_bswap32_copy_scalar(void *dst, const void *src, size_t nbytes);
+void vegas_bswap32_copy_ssse3(void *dst, const void *src, size_t nbytes);
+void vegas_bswap32_copy_avx2(void *dst, const void *src, size_t nbytes);
+
+/** Return the name of the kernel used by vegas_bswap32_copy() */
+const char *vegas_bswap32_kernel_name(void);
+
+#ifdef __cplusplus /* C++ prototypes */
+}
+#endif
+
+#endif
@@ -5,6 +5,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
@@ -12,6 +13,7 @@
 #include <sys/sem.h>
 #include <errno.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "fitshead.h"
 #include "vegas_status.h"
@@ -19,8 +21,263 @@
 #include "vegas_error.h"
 
 
+#ifndef SHM_HUGE_SHIFT
+#define SHM_HUGE_SHIFT 26
+#endif
+
+/// shmget flags selecting huge pages of the given size
+static int hugetlb_flags(size_t page_size)
+{
+    int log2_size = 0;
+    while (((size_t)1 << log2_size) < page_size)
+        log2_size++;
+    return SHM_HUGETLB | (log2_size << SHM_HUGE_SHIFT);
+}
+
+/* Fan-out.  The consumers' semaphore set holds a token per consumer per
+ * block, set when the block is filled and taken when the consumer starts
+ * on it, followed by a lock for the consumer table.  The primary
+ * consumer is consumer 0.  A filled block's own semaphore counts the
+ * consumers that have yet to release it, so the producer's wait for it
+ * to be free is unchanged.
+ */
+
+/// A consumer's token for a block
+#define FANOUT_TOKEN(d, c, b) ((c) * (d)->n_block + (b))
+/// The lock, after the tokens
+#define FANOUT_LOCK(d) ((d)->max_consumer * (d)->n_block)
+
+static void fanout_lock_op(struct vegas_databuf *d, int op)
+{
+    struct sembuf sop;
+    sop.sem_num = FANOUT_LOCK(d);
+    sop.sem_op = op;
+    sop.sem_flg = SEM_UNDO;
+    while (semop(d->csemid, &sop, 1) == -1 && errno == EINTR)
+        ;
+}
+
+static void fanout_lock(struct vegas_databuf *d) { fanout_lock_op(d, -1); }
+static void fanout_unlock(struct vegas_databuf *d) { fanout_lock_op(d, 1); }
+
+/// Take a consumer's token for a block, without waiting.  Returns 1 if it
+/// had one.
+static int fanout_take_token(struct vegas_databuf *d, int consumer, int block_id)
+{
+    struct sembuf op;
+    op.sem_num = FANOUT_TOKEN(d, consumer, block_id);
+    op.sem_op = -1;
+    op.sem_flg = IPC_NOWAIT;
+    return semop(d->csemid, &op, 1) == 0;
+}
+
+/// Count one consumer off a block.  A block freed or cleared by force
+/// has nothing left to count off, so this never waits.
+static void fanout_count_off(struct vegas_databuf *d, int block_id)
+{
+    struct sembuf op;
+    op.sem_num = block_id;
+    op.sem_op = -1;
+    op.sem_flg = IPC_NOWAIT;
+    semop(d->semid, &op, 1);
+}
+
+/// Give up every block a consumer has been handed but not started on
+static void fanout_drain(struct vegas_databuf *d, int consumer)
+{
+    int b;
+    for (b=0; b<d->n_block; b++)
+        if (fanout_take_token(d, consumer, b))
+            fanout_count_off(d, b);
+}
+
+/// Take back a block from the lossy consumers that have not started on
+/// it, moving their cursors past it, so that they never hold the
+/// producer up.  One that has started keeps it until it is done.  The
+/// lock keeps a consumer freeing a block from moving its cursor meanwhile.
+static void fanout_reclaim(struct vegas_databuf *d, int block_id)
+{
+    struct vegas_databuf_consumer *c;
+    int i;
+
+    fanout_lock(d);
+    for (i=1; i<d->max_consumer; i++) {
+        c = &d->consumer[i];
+        if (c->active != 1 || !c->lossy)
+            continue;
+        if (fanout_take_token(d, i, block_id)) {
+            fanout_count_off(d, block_id);
+            c->nskipped++;
+            if (c->block == block_id)
+                c->block = (block_id + 1) % d->n_block;
+        }
+    }
+    fanout_unlock(d);
+}
+
+/// Hand a filled block to the primary and every registered consumer.  The
+/// block's count is set before the tokens, so that none can be counted
+/// off before it is set.  The lock keeps consumers from coming or going
+/// meanwhile; it is taken even with none registered, as one registering
+/// now would otherwise start on the next block without this one's token.
+static int fanout_set_filled(struct vegas_databuf *d, int block_id)
+{
+    struct sembuf op[VEGAS_DATABUF_MAX_CONSUMERS];
+    union semun arg;
+    int c, n = 0, rv;
+
+    fanout_lock(d);
+    for (c=0; c<d->max_consumer; c++) {
+        if (c > 0 && d->consumer[c].active != 1)
+            continue;
+        op[n].sem_num = FANOUT_TOKEN(d, c, block_id);
+        op[n].sem_op = 1;
+        op[n].sem_flg = 0;
+        n++;
+    }
+    arg.val = n;
+    rv = semctl(d->semid, block_id, SETVAL, arg);
+    if (rv!=-1)
+        rv = semop(d->csemid, op, n);
+    d->fill_block = (block_id + 1) % d->n_block;
+    fanout_unlock(d);
+    if (rv==-1) {
+        vegas_error("vegas_databuf_set_filled", "semop error");
+        return(VEGAS_ERR_SYS);
+    }
+    return(0);
+}
+
+/// Clear every token and send the cursors back to block 0.  The lock is
+/// left as it is.
+static void fanout_reset(struct vegas_databuf *d)
+{
+    int nsem = d->max_consumer * d->n_block + 1;
+    union semun arg;
+    int c;
+
+    arg.array = (unsigned short *)malloc(sizeof(unsigned short)*nsem);
+    if (arg.array == NULL)
+        return;
+    if (semctl(d->csemid, 0, GETALL, arg) != -1) {
+        memset(arg.array, 0, sizeof(unsigned short)*(nsem - 1));
+        semctl(d->csemid, 0, SETALL, arg);
+    }
+    free(arg.array);
+    d->fill_block = 0;
+    for (c=0; c<d->max_consumer; c++)
+        d->consumer[c].block = 0;
+}
+
+/* Telemetry.  The producer writes the fill side, the primary consumer
+ * the take and free sides; only the occupancy and its histogram are
+ * shared, and those are updated atomically.  A clock read is a few tens
+ * of nanoseconds, against milliseconds per block.
+ */
+
+static double telemetry_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/// Histogram the occupancy in tenths of the ring, rounded up, so that
+/// bin 0 is empty and the last is full
+static void telemetry_sample(struct vegas_databuf *d, int occupancy)
+{
+    int bin = 0;
+    if (occupancy > 0 && d->n_block > 0)
+        bin = ((VEGAS_DATABUF_OCC_BINS - 1) * occupancy + d->n_block - 1) / d->n_block;
+    if (bin >= VEGAS_DATABUF_OCC_BINS)
+        bin = VEGAS_DATABUF_OCC_BINS - 1;
+    __sync_fetch_and_add(&d->telemetry.occupancy_hist[bin], 1ULL);
+}
+
+static void telemetry_fill(struct vegas_databuf *d, int block_id)
+{
+    struct vegas_databuf_telemetry *t = &d->telemetry;
+    if (!t->enabled)
+        return;
+    if (block_id < VEGAS_DATABUF_TELEM_BLOCKS)
+        t->fill_time[block_id] = telemetry_now();
+    t->nfill++;
+    telemetry_sample(d, __sync_add_and_fetch(&t->occupancy, 1));
+}
+
+/// The primary has a filled block; only its first wait for each fill counts
+static void telemetry_take(struct vegas_databuf *d, int block_id, double now)
+{
+    struct vegas_databuf_telemetry *t = &d->telemetry;
+    if (block_id >= VEGAS_DATABUF_TELEM_BLOCKS ||
+        t->take_time[block_id] >= t->fill_time[block_id])
+        return;
+    t->take_time[block_id] = now;
+    t->queue_time += now - t->fill_time[block_id];
+}
+
+/// The primary is done with a block.  Blocks freed without having been
+/// filled, as at startup, are not counted.
+static void telemetry_free(struct vegas_databuf *d, int block_id)
+{
+    struct vegas_databuf_telemetry *t = &d->telemetry;
+    double now, dwell;
+    if (!t->enabled)
+        return;
+    now = telemetry_now();
+    if (block_id < VEGAS_DATABUF_TELEM_BLOCKS) {
+        if (t->free_time[block_id] >= t->fill_time[block_id])
+            return;
+        if (t->take_time[block_id] >= t->fill_time[block_id])
+            t->hold_time += now - t->take_time[block_id];
+        dwell = now - t->fill_time[block_id];
+        if (dwell > t->max_dwell)
+            t->max_dwell = dwell;
+        t->free_time[block_id] = now;
+    } else if (t->occupancy <= 0) {
+        return;
+    }
+    t->nfree++;
+    telemetry_sample(d, __sync_sub_and_fetch(&t->occupancy, 1));
+}
+
+void vegas_databuf_stats_reset(struct vegas_databuf *d) {
+    struct vegas_databuf_telemetry *t = &d->telemetry;
+    if (!t->enabled)
+        return;
+    /* Blocks in flight keep their times, so that they are counted out */
+    memset(&t->nfill, 0, offsetof(struct vegas_databuf_telemetry, fill_time) -
+           offsetof(struct vegas_databuf_telemetry, nfill));
+    t->reset_time = telemetry_now();
+}
+
+int vegas_databuf_stats(struct vegas_databuf *d, struct vegas_databuf_stats *s) {
+    struct vegas_databuf_telemetry *t = &d->telemetry;
+    if (!t->enabled)
+        return(VEGAS_ERR_PARAM);
+    s->time = telemetry_now();
+    s->reset_time = t->reset_time;
+    s->n_block = d->n_block;
+    s->block_size = d->block_size;
+    s->occupancy = t->occupancy;
+    s->nfill = t->nfill;
+    s->nfree = t->nfree;
+    s->producer_wait = t->producer_wait;
+    s->consumer_wait = t->consumer_wait;
+    s->queue_time = t->queue_time;
+    s->hold_time = t->hold_time;
+    s->max_dwell = t->max_dwell;
+    memcpy(s->occupancy_hist, t->occupancy_hist, sizeof(s->occupancy_hist));
+    return(VEGAS_OK);
+}
+
 struct vegas_databuf *vegas_databuf_create(int n_block, size_t block_size,
         int databuf_id, int buf_type) {
+    return vegas_databuf_create_paged(n_block, block_size, databuf_id, buf_type, 0);
+}
+
+struct vegas_databuf *vegas_databuf_create_paged(int n_block, size_t block_size,
+        int databuf_id, int buf_type, size_t page_size) {
 
     /* Calc databuf size */
     const size_t header_size = VEGAS_STATUS_SIZE;
@@ -29,10 +286,28 @@ struct vegas_databuf *vegas_databuf_create(int n_block, size_t block_size,
     size_t index_size = sizeof(struct databuf_index);
     size_t databuf_size = (block_size+header_size+index_size) * n_block + struct_size;
 
-    /* Get shared memory block, error if it already exists */
-    int shmid;
-    shmid = shmget(VEGAS_DATABUF_KEY + databuf_id - 1, 
-            databuf_size, 0666 | IPC_CREAT | IPC_EXCL);
+    /* Get shared memory block, error if it already exists.
+     * A huge page segment must be a whole number of pages.
+     */
+    int shmid = -1;
+    if (page_size > (size_t)getpagesize()) {
+        size_t huge_size = (databuf_size + page_size - 1) / page_size * page_size;
+        shmid = shmget(VEGAS_DATABUF_KEY + databuf_id - 1, huge_size,
+                0666 | IPC_CREAT | IPC_EXCL | hugetlb_flags(page_size));
+        if (shmid!=-1) {
+            databuf_size = huge_size;
+        } else if (errno!=EEXIST) {
+            char msg[256];
+            sprintf(msg, "No %zd byte huge pages (%s), using normal pages",
+                    page_size, strerror(errno));
+            vegas_warn("vegas_databuf_create", msg);
+        }
+    }
+    if (shmid==-1) {
+        page_size = getpagesize();
+        shmid = shmget(VEGAS_DATABUF_KEY + databuf_id - 1, 
+                databuf_size, 0666 | IPC_CREAT | IPC_EXCL);
+    }
     if (shmid==-1) {
         vegas_error("vegas_databuf_create", "shmget error");
         return(NULL);
@@ -70,8 +345,11 @@ struct vegas_databuf *vegas_databuf_create(int n_block, size_t block_size,
     d->block_size = block_size;
     d->header_size = header_size;
     d->index_size = index_size;
+    d->page_size = page_size;
     sprintf(d->data_type, "unknown");
     d->buf_type = buf_type;
+    d->telemetry.enabled = 1;
+    d->telemetry.reset_time = telemetry_now();
 
     for (i=0; i<n_block; i++) { 
         memcpy(vegas_databuf_header(d,i), end_key, 80); 
@@ -107,6 +385,22 @@ struct vegas_databuf *vegas_databuf_create(int n_block, size_t block_size,
     rv = semctl(d->semid, 0, SETALL, arg);
     free(arg.array);
 
+    /* The consumers' semaphores, with the lock free.  Disk buffers can be
+       resized, which would move the tokens, so they do not fan out. */
+    if (buf_type != DISK_INPUT_BUF) {
+        int nsem = VEGAS_DATABUF_MAX_CONSUMERS * n_block + 1;
+        d->csemid = semget(IPC_PRIVATE, nsem, 0666 | IPC_CREAT);
+        if (d->csemid==-1) {
+            vegas_warn("vegas_databuf_create", "semget error, the buffer cannot fan out");
+        } else {
+            d->max_consumer = VEGAS_DATABUF_MAX_CONSUMERS;
+            arg.array = (unsigned short *)calloc(nsem, sizeof(unsigned short));
+            arg.array[nsem - 1] = 1;
+            semctl(d->csemid, 0, SETALL, arg);
+            free(arg.array);
+        }
+    }
+
     return(d);
 }
 
@@ -146,6 +440,10 @@ int vegas_databuf_detach(struct vegas_databuf *d) {
     return(VEGAS_OK);
 }
 
+size_t vegas_databuf_page_size(struct vegas_databuf *d) {
+    return d->page_size ? d->page_size : (size_t)getpagesize();
+}
+
 void vegas_databuf_clear(struct vegas_databuf *d) {
 
     /* Zero out semaphores */
@@ -163,6 +461,16 @@ void vegas_databuf_clear(struct vegas_databuf *d) {
 
     semctl(d->semid, 0, SETALL, arg);
     free(arg.array);
+    if (d->max_consumer > 0)
+        fanout_reset(d);
+    /* Nothing is in flight any more */
+    if (d->telemetry.enabled) {
+        d->telemetry.occupancy = 0;
+        memset(d->telemetry.fill_time, 0, sizeof(d->telemetry.fill_time));
+        memset(d->telemetry.take_time, 0, sizeof(d->telemetry.take_time));
+        memset(d->telemetry.free_time, 0, sizeof(d->telemetry.free_time));
+    }
+    vegas_databuf_stats_reset(d);
 
     /* Clear all headers */
     int i;
@@ -262,6 +570,9 @@ int vegas_databuf_total_status(struct vegas_databuf *d) {
 int vegas_databuf_wait_free(struct vegas_databuf *d, int block_id) {
     int rv;
     struct sembuf op;
+    double t0 = d->telemetry.enabled ? telemetry_now() : 0.0;
+    if (d->max_consumer > 0)
+        fanout_reclaim(d, block_id);
     op.sem_num = block_id;
     op.sem_op = 0;
     op.sem_flg = 0;
@@ -269,6 +580,8 @@ int vegas_databuf_wait_free(struct vegas_databuf *d, int block_id) {
     timeout.tv_sec = 0;
     timeout.tv_nsec = 250000000;
     rv = semtimedop(d->semid, &op, 1, &timeout);
+    if (d->telemetry.enabled)
+        d->telemetry.producer_wait += telemetry_now() - t0;
     if (rv==-1) { 
         if (errno==EAGAIN) return(VEGAS_TIMEOUT);
         if (errno==EINTR) return(VEGAS_ERR_SYS);
@@ -288,15 +601,27 @@ int vegas_databuf_wait_free(struct vegas_databuf *d, int block_id) {
      */
 int vegas_databuf_wait_filled(struct vegas_databuf *d, int block_id) {
     int rv;
+    int semid = d->semid;
     struct sembuf op[2];
+    double t0 = d->telemetry.enabled ? telemetry_now() : 0.0, t1 = 0.0;
     op[0].sem_num = op[1].sem_num = block_id;
+    /* With fan-out the block's semaphore counts all its consumers, so the
+       primary waits for its own token */
+    if (d->max_consumer > 0) {
+        semid = d->csemid;
+        op[0].sem_num = op[1].sem_num = FANOUT_TOKEN(d, 0, block_id);
+    }
     op[0].sem_flg = op[1].sem_flg = 0;
     op[0].sem_op = -1;
     op[1].sem_op = 1;
     struct timespec timeout;
     timeout.tv_sec = 0;
     timeout.tv_nsec = 250000000;
-    rv = semtimedop(d->semid, op, 2, &timeout);
+    rv = semtimedop(semid, op, 2, &timeout);
+    if (d->telemetry.enabled) {
+        t1 = telemetry_now();
+        d->telemetry.consumer_wait += t1 - t0;
+    }
     if (rv==-1) { 
         if (errno==EAGAIN) return(VEGAS_TIMEOUT);
         // Don't complain on a signal interruption
@@ -305,6 +630,8 @@ int vegas_databuf_wait_filled(struct vegas_databuf *d, int block_id) {
         perror("semop");
         return(VEGAS_ERR_SYS);
     }
+    if (d->telemetry.enabled)
+        telemetry_take(d, block_id, t1);
     return(0);
 }
 
@@ -315,6 +642,13 @@ int vegas_databuf_wait_filled(struct vegas_databuf *d, int block_id) {
 int vegas_databuf_set_free(struct vegas_databuf *d, int block_id) {
     int rv;
     union semun arg;
+    telemetry_free(d, block_id);
+    /* With fan-out, count the primary off, if it still holds the block */
+    if (d->max_consumer > 0) {
+        if (fanout_take_token(d, 0, block_id))
+            fanout_count_off(d, block_id);
+        return(0);
+    }
     arg.val = 0;
     rv = semctl(d->semid, block_id, SETVAL, arg);
     if (rv==-1) { 
@@ -331,6 +665,16 @@ int vegas_databuf_set_free(struct vegas_databuf *d, int block_id) {
 int vegas_databuf_set_filled(struct vegas_databuf *d, int block_id) {
     int rv;
     union semun arg;
+    if (d->max_consumer > 0) {
+        /* Filling it again would hand every consumer a second token */
+        if (vegas_databuf_block_status(d, block_id) != 0) {
+            vegas_error("vegas_databuf_set_filled", "block is already filled");
+            return(VEGAS_ERR_PARAM);
+        }
+        telemetry_fill(d, block_id);
+        return fanout_set_filled(d, block_id);
+    }
+    telemetry_fill(d, block_id);
     arg.val = 1;
     rv = semctl(d->semid, block_id, SETVAL, arg);
     if (rv==-1) { 
@@ -339,3 +683,105 @@ int vegas_databuf_set_filled(struct vegas_databuf *d, int block_id) {
     }
     return(0);
 }
+
+/// The registered consumer with the given id, or NULL
+static struct vegas_databuf_consumer *fanout_consumer(struct vegas_databuf *d,
+        int consumer, const char *name) {
+    if (consumer<1 || consumer>=d->max_consumer || d->consumer[consumer].active!=1) {
+        vegas_error(name, "no such consumer");
+        return(NULL);
+    }
+    return(&d->consumer[consumer]);
+}
+
+int vegas_databuf_add_consumer(struct vegas_databuf *d, int lossy) {
+    struct vegas_databuf_consumer *c;
+    int i, id = VEGAS_ERR_GEN;
+
+    if (d->max_consumer <= 0) {
+        vegas_error("vegas_databuf_add_consumer", "databuf cannot fan out");
+        return(VEGAS_ERR_PARAM);
+    }
+    fanout_lock(d);
+    for (i=1; i<d->max_consumer; i++) {
+        c = &d->consumer[i];
+        if (c->active)
+            continue;
+        /* Anything left from a consumer that died with the slot */
+        fanout_drain(d, i);
+        c->lossy = lossy != 0;
+        c->block = d->fill_block;
+        c->pid = getpid();
+        c->nread = 0;
+        c->nskipped = 0;
+        __sync_synchronize();
+        c->active = 1;
+        id = i;
+        break;
+    }
+    fanout_unlock(d);
+    if (id < 0)
+        vegas_error("vegas_databuf_add_consumer", "no room for another consumer");
+    return(id);
+}
+
+/** The consumer must have released any block it started on. */
+int vegas_databuf_remove_consumer(struct vegas_databuf *d, int consumer) {
+    struct vegas_databuf_consumer *c;
+
+    c = fanout_consumer(d, consumer, "vegas_databuf_remove_consumer");
+    if (c==NULL)
+        return(VEGAS_ERR_PARAM);
+    fanout_lock(d);
+    c->active = 0;
+    fanout_drain(d, consumer);
+    fanout_unlock(d);
+    return(VEGAS_OK);
+}
+
+int vegas_databuf_consumer_wait_filled(struct vegas_databuf *d, int consumer,
+        int *block_id) {
+    struct vegas_databuf_consumer *c;
+    struct sembuf op;
+    struct timespec timeout;
+    int rv, b;
+
+    c = fanout_consumer(d, consumer, "vegas_databuf_consumer_wait_filled");
+    if (c==NULL)
+        return(VEGAS_ERR_PARAM);
+    /* Taking the token marks the block as started on, so that the
+       producer cannot take it back from a lossy consumer */
+    b = c->block;
+    op.sem_num = FANOUT_TOKEN(d, consumer, b);
+    op.sem_op = -1;
+    op.sem_flg = 0;
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = 250000000;
+    rv = semtimedop(d->csemid, &op, 1, &timeout);
+    if (rv==-1) {
+        if (errno==EAGAIN) return(VEGAS_TIMEOUT);
+        if (errno==EINTR) return(VEGAS_ERR_SYS);
+        vegas_error("vegas_databuf_consumer_wait_filled", "semop error");
+        perror("semop");
+        return(VEGAS_ERR_SYS);
+    }
+    *block_id = b;
+    return(0);
+}
+
+int vegas_databuf_consumer_set_free(struct vegas_databuf *d, int consumer,
+        int block_id) {
+    struct vegas_databuf_consumer *c;
+
+    c = fanout_consumer(d, consumer, "vegas_databuf_consumer_set_free");
+    if (c==NULL)
+        return(VEGAS_ERR_PARAM);
+    /* Move on before the block can be filled again, under the lock, as
+       the producer may be moving the cursor on past a block it took back */
+    fanout_lock(d);
+    c->block = (block_id + 1) % d->n_block;
+    c->nread++;
+    fanout_count_off(d, block_id);
+    fanout_unlock(d);
+    return(0);
+}
@@ -10,6 +10,68 @@
 #include <sys/ipc.h>
 #include <sys/sem.h>
 
+/** Readers a databuf can fan its blocks out to, including the primary
+ * consumer, which uses the plain wait_filled/set_free calls.
+ */
+#define VEGAS_DATABUF_MAX_CONSUMERS 8
+
+/** A reader registered with vegas_databuf_add_consumer() */
+struct vegas_databuf_consumer {
+    int active;         /**< 1 while registered, -1 while being set up */
+    int lossy;          /**< Skipped, rather than waited for, when it falls behind */
+    int block;          /**< Cursor: the block it reads next */
+    int pid;            /**< Process that registered it */
+    unsigned long long nread;    /**< Blocks read */
+    unsigned long long nskipped; /**< Blocks the producer took back unread */
+};
+
+/** Blocks whose fill, take and free times are kept.  Enough for the
+ *  pipeline rings while keeping the struct within its 8192 bytes. */
+#define VEGAS_DATABUF_TELEM_BLOCKS 256
+/** Occupancy histogram bins: empty, up to 10% full, ... up to full */
+#define VEGAS_DATABUF_OCC_BINS 11
+
+/** What the databuf calls record about a ring as it runs.  The producer
+ * and the primary consumer each write their own fields, so no locking is
+ * needed.  Times are CLOCK_MONOTONIC seconds.
+ */
+struct vegas_databuf_telemetry {
+    int enabled;        /**< 0 in buffers created before this was kept */
+    int occupancy;      /**< Blocks filled and not yet freed by the primary */
+    double reset_time;  /**< When the counters were last reset */
+    unsigned long long nfill;    /**< Blocks filled */
+    unsigned long long nfree;    /**< Blocks freed by the primary */
+    double producer_wait;        /**< Seconds the producer waited for free blocks */
+    double consumer_wait;        /**< Seconds the primary waited for filled blocks */
+    double queue_time;           /**< Seconds blocks waited between fill and take */
+    double hold_time;            /**< Seconds the primary held blocks */
+    double max_dwell;            /**< Longest a block was filled for */
+    /** Occupancy, sampled at every fill and free */
+    unsigned long long occupancy_hist[VEGAS_DATABUF_OCC_BINS];
+    double fill_time[VEGAS_DATABUF_TELEM_BLOCKS]; /**< Last fill of each block */
+    double take_time[VEGAS_DATABUF_TELEM_BLOCKS]; /**< Last take by the primary */
+    double free_time[VEGAS_DATABUF_TELEM_BLOCKS]; /**< Last free by the primary */
+};
+
+/** A snapshot of a ring's telemetry, from vegas_databuf_stats().  Rates
+ * over an interval come from the difference of two snapshots.
+ */
+struct vegas_databuf_stats {
+    double time;        /**< When the snapshot was taken */
+    double reset_time;
+    int n_block;
+    size_t block_size;
+    int occupancy;
+    unsigned long long nfill;
+    unsigned long long nfree;
+    double producer_wait;
+    double consumer_wait;
+    double queue_time;
+    double hold_time;
+    double max_dwell;
+    unsigned long long occupancy_hist[VEGAS_DATABUF_OCC_BINS];
+};
+
 struct vegas_databuf {
     char data_type[64]; /**< Type of data in buffer */
     unsigned int buf_type;  /**< GPU_INPUT_BUF or CPU_INPUT_BUF */
@@ -21,6 +83,12 @@ struct vegas_databuf {
     int shmid;          /**< ID of this shared mem segment */
     int semid;          /**< ID of locking semaphore set */
     int n_block;        /**< Number of data blocks in buffer */
+    size_t page_size;   /**< Page size backing the segment (bytes), 0 if created before this was recorded */
+    int max_consumer;   /**< Consumers the buffer can fan out to, 0 if it cannot */
+    int csemid;         /**< ID of the consumers' semaphore set, if max_consumer > 0 */
+    int fill_block;     /**< Block the producer fills next, where new consumers start */
+    struct vegas_databuf_consumer consumer[VEGAS_DATABUF_MAX_CONSUMERS];
+    struct vegas_databuf_telemetry telemetry;
 };
 
 #define VEGAS_DATABUF_KEY 0x00C62C70
@@ -46,7 +114,8 @@ union semun {
 struct cpu_gpu_buf_index
 {
     unsigned int heap_cntr;
-    unsigned int heap_valid;
+    unsigned short heap_valid;      ///< Non-zero if every packet of the heap arrived
+    unsigned short heap_pkts_lost;  ///< Number of packets of the heap that were lost
     double heap_rcvd_mjd;
 };
 
@@ -95,6 +164,15 @@ struct vegas_databuf *vegas_databuf_create(int n_block, size_t block_size,
 #else
 struct vegas_databuf *vegas_databuf_create(int n_block, size_t block_size,
         int databuf_id, int buf_type);
+
+/** As vegas_databuf_create(), but backs the segment with huge pages
+ * of the given size (2MB or 1GB) to cut TLB misses on the data path.
+ * If the huge pages are not available the segment is created with
+ * normal pages, with a warning.  page_size 0 means normal pages.
+ * Attaching needs nothing special.
+ */
+struct vegas_databuf *vegas_databuf_create_paged(int n_block, size_t block_size,
+        int databuf_id, int buf_type, size_t page_size);
 void vegas_conf_databuf_size(struct vegas_databuf *d, size_t new_block_size);
 #endif
 
@@ -106,6 +184,9 @@ struct vegas_databuf *vegas_databuf_attach(int databuf_id);
 /** Detach from shared mem segment */
 int vegas_databuf_detach(struct vegas_databuf *d);
 
+/** Page size backing the segment, in bytes */
+size_t vegas_databuf_page_size(struct vegas_databuf *d);
+
 /** Clear out either the whole databuf (set all sems to 0, 
  * clear all header blocks) or a single FITS-style
  * header block.
@@ -139,6 +220,41 @@ int vegas_databuf_set_filled(struct vegas_databuf *d, int block_id);
 int vegas_databuf_wait_free(struct vegas_databuf *d, int block_id);
 int vegas_databuf_set_free(struct vegas_databuf *d, int block_id);
 
+/** Fan-out.  Besides its primary consumer, which uses the calls above,
+ * a databuf can hand each block to up to VEGAS_DATABUF_MAX_CONSUMERS-1
+ * more readers, without copying it.  Each has its own cursor, and a
+ * block is free for the producer only when every reader has released
+ * it.  A lossless reader holds the producer up as the primary does; a
+ * lossy one, such as a monitor, has the blocks it has not started on
+ * taken back when the producer comes round to them again.
+ *
+ * vegas_databuf_add_consumer() returns the new reader's id, or an error
+ * if the buffer is full or cannot fan out (disk buffers, and buffers
+ * created before fan-out existed, cannot).  The reader starts at the
+ * block the producer fills next.
+ */
+int vegas_databuf_add_consumer(struct vegas_databuf *d, int lossy);
+int vegas_databuf_remove_consumer(struct vegas_databuf *d, int consumer);
+
+/** Wait for the block at a reader's cursor to be filled, and store its
+ * id in *block_id.  Returns VEGAS_TIMEOUT after 250ms, as
+ * vegas_databuf_wait_filled() does.  Every block waited for must be
+ * released with vegas_databuf_consumer_set_free(), which moves the
+ * cursor on.
+ */
+int vegas_databuf_consumer_wait_filled(struct vegas_databuf *d, int consumer,
+        int *block_id);
+int vegas_databuf_consumer_set_free(struct vegas_databuf *d, int consumer,
+        int block_id);
+
+/** Take a snapshot of a ring's telemetry.  Returns VEGAS_ERR_PARAM for
+ * a buffer created before telemetry was kept.
+ */
+int vegas_databuf_stats(struct vegas_databuf *d, struct vegas_databuf_stats *s);
+
+/** Zero a ring's telemetry counters.  vegas_databuf_clear() does too. */
+void vegas_databuf_stats_reset(struct vegas_databuf *d);
+
 #ifdef __cplusplus /* C++ prototypes */
 }
 #endif
@@ -126,6 +126,7 @@ void write_fake_heap_to_block(struct fake_datablock_stats *d, int heap_cntr)
     index->heap_size = d->heap_size;
     index->cpu_gpu_buf[block_heap_idx].heap_cntr = heap_cntr;
     index->cpu_gpu_buf[block_heap_idx].heap_valid = 1;
+    index->cpu_gpu_buf[block_heap_idx].heap_pkts_lost = 0;
 
     //Create speed_heap at correct location in block
     struct freq_spead_heap* fake_heap;
@@ -213,9 +214,7 @@ void *vegas_fake_net_thread(void *_args) {
     struct sdfits pf;
 #endif
     char status_buf[VEGAS_STATUS_SIZE];
-    vegas_status_lock_safe(&st);
-    memcpy(status_buf, st.buf, VEGAS_STATUS_SIZE);
-    vegas_status_unlock_safe(&st);
+    vegas_status_snapshot(&st, status_buf);
     vegas_read_obs_params(status_buf, &gp, &pf);
 #if FITS_TYPE == PSRFITS
     pthread_cleanup_push((void *)vegas_free_psrfits, &pf);
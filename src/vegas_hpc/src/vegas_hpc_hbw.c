@@ -18,6 +18,7 @@
 #include "vegas_status.h"
 #include "vegas_databuf.h"
 #include "vegas_params.h"
+#include "vegas_stats.h"
 #include "vegas_thread_main.h"
 #include "vegas_defines.h"
 #include "fitshead.h"
@@ -68,14 +69,24 @@ int main(int argc, char *argv[]) {
     hputs(stat.buf, "BW_MODE", "high");
     hputs(stat.buf, "SWVER", SWVER);
 
+    /* Publish the thread statistics */
+    vegas_stat_flusher_start(&stat, VEGAS_STAT_FLUSH_INTERVAL);
+
+    /* Huge pages for the data buffers, if asked for (DBHUGEPG, MB) */
+    int huge_page_mb = 0;
+    vegas_status_lock(&stat);
+    hgeti4(stat.buf, "DBHUGEPG", &huge_page_mb);
+    vegas_status_unlock(&stat);
+    size_t page_size = (size_t)huge_page_mb << 20;
+
     /* Init first shared data buffer */
     struct vegas_databuf *cpu_input_dbuf=NULL;
     cpu_input_dbuf = vegas_databuf_attach(net_args.output_buffer);
 
     /* If attach fails, first try to create the databuf */
     if (cpu_input_dbuf==NULL) 
-        cpu_input_dbuf = vegas_databuf_create(24, 32*1024*1024,
-                            net_args.output_buffer, CPU_INPUT_BUF);
+        cpu_input_dbuf = vegas_databuf_create_paged(24, 32*1024*1024,
+                            net_args.output_buffer, CPU_INPUT_BUF, page_size);
 
     /* If that also fails, exit */
     if (cpu_input_dbuf==NULL) {
@@ -91,8 +102,8 @@ int main(int argc, char *argv[]) {
 
     /* If attach fails, first try to create the databuf */
     if (disk_input_dbuf==NULL) 
-        disk_input_dbuf = vegas_databuf_create(16, 16*1024*1024,
-                            accum_args.output_buffer, DISK_INPUT_BUF);
+        disk_input_dbuf = vegas_databuf_create_paged(16, 16*1024*1024,
+                            accum_args.output_buffer, DISK_INPUT_BUF, page_size);
 
     /* If that also fails, exit */
     if (disk_input_dbuf==NULL) {
@@ -103,8 +114,10 @@ int main(int argc, char *argv[]) {
     /* Resize the blocks in the disk input buffer, based on the exposure parameter */
     struct vegas_params vegas_p;
     struct sdfits sf;
+    vegas_status_lock(&stat);
     vegas_read_obs_params(stat.buf, &vegas_p, &sf);
     vegas_read_subint_params(stat.buf, &vegas_p, &sf);
+    vegas_status_unlock(&stat);
 
     long long int num_exp_per_blk = (int)(ceil(DISK_WRITE_INTERVAL / sf.data_columns.exposure));
     long long int disk_block_size = num_exp_per_blk * (sf.hdr.nchan * sf.hdr.nsubband * 4 * 4);
@@ -112,6 +125,12 @@ int main(int argc, char *argv[]) {
 
     vegas_conf_databuf_size(disk_input_dbuf, disk_block_size);
     vegas_databuf_clear(disk_input_dbuf);
+
+    /* Record the page size actually backing each buffer */
+    vegas_status_lock(&stat);
+    hputi8(stat.buf, "DBPGSZ2", vegas_databuf_page_size(cpu_input_dbuf));
+    hputi8(stat.buf, "DBPGSZ3", vegas_databuf_page_size(disk_input_dbuf));
+    vegas_status_unlock(&stat);
  
     signal(SIGINT, cc);
 
@@ -192,6 +211,8 @@ int main(int argc, char *argv[]) {
     printf("Joined disk thread\n"); fflush(stdout);
 #endif
 
+    vegas_stat_flusher_stop();
+
     vegas_thread_args_destroy(&net_args);
     vegas_thread_args_destroy(&accum_args);
     vegas_thread_args_destroy(&disk_args);
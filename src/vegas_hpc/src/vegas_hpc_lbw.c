@@ -18,6 +18,7 @@
 #include "vegas_status.h"
 #include "vegas_databuf.h"
 #include "vegas_params.h"
+#include "vegas_stats.h"
 #include "vegas_thread_main.h"
 #include "vegas_defines.h"
 #include "fitshead.h"
@@ -73,6 +74,9 @@ int main(int argc, char *argv[]) {
     hputs(stat.buf, "BW_MODE", "low");
     hputs(stat.buf, "SWVER", SWVER);
 
+    /* Publish the thread statistics */
+    vegas_stat_flusher_start(&stat, VEGAS_STAT_FLUSH_INTERVAL);
+
     /* Init first shared data buffer */
     struct vegas_databuf *gpu_input_dbuf=NULL;
     gpu_input_dbuf = vegas_databuf_attach(pfb_args.input_buffer);
@@ -226,6 +230,8 @@ int main(int argc, char *argv[]) {
     pthread_join(disk_thread_id,NULL);
     printf("Joined disk thread\n"); fflush(stdout);
 #endif
+    vegas_stat_flusher_stop();
+
     vegas_thread_args_destroy(&net_args);
     vegas_thread_args_destroy(&pfb_args);
     vegas_thread_args_destroy(&accum_args);
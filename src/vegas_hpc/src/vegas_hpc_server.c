@@ -25,7 +25,9 @@
 #include "vegas_status.h"
 #include "vegas_databuf.h"
 #include "vegas_params.h"
+#include "vegas_stats.h"
 #include "pfb_gpu.h"
+#include "vegas_pfb_coeff.h"
 
 #include "vegas_thread_main.h"
 
@@ -113,6 +115,20 @@ struct KeywordValues keywords[] =
 /// For the accumulator case, the manager always looks in buffer 3 for accumulator output
 #define ACCUM_BUFFER (3)
 
+/// Each HBW net pipeline has its own net and accumulator buffers: the
+/// first 2 and 3, the next 4 and 5, and so on.  An external writer finds
+/// a pipeline's accumulator output through its ACCBUFn keyword.
+#define HBW_PIPE_NET_BUFFER(pipe) (HBW_NET_BUFFER + 2*(pipe))
+#define HBW_PIPE_ACCUM_BUFFER(pipe) (ACCUM_BUFFER + 2*(pipe))
+
+/// Threads of each HBW pipeline: net, accum and, unless an external
+/// program writes the data, disk
+#if defined(EXT_DISK)
+#define HBW_PIPE_NTHREAD 2
+#else
+#define HBW_PIPE_NTHREAD 3
+#endif
+
 /** Resize the blocks in the disk input buffer, based on the exposure parameter */
 void configure_accumulator_buffer_size(struct vegas_status *stat, struct vegas_databuf *dbuf_acc)
 {
@@ -156,6 +172,80 @@ void init_hbw_mode(struct vegas_thread_args *args, int *nthread)
 #endif
 }
 
+/** Number of HBW net pipelines from NETPIPES, default 1 */
+int read_net_pipes(struct vegas_status *stat)
+{
+    int npipe = 1;
+    vegas_status_lock(stat);
+    hgeti4(stat->buf, "NETPIPES", &npipe);
+    vegas_status_unlock(stat);
+    if (npipe < 1)
+        npipe = 1;
+    if (npipe > VEGAS_MAX_NET_PIPES)
+    {
+        fprintf(stderr, "NETPIPES limited to %d\n", VEGAS_MAX_NET_PIPES);
+        npipe = VEGAS_MAX_NET_PIPES;
+    }
+    return npipe;
+}
+
+/** Attach to and clear one of a pipeline's databufs, resizing it for
+ * the accumulator output if asked */
+int clear_pipe_buffer(struct vegas_status *stat, int id, int pipe, int resize)
+{
+    struct vegas_databuf *db = vegas_databuf_attach(id);
+    if (db==NULL)
+    {
+        fprintf(stderr, "Error connecting to vegas_databuf %d (net pipeline %d)\n",
+                id, pipe);
+        return VEGAS_ERR_SYS;
+    }
+    if (resize)
+        configure_accumulator_buffer_size(stat, db);
+    vegas_databuf_clear(db);
+    vegas_databuf_detach(db);
+    return VEGAS_OK;
+}
+
+/** Add the threads of each HBW pipeline after the first, as
+ * init_hbw_mode() does for the first: a net thread listening on its own
+ * DATAPORTn, an accumulator, and a disk thread that writes files of its
+ * own.  A pipeline whose databufs are missing is left out, and so are
+ * those after it.  Returns the number of pipelines, the first included.
+ */
+int init_hbw_pipes(struct vegas_thread_args *args, int *nthread, int npipe,
+                   struct vegas_status *stat, int resize)
+{
+    char key[9];
+    int pipe, t;
+
+    for (pipe=1; pipe<npipe; pipe++)
+    {
+        if (clear_pipe_buffer(stat, HBW_PIPE_NET_BUFFER(pipe), pipe, 0)!=VEGAS_OK ||
+            clear_pipe_buffer(stat, HBW_PIPE_ACCUM_BUFFER(pipe), pipe, resize)!=VEGAS_OK)
+            return pipe;
+
+        t = *nthread;
+        vegas_thread_args_init(&args[t + NET_THREAD]);
+        vegas_thread_args_init(&args[t + HBW_ACCUM_THREAD]);
+        args[t + NET_THREAD].output_buffer = HBW_PIPE_NET_BUFFER(pipe);
+        args[t + HBW_ACCUM_THREAD].input_buffer = HBW_PIPE_NET_BUFFER(pipe);
+        args[t + HBW_ACCUM_THREAD].output_buffer = HBW_PIPE_ACCUM_BUFFER(pipe);
+#if !defined(EXT_DISK)
+        vegas_thread_args_init(&args[t + HBW_DISK_THREAD]);
+        args[t + HBW_DISK_THREAD].input_buffer = HBW_PIPE_ACCUM_BUFFER(pipe);
+#endif
+        for (; *nthread < t + HBW_PIPE_NTHREAD; *nthread = *nthread + 1)
+            args[*nthread].pipe = pipe;
+
+        vegas_pipe_key(key, "ACCBUF", pipe);
+        vegas_status_lock(stat);
+        hputi4(stat->buf, key, HBW_PIPE_ACCUM_BUFFER(pipe));
+        vegas_status_unlock(stat);
+    }
+    return npipe;
+}
+
 
 void init_lbw_mode(struct vegas_thread_args *args, int *nthread) {
     *nthread = 0;
@@ -218,7 +308,8 @@ void start_lbw_mode(struct vegas_thread_args *args, pthread_t *ids)
 
 extern void *_ZN15VegasFitsThread3runEP17vegas_thread_args(void *);
 
-void start_hbw_mode(struct vegas_thread_args *args, pthread_t *ids) 
+/// Start the threads of one HBW pipeline, from args[0] and ids[0] on
+void start_hbw_pipe(struct vegas_thread_args *args, pthread_t *ids) 
 {
     // TODO error checking...
     int rv;
@@ -245,6 +336,20 @@ void start_hbw_mode(struct vegas_thread_args *args, pthread_t *ids)
 
 }
 
+void start_hbw_mode(struct vegas_thread_args *args, pthread_t *ids) 
+{
+    start_hbw_pipe(args, ids);
+}
+
+/// Start the pipelines init_hbw_pipes() added, threads first to nthread
+void start_hbw_pipes(struct vegas_thread_args *args, pthread_t *ids,
+                     int first, int nthread)
+{
+    int t;
+    for (t=first; t<nthread; t+=HBW_PIPE_NTHREAD)
+        start_hbw_pipe(&args[t], &ids[t]);
+}
+
 void start_monitor_mode(struct vegas_thread_args *args, pthread_t *ids) {
     // TODO error checking...
     int rv;
@@ -344,6 +449,9 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Error connecting to vegas_status\n");
         exit(1);
     }
+
+    /* Publish the thread statistics */
+    vegas_stat_flusher_start(&stat, VEGAS_STAT_FLUSH_INTERVAL);
     dbuf_net = vegas_databuf_attach(netbuf_id);
     if (dbuf_net==NULL) {
         fprintf(stderr, "Error connecting to vegas_databuf (raw net)\n");
@@ -364,8 +472,16 @@ int main(int argc, char *argv[]) {
     }
     vegas_databuf_clear(dbuf_acc);
 
+    /* Record the page size backing each buffer */
+    vegas_status_lock(&stat);
+    hputi8(stat.buf, "DBPGSZ1", vegas_databuf_page_size(dbuf_net));
+    hputi8(stat.buf, "DBPGSZ2", vegas_databuf_page_size(dbuf_pfb));
+    hputi8(stat.buf, "DBPGSZ3", vegas_databuf_page_size(dbuf_acc));
+    vegas_status_unlock(&stat);
+
     /* Thread setup */
-#define MAX_THREAD 8
+#define MAX_THREAD (HBW_PIPE_NTHREAD*VEGAS_MAX_NET_PIPES > 8 ? \
+                    HBW_PIPE_NTHREAD*VEGAS_MAX_NET_PIPES : 8)
     int i;
     int nthread_cur = 0;
     struct vegas_thread_args args[MAX_THREAD];
@@ -540,6 +656,12 @@ int main(int argc, char *argv[]) {
                     vegas_status_unlock(&stat);
                     init_hbw_mode(args, &nthread_cur);
                     start_hbw_mode(args, thread_id);
+                    {
+                        int first = nthread_cur;
+                        init_hbw_pipes(args, &nthread_cur, read_net_pipes(&stat),
+                                       &stat, do_dbuf_resize);
+                        start_hbw_pipes(args, thread_id, first, nthread_cur);
+                    }
                     
                 } else if (strncasecmp(obs_mode, "LBW", 4)==0) {                
                     vegas_status_lock(&stat);
@@ -575,7 +697,8 @@ int main(int argc, char *argv[]) {
         } 
         else if (strncasecmp(cmd, "INIT_GPU", MAX_CMD_LEN)==0) 
         {
-            int nsubband, nchan;
+            int nsubband, nchan, pfb_threads;
+            char window[32];
             vegas_status_lock(&stat);
             if (hgeti4(stat.buf, "NCHAN", &nchan)==0) {
                 fprintf(stderr, "ERROR: %s not in status shm!\n", "NCHAN");
@@ -583,7 +706,14 @@ int main(int argc, char *argv[]) {
             if (hgeti4(stat.buf, "NSUBBAND", &nsubband)==0) {
                 fprintf(stderr, "ERROR: %s not in status shm!\n", "NSUBBAND");
             }
+            if (hgets(stat.buf, "PFBWIN", sizeof(window), window)) {
+                vegas_pfb_set_window(vegas_pfb_window_parse(window));
+            }
+            if (hgeti4(stat.buf, "PFBTHRDS", &pfb_threads)==0) {
+                pfb_threads = 1;
+            }
             vegas_status_unlock(&stat);
+            set_pfb_threads(pfb_threads);
             init_cuda_context(nsubband, nchan, dbuf_net->block_size, dbuf_pfb->block_size);
             vegas_status_lock(&stat);
             hputs(stat.buf, "GPUCTXIN", "TRUE");
@@ -601,6 +731,7 @@ int main(int argc, char *argv[]) {
     stop_threads(args, thread_id, nthread_cur);
 
     if (command_fifo>0) close(command_fifo);
+    vegas_stat_flusher_stop();
 
     vegas_status_lock(&stat);
     hputs(stat.buf, "DAQSTATE", "exiting");
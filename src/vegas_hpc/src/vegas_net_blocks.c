@@ -0,0 +1,380 @@
+/* vegas_net_blocks.c
+ *
+ * Placement of packets into the net thread's databuf blocks, and the
+ * accounting of what was lost.
+ */
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "fitshead.h"
+#include "vegas_error.h"
+#include "vegas_defines.h"
+#include "vegas_databuf.h"
+#include "vegas_udp.h"
+#include "vegas_time.h"
+#include "vegas_net_blocks.h"
+
+/** Number of 64 bit words in a block's packet bitmap */
+static inline size_t pkt_bitmap_words(const struct datablock_stats *d)
+{
+    return ((size_t)d->heaps_per_block * d->pkts_per_heap + 63) / 64;
+}
+
+/** Reset all packet loss counters */
+void reset_stats(struct datablock_stats *d) {
+    d->nheaps=0;
+    d->pkts_dropped=0;
+    d->heaps_lost=0;
+    d->pkts_dup=0;
+    d->last_heap=0;
+    memset(d->pkt_bitmap, 0, pkt_bitmap_words(d) * sizeof(uint64_t));
+}
+
+/** Reset block params */
+void reset_block(struct datablock_stats *d) {
+    d->block_idx = -1;
+    d->heap_idx = 0;
+
+    reset_stats(d);
+}
+
+/** Initialize block struct */
+void init_block(struct datablock_stats *d, struct vegas_databuf *db, 
+        size_t heap_size, size_t spead_hdr_size, int heaps_per_block,
+        int pkts_per_heap, uint64_t *pkt_bitmap) {
+    d->db = db;
+    d->heap_size = heap_size;
+    d->spead_hdr_size = spead_hdr_size;
+    d->heaps_per_block = heaps_per_block;
+    d->pkts_per_heap = pkts_per_heap;
+    d->pkt_bitmap = pkt_bitmap;
+    reset_block(d);
+}
+
+/** Address of the payload of a heap counter/offset within the block */
+char *block_payload_addr(struct datablock_stats *d, unsigned int heap_cntr,
+                         unsigned int heap_offset)
+{
+    return vegas_databuf_data(d->db, d->block_idx) +
+                MAX_HEAPS_PER_BLK * d->spead_hdr_size +
+                (heap_cntr - d->heap_idx) * (d->heap_size - d->spead_hdr_size) +
+                heap_offset;
+}
+
+/** Count the packets of a heap missing from the block's bitmap */
+static int heap_pkts_missing(const struct datablock_stats *d, int block_heap_idx)
+{
+    size_t bit = (size_t)block_heap_idx * d->pkts_per_heap;
+    size_t end = bit + d->pkts_per_heap;
+    int nrecv = 0;
+
+    for (; bit < end && (bit & 63); ++bit)
+        nrecv += (d->pkt_bitmap[bit/64] >> (bit & 63)) & 1;
+    for (; bit + 64 <= end; bit += 64)
+        nrecv += __builtin_popcountll(d->pkt_bitmap[bit/64]);
+    for (; bit < end; ++bit)
+        nrecv += (d->pkt_bitmap[bit/64] >> (bit & 63)) & 1;
+    return d->pkts_per_heap - nrecv;
+}
+
+/** Non-zero if a packet's bit is set in the block's bitmap */
+static inline int pkt_received(const struct datablock_stats *d, size_t bit)
+{
+    return (d->pkt_bitmap[bit/64] >> (bit & 63)) & 1;
+}
+
+/** Zero the payload of every packet of a heap missing from the bitmap */
+static void zero_missing_packets(struct datablock_stats *d, int block_heap_idx)
+{
+    size_t heap_payload = d->heap_size - d->spead_hdr_size;
+    size_t bit = (size_t)block_heap_idx * d->pkts_per_heap;
+    size_t offset, len;
+    char *payload = block_payload_addr(d, d->heap_idx + block_heap_idx, 0);
+    int k;
+
+    for (k=0; k<d->pkts_per_heap; k++, bit++)
+    {
+        if (pkt_received(d, bit))
+            continue;
+        offset = (size_t)k * PAYLOAD_SIZE;
+        len = k + 1 < d->pkts_per_heap ? PAYLOAD_SIZE : heap_payload - offset;
+        memset(payload + offset, 0, len);
+    }
+}
+
+/** Update block header info, set filled status.
+ *  The packet bitmap gives the exact loss of every heap, which is written
+ *  to the index; a heap is valid only if none of its packets were lost.
+ *  Blocks are not cleared when reused, so whatever was not written here
+ *  is zeroed now: the payload of lost packets, and the header too of
+ *  heaps that got no packets at all.
+ *  A complete block is one the stream has moved past, so every heap of it
+ *  that is missing packets counts as lost, those at its tail included.
+ *  Otherwise (a new observation cut it short) only the heaps up to the
+ *  last one received are counted.
+ */
+void finalize_block(struct datablock_stats *d, int complete) {
+    char *header = vegas_databuf_header(d->db, d->block_idx);
+    char *data = vegas_databuf_data(d->db, d->block_idx);
+    struct databuf_index* index = (struct databuf_index*)
+                                vegas_databuf_index(d->db, d->block_idx);
+    struct cpu_gpu_buf_index *heap;
+    int i, nmissing;
+
+    d->pkts_dropped = 0;
+    d->heaps_lost = 0;
+    if (complete)
+        d->nheaps = d->heaps_per_block;
+    for (i=0; i<d->heaps_per_block; i++)
+    {
+        nmissing = heap_pkts_missing(d, i);
+        heap = &index->cpu_gpu_buf[i];
+        heap->heap_valid = (nmissing == 0);
+        heap->heap_pkts_lost = nmissing;
+        if (nmissing == 0)
+            continue;
+
+        if (nmissing == d->pkts_per_heap)
+        {
+            heap->heap_cntr = d->heap_idx + i;
+            memset(data + (size_t)i * d->spead_hdr_size, 0, d->spead_hdr_size);
+        }
+        zero_missing_packets(d, i);
+        /* The arrival time comes from the heap's last packet */
+        if (!pkt_received(d, (size_t)(i+1) * d->pkts_per_heap - 1))
+            heap->heap_rcvd_mjd = 0.0;
+
+        if (i < d->nheaps)
+        {
+            d->pkts_dropped += nmissing;
+            d->heaps_lost++;
+        }
+    }
+
+    hputi4(header, "HEAPIDX", d->heap_idx);
+    hputi4(header, "HEAPSIZE", d->heap_size);
+    hputi4(header, "NHEAPS", d->nheaps);
+    hputi4(header, "NDROP", d->pkts_dropped);
+    hputi4(header, "NLOSTHP", d->heaps_lost);
+
+    index->num_heaps = d->nheaps;
+    index->heap_size = d->heap_size;
+
+    vegas_databuf_set_filled(d->db, d->block_idx);
+}
+
+/** Push all blocks down a level, losing the first one */
+void block_stack_push(struct datablock_stats *d, int nblock) {
+    int i;
+    uint64_t *pkt_bitmap = d[0].pkt_bitmap;
+    for (i=1; i<nblock; i++) 
+        memcpy(&d[i-1], &d[i], sizeof(struct datablock_stats));
+    /* The bitmap of the block pushed off is reused by the last one */
+    d[nblock-1].pkt_bitmap = pkt_bitmap;
+}
+
+/** Go to next block in set */
+void increment_block(struct datablock_stats *d, unsigned int next_heap_cntr)
+{
+    d->block_idx = (d->block_idx + 1) % d->db->n_block;
+    d->heap_idx = next_heap_cntr;
+    reset_stats(d);
+}
+
+/** Check whether a certain heap counter belongs in the data block */
+int block_heap_check(struct datablock_stats *d, unsigned int heap_cntr) {
+    if (heap_cntr < d->heap_idx)
+        return(-1);
+    else if (heap_cntr >= d->heap_idx + d->heaps_per_block)
+        return(1);
+    else return(0);
+}
+
+
+/** Predict the packet following heap_cntr/heap_offset, and where its
+ *  payload belongs, so that it can be received straight into the block.
+ *  Packets that would start a new block are not predicted.
+ */
+void predict_next_packet(struct datablock_stats *blocks, int nblock,
+                         struct vegas_udp_scatter *sc,
+                         unsigned int heap_cntr, unsigned int heap_offset)
+{
+    struct datablock_stats *d = &blocks[0];
+    int i;
+
+    if (heap_offset + 2*sc->payload_size <= d->heap_size - d->spead_hdr_size)
+    {
+        sc->heap_cntr = heap_cntr;
+        sc->heap_offset = heap_offset + sc->payload_size;
+    }
+    else
+    {
+        sc->heap_cntr = heap_cntr + 1;
+        sc->heap_offset = 0;
+    }
+    sc->payload_addr = NULL;
+    for (i=0; i<nblock; i++)
+    {
+        if (blocks[i].block_idx>=0 && block_heap_check(&blocks[i], sc->heap_cntr)==0)
+        {
+            sc->payload_addr = block_payload_addr(&blocks[i], sc->heap_cntr, sc->heap_offset);
+            break;
+        }
+    }
+}
+
+/**
+ *  Write a SPEAD packet into the datablock, in any order.  Packets are
+ *  placed by heap counter and offset and recorded in the block's bitmap;
+ *  duplicates are discarded.  Returns 1 if the packet was written.
+ *  A payload that was already received into its slot is only byte swapped.
+ */
+int write_spead_packet_to_block(struct datablock_stats *d, struct vegas_udp_packet *p,
+                                unsigned int heap_cntr, unsigned int heap_offset,
+                                unsigned int pkts_per_heap, char bw_mode[])
+{
+    int block_heap_idx;
+    char *spead_header_addr, *spead_payload_addr;
+    struct timespec rx_time;
+    size_t bit;
+
+    /*Determine packet's address within block */
+    block_heap_idx = heap_cntr - d->heap_idx;
+
+    bit = (size_t)block_heap_idx * pkts_per_heap + heap_offset / PAYLOAD_SIZE;
+    if (heap_offset % PAYLOAD_SIZE != 0 || heap_offset / PAYLOAD_SIZE >= pkts_per_heap)
+        return 0;
+    if (pkt_received(d, bit))
+    {
+        d->pkts_dup++;
+        return 0;
+    }
+
+    spead_header_addr = vegas_databuf_data(d->db, d->block_idx) + 
+                block_heap_idx * d->spead_hdr_size;
+    spead_payload_addr = block_payload_addr(d, heap_cntr, heap_offset);
+
+    /* Copy packet to address, while reversing the byte ordering */
+    vegas_spead_packet_copy(p, spead_header_addr, spead_payload_addr, bw_mode);
+
+    /*Update block statistics */
+    if (block_heap_idx + 1 > d->nheaps)
+        d->nheaps = block_heap_idx + 1;
+    if (heap_cntr > d->last_heap)
+        d->last_heap = heap_cntr;
+    d->pkt_bitmap[bit/64] |= 1ULL << (bit & 63);
+
+    struct databuf_index* index = (struct databuf_index*)
+                            vegas_databuf_index(d->db, d->block_idx);
+
+    //Write the heap counter to the index; validity is decided in finalize_block()
+    index->cpu_gpu_buf[block_heap_idx].heap_cntr = heap_cntr;
+
+    //If this is the last packet of the heap, write the MJD to index
+    // JJB what is 6*8 here?
+    if(heap_offset + PAYLOAD_SIZE + 6*8 >= d->heap_size)
+    {
+        vegas_udp_packet_rx_time(p, &rx_time);
+        index->cpu_gpu_buf[block_heap_idx].heap_rcvd_mjd =
+            vegas_mjd_from_epoch(&d->epoch, &rx_time);
+    }
+    return 1;
+}
+
+void pipeline_reset_totals(struct net_pipeline *np)
+{
+    np->npacket_total = 0;
+    np->ndropped_total = 0;
+    np->nheaps_lost_total = 0;
+    np->nreordered_total = 0;
+    np->ndup_total = 0;
+}
+
+/// Add the heaps skipped between blocks, which no block holds, to the
+/// totals as lost
+void pipeline_count_skipped(struct net_pipeline *np, unsigned int nheaps)
+{
+    np->ndropped_total += (unsigned long long)nheaps * np->packets_per_heap;
+    np->nheaps_lost_total += nheaps;
+}
+
+/// Add the exact losses of a finalized block to the totals
+void pipeline_count_block(struct net_pipeline *np, struct datablock_stats *d)
+{
+    const double drop_lpf = 0.25;
+
+    np->ndropped_total += d->pkts_dropped;
+    np->nheaps_lost_total += d->heaps_lost;
+    np->ndup_total += d->pkts_dup;
+    if (d->nheaps > 0)
+        np->drop_frac_avg = (1.0-drop_lpf)*np->drop_frac_avg 
+            + drop_lpf *
+            (double)d->pkts_dropped / 
+            (double)(d->nheaps * np->packets_per_heap);
+}
+
+int net_seq_check(struct net_seq *ns, struct net_pipeline *np,
+                  unsigned int seq_num)
+{
+    int seq_num_diff = (int)(seq_num - ns->last_seq_num);
+
+    /* last_seq_num only moves forward (or back at an observation
+     * start), so late packets are measured against the newest one.
+     */
+    if (seq_num_diff > 0) {
+        ns->last_seq_num = seq_num;
+        np->npacket_total += seq_num_diff;
+        return NET_PKT_NEXT;
+    }
+    if (seq_num_diff < -1024) {
+        ns->last_seq_num = seq_num;
+        return NET_PKT_START;
+    }
+    if (seq_num_diff == 0)
+        return NET_PKT_DUP;
+    if (-seq_num_diff <= ns->reorder_window) {
+        /* Late, but its block may still be active. It is placed
+         * by heap counter and offset. */
+        np->nreordered_total++;
+        return NET_PKT_LATE;
+    }
+    return NET_PKT_OLD;
+}
+
+/** The first block is finalized, counting its exact losses, along with
+ *  any heaps skipped past the end of the stack, then pushed off the
+ *  stack for the next free databuf block to take the end.  A new
+ *  observation cuts every active block short instead: all are finalized,
+ *  the newest one counting only the heaps up to the last it received,
+ *  and the new block is the only one left active.
+ */
+int net_next_block(struct net_pipeline *np, struct datablock_stats *blocks,
+                   int nblock, unsigned int heap_cntr,
+                   unsigned int nextblock_heap_cntr, int new_obs)
+{
+    struct datablock_stats *lblock = &blocks[nblock-1];
+    int i, last = blocks[0].block_idx;
+
+    for (i=0; i<(new_obs ? nblock : 1); i++)
+    {
+        if (blocks[i].block_idx < 0)
+            continue;
+        finalize_block(&blocks[i], i < nblock-1);
+        pipeline_count_block(np, &blocks[i]);
+        last = blocks[i].block_idx;
+    }
+    /* A jump of the heap counter past the next block loses the
+     * heaps in between */
+    if (lblock->block_idx>=0 && !new_obs && heap_cntr>nextblock_heap_cntr)
+        pipeline_count_skipped(np, heap_cntr - nextblock_heap_cntr);
+
+    block_stack_push(blocks, nblock);
+    increment_block(lblock, heap_cntr);
+    if (new_obs)
+        for (i=0; i<nblock-1; i++)
+            reset_block(&blocks[i]);
+    return last;
+}
@@ -0,0 +1,106 @@
+/** vegas_net_blocks.h
+ *
+ * The net thread's databuf blocks and loss accounting: where each packet
+ * goes, which packets arrived, and the exact drop, duplicate and reorder
+ * totals of a pipeline.  Kept apart from the thread so that the
+ * accounting can be driven by a test stream.
+ */
+#ifndef _VEGAS_NET_BLOCKS_H
+#define _VEGAS_NET_BLOCKS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vegas_defines.h"
+#include "vegas_databuf.h"
+#include "vegas_udp.h"
+#include "vegas_time.h"
+
+struct vegas_status;
+struct vegas_stat;
+
+/** Structs/functions to more easily deal with multiple 
+ * active blocks being filled
+ */
+struct datablock_stats {
+    struct vegas_databuf *db;       // Pointer to overall shared mem databuf
+    int block_idx;                  // Block index number in databuf
+    unsigned int heap_idx;          // Index of first heap in block
+    size_t heap_size;               // Size of each heap
+    size_t spead_hdr_size;          // Size of each SPEAD header
+    int heaps_per_block;            // Total number of heaps to go in the block
+    int pkts_per_heap;              // Number of packets in each heap
+    int nheaps;                     // Number of heaps filled so far
+    int pkts_dropped;               // Number of dropped packets (exact once finalized)
+    int heaps_lost;                 // Number of heaps with any dropped packet
+    int pkts_dup;                   // Number of duplicate packets discarded
+    unsigned int last_heap;         // Last heap counter written to block
+    struct vegas_mjd_epoch epoch;   // MJD reference for heap arrival times
+    uint64_t *pkt_bitmap;           // One bit per packet received into the block
+};
+
+/** Totals and statistics of one net pipeline.  A process may run
+ * several net threads, each on its own port and into its own databuf,
+ * so nothing the receive path updates is kept in file-scope state:
+ * it is all here or in the blocks, on the thread's own stack.
+ */
+struct net_pipeline {
+    int pipe;                   ///< Pipeline number, 0 for the first
+    struct vegas_status *st;
+    unsigned int packets_per_heap;
+    unsigned long long npacket_total, ndropped_total;
+    unsigned long long nheaps_lost_total, nreordered_total, ndup_total;
+    double drop_frac_avg;
+    char state_key[9];          ///< This pipeline's NETSTAT
+    struct vegas_stat *stat_state, *stat_npkt, *stat_ndrop, *stat_nlosthp;
+    struct vegas_stat *stat_nreorder, *stat_nduppkt, *stat_dropavg;
+    struct vegas_stat *stat_droptot, *stat_blkout, *stat_scathit, *stat_scatmis;
+};
+
+/** Sequence state of a pipeline's packet stream */
+struct net_seq {
+    unsigned int last_seq_num;  ///< Newest packet so far
+    int reorder_window;         ///< Packets this far behind it are still placed
+};
+
+/// How a packet stands against the newest one so far, from net_seq_check()
+#define NET_PKT_NEXT  0  ///< Newer than any before
+#define NET_PKT_START 1  ///< Far behind: a new observation has started
+#define NET_PKT_DUP   2  ///< The newest one again
+#define NET_PKT_LATE  3  ///< Late, but within the reorder window
+#define NET_PKT_OLD   4  ///< Too late to be placed
+
+void reset_stats(struct datablock_stats *d);
+void reset_block(struct datablock_stats *d);
+void init_block(struct datablock_stats *d, struct vegas_databuf *db, 
+        size_t heap_size, size_t spead_hdr_size, int heaps_per_block,
+        int pkts_per_heap, uint64_t *pkt_bitmap);
+char *block_payload_addr(struct datablock_stats *d, unsigned int heap_cntr,
+                         unsigned int heap_offset);
+void finalize_block(struct datablock_stats *d, int complete);
+void block_stack_push(struct datablock_stats *d, int nblock);
+void increment_block(struct datablock_stats *d, unsigned int next_heap_cntr);
+int block_heap_check(struct datablock_stats *d, unsigned int heap_cntr);
+void predict_next_packet(struct datablock_stats *blocks, int nblock,
+                         struct vegas_udp_scatter *sc,
+                         unsigned int heap_cntr, unsigned int heap_offset);
+int write_spead_packet_to_block(struct datablock_stats *d, struct vegas_udp_packet *p,
+                                unsigned int heap_cntr, unsigned int heap_offset,
+                                unsigned int pkts_per_heap, char bw_mode[]);
+
+void pipeline_reset_totals(struct net_pipeline *np);
+void pipeline_count_skipped(struct net_pipeline *np, unsigned int nheaps);
+void pipeline_count_block(struct net_pipeline *np, struct datablock_stats *d);
+
+/** Classify a packet by its sequence number, counting it in the totals */
+int net_seq_check(struct net_seq *ns, struct net_pipeline *np,
+                  unsigned int seq_num);
+
+/** Move the block stack on to a new block starting at heap_cntr.
+ * Returns the databuf block finalized last, or -1.
+ */
+int net_next_block(struct net_pipeline *np, struct datablock_stats *blocks,
+                   int nblock, unsigned int heap_cntr,
+                   unsigned int nextblock_heap_cntr, int new_obs);
+
+#endif
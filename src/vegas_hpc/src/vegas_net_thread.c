@@ -16,6 +16,7 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/types.h>
+#include <stdint.h>
 
 #include "fitshead.h"
 #include "vegas_params.h"
@@ -24,6 +25,7 @@
 #include "vegas_databuf.h"
 #include "vegas_udp.h"
 #include "vegas_time.h"
+#include "vegas_net_blocks.h"
 
 #define STATUS_KEY "NETSTAT"  /* Define before vegas_threads.h */
 #include "vegas_threads.h"
@@ -55,21 +57,6 @@ extern void vegas_read_obs_params(char *buf,
                                   struct vegas_params *g, 
                                   struct sdfits *p);
 
-/** Structs/functions to more easily deal with multiple 
- * active blocks being filled
- */
-struct datablock_stats {
-    struct vegas_databuf *db;       // Pointer to overall shared mem databuf
-    int block_idx;                  // Block index number in databuf
-    unsigned int heap_idx;          // Index of first heap in block
-    size_t heap_size;               // Size of each heap
-    size_t spead_hdr_size;          // Size of each SPEAD header
-    int heaps_per_block;            // Total number of heaps to go in the block
-    int nheaps;                     // Number of heaps filled so far
-    int pkts_dropped;               // Number of dropped packets so far
-    unsigned int last_heap;         // Last heap counter written to block
-};
-
 /** Touch all memory pages in a databuffer (non-destructive) */
 void touch_all_pages(struct vegas_databuf *db)
 {
@@ -89,141 +76,61 @@ void touch_all_pages(struct vegas_databuf *db)
     }
 }
 
-/** Reset all packet loss counters */
-void reset_stats(struct datablock_stats *d) {
-    d->nheaps=0;
-    d->pkts_dropped=0;
-    d->last_heap=0;
-}
-
-/** Reset block params */
-void reset_block(struct datablock_stats *d) {
-    d->block_idx = -1;
-    d->heap_idx = 0;
-
-    reset_stats(d);
-}
-
-/** Initialize block struct */
-void init_block(struct datablock_stats *d, struct vegas_databuf *db, 
-        size_t heap_size, size_t spead_hdr_size, int heaps_per_block) {
-    d->db = db;
-    d->heap_size = heap_size;
-    d->spead_hdr_size = spead_hdr_size;
-    d->heaps_per_block = heaps_per_block;
-    reset_block(d);
-}
-
-/** Update block header info, set filled status */
-void finalize_block(struct datablock_stats *d) {
-    char *header = vegas_databuf_header(d->db, d->block_idx);
-    hputi4(header, "HEAPIDX", d->heap_idx);
-    hputi4(header, "HEAPSIZE", d->heap_size);
-    hputi4(header, "NHEAPS", d->nheaps);
-    hputi4(header, "NDROP", d->pkts_dropped);
-
-    struct databuf_index* index = (struct databuf_index*)
-                                vegas_databuf_index(d->db, d->block_idx);
-    index->num_heaps = d->nheaps;
-    index->heap_size = d->heap_size;
-
-    vegas_databuf_set_filled(d->db, d->block_idx);
-}
-
-/** Push all blocks down a level, losing the first one */
-void block_stack_push(struct datablock_stats *d, int nblock) {
-    int i;
-    for (i=1; i<nblock; i++) 
-        memcpy(&d[i-1], &d[i], sizeof(struct datablock_stats));
+static struct vegas_stat *pipeline_stat(struct net_pipeline *np,
+                                        const char *key, int type)
+{
+    char pkey[9];
+    vegas_pipe_key(pkey, key, np->pipe);
+    return vegas_stat_register(pkey, type);
 }
 
-/** Go to next block in set */
-void increment_block(struct datablock_stats *d, unsigned int next_heap_cntr)
+/// Statistics are published to the status buffer by the stats flusher
+void pipeline_init(struct net_pipeline *np, struct vegas_status *st, int pipe)
 {
-    d->block_idx = (d->block_idx + 1) % d->db->n_block;
-    d->heap_idx = next_heap_cntr;
-    reset_stats(d);
+    memset(np, 0, sizeof(*np));
+    np->pipe = pipe;
+    np->st = st;
+    vegas_pipe_key(np->state_key, STATUS_KEY, pipe);
+    np->stat_state = vegas_stat_register(np->state_key, VEGAS_STAT_STR);
+    np->stat_npkt = pipeline_stat(np, "NPKT", VEGAS_STAT_INT);
+    np->stat_ndrop = pipeline_stat(np, "NDROP", VEGAS_STAT_INT);
+    np->stat_nlosthp = pipeline_stat(np, "NLOSTHP", VEGAS_STAT_INT);
+    np->stat_nreorder = pipeline_stat(np, "NREORDER", VEGAS_STAT_INT);
+    np->stat_nduppkt = pipeline_stat(np, "NDUPPKT", VEGAS_STAT_INT);
+    np->stat_dropavg = pipeline_stat(np, "DROPAVG", VEGAS_STAT_DOUBLE);
+    np->stat_droptot = pipeline_stat(np, "DROPTOT", VEGAS_STAT_DOUBLE);
+    np->stat_blkout = pipeline_stat(np, "NETBLKOU", VEGAS_STAT_INT);
+    np->stat_scathit = pipeline_stat(np, "NSCATHIT", VEGAS_STAT_INT);
+    np->stat_scatmis = pipeline_stat(np, "NSCATMIS", VEGAS_STAT_INT);
 }
 
-/** Check whether a certain heap counter belongs in the data block */
-int block_heap_check(struct datablock_stats *d, unsigned int heap_cntr) {
-    if (heap_cntr < d->heap_idx)
-        return(-1);
-    else if (heap_cntr >= d->heap_idx + d->heaps_per_block)
-        return(1);
-    else return(0);
+void pipeline_publish(struct net_pipeline *np, struct vegas_udp_scatter *sc,
+                      int block_idx)
+{
+    vegas_stat_set_int(np->stat_npkt, np->npacket_total);
+    vegas_stat_set_int(np->stat_ndrop, np->ndropped_total);
+    vegas_stat_set_int(np->stat_nlosthp, np->nheaps_lost_total);
+    vegas_stat_set_int(np->stat_nreorder, np->nreordered_total);
+    vegas_stat_set_int(np->stat_nduppkt, np->ndup_total);
+    vegas_stat_set_double(np->stat_dropavg, np->drop_frac_avg);
+    vegas_stat_set_double(np->stat_droptot, 
+            np->npacket_total ? 
+            (double)np->ndropped_total/(double)np->npacket_total 
+            : 0.0);
+    vegas_stat_set_int(np->stat_blkout, block_idx);
+    vegas_stat_set_int(np->stat_scathit, sc->nhit);
+    vegas_stat_set_int(np->stat_scatmis, sc->nmiss);
 }
 
-
-/**
- *  Write a SPEAD packet into the datablock.  Also zeroes out any dropped packets.
- */
-static unsigned int prev_heap_cntr;
-static unsigned int prev_heap_offset;
-static char pkts_dropped_in_heap;
-
-void write_spead_packet_to_block(struct datablock_stats *d, struct vegas_udp_packet *p,
-                                unsigned int heap_cntr, unsigned int heap_offset,
-                                unsigned int pkts_per_heap, char bw_mode[])
+/// Exit handler, set_exit_status() for this pipeline's NETSTAT
+void pipeline_exit_status(struct net_pipeline *np)
 {
-    int block_heap_idx;
-    char *spead_header_addr, *spead_payload_addr;
-    double mjd;
-
-    /*Determine packet's address within block */
-    block_heap_idx = heap_cntr - d->heap_idx;
-
-    spead_header_addr = vegas_databuf_data(d->db, d->block_idx) + 
-                block_heap_idx * d->spead_hdr_size;
-    spead_payload_addr = vegas_databuf_data(d->db, d->block_idx) +
-                MAX_HEAPS_PER_BLK * d->spead_hdr_size +
-                block_heap_idx * (d->heap_size - d->spead_hdr_size) +
-                heap_offset;
-
-    /* Copy packet to address, while reversing the byte ordering */
-    vegas_spead_packet_copy(p, spead_header_addr, spead_payload_addr, bw_mode);
-
-    /*Update block statistics */
-    d->nheaps = block_heap_idx + 1;
-    d->last_heap = heap_cntr;
-
-    //Determine if we dropped any packets while in same heap
-    if( vegas_spead_packet_seq_num(heap_cntr, heap_offset, pkts_per_heap) - 
-        vegas_spead_packet_seq_num(prev_heap_cntr, prev_heap_offset, pkts_per_heap) > 1 &&
-        prev_heap_cntr == heap_cntr)
-    {
-        pkts_dropped_in_heap = 1;
-    }
-
-    struct databuf_index* index = (struct databuf_index*)
-                            vegas_databuf_index(d->db, d->block_idx);
-
-    //If start of new heap, write it to index
-    if(heap_cntr != prev_heap_cntr)
-    {
-        index->cpu_gpu_buf[block_heap_idx].heap_cntr = heap_cntr;
-        index->cpu_gpu_buf[block_heap_idx].heap_valid = 0;
-
-        if(heap_offset == 0)
-            pkts_dropped_in_heap = 0;
-        else
-            pkts_dropped_in_heap = 1;
-    }
-
-    //If this is the last packet of the heap, write valid bit and MJD to index
-    // JJB what is 6*8 here?
-    if(heap_offset + PAYLOAD_SIZE + 6*8 >= d->heap_size)
-    {
-		index->cpu_gpu_buf[block_heap_idx].heap_valid = 1 - pkts_dropped_in_heap;
-        get_current_mjd_double(&mjd);
-        index->cpu_gpu_buf[block_heap_idx].heap_rcvd_mjd = mjd;
-    }
-
-    prev_heap_cntr = heap_cntr;
-    prev_heap_offset = heap_offset;
+    vegas_stat_set_str(np->stat_state, "exiting");
+    vegas_status_lock(np->st);
+    hputs(np->st->buf, np->state_key, "exiting");
+    vegas_status_unlock(np->st);
 }
 
-
 /** This thread is passed a single arg, pointer
  * to the vegas_udp_params struct.  This thread should 
  * be cancelled and restarted if any hardware params
@@ -264,26 +171,28 @@ void *vegas_net_thread(void *_args) {
         pthread_exit(NULL);
     }
     pthread_cleanup_push((void *)vegas_status_detach, &st);
-    pthread_cleanup_push((void *)set_exit_status, &st);
+
+    /* This thread's pipeline; its keywords carry the pipeline number */
+    struct net_pipeline np;
+    pipeline_init(&np, &st, args->pipe);
+    pthread_cleanup_push((void *)pipeline_exit_status, &np);
 
     /* Init status, read info */
     vegas_status_lock_safe(&st);
-    hputs(st.buf, STATUS_KEY, "init");
+    hputs(st.buf, np.state_key, "init");
     vegas_status_unlock_safe(&st);
 
     /* Read in general parameters */
     struct vegas_params gp;
     struct sdfits pf;
     char status_buf[VEGAS_STATUS_SIZE];
-    vegas_status_lock_safe(&st);
-    memcpy(status_buf, st.buf, VEGAS_STATUS_SIZE);
-    vegas_status_unlock_safe(&st);
+    vegas_status_snapshot(&st, status_buf);
     vegas_read_obs_params(status_buf, &gp, &pf);
     pthread_cleanup_push((void *)vegas_free_sdfits, &pf);
 
     /* Read network params */
     struct vegas_udp_params up;
-    vegas_read_net_params(status_buf, &up);
+    vegas_read_net_params_pipe(status_buf, &up, np.pipe);
     up.observation_started = 0;
 
     /* Attach to databuf shared mem */
@@ -302,6 +211,10 @@ void *vegas_net_thread(void *_args) {
     // at the beginning of scan issue.
     touch_all_pages(db);
 
+    /* Blocks fully cleared since the thread started */
+    char block_cleared[MAX_BLKS_PER_BUF];
+    memset(block_cleared, 0, sizeof(block_cleared));
+
     /* Time parameters */
     double meas_stt_mjd=0.0;
     double meas_stt_offs=0.0;
@@ -317,6 +230,7 @@ void *vegas_net_thread(void *_args) {
      */
     int block_size;
     struct vegas_udp_packet p;
+    struct vegas_udp_scatter sc;
     size_t heap_size = 0, spead_hdr_size = 0;
     unsigned int heaps_per_block, packets_per_heap = 0; 
     char bw_mode[16];
@@ -360,6 +274,7 @@ void *vegas_net_thread(void *_args) {
     }
     heaps_per_block =   (block_size - MAX_HEAPS_PER_BLK*spead_hdr_size) /
                         (heap_size - spead_hdr_size);
+    np.packets_per_heap = packets_per_heap;
     /* make general --> */
     int nsubband = pf.hdr.nsubband;
     int iDataSize = heaps_per_block * (heap_size - spead_hdr_size);
@@ -372,31 +287,54 @@ void *vegas_net_thread(void *_args) {
     }
     /* <-- make general */
 
-    /* List of databuf blocks currently in use */
+    /* Payloads are received directly into the block when predictable */
+    memset(&sc, 0, sizeof(sc));
+    sc.payload_size = PAYLOAD_SIZE;
+
+    /* Packets arriving up to this many behind the newest one are still
+     * placed into their block, instead of being dropped as out of order.
+     */
+    struct net_seq ns;
+    ns.last_seq_num = 1050;
+    if (hgeti4(status_buf, "NETREORD", &ns.reorder_window)==0)
+        ns.reorder_window = 64;
+    if (ns.reorder_window < 0)
+        ns.reorder_window = 0;
+    if (ns.reorder_window > 1024) /* larger jumps back signal a new observation */
+        ns.reorder_window = 1024;
+
+    /* List of databuf blocks currently in use, each with a bitmap
+     * of the packets received into it.
+     */
     unsigned i;
     const int nblock = 2;
     struct datablock_stats blocks[nblock];
+    size_t bitmap_words = ((size_t)heaps_per_block * packets_per_heap + 63) / 64;
+    uint64_t *pkt_bitmaps = calloc(nblock * bitmap_words, sizeof(uint64_t));
+    if (pkt_bitmaps==NULL) {
+        vegas_error("vegas_net_thread", "Error allocating packet bitmaps");
+        pthread_exit(NULL);
+    }
+    pthread_cleanup_push((void *)free, pkt_bitmaps);
     for (i=0; i<nblock; i++) 
-        init_block(&blocks[i], db, heap_size, spead_hdr_size, heaps_per_block);
+        init_block(&blocks[i], db, heap_size, spead_hdr_size, heaps_per_block,
+                   packets_per_heap, &pkt_bitmaps[i * bitmap_words]);
 
-    /* Convenience names for first/last blocks in set */
-    struct datablock_stats *fblock, *lblock;
-    fblock = &blocks[0];
-    lblock = &blocks[nblock-1];
+    /* Convenience name for the last block in set */
+    struct datablock_stats *lblock = &blocks[nblock-1];
 
     /* Misc counters, etc */
     char *curdata=NULL, *curheader=NULL, *curindex=NULL;
     unsigned int heap_cntr=0, last_heap_cntr=2048, nextblock_heap_cntr=0;
     unsigned int heap_offset;
-    unsigned int seq_num=0, last_seq_num=1050;
+    unsigned int seq_num=0;
     int heap_cntr_diff, seq_num_diff;
     unsigned int obs_started = 0;
-    unsigned long long npacket_total = 0, npacket_this_block=0, ndropped_total = 0;
-    double drop_frac_avg=0.0;
-    const double drop_lpf = 0.25;
-    prev_heap_cntr = 0;
-    prev_heap_offset = 0;
     char msg[256];
+    char sttmjd_key[9], sttoff_key[9];
+    vegas_pipe_key(sttmjd_key, "M_STTMJD", np.pipe);
+    vegas_pipe_key(sttoff_key, "M_STTOFF", np.pipe);
+    struct timespec rx_time;
 
     /* Give all the threads a chance to start before opening network socket */
     sleep(1);
@@ -421,9 +359,7 @@ void *vegas_net_thread(void *_args) {
             if (rv==VEGAS_TIMEOUT) { 
                 /* Set "waiting" flag */
                 if (waiting!=1) {
-                    vegas_status_lock_safe(&st);
-                    hputs(st.buf, STATUS_KEY, "waiting");
-                    vegas_status_unlock_safe(&st);
+                    vegas_stat_set_str(np.stat_state, "waiting");
                     waiting=1;
                 }
                 continue; 
@@ -436,10 +372,12 @@ void *vegas_net_thread(void *_args) {
         }
 	
         /* Read packet */
-        rv = vegas_udp_recv(&up, &p, bw_mode);
+        rv = vegas_udp_recv_scatter(&up, &p, &sc, bw_mode);
 #ifdef TEST_DROP_PKTS
         if (___test_toss_packets)
         {
+            if (p.payload)
+                memset(p.payload, 0, sc.payload_size);
             ___test_toss_packets--;
             ___test_have_tossed++;
             if (!___test_toss_packets)
@@ -463,9 +401,7 @@ void *vegas_net_thread(void *_args) {
 	
         /* Update status if needed */
         if (waiting!=0) {
-            vegas_status_lock_safe(&st);
-            hputs(st.buf, STATUS_KEY, "receiving");
-            vegas_status_unlock_safe(&st);
+            vegas_stat_set_str(np.stat_state, "receiving");
             waiting=0;
         }
 
@@ -475,15 +411,13 @@ void *vegas_net_thread(void *_args) {
         seq_num = vegas_spead_packet_seq_num(heap_cntr, heap_offset, packets_per_heap);
 
         heap_cntr_diff = heap_cntr - last_heap_cntr;
-        seq_num_diff = (int)(seq_num - last_seq_num);
+        seq_num_diff = (int)(seq_num - ns.last_seq_num);
         
-        last_seq_num = seq_num;
         last_heap_cntr = heap_cntr;
+        force_new_block=0; 
 
-        if (seq_num_diff<=0) { 
-
-            if (seq_num_diff<-1024)
-            {
+        switch (net_seq_check(&ns, &np, seq_num)) {
+            case NET_PKT_START:
                 force_new_block=1;
                 obs_started = 1;
                 up.observation_started = 1;
@@ -491,42 +425,32 @@ void *vegas_net_thread(void *_args) {
                 #ifdef DEBUG_NET
                 printf("Debug: observation started\n");
                 #endif
-            }
-            else if (seq_num_diff==0) {
+                break;
+            case NET_PKT_DUP:
                 sprintf(msg, "Received duplicate packet (seq_num=%d)", seq_num);
                 vegas_warn("vegas_net_thread", msg);
-            }
-            else  {
+                break;
+            case NET_PKT_OLD:
                 #ifdef DEBUG_NET
                 sprintf(msg, "out of order packet. Diff = %d", seq_num_diff);
                 vegas_warn("vegas_net_thread", msg);
                 #endif
                 continue;   /* No going backwards */
-            }
-        } else { 
-            force_new_block=0; 
-            npacket_total += seq_num_diff;
-            ndropped_total += seq_num_diff - 1;
-            npacket_this_block += seq_num_diff;
-            fblock->pkts_dropped += seq_num_diff - 1;
-
-            #ifdef DEBUG_NET
-            if(seq_num_diff > 1)
-            {
-                sprintf(msg, "Missing packet. seq_num_diff = %d", seq_num_diff);
-                vegas_warn("vegas_net_thread", msg);
-            }
-            #endif
-
+            case NET_PKT_NEXT:
+                #ifdef DEBUG_NET
+                if(seq_num_diff > 1)
+                {
+                    sprintf(msg, "Missing packet. seq_num_diff = %d", seq_num_diff);
+                    vegas_warn("vegas_net_thread", msg);
+                }
+                #endif
+                break;
         }
 
         /* If obs has not started, ignore this packet */
         if(!obs_started)
         {
-            fblock->pkts_dropped = 0;
-            npacket_total = 0;
-            ndropped_total = 0;
-            npacket_this_block = 0;
+            pipeline_reset_totals(&np);
             // insert synthetic blanking and the SCAN_NOT_STARTED bits in status field
             // [performed in the vegas_udp_recv() call above] and keep going.
             // This allows data to begin flowing through the data buffers without
@@ -537,50 +461,33 @@ void *vegas_net_thread(void *_args) {
         /* Determine if we go to next block */
         if (heap_cntr>=nextblock_heap_cntr || force_new_block)
         {
-            /* Update drop stats */
-            if (npacket_this_block > 0)  
-                drop_frac_avg = (1.0-drop_lpf)*drop_frac_avg 
-                    + drop_lpf *
-                    (double)fblock->pkts_dropped / (double)npacket_this_block;
-
-            vegas_status_lock_safe(&st);
-            hputi8(st.buf, "NPKT", npacket_total);
-            hputi8(st.buf, "NDROP", ndropped_total);
-            hputr8(st.buf, "DROPAVG", drop_frac_avg);
-            hputr8(st.buf, "DROPTOT", 
-                    npacket_total ? 
-                    (double)ndropped_total/(double)npacket_total 
-                    : 0.0);
-            hputi4(st.buf, "NETBLKOU", fblock->block_idx);
-            vegas_status_unlock_safe(&st);
-            
-            /* Finalize first block, and push it off the list.
-             * Then grab next available block.
+            /* Finalize the first block, or at a new observation all
+             * of them, counting their exact losses.  Push it off the
+             * list, then grab next available block.
              */
-            if (fblock->block_idx>=0) finalize_block(fblock);
-            block_stack_push(blocks, nblock);
-            increment_block(lblock, heap_cntr);
+            rv = net_next_block(&np, blocks, nblock, heap_cntr,
+                                nextblock_heap_cntr, force_new_block);
+            pipeline_publish(&np, &sc, rv);
+            vegas_udp_packet_rx_time(&p, &rx_time);
+            vegas_mjd_epoch_init(&lblock->epoch, &rx_time);
             curdata = vegas_databuf_data(db, lblock->block_idx);
             curheader = vegas_databuf_header(db, lblock->block_idx);
             curindex = vegas_databuf_index(db, lblock->block_idx);
             nextblock_heap_cntr = lblock->heap_idx + heaps_per_block;
-            npacket_this_block = 0;
 
             /* If new obs started, reset total counters, get start
              * time.  Start time is rounded to nearest integer
              * second, with warning if we're off that by more
-             * than 100ms.  Any current blocks on the stack
-             * are also finalized/reset */            
+             * than 100ms.  The blocks on the stack were finalized
+             * above */            
 
             if (force_new_block) {
             
                 /* Reset stats */
-                npacket_total=0;
-                ndropped_total=0;
-                npacket_this_block = 0;
+                pipeline_reset_totals(&np);
 
-                /* Get obs start time */
-                get_current_mjd_double(&meas_stt_mjd);
+                /* Get obs start time from the arrival of the start packet */
+                meas_stt_mjd = vegas_mjd_from_epoch(&lblock->epoch, &rx_time);
                 
                 printf("vegas_net_thread: got start packet at MJD %f", meas_stt_mjd);
                 
@@ -596,8 +503,8 @@ void *vegas_net_thread(void *_args) {
                 }
 
                 vegas_status_lock_safe(&st);
-                hputnr8(st.buf, "M_STTMJD", 8, meas_stt_mjd);
-                hputr8(st.buf, "M_STTOFF", meas_stt_offs);
+                hputnr8(st.buf, sttmjd_key, 8, meas_stt_mjd);
+                hputr8(st.buf, sttoff_key, meas_stt_offs);
                 vegas_status_unlock_safe(&st);
 
                 /* Warn if 1st packet number is not zero */
@@ -610,9 +517,7 @@ void *vegas_net_thread(void *_args) {
             }
             
             /* Read current status shared mem */
-            vegas_status_lock_safe(&st);
-            memcpy(status_buf, st.buf, VEGAS_STATUS_SIZE);
-            vegas_status_unlock_safe(&st);
+            vegas_status_snapshot(&st, status_buf);
 
             /* Wait for new block to be free, then clear it
              * if necessary and fill its header with new values.
@@ -622,9 +527,7 @@ void *vegas_net_thread(void *_args) {
                 if (rv==VEGAS_TIMEOUT) {
                     waiting=1;
                     vegas_warn("vegas_net_thread", "timeout while waiting for output block\n");
-                    vegas_status_lock_safe(&st);
-                    hputs(st.buf, STATUS_KEY, "blocked");
-                    vegas_status_unlock_safe(&st);
+                    vegas_stat_set_str(np.stat_state, "blocked");
                     continue;
                 } else {
                     vegas_error("vegas_net_thread", 
@@ -635,13 +538,23 @@ void *vegas_net_thread(void *_args) {
                 }
             }
             memcpy(curheader, status_buf, VEGAS_STATUS_SIZE);
-            memset(curdata, 0, block_size);
-            memset(curindex, 0, db->index_size);
+
+            /* Whatever this block held before is overwritten heap by
+             * heap, or zeroed by finalize_block().  Only the first use
+             * of each block, which may still hold data from another
+             * mode, needs a full clear.
+             */
+            if (!block_cleared[lblock->block_idx])
+            {
+                memset(curdata, 0, block_size);
+                memset(curindex, 0, db->index_size);
+                block_cleared[lblock->block_idx] = 1;
+            }
         }
 
         /* Copy packet into any blocks where it belongs.
-         * The "write packets" functions also update drop stats 
-         * for blocks, etc.
+         * The "write packets" functions also update the packet
+         * bitmaps of the blocks, from which losses are counted.
          */
         int nblocks = 0;
         for (i=0; i<nblock; i++)
@@ -656,6 +569,10 @@ void *vegas_net_thread(void *_args) {
                                 heap_offset, packets_per_heap, bw_mode);
             }
         }
+        /* Only predict ahead of the newest packet, never into a slot
+         * that may already hold data */
+        if (seq_num == ns.last_seq_num)
+            predict_next_packet(blocks, nblock, &sc, heap_cntr, heap_offset);
 
         /* Will exit if thread has been cancelled */
         pthread_testcancel();
@@ -665,7 +582,8 @@ void *vegas_net_thread(void *_args) {
 
     /* Have to close all push's */
     pthread_cleanup_pop(0); /* Closes push(vegas_udp_close) */
-    pthread_cleanup_pop(0); /* Closes set_exit_status */
+    pthread_cleanup_pop(0); /* Closes free(pkt_bitmaps) */
+    pthread_cleanup_pop(0); /* Closes pipeline_exit_status */
     pthread_cleanup_pop(0); /* Closes vegas_free_psrfits */
     pthread_cleanup_pop(0); /* Closes vegas_status_detach */
     pthread_cleanup_pop(0); /* Closes vegas_databuf_detach */
@@ -12,6 +12,7 @@
 #include "vegas_time.h"
 #include "vegas_error.h"
 #include "vegas_udp.h"
+#include "vegas_status.h"
 #include "slalib.h"
 
 #include "vegas_defines.h"
@@ -138,10 +139,44 @@ void set_obs_params_gb(char *buf,
 #endif
 
 // Read networking parameters
+void vegas_pipe_key(char *out, const char *key, int pipe) {
+    size_t len = strnlen(key, 8);
+    memcpy(out, key, len);
+    out[len] = '\0';
+    if (pipe > 0) {
+        if (strlen(out) > 7)
+            out[7] = '\0';
+        sprintf(out + strlen(out), "%d", pipe % 10);
+    }
+}
+
 void vegas_read_net_params(char *buf, struct vegas_udp_params *u) {
+    vegas_read_net_params_pipe(buf, u, 0);
+}
+
+void vegas_read_net_params_pipe(char *buf, struct vegas_udp_params *u, int pipe) {
     get_str("DATAHOST", u->sender, 80, "bee2-10");
     get_int("DATAPORT", u->port, 50000);
+    if (pipe > 0) {
+        /* Other pipelines share everything but the source */
+        char key[9];
+        vegas_pipe_key(key, "DATAHOST", pipe);
+        hgets(buf, key, 80, u->sender);
+        vegas_pipe_key(key, "DATAPORT", pipe);
+        get_int(key, u->port, u->port + pipe);
+    }
     get_str("PKTFMT", u->packet_format, 32, "VEGAS");
+    get_int("NETSCATR", u->scatter_recv, 1);
+    {
+        char tstamp[16];
+        get_str("NETTSTMP", tstamp, 16, "software");
+        if (strncasecmp(tstamp, "hardware", 8)==0)
+            u->rx_tstamp = VEGAS_RX_TSTAMP_HARDWARE;
+        else if (strncasecmp(tstamp, "none", 4)==0)
+            u->rx_tstamp = VEGAS_RX_TSTAMP_NONE;
+        else
+            u->rx_tstamp = VEGAS_RX_TSTAMP_SOFTWARE;
+    }
     if (strncmp(u->packet_format, "PARKES", 6)==0)
         u->packet_size = 2056;
     else if (strncmp(u->packet_format, "1SFA", 4)==0)
@@ -168,6 +203,9 @@ void vegas_read_subint_params(char *buf,
                               struct vegas_params *g, 
                               struct psrfits *p)
 {
+    /* Dozens of lookups in one header: index it once rather than
+       scan it for each */
+    struct hindex *index = hindex_open(buf, VEGAS_STATUS_SIZE);
     // Parse packet size, # of packets, etc.
     get_lon("PKTIDX", g->packetindex, -1L);
     get_int("PKTSIZE", g->packetsize, 0);
@@ -235,6 +273,8 @@ void vegas_read_subint_params(char *buf,
              &p->sub.glon, &p->sub.glat);
     p->sub.glon *= RADTODEG;
     p->sub.glat *= RADTODEG;
+
+    hindex_close(index);
 }
 
 #elif FITS_TYPE == SDFITS
@@ -244,6 +284,7 @@ void vegas_read_subint_params(char *buf,
                               struct vegas_params *g, 
                               struct sdfits *sf)
 {
+    struct hindex *index = hindex_open(buf, VEGAS_STATUS_SIZE);
     int i;
     char subxfreq_str[16];
 
@@ -292,6 +333,7 @@ void vegas_read_subint_params(char *buf,
         sf->data_columns.time = (double) lst_secs;
     }
 
+    hindex_close(index);
 }
 
 #endif
@@ -304,6 +346,7 @@ void vegas_read_obs_params(char *buf,
                            struct vegas_params *g, 
                            struct psrfits *p)
 {
+    struct hindex *index = hindex_open(buf, VEGAS_STATUS_SIZE);
     char base[200], dir[200];
 
     // Software data-stream modification params
@@ -490,6 +533,8 @@ void vegas_read_obs_params(char *buf,
     p->hdr.dec2000 = p->sub.dec;
     p->hdr.start_lst = p->sub.lst;
     p->hdr.feed_angle = p->sub.feed_ang;
+
+    hindex_close(index);
 }
 
 #elif FITS_TYPE == SDFITS
@@ -499,6 +544,7 @@ void vegas_read_obs_params(char *buf,
                            struct vegas_params *g, 
                            struct sdfits *sf)
 {
+    struct hindex *index = hindex_open(buf, VEGAS_STATUS_SIZE);
     char base[200], dir[200];
     double temp_double;
     int temp_int;
@@ -579,6 +625,8 @@ void vegas_read_obs_params(char *buf,
     
     // Read information that is appropriate for the subints
     vegas_read_subint_params(buf, g, sf);
+
+    hindex_close(index);
 }
 
 #endif
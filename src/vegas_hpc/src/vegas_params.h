@@ -10,6 +10,10 @@
 #include "vegas_udp.h"
 #include "vegas_defines.h"
 
+/// Most net receive pipelines one process runs, each on its own port
+/// and into its own databuf
+#define VEGAS_MAX_NET_PIPES 4
+
 #ifndef NEW_GBT
 
     /** Packet information for the current block */
@@ -55,7 +59,9 @@ int read_scan_length(char *buf, double *fpgaclk, double *scan_secs);
 
 #include "psrfits.h"
 void vegas_read_obs_mode(const char *buf, char *mode);
+void vegas_pipe_key(char *out, const char *key, int pipe);
 void vegas_read_net_params(char *buf, struct vegas_udp_params *u);
+void vegas_read_net_params_pipe(char *buf, struct vegas_udp_params *u, int pipe);
 void vegas_read_subint_params(char *buf, 
                               struct vegas_params *g, 
                               struct psrfits *p);
@@ -68,7 +74,15 @@ void vegas_free_psrfits(struct psrfits *p);
 
 #include "sdfits.h"
 void vegas_read_obs_mode(const char *buf, char *mode);
+/// Status keyword of a net pipeline: the key itself for pipeline 0,
+/// otherwise the key cut to 7 characters with the pipeline digit appended
+/// (DATAPORT, DATAPOR1, ...).  out must hold 9 characters.
+void vegas_pipe_key(char *out, const char *key, int pipe);
 void vegas_read_net_params(char *buf, struct vegas_udp_params *u);
+/// Net parameters of pipeline pipe.  Pipelines after the first read
+/// their own DATAHOST/DATAPORT keys, defaulting to the first pipeline's
+/// host and the port after it.
+void vegas_read_net_params_pipe(char *buf, struct vegas_udp_params *u, int pipe);
 void vegas_read_subint_params(char *buf, 
                               struct vegas_params *g, 
                               struct sdfits *p);
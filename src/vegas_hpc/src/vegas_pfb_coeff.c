@@ -0,0 +1,396 @@
+/* vegas_pfb_coeff.c
+ *
+ * Generate, cache and read the polyphase filterbank coefficients.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "vegas_error.h"
+#include "vegas_pfb_coeff.h"
+
+/// Samples in the fine part of a cosine table
+#define PFB_GEN_BLOCK 1024
+
+static const char *window_names[VEGAS_PFB_NUM_WIN] =
+{
+    "hanning", "hamming", "blackman", "rect"
+};
+
+static int pfb_window = VEGAS_PFB_WIN_HANNING;
+
+int vegas_pfb_window_parse(const char *name)
+{
+    int i;
+    for (i=0; i<VEGAS_PFB_NUM_WIN; i++)
+        if (strcasecmp(name, window_names[i]) == 0)
+            return i;
+    return -1;
+}
+
+const char *vegas_pfb_window_name(int window)
+{
+    if (window < 0 || window >= VEGAS_PFB_NUM_WIN)
+        return "unknown";
+    return window_names[window];
+}
+
+void vegas_pfb_set_window(int window)
+{
+    if (window >= 0 && window < VEGAS_PFB_NUM_WIN)
+        pfb_window = window;
+}
+
+int vegas_pfb_get_window(void)
+{
+    return pfb_window;
+}
+
+/* cos(step * i) for i in [0, n).  The angle is split into a coarse and a
+   fine part, cos(a + b) = cos a cos b - sin a sin b, so that only about
+   2 sqrt(n) transcendentals are evaluated and the inner loop is plain
+   arithmetic the compiler can vectorise. */
+static void cos_table(double *out, size_t n, double step)
+{
+    double cf[PFB_GEN_BLOCK], sf[PFB_GEN_BLOCK];
+    double ca, sa;
+    size_t j, k, len;
+
+    for (j=0; j<PFB_GEN_BLOCK; j++)
+    {
+        cf[j] = cos(step * j);
+        sf[j] = sin(step * j);
+    }
+    for (k=0; k<n; k+=PFB_GEN_BLOCK)
+    {
+        double *o = out + k;
+        ca = cos(step * k);
+        sa = sin(step * k);
+        len = n - k < PFB_GEN_BLOCK ? n - k : PFB_GEN_BLOCK;
+        for (j=0; j<len; j++)
+            o[j] = ca * cf[j] - sa * sf[j];
+    }
+}
+
+/* The window of length m, as numpy.hanning() and friends define it */
+static void make_window(double *w, size_t m, int window)
+{
+    size_t i;
+
+    if (window == VEGAS_PFB_WIN_RECT || m < 2)
+    {
+        for (i=0; i<m; i++)
+            w[i] = 1.0;
+        return;
+    }
+    cos_table(w, m, 2.0 * M_PI / (m - 1));
+    switch (window)
+    {
+        case VEGAS_PFB_WIN_HAMMING:
+            for (i=0; i<m; i++)
+                w[i] = 0.54 - 0.46 * w[i];
+            break;
+        case VEGAS_PFB_WIN_BLACKMAN:
+            /* cos 2x = 2 cos^2 x - 1 */
+            for (i=0; i<m; i++)
+                w[i] = 0.42 - 0.5 * w[i] + 0.08 * (2.0 * w[i] * w[i] - 1.0);
+            break;
+        default:
+            for (i=0; i<m; i++)
+                w[i] = 0.5 - 0.5 * w[i];
+            break;
+    }
+}
+
+/* Repeat each of n coefficients for every subband */
+static void expand_subbands(float *coeff, const float *one, size_t n,
+                            int nsubband)
+{
+    size_t i;
+    int s;
+
+    for (i=0; i<n; i++)
+        for (s=0; s<nsubband; s++)
+            coeff[i * nsubband + s] = one[i];
+}
+
+int vegas_pfb_gen_coeff(float *coeff, int ntaps, int nchan, int nsubband,
+                        int window)
+{
+    size_t m = (size_t)ntaps * nchan;
+    double half = ntaps / 2.0;
+    double frac = half - floor(half);
+    double *w, *s, *wt, x, sign;
+    float *one;
+    size_t i;
+    int t, c;
+
+    w = (double *)malloc(m * sizeof(double));
+    s = (double *)malloc(nchan * sizeof(double));
+    one = (float *)malloc(m * sizeof(float));
+    if (w == NULL || s == NULL || one == NULL)
+    {
+        free(w);
+        free(s);
+        free(one);
+        vegas_error("vegas_pfb_gen_coeff", "malloc failed");
+        return(VEGAS_ERR_SYS);
+    }
+
+    make_window(w, m, window);
+
+    /* The sinc is sampled at x = t - ntaps/2 + c/nchan.  sin(pi x) only
+       changes sign from one tap to the next, so one table of nchan sines
+       covers all of them. */
+    for (c=0; c<nchan; c++)
+        s[c] = sin(M_PI * ((double)c / nchan - frac));
+    for (t=0; t<ntaps; t++)
+    {
+        sign = ((t - (int)floor(half)) & 1) ? -1.0 : 1.0;
+        wt = w + (size_t)t * nchan;
+        for (c=0; c<nchan; c++)
+        {
+            x = (double)((size_t)t * nchan + c) / nchan - half;
+            wt[c] *= (x == 0.0) ? 1.0 : sign * s[c] / (M_PI * x);
+        }
+    }
+
+    for (i=0; i<m; i++)
+        one[i] = (float)w[i];
+    expand_subbands(coeff, one, m, nsubband);
+
+    free(w);
+    free(s);
+    free(one);
+    return(VEGAS_OK);
+}
+
+unsigned long long vegas_pfb_coeff_checksum(const float *coeff, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)coeff;
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i=0; i<n * sizeof(float); i++)
+    {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* True if a file or directory is ours and no one else can write to it.
+   The cache is trusted, checksum and all, so nothing else may be. */
+static int cache_private(const struct stat *st)
+{
+    return st->st_uid == geteuid() && !(st->st_mode & (S_IWGRP | S_IWOTH));
+}
+
+int vegas_pfb_cache_path(char *path, size_t len, int ntaps, int nchan,
+                         int window)
+{
+    char *cache = getenv("VEGAS_PFB_CACHE");
+    char *vdir = getenv("VEGAS_DIR");
+    char dir[200], msg[300];
+    struct stat st;
+
+    path[0] = '\0';
+    if (cache)
+        snprintf(dir, sizeof(dir), "%s", cache);
+    else if (vdir)
+    {
+        snprintf(dir, sizeof(dir), "%s/cache", vdir);
+        mkdir(dir, 0700);
+    }
+    else
+        return(VEGAS_ERR_SYS);
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode) || !cache_private(&st))
+    {
+        snprintf(msg, sizeof(msg),
+                 "%s is not a directory of ours that only we can write, not caching", dir);
+        vegas_warn("vegas_pfb_cache_path", msg);
+        return(VEGAS_ERR_SYS);
+    }
+    snprintf(path, len, "%s/vegas_pfb_%s_%d_%d.bin", dir,
+             vegas_pfb_window_name(window), ntaps, nchan);
+    return(VEGAS_OK);
+}
+
+/* Read a cached set of coefficients.  Returns VEGAS_ERR_SYS if there is
+   no cache file, and VEGAS_ERR_GEN if it is not the set asked for, is
+   corrupt, or is not a plain file that only we can write. */
+static int read_cache(float *one, int ntaps, int nchan, int window,
+                      const char *path)
+{
+    struct vegas_pfb_cache_hdr hdr;
+    size_t n = (size_t)ntaps * nchan;
+    struct stat st;
+    ssize_t rv;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0)
+        return(errno == ENOENT ? VEGAS_ERR_SYS : VEGAS_ERR_GEN);
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || !cache_private(&st))
+    {
+        close(fd);
+        return(VEGAS_ERR_GEN);
+    }
+    rv = read(fd, &hdr, sizeof(hdr));
+    if (rv != (ssize_t)sizeof(hdr) ||
+        memcmp(hdr.magic, VEGAS_PFB_CACHE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != VEGAS_PFB_CACHE_VERSION || hdr.window != window ||
+        hdr.ntaps != ntaps || hdr.nchan != nchan)
+    {
+        close(fd);
+        return(VEGAS_ERR_GEN);
+    }
+    rv = read(fd, one, n * sizeof(float));
+    close(fd);
+    if (rv != (ssize_t)(n * sizeof(float)) ||
+        vegas_pfb_coeff_checksum(one, n) != hdr.checksum)
+        return(VEGAS_ERR_GEN);
+    return(VEGAS_OK);
+}
+
+/* Write a set of coefficients to the cache.  The file is written under a
+   fresh temporary name and renamed, so that a reader never sees half of
+   it and nothing already at either name is written through. */
+static void write_cache(const float *one, int ntaps, int nchan, int window,
+                        const char *path)
+{
+    struct vegas_pfb_cache_hdr hdr;
+    size_t n = (size_t)ntaps * nchan;
+    char tmp[300], msg[400];
+    int fd, ok;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, VEGAS_PFB_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = VEGAS_PFB_CACHE_VERSION;
+    hdr.window = window;
+    hdr.ntaps = ntaps;
+    hdr.nchan = nchan;
+    hdr.checksum = vegas_pfb_coeff_checksum(one, n);
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    fd = mkstemp(tmp);
+    if (fd < 0)
+    {
+        snprintf(msg, sizeof(msg), "Could not create %s: %s", tmp, strerror(errno));
+        vegas_warn("vegas_pfb_read_coeff", msg);
+        return;
+    }
+    ok = fchmod(fd, 0644) == 0 &&
+         write(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) &&
+         write(fd, one, n * sizeof(float)) == (ssize_t)(n * sizeof(float));
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(tmp, path) != 0)
+    {
+        snprintf(msg, sizeof(msg), "Could not write %s: %s", path, strerror(errno));
+        vegas_warn("vegas_pfb_read_coeff", msg);
+        unlink(tmp);
+    }
+}
+
+int vegas_pfb_read_coeff(float *coeff, int ntaps, int nchan, int nsubband)
+{
+    size_t n = (size_t)ntaps * nchan;
+    int window = pfb_window;
+    char path[256], msg[320];
+    float *one;
+    int rv, cached;
+
+    one = (float *)malloc(n * sizeof(float));
+    if (one == NULL)
+    {
+        vegas_error("vegas_pfb_read_coeff", "malloc failed");
+        return(VEGAS_ERR_SYS);
+    }
+
+    cached = vegas_pfb_cache_path(path, sizeof(path), ntaps, nchan, window) == VEGAS_OK;
+    rv = cached ? read_cache(one, ntaps, nchan, window, path) : VEGAS_ERR_SYS;
+    if (rv != VEGAS_OK)
+    {
+        if (rv == VEGAS_ERR_GEN)
+        {
+            snprintf(msg, sizeof(msg),
+                     "%s is stale, corrupt or not only ours, regenerating", path);
+            vegas_warn("vegas_pfb_read_coeff", msg);
+        }
+        rv = vegas_pfb_gen_coeff(one, ntaps, nchan, 1, window);
+        if (rv != VEGAS_OK)
+        {
+            free(one);
+            return(rv);
+        }
+        if (cached)
+            write_cache(one, ntaps, nchan, window, path);
+        printf("Generated %s PFB coefficients for %d taps x %d channels\n",
+               vegas_pfb_window_name(window), ntaps, nchan);
+    }
+
+    expand_subbands(coeff, one, n, nsubband);
+    free(one);
+    return(VEGAS_OK);
+}
+
+void vegas_pfb_coeff_dir(char *dir, size_t len)
+{
+    char *ygor_root = getenv("YGOR_TELESCOPE");
+    char *vdir_root = getenv("VEGAS_DIR");
+    char *config_root = getenv("CONFIG_DIR");
+
+    if (ygor_root)
+        snprintf(dir, len, "%s/etc/config", ygor_root);
+    else if (config_root)
+        snprintf(dir, len, "%s", config_root);
+    else if (vdir_root)
+        snprintf(dir, len, "%s", vdir_root);
+    else
+        snprintf(dir, len, ".");
+}
+
+void vegas_pfb_coeff_path(char *path, size_t len, int ntaps, int nchan,
+                          int nsubband)
+{
+    char dir[128];
+
+    vegas_pfb_coeff_dir(dir, sizeof(dir));
+    snprintf(path, len, "%s/%s_%s_%d_%d_%d%s", dir,
+             VEGAS_PFB_COEFF_PREFIX, VEGAS_PFB_COEFF_DATATYPE,
+             ntaps, nchan, nsubband, VEGAS_PFB_COEFF_SUFFIX);
+}
+
+int vegas_pfb_read_coeff_file(float *coeff, int ntaps, int nchan, int nsubband)
+{
+    char path[256], msg[320];
+    size_t size = (size_t)ntaps * nchan * nsubband * sizeof(float);
+    ssize_t rv;
+    int fd;
+
+    vegas_pfb_coeff_path(path, sizeof(path), ntaps, nchan, nsubband);
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        snprintf(msg, sizeof(msg), "Opening filter coefficients file %s failed: %s",
+                 path, strerror(errno));
+        vegas_error("vegas_pfb_read_coeff_file", msg);
+        return(VEGAS_ERR_SYS);
+    }
+    rv = read(fd, coeff, size);
+    close(fd);
+    if (rv != (ssize_t)size)
+    {
+        snprintf(msg, sizeof(msg), "Reading filter coefficients from %s failed "
+                 "(%zd of %zu bytes)", path, rv, size);
+        vegas_error("vegas_pfb_read_coeff_file", msg);
+        return(VEGAS_ERR_SYS);
+    }
+    return(VEGAS_OK);
+}
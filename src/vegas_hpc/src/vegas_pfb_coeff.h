@@ -0,0 +1,103 @@
+/** vegas_pfb_coeff.h
+ *
+ * Polyphase filterbank coefficients, shared by the GPU and CPU PFB
+ * engines.  The coefficients are a windowed sinc, ntaps * nchan long,
+ * generated at startup for whatever geometry and window a mode asks for
+ * and kept in a local cache so that the next start only has to read them.
+ *
+ * The cache lives in $VEGAS_PFB_CACHE, or $VEGAS_DIR/cache, which is
+ * made if need be; with neither, nothing is cached.  The directory and
+ * its files are only used if they are ours and no one else can write to
+ * them.  Each file holds one (window, ntaps, nchan) set with a checksum;
+ * a file that does not match its header or checksum is regenerated.
+ *
+ * The files VEGAS used to ship, coeff_float_<ntaps>_<nchan>_<nsubband>.dat
+ * in $YGOR_TELESCOPE/etc/config, $CONFIG_DIR or $VEGAS_DIR, are no longer
+ * needed, but can still be read for comparison with the generator.
+ */
+#ifndef _VEGAS_PFB_COEFF_H
+#define _VEGAS_PFB_COEFF_H
+
+#include <stddef.h>
+
+#define VEGAS_PFB_COEFF_PREFIX   "coeff"
+#define VEGAS_PFB_COEFF_DATATYPE "float"
+#define VEGAS_PFB_COEFF_SUFFIX   ".dat"
+
+/* Windows applied to the sinc */
+#define VEGAS_PFB_WIN_HANNING  0 ///< What the shipped files used
+#define VEGAS_PFB_WIN_HAMMING  1
+#define VEGAS_PFB_WIN_BLACKMAN 2
+#define VEGAS_PFB_WIN_RECT     3
+#define VEGAS_PFB_NUM_WIN      4
+
+#define VEGAS_PFB_CACHE_MAGIC   "VEGASPFB"
+#define VEGAS_PFB_CACHE_VERSION 1
+
+/** Header of a cache file, followed by ntaps * nchan floats */
+struct vegas_pfb_cache_hdr {
+    char magic[8];              ///< VEGAS_PFB_CACHE_MAGIC
+    int  version;               ///< VEGAS_PFB_CACHE_VERSION
+    int  window;
+    int  ntaps;
+    int  nchan;
+    unsigned long long checksum; ///< FNV-1a of the coefficients
+};
+
+#ifdef __cplusplus /* C++ prototypes */
+extern "C" {
+#endif
+
+/** Window number for a name such as "hanning", or -1 if it is unknown */
+int vegas_pfb_window_parse(const char *name);
+
+/** Name of a window */
+const char *vegas_pfb_window_name(int window);
+
+/** Set the window used by vegas_pfb_read_coeff(), from the PFBWIN status
+ * keyword.  Engines already set up keep their coefficients until they
+ * next check their setup.
+ */
+void vegas_pfb_set_window(int window);
+int vegas_pfb_get_window(void);
+
+/** Generate the ntaps * nchan * nsubband coefficients for a geometry
+ * into coeff, laid out [tap][chan][subband].  Each coefficient is
+ * repeated for every subband.
+ */
+int vegas_pfb_gen_coeff(float *coeff, int ntaps, int nchan, int nsubband,
+                        int window);
+
+/** Checksum of n coefficients, as kept in the cache */
+unsigned long long vegas_pfb_coeff_checksum(const float *coeff, size_t n);
+
+/** Write the name of the cache file for a set of coefficients into path.
+ * Returns VEGAS_ERR_SYS, with path empty, if there is no cache directory
+ * fit to use.
+ */
+int vegas_pfb_cache_path(char *path, size_t len, int ntaps, int nchan,
+                         int window);
+
+/** Fill coeff with the coefficients for a geometry and the current
+ * window, from the cache if it holds them and from the generator, which
+ * then updates the cache, if not.
+ */
+int vegas_pfb_read_coeff(float *coeff, int ntaps, int nchan, int nsubband);
+
+/** Write the directory searched for coefficient files into dir */
+void vegas_pfb_coeff_dir(char *dir, size_t len);
+
+/** Write the name of the coefficient file for a geometry into path */
+void vegas_pfb_coeff_path(char *path, size_t len, int ntaps, int nchan,
+                          int nsubband);
+
+/** Read the ntaps * nchan * nsubband coefficients for a geometry from a
+ * coefficient file into coeff, laid out [tap][chan][subband].
+ */
+int vegas_pfb_read_coeff_file(float *coeff, int ntaps, int nchan, int nsubband);
+
+#ifdef __cplusplus /* C++ prototypes */
+}
+#endif
+
+#endif
@@ -0,0 +1,177 @@
+/* vegas_pfb_kernels.c
+ *
+ * CPU polyphase filterbank kernels, with runtime selection of the widest
+ * instruction set available.  Every product and sum is done in the same
+ * order as the scalar loop, so all the kernels give bit-identical results.
+ */
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "vegas_pfb_kernels.h"
+
+typedef void (*pfb_fir_fn)(float *, const int8_t *, const float *, int, size_t,
+                           size_t, size_t);
+typedef void (*pfb_stokes_fn)(float *, const float *, size_t, size_t);
+
+static pfb_fir_fn pfb_fir_kernel = NULL;
+static pfb_stokes_fn pfb_stokes_kernel = NULL;
+static const char *pfb_name = "none";
+
+void vegas_pfb_fir_scalar(float *out, const int8_t *in, const float *coeff,
+                          int ntaps, size_t n, size_t i0, size_t i1)
+{
+    const int8_t *d;
+    float c, x, y, z, w;
+    size_t i;
+    int j;
+
+    for (i=i0; i<i1; ++i)
+    {
+        x = y = z = w = 0.0f;
+        for (j=0; j<ntaps; ++j)
+        {
+            c = coeff[j*n + i];
+            d = in + 4*(j*n + i);
+            x += (float)d[0] * c;
+            y += (float)d[1] * c;
+            z += (float)d[2] * c;
+            w += (float)d[3] * c;
+        }
+        out[4*i]   = x;
+        out[4*i+1] = y;
+        out[4*i+2] = z;
+        out[4*i+3] = w;
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256 pfb_load_samples(const int8_t *d)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)d)));
+}
+
+__attribute__((target("avx2")))
+void vegas_pfb_fir_avx2(float *out, const int8_t *in, const float *coeff,
+                        int ntaps, size_t n, size_t i0, size_t i1)
+{
+    const __m256i idx0 = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+    const __m256i idx1 = _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3);
+    const __m256i idx2 = _mm256_setr_epi32(4, 4, 4, 4, 5, 5, 5, 5);
+    const __m256i idx3 = _mm256_setr_epi32(6, 6, 6, 6, 7, 7, 7, 7);
+    size_t i = i0, k;
+    int j;
+
+    // Eight samples, two per register, against eight coefficients
+    for (; i + 8 <= i1; i += 8)
+    {
+        __m256 a0 = _mm256_setzero_ps();
+        __m256 a1 = _mm256_setzero_ps();
+        __m256 a2 = _mm256_setzero_ps();
+        __m256 a3 = _mm256_setzero_ps();
+        for (j=0; j<ntaps; ++j)
+        {
+            k = j*n + i;
+            __m256 c = _mm256_loadu_ps(coeff + k);
+            const int8_t *d = in + 4*k;
+            a0 = _mm256_add_ps(a0, _mm256_mul_ps(pfb_load_samples(d),
+                                                 _mm256_permutevar8x32_ps(c, idx0)));
+            a1 = _mm256_add_ps(a1, _mm256_mul_ps(pfb_load_samples(d + 8),
+                                                 _mm256_permutevar8x32_ps(c, idx1)));
+            a2 = _mm256_add_ps(a2, _mm256_mul_ps(pfb_load_samples(d + 16),
+                                                 _mm256_permutevar8x32_ps(c, idx2)));
+            a3 = _mm256_add_ps(a3, _mm256_mul_ps(pfb_load_samples(d + 24),
+                                                 _mm256_permutevar8x32_ps(c, idx3)));
+        }
+        _mm256_storeu_ps(out + 4*i,      a0);
+        _mm256_storeu_ps(out + 4*i + 8,  a1);
+        _mm256_storeu_ps(out + 4*i + 16, a2);
+        _mm256_storeu_ps(out + 4*i + 24, a3);
+    }
+    vegas_pfb_fir_scalar(out, in, coeff, ntaps, n, i, i1);
+}
+
+void vegas_pfb_stokes_scalar(float *sum, const float *spec, size_t i0, size_t i1)
+{
+    float x, y, z, w;
+    size_t i;
+
+    for (i=i0; i<i1; ++i)
+    {
+        x = spec[4*i];
+        y = spec[4*i+1];
+        z = spec[4*i+2];
+        w = spec[4*i+3];
+        sum[4*i]   += (x * x) + (y * y);
+        sum[4*i+1] += (z * z) + (w * w);
+        sum[4*i+2] += (x * z) + (y * w);
+        sum[4*i+3] += (y * z) - (x * w);
+    }
+}
+
+/// The Stokes products of the two samples in a register.  The squares and
+/// the products [xz, yw, zy, -wx] are summed pairwise by one hadd, and
+/// y*z + -(w*x) rounds exactly as y*z - x*w does.
+__attribute__((target("avx2")))
+static inline __m256 pfb_stokes2(__m256 a)
+{
+    const __m256 neg3 = _mm256_setr_ps(0.0f, 0.0f, 0.0f, -0.0f,
+                                       0.0f, 0.0f, 0.0f, -0.0f);
+    __m256 b = _mm256_xor_ps(_mm256_permute_ps(a, _MM_SHUFFLE(0, 1, 3, 2)), neg3);
+    return _mm256_hadd_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(a, b));
+}
+
+__attribute__((target("avx2")))
+void vegas_pfb_stokes_avx2(float *sum, const float *spec, size_t i0, size_t i1)
+{
+    size_t i = i0;
+
+    for (; i + 4 <= i1; i += 4)
+    {
+        __m256 a = pfb_stokes2(_mm256_loadu_ps(spec + 4*i));
+        __m256 b = pfb_stokes2(_mm256_loadu_ps(spec + 4*i + 8));
+        _mm256_storeu_ps(sum + 4*i,     _mm256_add_ps(_mm256_loadu_ps(sum + 4*i), a));
+        _mm256_storeu_ps(sum + 4*i + 8, _mm256_add_ps(_mm256_loadu_ps(sum + 4*i + 8), b));
+    }
+    vegas_pfb_stokes_scalar(sum, spec, i, i1);
+}
+
+static void pfb_select_kernel(void)
+{
+    __builtin_cpu_init();
+    /* Both kernels are bound by memory well before AVX-512 would help */
+    if (__builtin_cpu_supports("avx2"))
+    {
+        pfb_name = "avx2";
+        pfb_fir_kernel = vegas_pfb_fir_avx2;
+        pfb_stokes_kernel = vegas_pfb_stokes_avx2;
+    }
+    else
+    {
+        pfb_name = "scalar";
+        pfb_fir_kernel = vegas_pfb_fir_scalar;
+        pfb_stokes_kernel = vegas_pfb_stokes_scalar;
+    }
+}
+
+void vegas_pfb_fir(float *out, const int8_t *in, const float *coeff,
+                   int ntaps, size_t n, size_t i0, size_t i1)
+{
+    // The selection is idempotent, so a race between threads is harmless
+    if (pfb_fir_kernel == NULL)
+        pfb_select_kernel();
+    pfb_fir_kernel(out, in, coeff, ntaps, n, i0, i1);
+}
+
+void vegas_pfb_stokes(float *sum, const float *spec, size_t i0, size_t i1)
+{
+    if (pfb_stokes_kernel == NULL)
+        pfb_select_kernel();
+    pfb_stokes_kernel(sum, spec, i0, i1);
+}
+
+const char *vegas_pfb_kernel_name(void)
+{
+    if (pfb_fir_kernel == NULL)
+        pfb_select_kernel();
+    return pfb_name;
+}
@@ -0,0 +1,51 @@
+/** vegas_pfb_kernels.h
+ *
+ * Kernels for the CPU polyphase filterbank: the FIR stage feeding the FFT,
+ * and the Stokes products of the FFT output summed into the accumulator.
+ * They are the host equivalents of DoPFB and Accumulate in
+ * pfb_gpu_kernels.cu and work on the same data layout.  The widest kernel
+ * the cpu supports (AVX2 or scalar) is selected on first use.
+ *
+ * A sample is four values, Re(X), Im(X), Re(Y), Im(Y), and one spectrum
+ * is n = nchan * nsubband samples laid out [chan][subband].
+ */
+#ifndef _VEGAS_PFB_KERNELS_H
+#define _VEGAS_PFB_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus /* C++ prototypes */
+extern "C" {
+#endif
+
+/** Filter samples i0 to i1-1 of a spectrum:
+ * out[i] = sum over taps j of in[j*n + i] * coeff[j*n + i],
+ * with in the 8 bit input samples and out complex float pairs.
+ */
+void vegas_pfb_fir(float *out, const int8_t *in, const float *coeff,
+                   int ntaps, size_t n, size_t i0, size_t i1);
+
+/** Add the Stokes products of samples i0 to i1-1 of an FFT output
+ * spectrum into sum:  XX*, YY*, Re(XY*) and Im(XY*).
+ */
+void vegas_pfb_stokes(float *sum, const float *spec, size_t i0, size_t i1);
+
+/** The individual kernels, exposed for testing and benchmarking.
+ * Calling a SIMD kernel on a cpu without the instruction set is fatal.
+ */
+void vegas_pfb_fir_scalar(float *out, const int8_t *in, const float *coeff,
+                          int ntaps, size_t n, size_t i0, size_t i1);
+void vegas_pfb_fir_avx2(float *out, const int8_t *in, const float *coeff,
+                        int ntaps, size_t n, size_t i0, size_t i1);
+void vegas_pfb_stokes_scalar(float *sum, const float *spec, size_t i0, size_t i1);
+void vegas_pfb_stokes_avx2(float *sum, const float *spec, size_t i0, size_t i1);
+
+/** Return the name of the kernels in use */
+const char *vegas_pfb_kernel_name(void);
+
+#ifdef __cplusplus /* C++ prototypes */
+}
+#endif
+
+#endif
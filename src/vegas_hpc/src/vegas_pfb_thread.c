@@ -21,6 +21,7 @@
 #include "vegas_databuf.h"
 #include "vegas_params.h"
 #include "pfb_gpu.h"
+#include "vegas_pfb_coeff.h"
 #include "spead_heap.h"
 
 #define STATUS_KEY "GPUSTAT"
@@ -81,6 +82,10 @@ void vegas_pfb_thread(void *_args) {
     hputs(st.buf, STATUS_KEY, "init");
     vegas_status_unlock_safe(&st);
 
+    /* Per block status, published by the stats flusher */
+    struct vegas_stat *stat_state = vegas_stat_register(STATUS_KEY, VEGAS_STAT_STR);
+    struct vegas_stat *stat_blkin = vegas_stat_register("PFBBLKIN", VEGAS_STAT_INT);
+
     /* Init structs */
     struct vegas_params gp;
     struct sdfits sf;
@@ -119,6 +124,9 @@ void vegas_pfb_thread(void *_args) {
     int packet_compression = 0;
     char mdname[80];
     int num_blocks_needed = 1;
+    int merge_threads = 1;
+    int pfb_threads = 1;
+    struct l8lbw1_merge_team merge_team;
     
     signal(SIGINT,cc);
     
@@ -138,6 +146,14 @@ void vegas_pfb_thread(void *_args) {
     {
         fprintf(stderr, "WARNING: %s not in status shm! Using computed value\n", "ACC_LEN");
     }    
+    if (hgeti4(st.buf, "PFBTHRDS", &pfb_threads)==0)
+    {
+        pfb_threads = 1;
+    }
+    if (hgeti4(st.buf, "MRGTHRDS", &merge_threads)==0)
+    {
+        merge_threads = 1;
+    }
     if (hgets(st.buf, "MODENAME", sizeof(mdname), mdname)) 
     {
         if (strcmp(mdname, "l8/lbw1") == 0 && g_use_L8_packets_for_L1_modes)
@@ -145,8 +161,16 @@ void vegas_pfb_thread(void *_args) {
             packet_compression = 1;
         }
     }
+    if (hgets(st.buf, "PFBWIN", sizeof(mdname), mdname))
+    {
+        if (vegas_pfb_window_parse(mdname) < 0)
+            fprintf(stderr, "WARNING: Unknown PFBWIN %s, keeping %s\n", mdname,
+                    vegas_pfb_window_name(vegas_pfb_get_window()));
+        vegas_pfb_set_window(vegas_pfb_window_parse(mdname));
+    }
         
     vegas_status_unlock_safe(&st);
+    set_pfb_threads(pfb_threads);
     if (EXIT_SUCCESS != reset_state(db_in->block_size,
                                     db_out->block_size,
                                     nsubband,
@@ -160,13 +184,14 @@ void vegas_pfb_thread(void *_args) {
     {
         num_blocks_needed = 8;
     }
+    /* MRGTHRDS threads share the merging of l8/lbw8 blocks */
+    l8lbw1_merge_team_init(&merge_team, packet_compression ? merge_threads : 1);
+    pthread_cleanup_push((void *)l8lbw1_merge_team_destroy, &merge_team);
 
     while (run) {
 
         /* Note waiting status */
-        vegas_status_lock_safe(&st);
-        hputs(st.buf, STATUS_KEY, "waiting");
-        vegas_status_unlock_safe(&st);
+        vegas_stat_set_str(stat_state, "waiting");
 
         int full_blocks[MULTIPLE_BLOCKS], free_blk, nextblk = curblock_in;
         /* Wait for buf to have data */
@@ -185,10 +210,8 @@ void vegas_pfb_thread(void *_args) {
         }
 
         /* Note waiting status, current input block */
-        vegas_status_lock_safe(&st);
-        hputs(st.buf, STATUS_KEY, "processing");
-        hputi4(st.buf, "PFBBLKIN", curblock_in);
-        vegas_status_unlock_safe(&st);
+        vegas_stat_set_str(stat_state, "processing");
+        vegas_stat_set_int(stat_blkin, curblock_in);
 
         hdr_in = vegas_databuf_header(db_in, curblock_in);
 
@@ -196,7 +219,7 @@ void vegas_pfb_thread(void *_args) {
         // 1 or 4 l8lbw8 input blocks
         if (packet_compression)
         {            
-            fixup_l8lbw1_block_merge(db_in, full_blocks);
+            fixup_l8lbw1_block_merge_team(&merge_team, db_in, full_blocks);
         }
         
         /* Get params */
@@ -234,6 +257,7 @@ void vegas_pfb_thread(void *_args) {
     //cudaThreadExit();
     pthread_exit(NULL);
 
+    pthread_cleanup_pop(0); /* Closes l8lbw1_merge_team_destroy */
     pthread_cleanup_pop(0); /* Closes vegas_databuf_detach(out) */
     pthread_cleanup_pop(0); /* Closes vegas_databuf_detach(in) */
     pthread_cleanup_pop(0); /* Closes vegas_free_sdfits */
@@ -21,6 +21,7 @@
 #include "vegas_status.h"
 #include "vegas_databuf.h"
 #include "spead_heap.h"
+#include "vegas_accum_kernels.h"
 
 #define STATUS_KEY "DISKSTAT"
 #include "vegas_threads.h"
@@ -35,6 +36,26 @@ extern void vegas_read_subint_params(char *buf,
                                      struct vegas_params *g,
                                      struct sdfits *sf);
 
+/* An accumulator run with ACCORDER=FITS hands over its spectra in
+ * SDFITS [subband][stokes][chan] order; this writer writes them in
+ * payload [chan][subband][stokes] order, so put them back. */
+static void fits_to_chan_order(float *out, const float *in, int nchan,
+                               int nsubband) {
+    const int stride = nsubband * VEGAS_ACCUM_NSTOKES;
+    int s, p, c;
+    for (s=0; s<nsubband; s++)
+        for (p=0; p<VEGAS_ACCUM_NSTOKES; p++) {
+            const float *i = in + (s * VEGAS_ACCUM_NSTOKES + p) * nchan;
+            float *o = out + s * VEGAS_ACCUM_NSTOKES + p;
+            for (c=0; c<nchan; c++)
+                o[c * stride] = i[c];
+        }
+}
+
+static void free_order_buf(float **buf) {
+    free(*buf);
+    *buf = NULL;
+}
 
 void vegas_sdfits_thread(void *_args) {
     
@@ -71,11 +92,18 @@ void vegas_sdfits_thread(void *_args) {
         pthread_exit(NULL);
     }
     pthread_cleanup_push((void *)vegas_status_detach, &st);
-    pthread_cleanup_push((void *)set_exit_status, &st);
+    /* The keywords carry the net pipeline's number after the first */
+    struct vegas_thread_state ts;
+    char blkin_key[9], filenum_key[9], expwr_key[9];
+    vegas_thread_state_init(&ts, &st, args->pipe);
+    vegas_pipe_key(blkin_key, "DSKBLKIN", args->pipe);
+    vegas_pipe_key(filenum_key, "FILENUM", args->pipe);
+    vegas_pipe_key(expwr_key, "DSKEXPWR", args->pipe);
+    pthread_cleanup_push((void *)set_pipe_exit_status, &ts);
     
     /* Init status */
     vegas_status_lock_safe(&st);
-    hputs(st.buf, STATUS_KEY, "init");
+    hputs(st.buf, ts.key, "init");
     vegas_status_unlock_safe(&st);
     
     /* Initialize some key parameters */
@@ -107,6 +135,10 @@ void vegas_sdfits_thread(void *_args) {
     int scan_finished=0, old_filenum;
     int num_exposures_written = 0;
     int old_integ_num = -1;
+    char accum_order[16];
+    float *order_buf = NULL;
+    size_t order_len = 0;
+    pthread_cleanup_push((void *)free_order_buf, &order_buf);
 
     signal(SIGINT, cc);
     do {
@@ -116,7 +148,7 @@ void vegas_sdfits_thread(void *_args) {
             sprintf(tmpstr, "waiting(%d)", curblock);
         else
             sprintf(tmpstr, "ready");
-        hputs(st.buf, STATUS_KEY, tmpstr);
+        hputs(st.buf, ts.key, tmpstr);
         vegas_status_unlock_safe(&st);
         
         /* Wait for buf to have data */
@@ -130,7 +162,7 @@ void vegas_sdfits_thread(void *_args) {
 
         /* Note current block */
         vegas_status_lock_safe(&st);
-        hputi4(st.buf, "DSKBLKIN", curblock);
+        hputi4(st.buf, blkin_key, curblock);
         vegas_status_unlock_safe(&st);
 
         /* See how full databuf is */
@@ -140,14 +172,22 @@ void vegas_sdfits_thread(void *_args) {
         ptr = vegas_databuf_header(db, curblock);
         if (firsttime) {
             vegas_read_obs_params(ptr, &gp, &sf);
+            /* Each pipeline writes its own files */
+            if (args->pipe > 0) {
+                size_t len = strlen(sf.basefilename);
+                snprintf(sf.basefilename + len, sizeof(sf.basefilename) - len,
+                         "_p%d", args->pipe);
+            }
             firsttime = 0;
         } else {
             vegas_read_subint_params(ptr, &gp, &sf);
         }
+        if (hgets(ptr, "ACCORDER", sizeof(accum_order), accum_order) == 0)
+            strcpy(accum_order, "CHAN");
 
         /* Note waiting status */
         vegas_status_lock_safe(&st);
-        hputs(st.buf, STATUS_KEY, "writing");
+        hputs(st.buf, ts.key, "writing");
         vegas_status_unlock_safe(&st);
 
         struct sdfits_data_columns* data_cols;
@@ -162,6 +202,22 @@ void vegas_sdfits_thread(void *_args) {
                         db_index->disk_buf[dataset].struct_offset);
 
             sf.data_columns = *data_cols;
+            if (strcmp(accum_order, "FITS") == 0) {
+                size_t n = (size_t)sf.hdr.nchan * sf.hdr.nsubband * VEGAS_ACCUM_NSTOKES;
+                if (n > order_len) {
+                    free(order_buf);
+                    order_buf = (float *)malloc(n * sizeof(float));
+                    if (order_buf == NULL) {
+                        vegas_error("vegas_sdfits_thread",
+                                    "Error allocating the reorder buffer.");
+                        pthread_exit(NULL);
+                    }
+                    order_len = n;
+                }
+                fits_to_chan_order(order_buf, (const float *)data_cols->data,
+                                   sf.hdr.nchan, sf.hdr.nsubband);
+                sf.data_columns.data = (unsigned char *)order_buf;
+            }
 
             /* Write the data */
             old_filenum = sf.filenum;
@@ -171,7 +227,7 @@ void vegas_sdfits_thread(void *_args) {
             if(sf.filenum != old_filenum)
             {
                 vegas_status_lock_safe(&st);
-                hputi4(st.buf, "FILENUM", sf.filenum);
+                hputi4(st.buf, filenum_key, sf.filenum);
                 vegas_status_unlock_safe(&st);
             }
 
@@ -186,7 +242,7 @@ void vegas_sdfits_thread(void *_args) {
 
         /* Indicate number of exposures written */
         vegas_status_lock_safe(&st);
-        hputi4(st.buf, "DSKEXPWR", num_exposures_written);
+        hputi4(st.buf, expwr_key, num_exposures_written);
         vegas_status_unlock_safe(&st);
 
         /* For debugging... */
@@ -209,9 +265,10 @@ void vegas_sdfits_thread(void *_args) {
     /* Cleanup */
     pthread_exit(NULL);
     
+    pthread_cleanup_pop(0); /* Closes free_order_buf */
     pthread_cleanup_pop(0); /* Closes sdfits_close */
     pthread_cleanup_pop(0); /* Closes vegas_free_sdfits */
-    pthread_cleanup_pop(0); /* Closes set_exit_status */
+    pthread_cleanup_pop(0); /* Closes set_pipe_exit_status */
     pthread_cleanup_pop(0); /* Closes set_finished */
     pthread_cleanup_pop(0); /* Closes vegas_status_detach */
     pthread_cleanup_pop(0); /* Closes vegas_databuf_detach */
@@ -0,0 +1,127 @@
+/* vegas_spead_capture.c
+ *
+ * Reading and writing of SPEAD packet capture files.
+ * See vegas_spead_capture.h for the file layout.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vegas_spead_capture.h"
+#include "vegas_error.h"
+
+int vegas_capture_write_hdr(FILE *f, int is_hbw)
+{
+    struct vegas_capture_file_hdr h;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, VEGAS_CAPTURE_MAGIC, sizeof(h.magic));
+    h.version = VEGAS_CAPTURE_VERSION;
+    h.is_hbw = is_hbw;
+    if (fwrite(&h, sizeof(h), 1, f) != 1)
+    {
+        vegas_error("vegas_capture_write_hdr", "Error writing capture file header");
+        return(VEGAS_ERR_SYS);
+    }
+    return(VEGAS_OK);
+}
+
+int vegas_capture_write_pkt(FILE *f, const struct timespec *ts,
+                            const char *data, uint32_t len)
+{
+    static const char pad[VEGAS_CAPTURE_ALIGN];
+    struct vegas_capture_pkt_hdr h;
+    size_t npad = VEGAS_CAPTURE_PADDED(len) - len;
+
+    h.sec = ts->tv_sec;
+    h.nsec = ts->tv_nsec;
+    h.len = len;
+    if (fwrite(&h, sizeof(h), 1, f) != 1 || fwrite(data, 1, len, f) != len ||
+        fwrite(pad, 1, npad, f) != npad)
+    {
+        vegas_error("vegas_capture_write_pkt", "Error writing capture file");
+        return(VEGAS_ERR_SYS);
+    }
+    return(VEGAS_OK);
+}
+
+int vegas_capture_open(struct vegas_capture *c, const char *filename)
+{
+    struct stat st;
+    const struct vegas_capture_file_hdr *fh;
+    const struct vegas_capture_pkt_hdr *ph, **pkt;
+    size_t off, nalloc;
+    int fd;
+
+    memset(c, 0, sizeof(*c));
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        vegas_error("vegas_capture_open", "Error opening capture file");
+        return(VEGAS_ERR_SYS);
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*fh))
+    {
+        vegas_error("vegas_capture_open", "Capture file is too short");
+        close(fd);
+        return(VEGAS_ERR_GEN);
+    }
+    c->map_size = st.st_size;
+    c->map = mmap(NULL, c->map_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (c->map == MAP_FAILED)
+    {
+        c->map = NULL;
+        vegas_error("vegas_capture_open", "Error mapping capture file");
+        return(VEGAS_ERR_SYS);
+    }
+
+    fh = (const struct vegas_capture_file_hdr *)c->map;
+    if (memcmp(fh->magic, VEGAS_CAPTURE_MAGIC, sizeof(fh->magic)) != 0 ||
+        fh->version != VEGAS_CAPTURE_VERSION)
+    {
+        vegas_error("vegas_capture_open", fh->version == 1 &&
+                    memcmp(fh->magic, VEGAS_CAPTURE_MAGIC, sizeof(fh->magic)) == 0 ?
+                    "Capture file is of an old version, record it again" :
+                    "Not a VEGAS capture file");
+        vegas_capture_close(c);
+        return(VEGAS_ERR_GEN);
+    }
+    c->is_hbw = fh->is_hbw;
+
+    /* Index the records.  The last one's padding may be missing. */
+    nalloc = 0;
+    for (off = sizeof(*fh); off + sizeof(*ph) <= c->map_size;
+         off += sizeof(*ph) + VEGAS_CAPTURE_PADDED(ph->len))
+    {
+        ph = (const struct vegas_capture_pkt_hdr *)(c->map + off);
+        if (off + sizeof(*ph) + ph->len > c->map_size)
+            break;
+        if (c->npkt == nalloc)
+        {
+            nalloc = nalloc ? 2*nalloc : 65536;
+            pkt = realloc(c->pkt, nalloc * sizeof(*c->pkt));
+            if (pkt == NULL)
+            {
+                vegas_error("vegas_capture_open", "Error allocating packet index");
+                vegas_capture_close(c);
+                return(VEGAS_ERR_SYS);
+            }
+            c->pkt = pkt;
+        }
+        c->pkt[c->npkt++] = ph;
+    }
+    return(VEGAS_OK);
+}
+
+void vegas_capture_close(struct vegas_capture *c)
+{
+    if (c->map)
+        munmap(c->map, c->map_size);
+    free(c->pkt);
+    memset(c, 0, sizeof(*c));
+}
@@ -0,0 +1,78 @@
+/** vegas_spead_capture.h
+ *
+ * File format and routines shared by the SPEAD packet recorder and
+ * replayer (vegas_spead_record, vegas_spead_replay).
+ *
+ * A capture file is a vegas_capture_file_hdr followed by one record per
+ * packet: a vegas_capture_pkt_hdr holding the arrival time and length,
+ * then the packet exactly as it came off the wire (network byte order),
+ * padded with zeros to a multiple of VEGAS_CAPTURE_ALIGN bytes so that
+ * every record header is aligned in the mapped file.  All header fields
+ * are stored in host byte order.
+ */
+#ifndef _VEGAS_SPEAD_CAPTURE_H
+#define _VEGAS_SPEAD_CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define VEGAS_CAPTURE_MAGIC   "VEGASPCP"
+#define VEGAS_CAPTURE_VERSION 2 ///< 1 had unpadded records
+#define VEGAS_CAPTURE_ALIGN   8
+
+/** Bytes a packet of len bytes takes up in its record, padding included */
+#define VEGAS_CAPTURE_PADDED(len) \
+    (((len) + VEGAS_CAPTURE_ALIGN - 1) & ~(size_t)(VEGAS_CAPTURE_ALIGN - 1))
+
+/** Start of a capture file */
+struct vegas_capture_file_hdr {
+    char magic[8];     /**< VEGAS_CAPTURE_MAGIC, not nul terminated */
+    uint32_t version;  /**< VEGAS_CAPTURE_VERSION */
+    uint32_t is_hbw;   /**< Non-zero if recorded from a HBW (SPEAD) stream */
+};
+
+/** Start of each packet record */
+struct vegas_capture_pkt_hdr {
+    int64_t sec;       /**< Arrival time (UTC), seconds */
+    uint32_t nsec;     /**< Arrival time, nanoseconds */
+    uint32_t len;      /**< Packet length in bytes */
+};
+
+/** A capture file mapped for reading */
+struct vegas_capture {
+    char *map;         /**< Mapped file contents */
+    size_t map_size;   /**< Mapped size in bytes */
+    int is_hbw;        /**< From the file header */
+    size_t npkt;       /**< Number of complete packet records */
+    const struct vegas_capture_pkt_hdr **pkt; /**< Record of each packet */
+};
+
+/** Write the file header to a capture file opened for writing */
+int vegas_capture_write_hdr(FILE *f, int is_hbw);
+
+/** Append one packet to a capture file */
+int vegas_capture_write_pkt(FILE *f, const struct timespec *ts,
+                            const char *data, uint32_t len);
+
+/** Map a capture file and index its records.  A truncated last
+ * record (recorder killed mid-write) is ignored.
+ */
+int vegas_capture_open(struct vegas_capture *c, const char *filename);
+
+/** Unmap a capture file */
+void vegas_capture_close(struct vegas_capture *c);
+
+/** Packet bytes of a record */
+static inline const char *vegas_capture_pkt_data(const struct vegas_capture_pkt_hdr *h)
+{
+    return (const char *)(h + 1);
+}
+
+/** Arrival time of a record in nanoseconds */
+static inline int64_t vegas_capture_pkt_time_ns(const struct vegas_capture_pkt_hdr *h)
+{
+    return h->sec * 1000000000LL + h->nsec;
+}
+
+#endif
@@ -0,0 +1,253 @@
+/* vegas_spead_gen.c
+ *
+ * Generate a synthetic HBW (SPEAD) or LBW packet stream, laid out
+ * exactly as the roaches send it, and send it to a UDP port or write it
+ * to a capture file for vegas_spead_replay.  Drops, duplicates,
+ * reordering, time counter jumps and switching state changes can be
+ * injected at random or at given heaps from a profile, so that the net
+ * and accumulator threads can be tested repeatably without hardware.
+ *
+ * The profile format is described in vegas_spead_stream.h.
+ */
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "vegas_error.h"
+#include "vegas_defines.h"
+#include "vegas_spead_capture.h"
+#include "vegas_spead_send.h"
+#include "vegas_spead_stream.h"
+
+void usage() {
+    fprintf(stderr,
+            "Usage: vegas_spead_gen [options] [dest_hostname]\n"
+            "Options:\n"
+            "  -p n, --port=n       Destination port (60000)\n"
+            "  -o f, --output=f     Write a capture file instead of sending\n"
+            "  -l, --lbw            Generate LBW rather than HBW packets\n"
+            "  -c n, --nchan=n      HBW channels per spectrum (1024)\n"
+            "  -H n, --heaps=n      Stop after n heaps (0=no limit)\n"
+            "  -r x, --rate=x       Packets per second (0=as fast as possible)\n"
+            "  -b n, --batch=n      Packets per sendmmsg call (64)\n"
+            "  -t v, --time=v       Initial time counter (0)\n"
+            "  -T v, --tstep=v      HBW time counter step per heap (1024)\n"
+            "  -i n, --integ=n      HBW spectra per integration (1)\n"
+            "  -S v, --status=v     Initial switching status bits (0)\n"
+            "  -P f, --profile=f    Scripted fault profile\n"
+            "  -d x, --drop=x       Drop a fraction x of the packets\n"
+            "  -u x, --dup=x        Duplicate a fraction x of the packets\n"
+            "  -R x, --reorder=x    Move a fraction x of the packets later\n"
+            "  -D n, --depth=n      ...by up to n places (8)\n"
+            "  -s n, --seed=n       Random seed for the faults (1)\n"
+            "  -h, --help           This message\n"
+           );
+}
+
+/* control-c handler */
+int run=1;
+void stop_running(int sig) { run=0; }
+
+/// Where the batch goes: a connected socket or a capture file
+struct gen_sink {
+    int sock;
+    FILE *f;
+    int64_t t_start;    ///< Monotonic time of the first packet slot
+    struct timespec t_file; ///< Capture file time of the first slot
+    double rate;        ///< Packets per second, 0 for no pacing
+};
+
+/// Nanoseconds from the first packet slot to this one
+static int64_t slot_time(const struct gen_sink *s, unsigned long long slot)
+{
+    return s->rate > 0.0 ? (int64_t)(slot / s->rate * 1e9) : 0;
+}
+
+static int write_batch(struct gen_sink *s, struct vegas_stream_batch *b)
+{
+    char pkt[VEGAS_STREAM_HBW_HDR_SIZE + PAYLOAD_SIZE];
+    struct timespec ts;
+    struct iovec *iov;
+    int64_t t;
+    int i;
+
+    /* Packets are stamped with the time they would have arrived */
+    for (i=0; i<b->n; i++) {
+        iov = b->iovs[i];
+        t = s->t_file.tv_nsec + slot_time(s, b->slot[i]);
+        ts.tv_sec = s->t_file.tv_sec + t / 1000000000LL;
+        ts.tv_nsec = t % 1000000000LL;
+        memcpy(pkt, iov[0].iov_base, iov[0].iov_len);
+        memcpy(pkt + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+        if (vegas_capture_write_pkt(s->f, &ts, pkt,
+                    iov[0].iov_len + iov[1].iov_len)!=VEGAS_OK)
+            return(VEGAS_ERR_SYS);
+    }
+    return(VEGAS_OK);
+}
+
+static int send_batch(struct gen_sink *s, struct vegas_stream_batch *b)
+{
+    if (s->rate > 0.0)
+        vegas_send_wait_until(s->t_start + slot_time(s, b->slot[0]));
+    return vegas_send_batch(s->sock, b->msgs, b->n, &run);
+}
+
+int main(int argc, char *argv[]) {
+
+    char *dest = "localhost", *output = NULL, *profile = NULL;
+    int port = 60000, batch = 64, nchan = 1024;
+    double rate = 0.0;
+    struct vegas_stream g;
+
+    vegas_stream_init(&g);
+
+    static struct option long_opts[] = {
+        {"help",    0, NULL, 'h'},
+        {"port",    1, NULL, 'p'},
+        {"output",  1, NULL, 'o'},
+        {"lbw",     0, NULL, 'l'},
+        {"nchan",   1, NULL, 'c'},
+        {"heaps",   1, NULL, 'H'},
+        {"rate",    1, NULL, 'r'},
+        {"batch",   1, NULL, 'b'},
+        {"time",    1, NULL, 't'},
+        {"tstep",   1, NULL, 'T'},
+        {"integ",   1, NULL, 'i'},
+        {"status",  1, NULL, 'S'},
+        {"profile", 1, NULL, 'P'},
+        {"drop",    1, NULL, 'd'},
+        {"dup",     1, NULL, 'u'},
+        {"reorder", 1, NULL, 'R'},
+        {"depth",   1, NULL, 'D'},
+        {"seed",    1, NULL, 's'},
+        {0,0,0,0}
+    };
+    int opt, opti;
+    while ((opt=getopt_long(argc,argv,"hp:o:lc:H:r:b:t:T:i:S:P:d:u:R:D:s:",
+                    long_opts,&opti))!=-1) {
+        switch (opt) {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'l':
+                g.is_hbw = 0;
+                break;
+            case 'c':
+                nchan = atoi(optarg);
+                break;
+            case 'H':
+                g.max_heaps = strtoull(optarg, NULL, 0);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'b':
+                batch = atoi(optarg);
+                break;
+            case 't':
+                g.time_cntr = strtoull(optarg, NULL, 0);
+                break;
+            case 'T':
+                g.time_step = strtoull(optarg, NULL, 0);
+                break;
+            case 'i':
+                g.integ_size = atoi(optarg);
+                break;
+            case 'S':
+                g.status = strtoul(optarg, NULL, 0);
+                break;
+            case 'P':
+                profile = optarg;
+                break;
+            case 'd':
+                g.drop_frac = atof(optarg);
+                break;
+            case 'u':
+                g.dup_frac = atof(optarg);
+                break;
+            case 'R':
+                g.reorder_frac = atof(optarg);
+                break;
+            case 'D':
+                g.depth = atoi(optarg);
+                break;
+            case 's':
+                g.seed = strtoul(optarg, NULL, 0);
+                break;
+            default:
+            case 'h':
+                usage();
+                exit(0);
+                break;
+        }
+    }
+    if (optind < argc)
+        dest = argv[optind];
+    if (batch < 1) batch = 1;
+    if (batch > VEGAS_STREAM_MAX_BATCH) batch = VEGAS_STREAM_MAX_BATCH;
+
+    if (profile && vegas_stream_read_profile(&g, profile)!=VEGAS_OK)
+        exit(1);
+    if (vegas_stream_start(&g, nchan)!=VEGAS_OK)
+        exit(1);
+
+    struct gen_sink sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.sock = -1;
+    sink.rate = rate;
+    if (output) {
+        sink.f = fopen(output, "w");
+        if (sink.f==NULL) {
+            perror(output);
+            exit(1);
+        }
+        setvbuf(sink.f, NULL, _IOFBF, 16*1024*1024);
+        if (vegas_capture_write_hdr(sink.f, g.is_hbw)!=VEGAS_OK)
+            exit(1);
+        clock_gettime(CLOCK_REALTIME, &sink.t_file);
+    } else {
+        /* Connected UDP socket to the destination */
+        sink.sock = vegas_send_open(dest, port);
+        if (sink.sock<0)
+            exit(1);
+    }
+
+    static struct vegas_stream_batch b;
+    int64_t t_start, t_end;
+
+    signal(SIGINT, stop_running);
+    if (output)
+        printf("Writing %s packets to %s\n", g.is_hbw ? "HBW" : "LBW", output);
+    else
+        printf("Sending %s packets to %s:%d\n", g.is_hbw ? "HBW" : "LBW", dest, port);
+    t_start = vegas_send_now_ns();
+    sink.t_start = t_start;
+    while (run && vegas_stream_fill(&g, &b, batch) > 0) {
+        if ((sink.f ? write_batch(&sink, &b) : send_batch(&sink, &b))!=VEGAS_OK)
+            run = 0;
+    }
+    t_end = vegas_send_now_ns();
+
+    double elapsed = (t_end - t_start) * 1e-9;
+    printf("Sent %lld packets (%lld bytes) of %lld heaps in %.3f s: %.0f pkt/s, %.3f Gb/s\n",
+            g.nsent, g.nbytes, g.heap, elapsed, g.nsent / elapsed, 8e-9 * g.nbytes / elapsed);
+    printf("Dropped %lld, duplicated %lld, reordered %lld, skipped %lld heaps, "
+           "%lld time counter rollovers\n",
+            g.ndropped, g.nduped, g.nreordered, g.nskipped, g.nrollover);
+
+    if (sink.f)
+        fclose(sink.f);
+    if (sink.sock >= 0)
+        close(sink.sock);
+    vegas_stream_free(&g);
+    exit(0);
+}
@@ -0,0 +1,183 @@
+/* vegas_spead_record.c
+ *
+ * Record a SPEAD (or LBW) packet stream, with kernel arrival times,
+ * to a capture file that vegas_spead_replay can play back.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <signal.h>
+#include <getopt.h>
+#include <errno.h>
+
+#include "vegas_udp.h"
+#include "vegas_error.h"
+#include "vegas_spead_capture.h"
+
+#define RECORD_BATCH 64
+
+void usage() {
+    fprintf(stderr,
+            "Usage: vegas_spead_record [options] sender_hostname\n"
+            "Options:\n"
+            "  -p n, --port=n       Port number (60000)\n"
+            "  -o f, --output=f     Capture file (spead.cap)\n"
+            "  -n n, --npacket=n    Stop after n packets (0=no limit)\n"
+            "  -t s, --time=s       Stop after s seconds (0=no limit)\n"
+            "  -l, --lbw            Stream is LBW rather than HBW\n"
+            "  -h, --help           This message\n"
+           );
+}
+
+/* control-c handler */
+int run=1;
+void stop_running(int sig) { run=0; }
+
+int main(int argc, char *argv[]) {
+
+    int rv;
+    struct vegas_udp_params p;
+    char *filename = "spead.cap";
+    unsigned long long max_packets = 0;
+    double max_time = 0.0;
+
+    static struct option long_opts[] = {
+        {"help",    0, NULL, 'h'},
+        {"port",    1, NULL, 'p'},
+        {"output",  1, NULL, 'o'},
+        {"npacket", 1, NULL, 'n'},
+        {"time",    1, NULL, 't'},
+        {"lbw",     0, NULL, 'l'},
+        {0,0,0,0}
+    };
+    int opt, opti;
+    memset(&p, 0, sizeof(p));
+    p.port = 60000;
+    p.is_hbw = 1;
+    p.rx_tstamp = VEGAS_RX_TSTAMP_SOFTWARE;
+    while ((opt=getopt_long(argc,argv,"hp:o:n:t:l",long_opts,&opti))!=-1) {
+        switch (opt) {
+            case 'p':
+                p.port = atoi(optarg);
+                break;
+            case 'o':
+                filename = optarg;
+                break;
+            case 'n':
+                max_packets = strtoull(optarg, NULL, 0);
+                break;
+            case 't':
+                max_time = atof(optarg);
+                break;
+            case 'l':
+                p.is_hbw = 0;
+                break;
+            default:
+            case 'h':
+                usage();
+                exit(0);
+                break;
+        }
+    }
+    if (optind==argc) {
+        usage();
+        exit(1);
+    }
+    strcpy(p.sender, argv[optind]);
+
+    /* Init udp params */
+    rv = vegas_udp_init(&p);
+    if (rv!=VEGAS_OK) {
+        fprintf(stderr, "Error setting up networking\n");
+        exit(1);
+    }
+
+    FILE *f = fopen(filename, "w");
+    if (f==NULL) {
+        perror(filename);
+        exit(1);
+    }
+    setvbuf(f, NULL, _IOFBF, 16*1024*1024);
+    if (vegas_capture_write_hdr(f, p.is_hbw)!=VEGAS_OK)
+        exit(1);
+
+    /* Packets are read in batches, straight off the socket and without
+     * any of the processing vegas_udp_recv() does, so the file holds
+     * exactly what was on the wire.
+     */
+    static char bufs[RECORD_BATCH][VEGAS_MAX_PACKET_SIZE];
+    static char control[RECORD_BATCH][CMSG_SPACE(sizeof(struct timespec) * 3)];
+    struct mmsghdr msgs[RECORD_BATCH];
+    struct iovec iovs[RECORD_BATCH];
+    struct timespec ts, start, now;
+    struct cmsghdr *cmsg;
+    unsigned long long npacket=0, nbytes=0;
+    int i;
+
+    signal(SIGINT, stop_running);
+    printf("Recording to %s (sock=%d).\n", filename, p.sock);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (run) {
+        rv = vegas_udp_wait(&p);
+        if (rv==VEGAS_TIMEOUT) {
+            continue;
+        } else if (rv!=VEGAS_OK) {
+            if (run) perror("poll");
+            break;
+        }
+
+        memset(msgs, 0, sizeof(msgs));
+        for (i=0; i<RECORD_BATCH; i++) {
+            iovs[i].iov_base = bufs[i];
+            iovs[i].iov_len = VEGAS_MAX_PACKET_SIZE;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = control[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+        }
+        rv = recvmmsg(p.sock, msgs, RECORD_BATCH, MSG_DONTWAIT, NULL);
+        if (rv<0) {
+            if (errno==EAGAIN || errno==EINTR) continue;
+            perror("recvmmsg");
+            break;
+        }
+
+        for (i=0; i<rv; i++) {
+            /* Kernel arrival time, or the clock if there was none */
+            ts.tv_sec = 0;
+            ts.tv_nsec = 0;
+            for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL;
+                 cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+                if (cmsg->cmsg_level==SOL_SOCKET && cmsg->cmsg_type==SCM_TIMESTAMPNS)
+                    memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            }
+            if (ts.tv_sec==0)
+                clock_gettime(CLOCK_REALTIME, &ts);
+
+            if (vegas_capture_write_pkt(f, &ts, bufs[i], msgs[i].msg_len)!=VEGAS_OK) {
+                run = 0;
+                break;
+            }
+            npacket++;
+            nbytes += msgs[i].msg_len;
+            if (max_packets && npacket>=max_packets) {
+                run = 0;
+                break;
+            }
+        }
+
+        if (max_time > 0.0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (now.tv_sec - start.tv_sec + 1e-9*(now.tv_nsec - start.tv_nsec) >= max_time)
+                run = 0;
+        }
+    }
+
+    fclose(f);
+    printf("Recorded %lld packets (%lld bytes) to %s\n", npacket, nbytes, filename);
+
+    vegas_udp_close(&p);
+    exit(0);
+}
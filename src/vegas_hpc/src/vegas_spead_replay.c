@@ -0,0 +1,225 @@
+/* vegas_spead_replay.c
+ *
+ * Replay a capture file written by vegas_spead_record to a UDP port,
+ * at the recorded rate, a multiple of it or as fast as possible, with
+ * optional packet drops, duplicates and reordering.  Pointed at a
+ * vegas_hpc_hbw over loopback (or a veth pair) this benchmarks the net
+ * thread without a telescope.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "vegas_error.h"
+#include "vegas_spead_capture.h"
+#include "vegas_spead_send.h"
+
+#define REPLAY_MAX_BATCH 256
+
+void usage() {
+    fprintf(stderr,
+            "Usage: vegas_spead_replay [options] capture_file [dest_hostname]\n"
+            "Options:\n"
+            "  -p n, --port=n       Destination port (60000)\n"
+            "  -r x, --rate=x       Replay at x times the recorded rate (1.0)\n"
+            "  -m, --max            Replay as fast as possible\n"
+            "  -l n, --loops=n      Play the file n times (1)\n"
+            "  -b n, --batch=n      Packets per sendmmsg call (64)\n"
+            "  -d x, --drop=x       Drop a fraction x of the packets\n"
+            "  -u x, --dup=x        Duplicate a fraction x of the packets\n"
+            "  -R x, --reorder=x    Move a fraction x of the packets later\n"
+            "  -D n, --depth=n      ...by up to n places (8)\n"
+            "  -s n, --seed=n       Random seed for the faults (1)\n"
+            "  -h, --help           This message\n"
+           );
+}
+
+/* control-c handler */
+int run=1;
+void stop_running(int sig) { run=0; }
+
+int main(int argc, char *argv[]) {
+
+    char *dest = "localhost";
+    int port = 60000;
+    double rate = 1.0;
+    int max_rate = 0, loops = 1, batch = 64, depth = 8;
+    double drop_frac = 0.0, dup_frac = 0.0, reorder_frac = 0.0;
+    unsigned int seed = 1;
+
+    static struct option long_opts[] = {
+        {"help",    0, NULL, 'h'},
+        {"port",    1, NULL, 'p'},
+        {"rate",    1, NULL, 'r'},
+        {"max",     0, NULL, 'm'},
+        {"loops",   1, NULL, 'l'},
+        {"batch",   1, NULL, 'b'},
+        {"drop",    1, NULL, 'd'},
+        {"dup",     1, NULL, 'u'},
+        {"reorder", 1, NULL, 'R'},
+        {"depth",   1, NULL, 'D'},
+        {"seed",    1, NULL, 's'},
+        {0,0,0,0}
+    };
+    int opt, opti;
+    while ((opt=getopt_long(argc,argv,"hp:r:ml:b:d:u:R:D:s:",long_opts,&opti))!=-1) {
+        switch (opt) {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'm':
+                max_rate = 1;
+                break;
+            case 'l':
+                loops = atoi(optarg);
+                break;
+            case 'b':
+                batch = atoi(optarg);
+                break;
+            case 'd':
+                drop_frac = atof(optarg);
+                break;
+            case 'u':
+                dup_frac = atof(optarg);
+                break;
+            case 'R':
+                reorder_frac = atof(optarg);
+                break;
+            case 'D':
+                depth = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            default:
+            case 'h':
+                usage();
+                exit(0);
+                break;
+        }
+    }
+    if (optind==argc) {
+        usage();
+        exit(1);
+    }
+    if (rate <= 0.0)
+        max_rate = 1;
+    if (batch < 1) batch = 1;
+    if (batch > REPLAY_MAX_BATCH) batch = REPLAY_MAX_BATCH;
+    if (depth < 1) depth = 1;
+
+    struct vegas_capture c;
+    if (vegas_capture_open(&c, argv[optind])!=VEGAS_OK)
+        exit(1);
+    if (c.npkt==0) {
+        fprintf(stderr, "No packets in %s\n", argv[optind]);
+        exit(1);
+    }
+    if (optind+1 < argc)
+        dest = argv[optind+1];
+
+    /* Connected UDP socket to the destination */
+    int sock = vegas_send_open(dest, port);
+    if (sock<0)
+        exit(1);
+
+    /* Play order of the packets, and the recorded time line.  A loop
+     * lasts as long as the recording plus one mean packet spacing.
+     */
+    size_t *order = malloc(c.npkt * sizeof(size_t));
+    int64_t t_first = vegas_capture_pkt_time_ns(c.pkt[0]);
+    int64_t span = vegas_capture_pkt_time_ns(c.pkt[c.npkt-1]) - t_first;
+    if (c.npkt > 1)
+        span += span / (c.npkt - 1);
+
+    struct mmsghdr msgs[REPLAY_MAX_BATCH];
+    struct iovec iovs[REPLAY_MAX_BATCH];
+    unsigned long long nsent=0, nbytes=0, ndropped=0, nduped=0, nreordered=0;
+    int64_t t_start, t_due, t_end;
+    size_t i, j, tmp;
+    int n, loop, copies;
+
+    memset(msgs, 0, sizeof(msgs));
+    signal(SIGINT, stop_running);
+    printf("Replaying %zd packets from %s to %s:%d\n", c.npkt, argv[optind], dest, port);
+    t_start = vegas_send_now_ns();
+    n = 0;
+    for (loop=0; loop<loops && run; loop++) {
+        for (i=0; i<c.npkt; i++)
+            order[i] = i;
+        /* Reordering moves a packet later by swapping it with one of
+         * the next few, so nothing is delayed by more than depth places.
+         */
+        for (i=0; i<c.npkt; i++) {
+            if (vegas_send_chance(reorder_frac, &seed)) {
+                j = i + 1 + rand_r(&seed) % depth;
+                if (j < c.npkt) {
+                    tmp = order[i];
+                    order[i] = order[j];
+                    order[j] = tmp;
+                    nreordered++;
+                }
+            }
+        }
+
+        for (i=0; i<c.npkt && run; i++) {
+            if (vegas_send_chance(drop_frac, &seed)) {
+                ndropped++;
+                continue;
+            }
+
+            /* Pace on the recorded time of this slot in the stream, so
+             * that reordering does not change the rate.
+             */
+            if (!max_rate) {
+                t_due = t_start + (int64_t)((loop * span +
+                        vegas_capture_pkt_time_ns(c.pkt[i]) - t_first) / rate);
+                if (t_due > vegas_send_now_ns()) {
+                    if (n > 0 && vegas_send_batch(sock, msgs, n, &run)!=VEGAS_OK)
+                        run = 0;
+                    n = 0;
+                    vegas_send_wait_until(t_due);
+                }
+            }
+
+            copies = vegas_send_chance(dup_frac, &seed) ? 2 : 1;
+            nduped += copies - 1;
+            while (copies--) {
+                const struct vegas_capture_pkt_hdr *h = c.pkt[order[i]];
+                iovs[n].iov_base = (void *)vegas_capture_pkt_data(h);
+                iovs[n].iov_len = h->len;
+                msgs[n].msg_hdr.msg_iov = &iovs[n];
+                msgs[n].msg_hdr.msg_iovlen = 1;
+                n++;
+                nsent++;
+                nbytes += h->len;
+                if (n==batch) {
+                    if (vegas_send_batch(sock, msgs, n, &run)!=VEGAS_OK)
+                        run = 0;
+                    n = 0;
+                }
+            }
+        }
+    }
+    if (n > 0)
+        vegas_send_batch(sock, msgs, n, &run);
+    t_end = vegas_send_now_ns();
+
+    double elapsed = (t_end - t_start) * 1e-9;
+    printf("Sent %lld packets (%lld bytes) in %.3f s: %.0f pkt/s, %.3f Gb/s\n",
+            nsent, nbytes, elapsed, nsent / elapsed, 8e-9 * nbytes / elapsed);
+    printf("Dropped %lld, duplicated %lld, reordered %lld\n",
+            ndropped, nduped, nreordered);
+
+    free(order);
+    close(sock);
+    vegas_capture_close(&c);
+    exit(0);
+}
@@ -0,0 +1,89 @@
+/* vegas_spead_send.c
+ *
+ * Pacing, fault dice and batched UDP sending shared by the SPEAD packet
+ * senders.
+ */
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <errno.h>
+#include <time.h>
+
+#include "vegas_error.h"
+#include "vegas_spead_send.h"
+
+int64_t vegas_send_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void vegas_send_wait_until(int64_t t)
+{
+    struct timespec ts;
+    int64_t dt = t - vegas_send_now_ns();
+
+    if (dt > 200000) {
+        t -= 100000;
+        ts.tv_sec = t / 1000000000LL;
+        ts.tv_nsec = t % 1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        t += 100000;
+    }
+    while (vegas_send_now_ns() < t)
+        ;
+}
+
+int vegas_send_chance(double frac, unsigned int *seed)
+{
+    return frac > 0.0 && rand_r(seed) < frac * ((double)RAND_MAX + 1.0);
+}
+
+int vegas_send_open(const char *dest, int port)
+{
+    struct addrinfo hints, *result;
+    char port_str[16];
+    int rv, sock;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    sprintf(port_str, "%d", port);
+    rv = getaddrinfo(dest, port_str, &hints, &result);
+    if (rv!=0) {
+        fprintf(stderr, "%s: %s\n", dest, gai_strerror(rv));
+        return(VEGAS_ERR_SYS);
+    }
+    sock = socket(PF_INET, SOCK_DGRAM, 0);
+    if (sock<0 || connect(sock, result->ai_addr, result->ai_addrlen)!=0) {
+        perror("socket");
+        if (sock >= 0)
+            close(sock);
+        freeaddrinfo(result);
+        return(VEGAS_ERR_SYS);
+    }
+    freeaddrinfo(result);
+    int bufsize = 64*1024*1024;
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    return sock;
+}
+
+int vegas_send_batch(int sock, struct mmsghdr *msgs, int n, const int *run)
+{
+    int rv, sent = 0;
+
+    while (sent < n && *run) {
+        rv = sendmmsg(sock, msgs + sent, n - sent, 0);
+        if (rv < 0) {
+            if (errno==EAGAIN || errno==ENOBUFS || errno==EINTR) continue;
+            perror("sendmmsg");
+            return(VEGAS_ERR_SYS);
+        }
+        sent += rv;
+    }
+    return(VEGAS_OK);
+}
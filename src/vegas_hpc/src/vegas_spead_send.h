@@ -0,0 +1,34 @@
+/** vegas_spead_send.h
+ *
+ * Pacing, fault dice and batched UDP sending shared by the SPEAD packet
+ * senders (vegas_spead_replay, vegas_spead_gen).
+ */
+#ifndef _VEGAS_SPEAD_SEND_H
+#define _VEGAS_SPEAD_SEND_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/** Monotonic clock in nanoseconds */
+int64_t vegas_send_now_ns(void);
+
+/** Wait until the monotonic clock reaches t, sleeping if there is time
+ * to and spinning for the last stretch.
+ */
+void vegas_send_wait_until(int64_t t);
+
+/** Non-zero with probability frac */
+int vegas_send_chance(double frac, unsigned int *seed);
+
+/** Open a UDP socket connected to dest:port, with a large send buffer.
+ * Returns the socket, or VEGAS_ERR_SYS.
+ */
+int vegas_send_open(const char *dest, int port);
+
+/** Send n messages, retrying whatever the kernel did not take, until
+ * all are sent or *run is cleared.
+ */
+int vegas_send_batch(int sock, struct mmsghdr *msgs, int n, const int *run);
+
+#endif
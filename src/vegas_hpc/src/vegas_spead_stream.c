@@ -0,0 +1,329 @@
+/* vegas_spead_stream.c
+ *
+ * Synthetic SPEAD/LBW packet streams with injected faults.
+ */
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+
+#include "vegas_error.h"
+#include "vegas_defines.h"
+#include "vegas_spead_send.h"
+#include "vegas_spead_stream.h"
+
+static const char *event_names[] = { "status", "drop", "dup", "reorder",
+                                     "skip", "time", "restart", "stop" };
+
+void vegas_stream_init(struct vegas_stream *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->is_hbw = 1;
+    s->time_step = 1024;
+    s->integ_size = 1;
+    s->depth = 8;
+    s->seed = 1;
+}
+
+/// Events in heap order, then file order
+static int event_cmp(const void *a, const void *b)
+{
+    const struct vegas_stream_event *ea = a, *eb = b;
+    if (ea->heap != eb->heap)
+        return ea->heap < eb->heap ? -1 : 1;
+    return ea->line - eb->line;
+}
+
+int vegas_stream_read_profile(struct vegas_stream *s, const char *filename)
+{
+    char line[256], name[32], *c;
+    unsigned long long heap, value;
+    int i, n, nev = 0, lineno = 0;
+    struct vegas_stream_event *ev;
+    FILE *f = fopen(filename, "r");
+
+    if (f==NULL) {
+        perror(filename);
+        return(VEGAS_ERR_SYS);
+    }
+    ev = malloc(VEGAS_STREAM_MAX_EVENTS * sizeof(*ev));
+    if (ev==NULL) {
+        fprintf(stderr, "Error allocating events\n");
+        fclose(f);
+        return(VEGAS_ERR_SYS);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        if ((c = strchr(line, '#')) != NULL)
+            *c = '\0';
+        value = 0;
+        n = sscanf(line, "%lli %31s %lli", &heap, name, &value);
+        if (n <= 0)
+            continue;
+        for (i=0; i<(int)(sizeof(event_names)/sizeof(event_names[0])); i++)
+            if (strcasecmp(name, event_names[i])==0)
+                break;
+        if (n < 2 || i==(int)(sizeof(event_names)/sizeof(event_names[0]))) {
+            fprintf(stderr, "%s:%d: bad event\n", filename, lineno);
+            fclose(f);
+            free(ev);
+            return(VEGAS_ERR_PARAM);
+        }
+        if (nev==VEGAS_STREAM_MAX_EVENTS) {
+            fprintf(stderr, "%s: more than %d events\n", filename,
+                    VEGAS_STREAM_MAX_EVENTS);
+            fclose(f);
+            free(ev);
+            return(VEGAS_ERR_PARAM);
+        }
+        ev[nev].heap = heap;
+        ev[nev].type = i;
+        ev[nev].value = value;
+        ev[nev].line = lineno;
+        nev++;
+    }
+    fclose(f);
+    qsort(ev, nev, sizeof(*ev), event_cmp);
+    free(s->events);
+    s->events = ev;
+    s->nev = nev;
+    s->iev = 0;
+    return(VEGAS_OK);
+}
+
+int vegas_stream_start(struct vegas_stream *s, int nchan)
+{
+    size_t pattern_size, k;
+    uint32_t word;
+
+    if (s->depth < 1) s->depth = 1;
+    if (s->integ_size < 1) s->integ_size = 1;
+
+    /* HBW heaps are nchan spectra of 4 int32 products */
+    if (s->is_hbw) {
+        s->heap_size = nchan * 4 * sizeof(int);
+        if (nchan <= 0 || s->heap_size % PAYLOAD_SIZE) {
+            fprintf(stderr, "nchan must be a multiple of %d\n",
+                    (int)(PAYLOAD_SIZE / (4 * sizeof(int))));
+            return(VEGAS_ERR_PARAM);
+        }
+        s->pkts_per_heap = s->heap_size / PAYLOAD_SIZE;
+    } else {
+        s->pkts_per_heap = 1;
+    }
+
+    /* The payload of every heap is the same ramp, one int32 (HBW) or
+     * byte (LBW) per sample, in network order, so received data can
+     * be checked.  Packets point straight into it.
+     */
+    pattern_size = s->is_hbw ? s->heap_size : PAYLOAD_SIZE;
+    free(s->pattern);
+    s->pattern = malloc(pattern_size);
+    if (s->pattern==NULL) {
+        fprintf(stderr, "Error allocating payload\n");
+        return(VEGAS_ERR_SYS);
+    }
+    if (s->is_hbw) {
+        for (k=0; k<pattern_size/sizeof(word); k++) {
+            word = htobe32(k);
+            memcpy(s->pattern + k*sizeof(word), &word, sizeof(word));
+        }
+    } else {
+        for (k=0; k<pattern_size; k++)
+            s->pattern[k] = k & 0xFF;
+    }
+    s->last_time = s->time_cntr;
+    return(VEGAS_OK);
+}
+
+void vegas_stream_free(struct vegas_stream *s)
+{
+    free(s->events);
+    free(s->pattern);
+    s->events = NULL;
+    s->pattern = NULL;
+}
+
+/// One SPEAD item pointer, in network byte order
+static void put_item(char *hdr, int i, int immediate, unsigned int id,
+                     unsigned long long addr)
+{
+    uint64_t v = ((uint64_t)(immediate ? 1 : 0) << 63) |
+                 ((uint64_t)(id & 0x7FFFFF) << 40) |
+                 (addr & 0xFFFFFFFFFFULL);
+    v = htobe64(v);
+    memcpy(hdr + sizeof(SPEAD_HEADER) + i*sizeof(uint64_t), &v, sizeof(v));
+}
+
+static void build_hbw_header(const struct vegas_stream *s, char *hdr, int pkt)
+{
+    static const unsigned char magic[] = { SPEAD_MAGIC_HEAD_CHAR };
+    uint16_t nitems = htobe16(VEGAS_STREAM_HBW_NITEMS);
+
+    memset(hdr, 0, sizeof(SPEAD_HEADER));
+    memcpy(hdr, magic, sizeof(magic));
+    memcpy(hdr + 6, &nitems, sizeof(nitems));
+    put_item(hdr, 0, 1, HEAP_COUNTER_ID, s->heap_cntr);
+    put_item(hdr, 1, 1, HEAP_SIZE_ID, s->heap_size);
+    put_item(hdr, 2, 1, HEAP_OFFSET_ID, (unsigned long long)pkt * PAYLOAD_SIZE);
+    put_item(hdr, 3, 1, PAYLOAD_OFFSET_ID, PAYLOAD_SIZE);
+    put_item(hdr, 4, 1, TIME_STAMP_ID, s->time_cntr & VEGAS_STREAM_TIME_MASK);
+    put_item(hdr, 5, 1, SPECTRUM_COUNTER_ID, s->spectrum_cntr);
+    /* The net thread adds one to this */
+    put_item(hdr, 6, 1, SPECTRUM_PER_INTEGRATION_ID, s->integ_size - 1);
+    put_item(hdr, 7, 1, MODE_NUMBER_ID, 0);
+    put_item(hdr, 8, 1, SWITCHING_STATE_ID, s->status);
+    put_item(hdr, 9, 0, PAYLOAD_DATA_OFFSET_ID, 0);
+}
+
+static void build_lbw_header(const struct vegas_stream *s, char *hdr)
+{
+    /* 60 bit counter over 4 status bits, sent twice */
+    uint64_t v = htobe64((s->time_cntr << 4) | (s->status & 0xF));
+    memcpy(hdr, &v, sizeof(v));
+    memcpy(hdr + sizeof(v), &v, sizeof(v));
+}
+
+/// Move on to the next heap.  In LBW mode the counters are all in the
+/// time counter, which the net thread turns into a heap counter.
+static void next_heap(struct vegas_stream *s)
+{
+    s->heap_cntr++;
+    s->spectrum_cntr++;
+    if (s->is_hbw)
+        s->time_cntr = (s->time_cntr + s->time_step) & VEGAS_STREAM_TIME_MASK;
+    else
+        s->time_cntr += VEGAS_STREAM_LBW_CNTR_STEP;
+}
+
+/// Apply the scripted events of a new heap.  Returns 0 at the end of
+/// the stream.
+static int start_heap(struct vegas_stream *s)
+{
+    struct vegas_stream_event *ev;
+    unsigned long long k;
+
+    if (s->max_heaps && s->heap >= s->max_heaps)
+        return 0;
+    for (; s->iev<s->nev && s->events[s->iev].heap<=s->heap; s->iev++) {
+        ev = &s->events[s->iev];
+        switch (ev->type) {
+            case VEGAS_EV_STATUS:  s->status = ev->value; break;
+            case VEGAS_EV_DROP:    s->drop_left += ev->value; break;
+            case VEGAS_EV_DUP:     s->dup_left += ev->value; break;
+            case VEGAS_EV_REORDER: s->reorder_left += ev->value; break;
+            case VEGAS_EV_SKIP:
+                for (k=0; k<ev->value; k++)
+                    next_heap(s);
+                s->nskipped += ev->value;
+                break;
+            case VEGAS_EV_TIME:    s->time_cntr = ev->value; break;
+            case VEGAS_EV_RESTART: s->heap_cntr = 0; s->spectrum_cntr = 0; break;
+            case VEGAS_EV_STOP:    return 0;
+        }
+    }
+    if ((s->time_cntr & VEGAS_STREAM_TIME_MASK) <
+        (s->last_time & VEGAS_STREAM_TIME_MASK))
+        s->nrollover++;
+    s->last_time = s->time_cntr;
+    return 1;
+}
+
+/// Add the current packet to the batch, unless it is dropped
+static void add_packet(struct vegas_stream *s, struct vegas_stream_batch *b)
+{
+    int copies;
+
+    if (s->drop_left || vegas_send_chance(s->drop_frac, &s->seed)) {
+        if (s->drop_left) s->drop_left--;
+        s->ndropped++;
+        return;
+    }
+
+    if (s->is_hbw)
+        build_hbw_header(s, b->hdrs[b->nhdr], s->pkt);
+    else
+        build_lbw_header(s, b->hdrs[b->nhdr]);
+
+    copies = 1;
+    if (s->dup_left || vegas_send_chance(s->dup_frac, &s->seed)) {
+        if (s->dup_left) s->dup_left--;
+        copies = 2;
+        s->nduped++;
+    }
+    while (copies--) {
+        struct iovec *iov = b->iovs[b->n];
+        iov[0].iov_base = b->hdrs[b->nhdr];
+        iov[0].iov_len = s->is_hbw ? VEGAS_STREAM_HBW_HDR_SIZE
+                                   : VEGAS_STREAM_LBW_HDR_SIZE;
+        iov[1].iov_base = s->pattern + (s->is_hbw ? s->pkt * PAYLOAD_SIZE : 0);
+        iov[1].iov_len = PAYLOAD_SIZE;
+        b->late[b->n] = 0;
+        b->slot[b->n] = s->slot;
+        b->n++;
+        s->nsent++;
+        s->nbytes += iov[0].iov_len + iov[1].iov_len;
+    }
+    if (s->reorder_left) {
+        s->reorder_left--;
+        b->late[b->n-1] = 2;
+    } else if (vegas_send_chance(s->reorder_frac, &s->seed)) {
+        b->late[b->n-1] = 1;
+    }
+    b->nhdr++;
+}
+
+/// Late packets swap with one up to depth places on, within the batch,
+/// keeping the time slots where they are.
+static void reorder_batch(struct vegas_stream *s, struct vegas_stream_batch *b)
+{
+    struct iovec tmp[2];
+    int i, j;
+
+    for (i=0; i<b->n; i++) {
+        if (!b->late[i])
+            continue;
+        j = i + (b->late[i]==2 ? s->depth : 1 + rand_r(&s->seed) % s->depth);
+        if (j >= b->n)
+            j = b->n - 1;
+        if (j > i) {
+            memcpy(tmp, b->iovs[i], sizeof(tmp));
+            memcpy(b->iovs[i], b->iovs[j], sizeof(tmp));
+            memcpy(b->iovs[j], tmp, sizeof(tmp));
+            b->late[j] = 0;
+            s->nreordered++;
+        }
+    }
+}
+
+int vegas_stream_fill(struct vegas_stream *s, struct vegas_stream_batch *b,
+                      int batch)
+{
+    int i;
+
+    if (batch > VEGAS_STREAM_MAX_BATCH)
+        batch = VEGAS_STREAM_MAX_BATCH;
+    b->n = 0;
+    b->nhdr = 0;
+    while (!s->done && b->nhdr < batch) {
+        if (s->pkt == 0 && !start_heap(s)) {
+            s->done = 1;
+            break;
+        }
+        add_packet(s, b);
+        s->slot++;
+        if (++s->pkt == s->pkts_per_heap) {
+            s->pkt = 0;
+            next_heap(s);
+            s->heap++;
+        }
+    }
+    reorder_batch(s, b);
+    for (i=0; i<b->n; i++) {
+        memset(&b->msgs[i], 0, sizeof(b->msgs[i]));
+        b->msgs[i].msg_hdr.msg_iov = b->iovs[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+    return b->n;
+}
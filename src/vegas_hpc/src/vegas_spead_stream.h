@@ -0,0 +1,124 @@
+/** vegas_spead_stream.h
+ *
+ * Synthetic HBW (SPEAD) and LBW packet streams, laid out exactly as the
+ * roaches send them, with drops, duplicates, reordering, time counter
+ * jumps and switching state changes injected at random or at given heaps
+ * from a profile.  Used by vegas_spead_gen, and by the tests of the net
+ * thread's loss accounting.
+ *
+ * A profile has one event per line, "heap event [value]", heaps
+ * counted from 0 in the order they are generated:
+ *
+ *   status v    switching status bits are v from this heap on
+ *   drop n      drop the next n packets
+ *   dup n       send the next n packets twice
+ *   reorder n   send each of the next n packets depth places late
+ *   skip n      jump the heap counter ahead n heaps (all lost)
+ *   time v      set the time counter (e.g. 0xfffffff000 to roll over)
+ *   restart     restart the heap counter at 0, as a new observation
+ *   stop        end the stream
+ *
+ * '#' starts a comment.
+ */
+#ifndef _VEGAS_SPEAD_STREAM_H
+#define _VEGAS_SPEAD_STREAM_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "spead_packet.h"
+
+#define VEGAS_STREAM_MAX_BATCH  256
+#define VEGAS_STREAM_MAX_EVENTS 4096
+
+#define VEGAS_STREAM_HBW_NITEMS   10  ///< Items in each HBW packet header
+#define VEGAS_STREAM_HBW_HDR_SIZE \
+    (sizeof(SPEAD_HEADER) + VEGAS_STREAM_HBW_NITEMS*sizeof(uint64_t))
+#define VEGAS_STREAM_LBW_HDR_SIZE (2*sizeof(uint64_t))
+#define VEGAS_STREAM_LBW_CNTR_STEP 0x800 ///< LBW time counter advance per packet
+#define VEGAS_STREAM_TIME_MASK 0xFFFFFFFFFFULL ///< HBW time counters are 40 bits
+
+/** Profile events */
+enum vegas_stream_event_type { VEGAS_EV_STATUS, VEGAS_EV_DROP, VEGAS_EV_DUP,
+                               VEGAS_EV_REORDER, VEGAS_EV_SKIP, VEGAS_EV_TIME,
+                               VEGAS_EV_RESTART, VEGAS_EV_STOP };
+
+struct vegas_stream_event {
+    unsigned long long heap;
+    int type;
+    unsigned long long value;
+    int line;
+};
+
+/** The stream being generated.  vegas_stream_init() sets the defaults,
+ * which may be changed before vegas_stream_start().
+ */
+struct vegas_stream {
+    int is_hbw;
+    unsigned int heap_size;         ///< HBW payload bytes per heap
+    unsigned int pkts_per_heap;
+    unsigned long long heap_cntr;
+    unsigned long long time_cntr;
+    unsigned long long time_step;
+    unsigned int spectrum_cntr;
+    unsigned int integ_size;
+    unsigned int status;
+    unsigned long long max_heaps;   ///< Stop after this many heaps, 0 for no limit
+
+    /* Random faults */
+    double drop_frac, dup_frac, reorder_frac;
+    int depth;                      ///< Most places a packet is moved late
+    unsigned int seed;
+
+    /* Scripted faults, in heap order */
+    struct vegas_stream_event *events;
+    int nev, iev;
+
+    /* Progress */
+    unsigned long long heap;        ///< Heaps generated so far
+    unsigned long long slot;        ///< Packet slots, dropped ones included
+    unsigned int pkt;               ///< Next packet of the current heap
+    int done;
+    unsigned long long drop_left, dup_left, reorder_left;
+    unsigned long long last_time;
+    char *pattern;                  ///< Payload of every heap
+
+    /* Totals */
+    unsigned long long nsent, nbytes, ndropped, nduped, nreordered;
+    unsigned long long nskipped, nrollover;
+};
+
+/** Packets ready to go out.  Up to batch generated packets, twice over
+ * for the duplicates, each a header and a pointer into the payload
+ * pattern, with the time slot of its place in the stream.
+ */
+struct vegas_stream_batch {
+    int n;
+    int nhdr;
+    char hdrs[VEGAS_STREAM_MAX_BATCH][VEGAS_STREAM_HBW_HDR_SIZE];
+    struct mmsghdr msgs[2*VEGAS_STREAM_MAX_BATCH];
+    struct iovec iovs[2*VEGAS_STREAM_MAX_BATCH][2];
+    char late[2*VEGAS_STREAM_MAX_BATCH];   ///< 1 to move randomly, 2 by exactly depth
+    unsigned long long slot[2*VEGAS_STREAM_MAX_BATCH];
+};
+
+/** Set the defaults: a HBW stream with no faults */
+void vegas_stream_init(struct vegas_stream *s);
+
+/** Read a fault profile */
+int vegas_stream_read_profile(struct vegas_stream *s, const char *filename);
+
+/** Size the heaps for nchan HBW channels and build the payload */
+int vegas_stream_start(struct vegas_stream *s, int nchan);
+
+/** Generate the next batch packets, or as many as are left, and apply
+ * the reordering.  Returns the number of messages in b, 0 at the end.
+ */
+int vegas_stream_fill(struct vegas_stream *s, struct vegas_stream_batch *b,
+                      int batch);
+
+void vegas_stream_free(struct vegas_stream *s);
+
+#endif
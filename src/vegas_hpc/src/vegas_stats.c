@@ -0,0 +1,170 @@
+/* vegas_stats.c
+ *
+ * Registry of lock-free thread statistics and the thread that
+ * publishes them to the status shared memory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "fitshead.h"
+#include "vegas_error.h"
+#include "vegas_stats.h"
+
+static struct vegas_stat stats[VEGAS_STAT_MAX];
+static int nstat = 0;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/// Handed out once the registry is full, so callers need no checks.
+/// It is never published.
+static struct vegas_stat overflow_stat;
+
+/// Sequence number of each value when it was last published.
+/// Only the flusher touches these.
+static unsigned int published_seq[VEGAS_STAT_MAX];
+
+struct vegas_stat *vegas_stat_register(const char *key, int type)
+{
+    struct vegas_stat *s = NULL;
+    int i;
+
+    pthread_mutex_lock(&stats_mutex);
+    for (i=0; i<nstat; i++)
+    {
+        if (strcmp(stats[i].key, key) == 0)
+        {
+            s = &stats[i];
+            break;
+        }
+    }
+    if (s == NULL)
+    {
+        if (nstat < VEGAS_STAT_MAX)
+        {
+            s = &stats[nstat];
+            strncpy(s->key, key, sizeof(s->key) - 1);
+            s->type = type;
+            /* Publish the slot only once it is filled in */
+            __atomic_store_n(&nstat, nstat + 1, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            vegas_warn("vegas_stat_register", "Too many status statistics");
+            s = &overflow_stat;
+        }
+    }
+    else if (s->type != type)
+    {
+        vegas_warn("vegas_stat_register", "Statistic registered with two types");
+    }
+    pthread_mutex_unlock(&stats_mutex);
+    return s;
+}
+
+/// Take a consistent snapshot of a string value. Returns non-zero if
+/// it is mid-update, in which case it is left for the next flush.
+static int read_str(struct vegas_stat *s, unsigned int *seq, char *str)
+{
+    unsigned int seq2;
+
+    *seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if (*seq & 1)
+        return 1;
+    memcpy(str, s->str, VEGAS_STAT_STRLEN);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    seq2 = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    str[VEGAS_STAT_STRLEN - 1] = '\0';
+    return seq2 != *seq;
+}
+
+void vegas_stat_flush(struct vegas_status *st)
+{
+    struct vegas_stat *s;
+    unsigned int seq;
+    int64_t bits;
+    double d;
+    char str[VEGAS_STAT_STRLEN];
+    int i, n;
+
+    n = __atomic_load_n(&nstat, __ATOMIC_ACQUIRE);
+    vegas_status_lock(st);
+    for (i=0; i<n; i++)
+    {
+        s = &stats[i];
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == published_seq[i])
+            continue;
+        switch (s->type)
+        {
+            case VEGAS_STAT_INT:
+                seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+                hputi8(st->buf, s->key, __atomic_load_n(&s->value.i, __ATOMIC_RELAXED));
+                break;
+            case VEGAS_STAT_DOUBLE:
+                seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+                bits = __atomic_load_n(&s->value.i, __ATOMIC_RELAXED);
+                memcpy(&d, &bits, sizeof(d));
+                hputr8(st->buf, s->key, d);
+                break;
+            case VEGAS_STAT_STR:
+                if (read_str(s, &seq, str))
+                    continue;
+                hputs(st->buf, s->key, str);
+                break;
+            default:
+                continue;
+        }
+        published_seq[i] = seq;
+    }
+    vegas_status_unlock(st);
+}
+
+static struct vegas_status *flusher_status;
+static double flusher_interval;
+static int flusher_running = 0;
+static pthread_t flusher_id;
+
+static void *vegas_stat_flusher(void *args)
+{
+    struct timespec ts;
+
+    /* Only ever behind the data path threads */
+    setpriority(PRIO_PROCESS, 0, VEGAS_STAT_FLUSH_PRIORITY);
+
+    ts.tv_sec = (time_t)flusher_interval;
+    ts.tv_nsec = (long)((flusher_interval - ts.tv_sec) * 1e9);
+    while (__atomic_load_n(&flusher_running, __ATOMIC_ACQUIRE))
+    {
+        nanosleep(&ts, NULL);
+        vegas_stat_flush(flusher_status);
+    }
+    return NULL;
+}
+
+int vegas_stat_flusher_start(struct vegas_status *s, double interval)
+{
+    if (flusher_running)
+        return(VEGAS_OK);
+    flusher_status = s;
+    flusher_interval = interval > 0.0 ? interval : VEGAS_STAT_FLUSH_INTERVAL;
+    flusher_running = 1;
+    if (pthread_create(&flusher_id, NULL, vegas_stat_flusher, NULL))
+    {
+        vegas_error("vegas_stat_flusher_start", "Error creating stats flusher thread");
+        flusher_running = 0;
+        return(VEGAS_ERR_SYS);
+    }
+    return(VEGAS_OK);
+}
+
+void vegas_stat_flusher_stop(void)
+{
+    if (!flusher_running)
+        return;
+    __atomic_store_n(&flusher_running, 0, __ATOMIC_RELEASE);
+    pthread_join(flusher_id, NULL);
+    vegas_stat_flush(flusher_status);
+}
@@ -0,0 +1,100 @@
+/** vegas_stats.h
+ *
+ * Lock-free counters for the data path threads.  A thread registers
+ * each status keyword it reports once, then updates it with plain
+ * atomic stores.  A low priority flusher thread copies every value that
+ * changed into the status shared memory at a fixed cadence, so the data
+ * paths never take the status lock just to report statistics.
+ *
+ * Each keyword must have a single writer thread.
+ */
+#ifndef _VEGAS_STATS_H
+#define _VEGAS_STATS_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "vegas_status.h"
+
+#define VEGAS_STAT_INT    0  /**< Written with hputi8 */
+#define VEGAS_STAT_DOUBLE 1  /**< Written with hputr8 */
+#define VEGAS_STAT_STR    2  /**< Written with hputs */
+
+#define VEGAS_STAT_MAX    64 ///< Maximum number of registered keywords
+#define VEGAS_STAT_STRLEN 24 ///< Longest string value, including the nul
+
+#define VEGAS_STAT_FLUSH_INTERVAL 0.25 ///< Default flusher period, seconds
+#define VEGAS_STAT_FLUSH_PRIORITY 10   ///< Nice value of the flusher thread
+
+/** One published value, alone on its cache line so that threads
+ * updating different counters do not contend.
+ */
+struct vegas_stat {
+    unsigned int seq;  /**< Bumped on every update; odd while a string is written */
+    int type;          /**< VEGAS_STAT_* */
+    union {
+        int64_t i;
+        double d;
+    } value;
+    char str[VEGAS_STAT_STRLEN];
+    char key[9];       /**< Status keyword */
+} __attribute__ ((aligned(64)));
+
+#ifdef __cplusplus /* C++ prototypes */
+extern "C" {
+#endif
+
+/** Return the counter for a status keyword, creating it on first use.
+ * Registering an existing keyword again returns the same counter, so
+ * threads can simply register at startup each time they run.
+ */
+struct vegas_stat *vegas_stat_register(const char *key, int type);
+
+/** Copy every value changed since the last flush into the status buffer,
+ * taking the status lock once.
+ */
+void vegas_stat_flush(struct vegas_status *s);
+
+/** Start the flusher thread, publishing every interval seconds */
+int vegas_stat_flusher_start(struct vegas_status *s, double interval);
+
+/** Stop the flusher thread after a final flush */
+void vegas_stat_flusher_stop(void);
+
+#ifdef __cplusplus /* C++ prototypes */
+}
+#endif
+
+static inline void vegas_stat_set_int(struct vegas_stat *s, int64_t v)
+{
+    __atomic_store_n(&s->value.i, v, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline void vegas_stat_add_int(struct vegas_stat *s, int64_t v)
+{
+    vegas_stat_set_int(s, s->value.i + v);
+}
+
+static inline void vegas_stat_set_double(struct vegas_stat *s, double v)
+{
+    int64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    __atomic_store_n(&s->value.i, bits, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+/** Strings are published with a sequence lock: seq is odd while the
+ * string is being written and the flusher retries if it changes.
+ */
+static inline void vegas_stat_set_str(struct vegas_stat *s, const char *v)
+{
+    unsigned int seq = s->seq;
+    __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    strncpy(s->str, v, VEGAS_STAT_STRLEN - 1);
+    s->str[VEGAS_STAT_STRLEN - 1] = '\0';
+    __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+#endif
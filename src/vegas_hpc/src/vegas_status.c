@@ -11,8 +11,16 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
 #include <semaphore.h>
 
+#include "fitshead.h"
+#include "hashpipe_ipckey.h"
 #include "vegas_status.h"
 #include "vegas_error.h"
 
@@ -81,8 +89,15 @@ int vegas_status_attach_inst(struct vegas_status *s, int instance_id) {
     }
     printf("shmget key: %x\n" , key);
 
-    /* Get shared mem id (creating it if necessary) */
-    s->shmid = shmget(key, VEGAS_STATUS_SIZE, 0666 | IPC_CREAT);
+    /* Get shared mem id (creating it if necessary), with room for the
+       keyword index and sequence counter.  A segment that is too small
+       for them was made before them, with the index alone or neither. */
+    const size_t size[3] = {VEGAS_STATUS_SEQ_OFFSET + VEGAS_STATUS_SEQ_SIZE,
+        VEGAS_STATUS_INDEX_OFFSET + sizeof(struct hindex), VEGAS_STATUS_SIZE};
+    int layout = 0;
+    s->shmid = shmget(key, size[0], 0666 | IPC_CREAT);
+    while (s->shmid==-1 && errno==EINVAL && layout < 2)
+        s->shmid = shmget(key, size[++layout], 0666 | IPC_CREAT);
     //s->shmid = shmget(VEGAS_STATUS_KEY, VEGAS_STATUS_SIZE, 0666 | IPC_CREAT);
     if (s->shmid==-1) { 
         vegas_error("vegas_status_attach", "shmget error");
@@ -96,6 +111,17 @@ int vegas_status_attach_inst(struct vegas_status *s, int instance_id) {
         vegas_error("vegas_status_attach", "shmat error");
         return(VEGAS_ERR_SYS);
     }
+    s->seq = NULL;
+    if (layout > 0)
+        vegas_warn("vegas_status_attach", layout == 1 ?
+                "status segment has no sequence counter, recreate it to get one" :
+                "status segment has no sequence counter or keyword index, "
+                "recreate it to get them");
+    if (layout == 0)
+        s->seq = (struct vegas_status_seq *)(s->buf + VEGAS_STATUS_SEQ_OFFSET);
+    if (layout < 2 && hindex_attach(s->buf, VEGAS_STATUS_SIZE,
+                (struct hindex *)(s->buf + VEGAS_STATUS_INDEX_OFFSET)))
+        vegas_warn("vegas_status_attach", "too many attaches to index them all");
 
     /* Get the locking semaphore.
      * Final arg (1) means create in unlocked state (0=locked).
@@ -122,24 +148,147 @@ int vegas_status_attach_inst(struct vegas_status *s, int instance_id) {
 }
 
 int vegas_status_detach(struct vegas_status *s) {
+    hindex_detach(s->buf);
     int rv = shmdt(s->buf);
     if (rv!=0) {
         vegas_error("vegas_status_detach", "shmdt error");
         return(VEGAS_ERR_SYS);
     }
     s->buf = NULL;
+    s->seq = NULL;
     return(VEGAS_OK);
 }
 
-/* TODO: put in some (long, ~few sec) timeout */
+static double status_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Say who has held the lock while we waited for it */
+static void status_lock_warn(struct vegas_status *s, const char *name,
+        double waited) {
+    char msg[256];
+    struct vegas_status_seq *q = s->seq;
+    if (q == NULL || !(q->seq & 1)) {
+        snprintf(msg, sizeof(msg), "waited %.0f s for the status lock", waited);
+    } else {
+        snprintf(msg, sizeof(msg),
+                "waited %.0f s for the status lock, held by pid %d for %.1f s%s",
+                waited, q->pid, status_now() - q->lock_time,
+                kill(q->pid, 0) == -1 && errno == ESRCH ? ", which has exited" : "");
+    }
+    vegas_warn(name, msg);
+}
+
+/* Wait for the semaphore until the time limit, warning as we go */
+static int status_sem_wait(struct vegas_status *s, const char *name,
+        double timeout) {
+    double start = status_now(), limit, t;
+    struct timespec ts;
+    int rv;
+    while (1) {
+        limit = start + timeout;
+        t = status_now() + VEGAS_STATUS_LOCK_WARN;
+        if (t < limit)
+            limit = t;
+        ts.tv_sec = (time_t)limit;
+        ts.tv_nsec = (long)((limit - ts.tv_sec) * 1e9);
+        rv = sem_timedwait(s->lock, &ts);
+        if (rv == 0)
+            return(VEGAS_OK);
+        if (errno == EINTR)
+            continue;
+        if (errno != ETIMEDOUT) {
+            vegas_error(name, "sem_timedwait error");
+            return(VEGAS_ERR_SYS);
+        }
+        t = status_now() - start;
+        if (t >= timeout)
+            return(VEGAS_TIMEOUT);
+        status_lock_warn(s, name, t);
+    }
+}
+
+/* Writers make the sequence counter odd while they hold the lock */
+static void status_seq_begin(struct vegas_status *s) {
+    struct vegas_status_seq *q = s->seq;
+    if (q == NULL)
+        return;
+    q->pid = getpid();
+    q->lock_time = status_now();
+    if (!(q->seq & 1))
+        __sync_add_and_fetch(&q->seq, 1);
+}
+
+static void status_seq_end(struct vegas_status *s) {
+    struct vegas_status_seq *q = s->seq;
+    if (q != NULL && (q->seq & 1))
+        __sync_add_and_fetch(&q->seq, 1);
+}
+
+/* The shared keyword index is only rebuilt with the lock held */
 int vegas_status_lock(struct vegas_status *s) {
-    return(sem_wait(s->lock));
+    int rv = status_sem_wait(s, "vegas_status_lock", 1e30);
+    if (rv == VEGAS_OK) {
+        status_seq_begin(s);
+        hindex_refresh(s->buf);
+    }
+    return(rv);
+}
+
+int vegas_status_lock_timeout(struct vegas_status *s, double timeout) {
+    int rv = status_sem_wait(s, "vegas_status_lock_timeout", timeout);
+    if (rv == VEGAS_OK) {
+        status_seq_begin(s);
+        hindex_refresh(s->buf);
+    }
+    return(rv);
 }
 
 int vegas_status_unlock(struct vegas_status *s) {
+    status_seq_end(s);
     return(sem_post(s->lock));
 }
 
+/* Whether nobody holds the lock */
+static int status_unlocked(struct vegas_status *s) {
+    int val = 0;
+    return sem_getvalue(s->lock, &val) == 0 && val > 0;
+}
+
+int vegas_status_snapshot(struct vegas_status *s, char *copy) {
+    struct vegas_status_seq *q = s->seq;
+    unsigned int seq;
+    int ntry, rv;
+
+    /* The counter only covers writers that keep it.  Those that do not
+       still hold the lock while they write, and finish before they let
+       it go, so a copy taken with the lock free at both ends that is
+       the same as the cards after it is whole. */
+    for (ntry=0; q != NULL && ntry < VEGAS_STATUS_SNAP_TRIES; ntry++) {
+        seq = q->seq;
+        __sync_synchronize();
+        if (!(seq & 1) && status_unlocked(s)) {
+            memcpy(copy, s->buf, VEGAS_STATUS_SIZE);
+            __sync_synchronize();
+            if (memcmp(copy, s->buf, VEGAS_STATUS_SIZE) == 0 &&
+                    status_unlocked(s) && q->seq == seq)
+                return(VEGAS_OK);
+        }
+        /* A writer is at it: give it the processor */
+        sched_yield();
+    }
+
+    /* Without the counter, or with a writer at it throughout, only the
+       lock keeps the copy whole */
+    rv = vegas_status_lock(s);
+    if (rv != VEGAS_OK)
+        return(rv);
+    memcpy(copy, s->buf, VEGAS_STATUS_SIZE);
+    return(vegas_status_unlock(s));
+}
+
 /* Return pointer to END key */
 char *vegas_find_end(char *buf) {
     /* Loop over 80 byte cards */
@@ -177,6 +326,7 @@ void vegas_status_chkinit(struct vegas_status *s) {
         memset(s->buf, ' ', VEGAS_STATUS_CARD);
         /* add END */
         strncpy(s->buf, "END", 3);
+        hindex_changed(s->buf);
     }
 
     /* Unlock */
@@ -206,6 +356,7 @@ void vegas_status_clear(struct vegas_status *s) {
     memset(s->buf, ' ', VEGAS_STATUS_CARD);
     /* add END */
     strncpy(s->buf, "END", 3);
+    hindex_changed(s->buf);
 
     /* Unlock */
     vegas_status_unlock(s);
@@ -18,6 +18,37 @@
 #define VEGAS_STATUS_SIZE (2880*64) ///< FITS-style buffer
 #define VEGAS_STATUS_CARD 80 ///< Size of each FITS "card"
 
+/** The segment keeps a keyword index of the cards (struct hindex, see
+ * fitshead.h) straight after them, so that hget*() of the status buffer
+ * need not scan it.  hput*() keep it up to date; anything else that
+ * rewrites the cards must zero its first word, so that it is rebuilt.
+ * A segment created before there was an index is used without one.
+ */
+#define VEGAS_STATUS_INDEX_OFFSET VEGAS_STATUS_SIZE
+
+/** After the index, the segment keeps a sequence counter that
+ * vegas_status_lock() makes odd and vegas_status_unlock() even again.
+ * vegas_status_snapshot() copies the cards without the lock while the
+ * counter is even and the lock free, and checks that they are unchanged
+ * after, as not every writer keeps the counter.  A segment created
+ * before there was a counter is read under the lock.
+ */
+struct vegas_status_seq {
+    volatile unsigned int seq; /**< Odd while the lock is held */
+    int pid;                   /**< Process that last took the lock */
+    double lock_time;          /**< When it took it (unix time, s) */
+};
+#define VEGAS_STATUS_SEQ_OFFSET (VEGAS_STATUS_INDEX_OFFSET + sizeof(struct hindex))
+#define VEGAS_STATUS_SEQ_SIZE 64 ///< Room kept for the counter
+
+/** Lock-free copies vegas_status_snapshot() tries before it waits for
+ * the lock */
+#define VEGAS_STATUS_SNAP_TRIES 16
+
+/** vegas_status_lock() says who holds the lock each time it has waited
+ * this long (s) for it */
+#define VEGAS_STATUS_LOCK_WARN 5.0
+
 #define VEGAS_LOCK 1
 #define VEGAS_NOLOCK 0
 
@@ -26,6 +57,7 @@ struct vegas_status {
     int shmid;   /**< Shared memory segment id */
     sem_t *lock; /**< POSIX semaphore descriptor for locking */
     char *buf;   /**< Pointer to data area */
+    struct vegas_status_seq *seq; /**< Sequence counter, or NULL */
 };
 
 #ifdef __cplusplus /* C++ prototypes */
@@ -42,12 +74,24 @@ int vegas_status_attach(struct vegas_status *s);
 /** Detach from shared mem segment */
 int vegas_status_detach(struct vegas_status *s); 
 
-/** Lock/unlock the status buffer.  vegas_status_lock() will wait for
- * the buffer to become unlocked.  Return non-zero on errors.
+/** Lock/unlock the status buffer, to change it.  vegas_status_lock()
+ * will wait for the buffer to become unlocked, saying who holds it every
+ * VEGAS_STATUS_LOCK_WARN seconds.  Return non-zero on errors.
  */
 int vegas_status_lock(struct vegas_status *s);
 int vegas_status_unlock(struct vegas_status *s);
 
+/** As vegas_status_lock(), but give up after timeout seconds, returning
+ * VEGAS_TIMEOUT without the lock.
+ */
+int vegas_status_lock_timeout(struct vegas_status *s, double timeout);
+
+/** Copy the VEGAS_STATUS_SIZE bytes of cards into copy, consistently,
+ * without taking the lock if it can.  Waits for the lock only if a
+ * writer keeps it, or changes the cards, through a few tries.
+ */
+int vegas_status_snapshot(struct vegas_status *s, char *copy);
+
 /** Check the buffer for appropriate formatting (existence of "END").
  * If not found, zero it out and add END.
  */
@@ -13,6 +13,7 @@
 void vegas_thread_args_init(struct vegas_thread_args *a) {
     a->priority=0;
     a->finished=0;
+    a->pipe=0;
     pthread_cond_init(&a->finished_c,NULL);
     pthread_mutex_init(&a->finished_m,NULL);
     /* By default, allow all cores currently allowed */
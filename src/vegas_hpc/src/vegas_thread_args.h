@@ -18,6 +18,7 @@ struct vegas_thread_args {
     int cov_mode1;                          // HI fine channels
     int cov_mode2;                          // PAF coarse channels
     int cov_mode3;                          // FRB mode
+    int pipe;                               // Net pipeline, 0 for the first
 };
 
 void vegas_thread_args_init(struct vegas_thread_args *a);
@@ -7,6 +7,7 @@
 #define _VEGAS_THREADS_H
 
 #include "vegas_thread_args.h"
+#include "vegas_stats.h"
 
 #ifndef VEGAS_NUMA
 #define ACCUM_THREAD_CORE 1
@@ -47,12 +48,36 @@ extern void cc(int sig);
 extern "C" {
 #endif
 
-static void set_exit_status(struct vegas_status *s) {
+static inline void set_exit_status(struct vegas_status *s) {
+    /* Also through the stats, so that a state still waiting to be
+     * flushed cannot overwrite this one. */
+    vegas_stat_set_str(vegas_stat_register(STATUS_KEY, VEGAS_STAT_STR), "exiting");
     vegas_status_lock(s);
     hputs(s->buf, STATUS_KEY, "exiting");
     vegas_status_unlock(s);
 }
 
+/** A thread's status keyword, numbered for its net pipeline as
+ * vegas_pipe_key() numbers them; the first pipeline's is STATUS_KEY */
+struct vegas_thread_state {
+    struct vegas_status *st;
+    char key[9];
+};
+
+static inline void vegas_thread_state_init(struct vegas_thread_state *ts,
+        struct vegas_status *st, int pipe) {
+    ts->st = st;
+    vegas_pipe_key(ts->key, STATUS_KEY, pipe);
+}
+
+/** set_exit_status() for the keyword of a thread's pipeline */
+static inline void set_pipe_exit_status(struct vegas_thread_state *ts) {
+    vegas_stat_set_str(vegas_stat_register(ts->key, VEGAS_STAT_STR), "exiting");
+    vegas_status_lock(ts->st);
+    hputs(ts->st->buf, ts->key, "exiting");
+    vegas_status_unlock(ts->st);
+}
+
 #ifdef __cplusplus /* C++ prototypes */
 }
 #endif
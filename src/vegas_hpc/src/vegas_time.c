@@ -8,6 +8,7 @@
 #include "slalib.h"
 #include "vegas_error.h"
 #include "vegas_defines.h"
+#include "vegas_time.h"
 
 int get_current_mjd(int *stt_imjd, int *stt_smjd, double *stt_offs) {
     int rv;
@@ -59,6 +60,22 @@ int get_current_mjd_double(double *mjd) {
     return(VEGAS_OK);
 }
 
+int vegas_mjd_epoch_init(struct vegas_mjd_epoch *e, const struct timespec *ts) {
+    int rv;
+    struct tm gmt;
+
+    if (gmtime_r(&ts->tv_sec, &gmt)==NULL)
+        return(VEGAS_ERR_SYS);
+
+    slaCaldj(gmt.tm_year+1900, gmt.tm_mon+1, gmt.tm_mday, &e->mjd, &rv);
+    if (rv!=0) { return(VEGAS_ERR_GEN); }
+
+    e->mjd += (gmt.tm_hour*3600 + gmt.tm_min*60 + gmt.tm_sec) / 86400.0;
+    e->sec = ts->tv_sec;
+
+    return(VEGAS_OK);
+}
+
 #endif
 
 int datetime_from_mjd(long double MJD, int *YYYY, int *MM, int *DD, 
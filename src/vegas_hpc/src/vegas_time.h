@@ -5,6 +5,7 @@
 #ifndef _VEGAS_TIME_H
 #define _VEGAS_TIME_H
 
+#include <time.h>
 #include "vegas_defines.h"
 
 /** Return current time using PSRFITS-style integer MJD, integer 
@@ -23,6 +24,24 @@ int get_current_lst(double mjd, int *lst_secs);
 /** Return the time in MJD, with microsecond resolution */
 int get_current_mjd_double(double *mjd);
 
+/** A reference point for converting many nearby UTC times to MJD
+ * without calendar arithmetic for each one.
+ */
+struct vegas_mjd_epoch {
+    time_t sec;     /**< Unix time of the epoch (whole seconds) */
+    double mjd;     /**< MJD corresponding to sec */
+};
+
+/** Set the epoch to the whole second containing ts */
+int vegas_mjd_epoch_init(struct vegas_mjd_epoch *e, const struct timespec *ts);
+
+/** Convert a UTC time near the epoch to MJD */
+static inline double vegas_mjd_from_epoch(const struct vegas_mjd_epoch *e,
+                                          const struct timespec *ts)
+{
+    return e->mjd + ((double)(ts->tv_sec - e->sec) + ts->tv_nsec*1e-9) / 86400.0;
+}
+
 #endif
 
 #endif
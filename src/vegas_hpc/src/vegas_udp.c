@@ -8,7 +8,9 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <linux/net_tstamp.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <poll.h>
@@ -23,6 +25,7 @@
 #include "vegas_defines.h"
 #include "spead_packet.h"
 #include "spead_heap.h"
+#include "vegas_bswap.h"
 
 enum IDIndex { HEAP_COUNTER_IDX, HEAP_SIZE_IDX, HEAP_OFFSET_IDX,
                PAYLOAD_OFFSET_IDX, TIME_STAMP_IDX, SPECTRUM_COUNTER_IDX,
@@ -61,8 +64,9 @@ static inline unsigned int BYTE_ARR_TO_UINT(const char *p1, int idx)
 }
 
 /// Extract the number of items in the SPEAD header.
-static uint32_t ok_packets =0;
-static uint32_t error_packets=0;
+/* Per thread, as each net pipeline has its own */
+static __thread uint32_t ok_packets =0;
+static __thread uint32_t error_packets=0;
 
 static void set_obs_status_bit(struct vegas_udp_packet *p);
 
@@ -230,6 +234,30 @@ int vegas_udp_init(struct vegas_udp_params *p) {
         printf("vegas_udp_init: SO_RCVBUF=%d\n", bufsize);
     }
 
+    /* Ask the kernel (or NIC) to timestamp each packet on arrival.
+     * Hardware timestamps also need the NIC configured (SIOCSHWTSTAMP),
+     * so we ask for software stamps as well and use whichever comes back.
+     */
+    if (p->rx_tstamp == VEGAS_RX_TSTAMP_HARDWARE)
+    {
+        int flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+                    SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        rv = setsockopt(p->sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+        if (rv<0) {
+            vegas_warn("vegas_udp_init", "SO_TIMESTAMPING failed, using SO_TIMESTAMPNS");
+            p->rx_tstamp = VEGAS_RX_TSTAMP_SOFTWARE;
+        }
+    }
+    if (p->rx_tstamp == VEGAS_RX_TSTAMP_SOFTWARE)
+    {
+        int on = 1;
+        rv = setsockopt(p->sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+        if (rv<0) {
+            vegas_warn("vegas_udp_init", "SO_TIMESTAMPNS failed, using clock time");
+            p->rx_tstamp = VEGAS_RX_TSTAMP_NONE;
+        }
+    }
+
     /* Poll command */
     p->pfd.fd = p->sock;
     p->pfd.events = POLLIN;
@@ -257,28 +285,25 @@ int vegas_udp_wait(struct vegas_udp_params *p) {
     }  
 }
 
-/// Receives the network packet and processes the packet filling the udp_packet structure.
-/// The resulting packet has a SPEAD header, and the item table is in host byte order
-int vegas_udp_recv(struct vegas_udp_params *p, struct vegas_udp_packet *b, char bw_mode[]) 
+/// Size of the raw LBW header in front of the payload on the wire
+#define LBW_WIRE_HDR_SIZE (2*sizeof(uint64_t))
+
+/// Where the packet is received within b->data. In the LBW mode the packet
+/// lands at an offset so that the 72 byte fake SPEAD header can be written
+/// over the 16 byte LBW header without moving the payload.
+static char *wire_start(const struct vegas_udp_params *p, struct vegas_udp_packet *b)
+{
+    if (p->is_hbw)
+        return b->data;
+    return &b->data[sizeof(sphead) - LBW_WIRE_HDR_SIZE];
+}
+
+/// Process a received packet of rv bytes, leaving a SPEAD header with
+/// the item table in host byte order.
+static int vegas_udp_process(struct vegas_udp_params *p, struct vegas_udp_packet *b, int rv)
 {
-    int rv = 0;
     int hbw = p->is_hbw;
-    if (hbw) /* high bandwidth mode */
-    {
-        rv = recv(p->sock, b->data, VEGAS_MAX_PACKET_SIZE, 0);
-    }
-    else    /* lbw */
-    {
-        // Copy the packet into the databuffer offset so that we don't need to recopy
-        // the data later. A 72 byte SPEAD header will be prepended, so we leave
-        // space for that, but we need to offset backwards to allow for the 16 byte LBW header
-        // off the wire. Bottom line is that real data should land at correct offset
-        rv = recv(p->sock, &b->data[sizeof(sphead) - sizeof(uint64_t) * 2], VEGAS_MAX_PACKET_SIZE, 0);
-        if (8208 != rv) /* sanity check */
-        {
-            return VEGAS_ERR_PACKET;
-        }
-    }
+
     // record the actual packet length received
     b->packet_size = rv;
     
@@ -332,6 +357,186 @@ int vegas_udp_recv(struct vegas_udp_params *p, struct vegas_udp_packet *b, char
     }
 }
 
+/// Room for either an SCM_TIMESTAMPNS or an SCM_TIMESTAMPING control message
+#define RX_CONTROL_SIZE CMSG_SPACE(sizeof(struct timespec) * 3)
+
+/// Set up a msghdr for recvmsg, with a control buffer if timestamps are on
+static void init_msghdr(const struct vegas_udp_params *p, struct msghdr *msg,
+                        struct iovec *iov, int niov, char *control)
+{
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_iov = iov;
+    msg->msg_iovlen = niov;
+    if (p->rx_tstamp != VEGAS_RX_TSTAMP_NONE)
+    {
+        msg->msg_control = control;
+        msg->msg_controllen = RX_CONTROL_SIZE;
+    }
+}
+
+/// Pull the arrival time out of the control messages. A raw hardware
+/// stamp is preferred over the software one when both are present.
+/// The raw hardware stamp (ts[2]) is read from the NIC's PTP hardware
+/// clock, not the system clock: it is only UTC if that clock is kept
+/// disciplined (e.g. by ptp4l or phc2sys), which is why NETTSTMP=hardware
+/// has to be asked for.  The software stamp (ts[0]) is CLOCK_REALTIME.
+static void get_rx_time(struct msghdr *msg, struct vegas_udp_packet *b)
+{
+    struct cmsghdr *cmsg;
+    struct timespec ts[3];
+
+    b->rx_time.tv_sec = 0;
+    b->rx_time.tv_nsec = 0;
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+        if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            memcpy(&b->rx_time, CMSG_DATA(cmsg), sizeof(struct timespec));
+        }
+        else if (cmsg->cmsg_type == SCM_TIMESTAMPING)
+        {
+            memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+            b->rx_time = ts[2].tv_sec != 0 ? ts[2] : ts[0];
+        }
+    }
+}
+
+void vegas_udp_packet_rx_time(const struct vegas_udp_packet *b, struct timespec *ts)
+{
+    if (b->rx_time.tv_sec != 0)
+        *ts = b->rx_time;
+    else
+        clock_gettime(CLOCK_REALTIME, ts);
+}
+
+/// Receives the network packet and processes the packet filling the udp_packet structure.
+/// The resulting packet has a SPEAD header, and the item table is in host byte order
+int vegas_udp_recv(struct vegas_udp_params *p, struct vegas_udp_packet *b, char bw_mode[])
+{
+    int rv = 0;
+
+    struct iovec iov;
+    struct msghdr msg;
+    char control[RX_CONTROL_SIZE];
+
+    b->payload = NULL;
+    // Copy the packet into the databuffer offset so that we don't need to recopy
+    // the data later. Bottom line is that real data should land at correct offset
+    iov.iov_base = wire_start(p, b);
+    iov.iov_len  = VEGAS_MAX_PACKET_SIZE;
+    init_msghdr(p, &msg, &iov, 1, control);
+    rv = recvmsg(p->sock, &msg, 0);
+    if (rv == -1)
+        return(VEGAS_ERR_SYS);
+    get_rx_time(&msg, b);
+    if (!p->is_hbw && 8208 != rv) /* lbw sanity check */
+    {
+        return VEGAS_ERR_PACKET;
+    }
+    return vegas_udp_process(p, b, rv);
+}
+
+/// Move a scattered payload back into the packet buffer just after the
+/// wire header and re-zero the slot, so the packet looks as if it was
+/// read by vegas_udp_recv().
+static void unscatter(struct vegas_udp_packet *b, char *wire, size_t hdr_size,
+                      struct vegas_udp_scatter *s, int rv)
+{
+    size_t n = 0;
+    if (rv > (int)hdr_size)
+        n = rv - hdr_size < s->payload_size ? rv - hdr_size : s->payload_size;
+    memcpy(wire + hdr_size, s->payload_addr, n);
+    memset(s->payload_addr, 0, n);
+    b->payload = NULL;
+    s->nmiss++;
+}
+
+/// Receive into the predicted databuf slot. The wire header goes into the
+/// packet buffer, the payload into the slot and anything unexpected past
+/// that back into the packet buffer, so that a miss can be reassembled.
+int vegas_udp_recv_scatter(struct vegas_udp_params *p, struct vegas_udp_packet *b,
+                           struct vegas_udp_scatter *s, char bw_mode[])
+{
+    char *wire = wire_start(p, b);
+    size_t hdr_size;
+    struct iovec iov[3];
+    struct msghdr msg;
+    char control[RX_CONTROL_SIZE];
+    int rv, num_items;
+
+    if (p->is_hbw)
+        hdr_size = s->heap_offset == 0 ? s->hdr_size_first : s->hdr_size_cont;
+    else
+        hdr_size = LBW_WIRE_HDR_SIZE;
+
+    if (!p->scatter_recv || s->payload_addr == NULL || hdr_size == 0 ||
+        hdr_size + s->payload_size >= VEGAS_MAX_PACKET_SIZE)
+    {
+        rv = vegas_udp_recv(p, b, bw_mode);
+    }
+    else
+    {
+        iov[0].iov_base = wire;
+        iov[0].iov_len  = hdr_size;
+        iov[1].iov_base = s->payload_addr;
+        iov[1].iov_len  = s->payload_size;
+        iov[2].iov_base = wire + hdr_size + s->payload_size;
+        iov[2].iov_len  = VEGAS_MAX_PACKET_SIZE - hdr_size - s->payload_size;
+        init_msghdr(p, &msg, iov, 3, control);
+
+        rv = recvmsg(p->sock, &msg, 0);
+        if (rv == -1)
+            return(VEGAS_ERR_SYS);
+        get_rx_time(&msg, b);
+
+        // The header must be exactly the size predicted. This is checked on
+        // the raw big-endian item count, before anything is byte swapped.
+        num_items = 0;
+        if (p->is_hbw)
+            num_items = rv >= (int)sizeof(SPEAD_HEADER) ?
+                be16toh(((SPEAD_HEADER *)wire)->num_items) : -1;
+        if (rv != (int)(hdr_size + s->payload_size) ||
+            (p->is_hbw && sizeof(SPEAD_HEADER) + num_items*sizeof(ItemPointer) != hdr_size))
+        {
+            unscatter(b, wire, hdr_size, s, rv);
+            if (!p->is_hbw)
+                return VEGAS_ERR_PACKET;
+            rv = vegas_udp_process(p, b, rv);
+        }
+        else
+        {
+            b->payload = s->payload_addr;
+            rv = vegas_udp_process(p, b, rv);
+            if (rv != VEGAS_OK ||
+                vegas_spead_packet_heap_cntr(b) != s->heap_cntr ||
+                vegas_spead_packet_heap_offset(b) != s->heap_offset)
+            {
+                // The header has been processed in place, only the payload moves
+                if (p->is_hbw)
+                    unscatter(b, b->data, hdr_size, s, hdr_size + s->payload_size);
+                else
+                    unscatter(b, b->data, sizeof(sphead), s,
+                              sizeof(sphead) + s->payload_size);
+            }
+            else
+                s->nhit++;
+        }
+    }
+
+    // Learn the HBW header sizes from what actually arrives
+    if (rv == VEGAS_OK && p->is_hbw)
+    {
+        hdr_size = b->packet_size - vegas_spead_packet_datasize(b);
+        if (vegas_spead_packet_heap_offset(b) == 0)
+            s->hdr_size_first = hdr_size;
+        else
+            s->hdr_size_cont = hdr_size;
+    }
+    return rv;
+}
+
 /// Byte swap a 64 bit value
 unsigned long long change_endian64(const unsigned long long *d) 
 {
@@ -672,6 +877,8 @@ unsigned int vegas_spead_packet_seq_num(int heap_cntr, int heap_offset, int pack
 /// variable length SPEAD headers
 char* vegas_spead_packet_data(const struct vegas_udp_packet *p)
 {
+    if (p->payload != NULL)
+        return p->payload;
     VegasSpeadPacketHeader *sptr = (VegasSpeadPacketHeader *)p->data;
     size_t data_offset = sizeof(SPEAD_HEADER) + num_spead_items(sptr)*sizeof(ItemPointer);
     return (char*)(p->data + data_offset);
@@ -690,7 +897,7 @@ int vegas_spead_packet_copy(struct vegas_udp_packet *p, char *header_addr,
                             char* payload_addr, char bw_mode[])
 {
     char* pkt_payload;
-    int payload_size, offset;
+    int payload_size;
     int hbw = (strncmp(bw_mode, "high", 4) == 0);
     VegasSpeadPacketHeader *sptr = (VegasSpeadPacketHeader *)p->data; 
     // ItemPointer *hdr_items = (ItemPointer *)header_addr;
@@ -721,22 +928,20 @@ int vegas_spead_packet_copy(struct vegas_udp_packet *p, char *header_addr,
     }
     
 
-    /* Copy payload */
+    /* Copy payload. If it was received straight into the slot, HBW data
+     * is byte swapped in place and LBW data is already where it belongs.
+     */
     pkt_payload  = vegas_spead_packet_data(p);
     payload_size = vegas_spead_packet_datasize(p);
 
     /* If high-bandwidth mode, byte swap the int32_t data into little endian form. */
     if(hbw)
     {
-        for(offset = 0; offset < payload_size; offset += 4)
-        {
-            *(unsigned int *)(payload_addr + offset) =
-                ntohl(*(unsigned int *)(pkt_payload + offset));
-        }
+        vegas_bswap32_copy(payload_addr, pkt_payload, payload_size);
     }
     
     /* Else if low-bandwidth mode */
-    else if(strncmp(bw_mode, "low", 3) == 0)
+    else if(strncmp(bw_mode, "low", 3) == 0 && pkt_payload != payload_addr)
         memcpy(payload_addr, pkt_payload, payload_size);
 
     return 0;
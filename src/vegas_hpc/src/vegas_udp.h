@@ -7,12 +7,20 @@
 #define _VEGAS_UDP_H
 
 #include <sys/types.h>
+#include <time.h>
 #include <netdb.h>
 #include <poll.h>
 #include "vegas_defines.h"
 
 #define VEGAS_MAX_PACKET_SIZE 9600
 
+/** Receive timestamp sources, selected with the NETTSTMP status keyword */
+#define VEGAS_RX_TSTAMP_NONE     0  /**< No kernel timestamps, use the clock */
+#define VEGAS_RX_TSTAMP_SOFTWARE 1  /**< Kernel receive time (SO_TIMESTAMPNS) */
+#define VEGAS_RX_TSTAMP_HARDWARE 2  /**< NIC receive time (SO_TIMESTAMPING), by
+                                         the NIC's PTP clock: UTC only if that
+                                         is disciplined */
+
 /** Struct to hold connection parameters */
 struct vegas_udp_params {
 
@@ -28,6 +36,24 @@ struct vegas_udp_params {
     struct pollfd pfd;              /**< Use to poll for avail data */
     int observation_started;        /**< Flag used for synthetic blanking data prior to scan start */
     int is_hbw;                     /**< Indicates expected high/low bandwidth packet format */
+    int scatter_recv;               /**< Receive payloads straight into databuf slots when predictable */
+    int rx_tstamp;                  /**< Requested VEGAS_RX_TSTAMP_* source */
+};
+
+/** Prediction of where the next packet's payload belongs, used by
+ * vegas_udp_recv_scatter() to receive the payload directly into a
+ * databuf heap slot.  The caller fills in the prediction before each
+ * receive; the learned header sizes and counters are kept here.
+ */
+struct vegas_udp_scatter {
+    char *payload_addr;        /**< Predicted payload slot, NULL for a plain receive */
+    size_t payload_size;       /**< Expected payload bytes */
+    unsigned int heap_cntr;    /**< Predicted heap counter */
+    unsigned int heap_offset;  /**< Predicted heap offset */
+    size_t hdr_size_first;     /**< Wire header size of a packet at heap offset 0 (0=unknown) */
+    size_t hdr_size_cont;      /**< Wire header size of the remaining packets (0=unknown) */
+    unsigned long long nhit;   /**< Packets received in place */
+    unsigned long long nmiss;  /**< Mispredicted packets that were copied back */
 };
 
 /** Basic structure of a packet.  This struct, functions should 
@@ -45,6 +71,8 @@ struct vegas_udp_params {
  */
 struct vegas_udp_packet {
     size_t packet_size;  /**< packet size, bytes */
+    char *payload;       /**< Payload location when received into a databuf slot, else NULL */
+    struct timespec rx_time; /**< Arrival time (UTC) from the kernel or NIC, zero if unavailable */
     char data[VEGAS_MAX_PACKET_SIZE] __attribute__ ((aligned(32))); /**< packet data */
 };
 unsigned long long vegas_udp_packet_seq_num(const struct vegas_udp_packet *p);
@@ -61,9 +89,22 @@ int vegas_udp_init(struct vegas_udp_params *p);
 /** Wait for available data on the UDP socket */
 int vegas_udp_wait(struct vegas_udp_params *p); 
 
+/** Arrival time of a packet, falling back to the current time
+ * when the socket gave no timestamp.
+ */
+void vegas_udp_packet_rx_time(const struct vegas_udp_packet *b, struct timespec *ts);
+
 /** Read a packet */
 int vegas_udp_recv(struct vegas_udp_params *p, struct vegas_udp_packet *b, char bw_mode[]);
 
+/** Read a packet, placing its payload at s->payload_addr if the packet is
+ * the one predicted in s.  On a hit b->payload points at the slot; on a
+ * miss the payload is copied back into b, the slot is re-zeroed and the
+ * packet is indistinguishable from one read with vegas_udp_recv().
+ */
+int vegas_udp_recv_scatter(struct vegas_udp_params *p, struct vegas_udp_packet *b,
+                           struct vegas_udp_scatter *s, char bw_mode[]);
+
 /** Convert a Parkes-style packet to a VEGAS-style packet */
 void parkes_to_vegas(struct vegas_udp_packet *b, const int acc_len, 
         const int npol, const int nchan);
@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include "vegas_accum_kernels.h"
+#include "vegas_accum_team.h"
+
+#define NUM_STOKES 4
+
+typedef void (*int32_fn)(float *, const int32_t *, size_t);
+typedef void (*float_fn)(float *, const float *, size_t);
+
+/// The loop formerly used in vegas_accum_thread() for HBW payloads
+static void reference_int32(float *acc, const int32_t *in, int nchan, int nsubband)
+{
+    int i, j, k;
+    for(i = 0; i < nchan; i++)
+        for(j = 0; j < nsubband; j++)
+            for(k = 0; k < NUM_STOKES; k++)
+                acc[i*nsubband*NUM_STOKES + j*NUM_STOKES + k] +=
+                    (float)in[i*nsubband*NUM_STOKES + j*NUM_STOKES + k];
+}
+
+/// ...and for LBW payloads
+static void reference_float(float *acc, const float *in, int nchan, int nsubband)
+{
+    int i, j, k;
+    for(i = 0; i < nchan; i++)
+        for(j = 0; j < nsubband; j++)
+            for(k = 0; k < NUM_STOKES; k++)
+                acc[i*nsubband*NUM_STOKES + j*NUM_STOKES + k] +=
+                    in[i*nsubband*NUM_STOKES + j*NUM_STOKES + k];
+}
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/// Accumulate a run of random heaps with a kernel and with the reference
+/// loop, at several sizes and misalignments, and compare the bits.
+int test_bit_exact(const char *name, int32_fn ifn, float_fn ffn)
+{
+    const int maxchan = 1100, nheap = 20;
+    size_t maxn = (size_t)maxchan * 2 * NUM_STOKES;
+    int32_t *iin = malloc((maxn + 16) * sizeof(int32_t));
+    float *fin = malloc((maxn + 16) * sizeof(float));
+    float *ref = malloc((maxn + 32) * sizeof(float));
+    float *out = malloc((maxn + 32) * sizeof(float));
+    int nchan, nsub, off, h, errors = 0;
+    size_t i, n;
+
+    for (nchan = 1; nchan <= maxchan; nchan += (nchan < 40 ? 1 : 97))
+    {
+        for (nsub = 1; nsub <= 2; nsub++)
+        {
+            for (off = 0; off < 16; off += 5)
+            {
+                n = (size_t)nchan * nsub * NUM_STOKES;
+                /* Start from a non-zero sum, guarded at each end */
+                for (i=0; i<maxn + 32; ++i)
+                    ref[i] = out[i] = (float)(rand() % 1000) * 0.125f;
+                for (h = 0; h < nheap; h++)
+                {
+                    for (i=0; i<n; ++i)
+                    {
+                        /* Full range ints, so conversion must round */
+                        iin[off + i] = (int32_t)((uint32_t)rand() << 16 ^ (uint32_t)rand());
+                        fin[off + i] = (float)rand() / (float)rand();
+                    }
+                    reference_int32(ref + off, iin + off, nchan, nsub);
+                    ifn(out + off, iin + off, n);
+                    reference_float(ref + off, fin + off, nchan, nsub);
+                    ffn(out + off, fin + off, n);
+                }
+                if (memcmp(ref, out, (maxn + 32) * sizeof(float)) != 0)
+                {
+                    printf("%s: mismatch nchan=%d nsubband=%d offset=%d\n",
+                           name, nchan, nsub, off);
+                    errors++;
+                }
+            }
+        }
+    }
+    free(iin);
+    free(fin);
+    free(ref);
+    free(out);
+    printf("%s: %s\n", name, errors ? "FAILED" : "bit exact");
+    return errors;
+}
+
+/// Time the accumulation of one heap of nchan x nsubband spectra.
+/// The rate counts the payload read and the accumulator read and written.
+void benchmark(const char *name, int32_fn ifn, float_fn ffn, int nchan, int nsubband)
+{
+    size_t n = (size_t)nchan * nsubband * NUM_STOKES, i;
+    int niter = (int)(400000000 / n);
+    int32_t *iin = aligned_alloc(64, n * sizeof(int32_t));
+    float *fin = aligned_alloc(64, n * sizeof(float));
+    float *acc = aligned_alloc(64, n * sizeof(float));
+    double t0, t1, t2;
+    int it;
+
+    for (i=0; i<n; ++i)
+    {
+        iin[i] = (int32_t)i;
+        fin[i] = (float)i;
+        acc[i] = 0.0f;
+    }
+    t0 = now_sec();
+    for (it=0; it<niter; ++it)
+    {
+        ifn(acc, iin, n);
+        __asm__ __volatile__("" : : "r"(acc) : "memory");
+    }
+    t1 = now_sec();
+    for (it=0; it<niter; ++it)
+    {
+        ffn(acc, fin, n);
+        __asm__ __volatile__("" : : "r"(acc) : "memory");
+    }
+    t2 = now_sec();
+    printf("  %-8s %6d x %d: int32 %9.1f ns/heap %6.2f GB/s   float %9.1f ns/heap %6.2f GB/s\n",
+           name, nchan, nsubband,
+           (t1 - t0) / niter * 1e9, 12.0 * n * niter / (t1 - t0) / 1e9,
+           (t2 - t1) / niter * 1e9, 12.0 * n * niter / (t2 - t1) / 1e9);
+    free(iin);
+    free(fin);
+    free(acc);
+}
+
+/// Accumulate the same heaps into several switching states with one
+/// thread and with teams of each size, and compare the bits.  Shapes
+/// include channel counts that do not split evenly, and the states come
+/// in runs of three heaps so that the runs are fused.  In SDFITS order the
+/// reference is transposed to [subband][stokes][chan] before comparing.
+int test_team(int is_int, int fits_order)
+{
+    const int shapes[][2] = { { 1, 1 }, { 7, 1 }, { 1024, 1 }, { 1000, 8 }, { 4099, 2 } };
+    const int nstate = 4, nheap = 24;
+    struct vegas_accum_team team;
+    int s, nthread, h, c, b, p, errors = 0;
+    unsigned k;
+    size_t i, n;
+    float *tmp;
+
+    for (k=0; k<sizeof(shapes)/sizeof(shapes[0]); ++k)
+    {
+        int nchan = shapes[k][0], nsub = shapes[k][1];
+        n = (size_t)nchan * nsub * NUM_STOKES;
+        int32_t *in = malloc(nheap * n * sizeof(int32_t));
+        float *ref[4], *out[4];
+        for (i=0; i<nheap * n; ++i)
+        {
+            if (is_int)
+                in[i] = (int32_t)((uint32_t)rand() << 16 ^ (uint32_t)rand());
+            else
+                ((float *)in)[i] = (float)rand() / (float)rand();
+        }
+        for (s=0; s<nstate; s++)
+        {
+            ref[s] = calloc(n, sizeof(float));
+            out[s] = malloc(n * sizeof(float));
+        }
+        for (h=0; h<nheap; h++)
+        {
+            if (is_int)
+                vegas_accum_add_int32(ref[h / 3 % nstate], in + h * n, n);
+            else
+                vegas_accum_add_float(ref[h / 3 % nstate], (float *)in + h * n, n);
+        }
+        for (s=0; fits_order && s<nstate; s++)
+        {
+            tmp = malloc(n * sizeof(float));
+            for (c=0; c<nchan; c++)
+                for (b=0; b<nsub; b++)
+                    for (p=0; p<NUM_STOKES; p++)
+                        tmp[(b * NUM_STOKES + p) * nchan + c] = ref[s][(c * nsub + b) * NUM_STOKES + p];
+            free(ref[s]);
+            ref[s] = tmp;
+        }
+
+        for (nthread = 1; nthread <= 8; nthread++)
+        {
+            for (s=0; s<nstate; s++)
+                memset(out[s], 0, n * sizeof(float));
+            /* A short queue so that it also flushes itself */
+            vegas_accum_team_init(&team, nthread, out, NULL, nchan, nsub, is_int, fits_order, 5);
+            for (h=0; h<nheap; h++)
+                vegas_accum_team_add(&team, h / 3 % nstate, in + h * n);
+            vegas_accum_team_flush(&team);
+            vegas_accum_team_destroy(&team);
+            for (s=0; s<nstate; s++)
+            {
+                if (memcmp(ref[s], out[s], n * sizeof(float)) != 0)
+                {
+                    printf("team: %s %s mismatch nchan=%d nsubband=%d nthread=%d\n",
+                           is_int ? "int32" : "float", fits_order ? "fits" : "chan",
+                           nchan, nsub, nthread);
+                    errors++;
+                    break;
+                }
+            }
+        }
+        for (s=0; s<nstate; s++)
+        {
+            free(ref[s]);
+            free(out[s]);
+        }
+        free(in);
+    }
+    printf("team %s %s order: %s\n", is_int ? "int32" : "float",
+           fits_order ? "fits" : "chan", errors ? "FAILED" : "bit exact");
+    return errors;
+}
+
+typedef void (*int64_fn)(int64_t *, const int32_t *, size_t);
+
+/// Sum a long integration of large HBW-like values exactly with each
+/// int64 kernel and with teams, checking against a plain int64 loop, and
+/// show how far float accumulation of the same heaps drifts.
+int test_int64(const char *name, int64_fn fn)
+{
+    const int nchan = 1031, nsub = 1, nheap = 2000;
+    size_t n = (size_t)nchan * nsub * NUM_STOKES, i;
+    int32_t *in = malloc(n * sizeof(int32_t));
+    int64_t *ref = calloc(n, sizeof(int64_t));
+    int64_t *out = calloc(n, sizeof(int64_t));
+    int64_t *team_out[2];
+    float *facc = calloc(n, sizeof(float));
+    float *exact = malloc(n * sizeof(float));
+    float *fits = malloc(n * sizeof(float));
+    struct vegas_accum_team team;
+    double err, max_err = 0.0;
+    int h, c, p, errors = 0;
+
+    team_out[0] = calloc(n, sizeof(int64_t));
+    team_out[1] = calloc(n, sizeof(int64_t));
+    vegas_accum_team_init(&team, 3, NULL, team_out, nchan, nsub, 1, 0, 7);
+    for (h=0; h<nheap; h++)
+    {
+        for (i=0; i<n; ++i)
+            in[i] = (1 << 30) + (rand() & 0xFFFFF) - ((h & 1) << 29);
+        for (i=0; i<n; ++i)
+            ref[i] += in[i];
+        fn(out, in, n);
+        vegas_accum_add_int32(facc, in, n);
+        /* The team reads the payloads only when flushed */
+        vegas_accum_team_add(&team, h & 1, in);
+        vegas_accum_team_flush(&team);
+    }
+    vegas_accum_team_destroy(&team);
+    for (i=0; i<n; ++i)
+        team_out[0][i] += team_out[1][i];
+    if (memcmp(ref, out, n * sizeof(int64_t)) != 0)
+    {
+        printf("%s int64: mismatch\n", name);
+        errors++;
+    }
+    if (memcmp(ref, team_out[0], n * sizeof(int64_t)) != 0)
+    {
+        printf("%s int64: team mismatch\n", name);
+        errors++;
+    }
+
+    /* One rounding per element at dump time, in either order */
+    vegas_accum_int64_to_float(exact, out, nchan, nsub, 0);
+    vegas_accum_int64_to_float(fits, out, nchan, nsub, 1);
+    for (c=0; c<nchan; ++c)
+        for (p=0; p<NUM_STOKES; ++p)
+        {
+            i = c * NUM_STOKES + p;
+            if (exact[i] != (float)ref[i] || fits[p * nchan + c] != (float)ref[i])
+                errors++;
+            err = fabs((double)facc[i] - (double)ref[i]) / (double)ref[i];
+            if (err > max_err)
+                max_err = err;
+        }
+    printf("%s int64: %s, float accumulation off by up to %.2g\n",
+           name, errors ? "FAILED" : "exact", max_err);
+
+    free(in);
+    free(ref);
+    free(out);
+    free(team_out[0]);
+    free(team_out[1]);
+    free(facc);
+    free(exact);
+    free(fits);
+    return errors;
+}
+
+/// Time exact accumulation of one heap.  The rate counts the payload
+/// read and the twice as wide accumulator read and written.
+void benchmark_int64(const char *name, int64_fn fn, int nchan, int nsubband)
+{
+    size_t n = (size_t)nchan * nsubband * NUM_STOKES, i;
+    int niter = (int)(400000000 / n);
+    int32_t *in = aligned_alloc(64, n * sizeof(int32_t));
+    int64_t *acc = aligned_alloc(64, n * sizeof(int64_t));
+    double t0, t1;
+    int it;
+
+    for (i=0; i<n; ++i)
+    {
+        in[i] = (int32_t)i;
+        acc[i] = 0;
+    }
+    t0 = now_sec();
+    for (it=0; it<niter; ++it)
+    {
+        fn(acc, in, n);
+        __asm__ __volatile__("" : : "r"(acc) : "memory");
+    }
+    t1 = now_sec();
+    printf("  %-8s %6d x %d: int64 %9.1f ns/heap %6.2f GB/s\n", name, nchan, nsubband,
+           (t1 - t0) / niter * 1e9, 20.0 * n * niter / (t1 - t0) / 1e9);
+    free(in);
+    free(acc);
+}
+
+/// Time a synthetic input block's worth of heaps through teams of each
+/// size, with and without fusing runs of heaps.  As from a switched
+/// observation the block holds runs of eight heaps in each of two states,
+/// with the payloads back to back as in a databuf block.
+void benchmark_team(int nchan, int nsubband)
+{
+    size_t n = (size_t)nchan * nsubband * NUM_STOKES;
+    int nheap = 64 * 1048576 / (n * sizeof(int32_t));
+    int32_t *in;
+    float *acc[2];
+    struct vegas_accum_team team;
+    int nthread, fuse, h, it, niter;
+    double t0, t1;
+    size_t i;
+
+    if (nheap > 64)
+        nheap = 64;
+    if (nheap < 16)
+        nheap = 16;
+    niter = (int)(4000000000.0 / (n * nheap)) + 1;
+    in = aligned_alloc(64, nheap * n * sizeof(int32_t));
+    for (i=0; i<nheap * n; ++i)
+        in[i] = (int32_t)i;
+    acc[0] = aligned_alloc(64, n * sizeof(float));
+    acc[1] = aligned_alloc(64, n * sizeof(float));
+    for (nthread = 1; nthread <= 4; nthread *= 2)
+    {
+        for (fuse = 0; fuse <= 1; fuse++)
+        {
+            vegas_accum_team_init(&team, nthread, acc, NULL, nchan, nsubband, 1, 0, nheap);
+            if (!fuse)
+                team.max_run = 1;
+            t0 = now_sec();
+            for (it=0; it<niter; ++it)
+            {
+                for (h=0; h<nheap; h++)
+                    vegas_accum_team_add(&team, (h >> 3) & 1, in + h * n);
+                vegas_accum_team_flush(&team);
+            }
+            t1 = now_sec();
+            vegas_accum_team_destroy(&team);
+            printf("  team x%d %-5s %6d x %d: %9.1f ns/heap %9.0f heaps/s\n", nthread,
+                   fuse ? "fused" : "heap", nchan, nsubband,
+                   (t1 - t0) / (niter * nheap) * 1e9, niter * nheap / (t1 - t0));
+        }
+    }
+    free(in);
+    free(acc[0]);
+    free(acc[1]);
+}
+
+static int cur_nchan, cur_nsub;
+static void reference_int32_fn(float *acc, const int32_t *in, size_t n)
+{
+    reference_int32(acc, in, cur_nchan, cur_nsub);
+}
+static void reference_float_fn(float *acc, const float *in, size_t n)
+{
+    reference_float(acc, in, cur_nchan, cur_nsub);
+}
+
+int main(int argc, char **argv)
+{
+    /* HBW h1k and h16k, and LBW modes with 8 subbands */
+    const int shapes[][2] = { { 1024, 1 }, { 16384, 1 }, { 4096, 8 }, { 32768, 8 } };
+    int nerr = 0;
+    unsigned i;
+
+    srand(12345);
+    printf("dispatch selects %s\n", vegas_accum_kernel_name());
+
+    nerr += test_bit_exact("scalar", vegas_accum_add_int32_scalar, vegas_accum_add_float_scalar);
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        nerr += test_bit_exact("avx2", vegas_accum_add_int32_avx2, vegas_accum_add_float_avx2);
+    if (__builtin_cpu_supports("avx512f"))
+        nerr += test_bit_exact("avx512", vegas_accum_add_int32_avx512, vegas_accum_add_float_avx512);
+    nerr += test_bit_exact("dispatch", vegas_accum_add_int32, vegas_accum_add_float);
+    nerr += test_int64("scalar", vegas_accum_add_int32_int64_scalar);
+    if (__builtin_cpu_supports("avx2"))
+        nerr += test_int64("avx2", vegas_accum_add_int32_int64_avx2);
+    if (__builtin_cpu_supports("avx512f"))
+        nerr += test_int64("avx512", vegas_accum_add_int32_int64_avx512);
+    nerr += test_team(1, 0);
+    nerr += test_team(0, 0);
+    nerr += test_team(1, 1);
+    nerr += test_team(0, 1);
+
+    printf("per heap accumulation cost:\n");
+    for (i=0; i<sizeof(shapes)/sizeof(shapes[0]); ++i)
+    {
+        cur_nchan = shapes[i][0];
+        cur_nsub = shapes[i][1];
+        benchmark("loop", reference_int32_fn, reference_float_fn, cur_nchan, cur_nsub);
+        benchmark("scalar", vegas_accum_add_int32_scalar, vegas_accum_add_float_scalar,
+                  cur_nchan, cur_nsub);
+        if (__builtin_cpu_supports("avx2"))
+            benchmark("avx2", vegas_accum_add_int32_avx2, vegas_accum_add_float_avx2,
+                      cur_nchan, cur_nsub);
+        if (__builtin_cpu_supports("avx512f"))
+            benchmark("avx512", vegas_accum_add_int32_avx512, vegas_accum_add_float_avx512,
+                      cur_nchan, cur_nsub);
+        benchmark_int64("scalar", vegas_accum_add_int32_int64_scalar, cur_nchan, cur_nsub);
+        if (__builtin_cpu_supports("avx2"))
+            benchmark_int64("avx2", vegas_accum_add_int32_int64_avx2, cur_nchan, cur_nsub);
+        if (__builtin_cpu_supports("avx512f"))
+            benchmark_int64("avx512", vegas_accum_add_int32_int64_avx512, cur_nchan, cur_nsub);
+        benchmark_team(cur_nchan, cur_nsub);
+    }
+    return nerr ? 1 : 0;
+}
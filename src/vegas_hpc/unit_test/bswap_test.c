@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "vegas_bswap.h"
+
+typedef void (*bswap_fn)(void *, const void *, size_t);
+
+/// The loop formerly used in vegas_spead_packet_copy()
+static void reference_copy(char *payload_addr, const char *pkt_payload, int payload_size)
+{
+    int offset;
+    for(offset = 0; offset < payload_size; offset += 4)
+    {
+        *(unsigned int *)(payload_addr + offset) =
+            ntohl(*(unsigned int *)(pkt_payload + offset));
+    }
+}
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/// Compare a kernel against the reference on random data, at several
+/// sizes and source/destination misalignments.
+int test_bit_exact(const char *name, bswap_fn fn)
+{
+    const size_t maxsize = 9000;
+    char *src = malloc(maxsize + 64);
+    char *ref = malloc(maxsize + 64);
+    char *out = malloc(maxsize + 64);
+    size_t size, i;
+    int soff, doff;
+    int errors = 0;
+
+    for (size = 0; size <= maxsize; size += (size < 256 ? 4 : 508))
+    {
+        for (soff = 0; soff < 16; soff += 4)
+        {
+            for (doff = 0; doff < 16; doff += 4)
+            {
+                for (i=0; i<size + soff; ++i)
+                    src[i] = (char)rand();
+                memset(ref, 0x5a, maxsize + 64);
+                memset(out, 0x5a, maxsize + 64);
+                reference_copy(ref + doff, src + soff, size);
+                fn(out + doff, src + soff, size);
+                if (memcmp(ref, out, maxsize + 64) != 0)
+                {
+                    printf("%s: mismatch size=%ld soff=%d doff=%d\n", name, size, soff, doff);
+                    errors++;
+                }
+            }
+        }
+    }
+    free(src);
+    free(ref);
+    free(out);
+    printf("%s: %s\n", name, errors ? "FAILED" : "bit exact");
+    return errors;
+}
+
+/// Time one kernel over a packet sized payload
+void benchmark(const char *name, bswap_fn fn, size_t size)
+{
+    const int niter = 200000;
+    char *src = aligned_alloc(64, size);
+    char *dst = aligned_alloc(64, size);
+    double t0, t1;
+    int i;
+
+    for (i=0; i<size; ++i)
+        src[i] = (char)i;
+    t0 = now_sec();
+    for (i=0; i<niter; ++i)
+    {
+        fn(dst, src, size);
+        __asm__ __volatile__("" : : "r"(dst) : "memory");
+    }
+    t1 = now_sec();
+    printf("  %-8s %6ld bytes: %8.1f ns/pkt %8.2f GB/s\n", name, size,
+           (t1 - t0) / niter * 1e9, (double)size * niter / (t1 - t0) / 1e9);
+    free(src);
+    free(dst);
+}
+
+static void reference_fn(void *dst, const void *src, size_t n)
+{
+    reference_copy((char *)dst, (const char *)src, (int)n);
+}
+
+int main(int argc, char **argv)
+{
+    const size_t sizes[] = { 1024, 2048, 4096, 8192 };
+    int nerr = 0;
+    unsigned i;
+
+    srand(12345);
+    printf("dispatch selects %s\n", vegas_bswap32_kernel_name());
+
+    nerr += test_bit_exact("scalar", vegas_bswap32_copy_scalar);
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+        nerr += test_bit_exact("ssse3", vegas_bswap32_copy_ssse3);
+    if (__builtin_cpu_supports("avx2"))
+        nerr += test_bit_exact("avx2", vegas_bswap32_copy_avx2);
+    nerr += test_bit_exact("dispatch", vegas_bswap32_copy);
+
+    printf("payload copy+byteswap cost:\n");
+    for (i=0; i<sizeof(sizes)/sizeof(sizes[0]); ++i)
+    {
+        benchmark("ntohl", reference_fn, sizes[i]);
+        benchmark("scalar", vegas_bswap32_copy_scalar, sizes[i]);
+        if (__builtin_cpu_supports("ssse3"))
+            benchmark("ssse3", vegas_bswap32_copy_ssse3, sizes[i]);
+        if (__builtin_cpu_supports("avx2"))
+            benchmark("avx2", vegas_bswap32_copy_avx2, sizes[i]);
+    }
+    return nerr ? 1 : 0;
+}
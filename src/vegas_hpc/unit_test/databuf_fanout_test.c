@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/sem.h>
+#include "vegas_error.h"
+#include "vegas_defines.h"
+#include "vegas_databuf.h"
+
+/* Well clear of the ids the pipeline uses */
+#define TEST_DATABUF_ID 37
+#define NBLOCK 8
+#define BLOCK_SIZE 65536
+#define NFILL 2000
+
+/* Each block is filled with its fill number, so a reader can tell if it
+   was overwritten while it read */
+struct reader {
+    struct vegas_databuf *db;
+    int id;             ///< 0 for the primary
+    int lossy;
+    int delay_us;       ///< Time spent on each block
+    long nread;
+    long errors;
+};
+
+static volatile int producing = 1;
+
+static void fill(struct vegas_databuf *db, int block, uint64_t seq)
+{
+    uint64_t *p = (uint64_t *)vegas_databuf_data(db, block);
+    size_t i;
+    for (i=0; i<BLOCK_SIZE / sizeof(uint64_t); i++)
+        p[i] = seq;
+}
+
+/// Returns the fill number of an intact block, or -1
+static long check(struct vegas_databuf *db, int block)
+{
+    uint64_t *p = (uint64_t *)vegas_databuf_data(db, block);
+    size_t i;
+    for (i=1; i<BLOCK_SIZE / sizeof(uint64_t); i++)
+        if (p[i] != p[0])
+            return -1;
+    return (long)p[0];
+}
+
+static void *producer(void *arg)
+{
+    struct vegas_databuf *db = (struct vegas_databuf *)arg;
+    uint64_t seq;
+    int block;
+
+    for (seq=0; seq<NFILL; seq++) {
+        block = seq % NBLOCK;
+        while (vegas_databuf_wait_free(db, block) != VEGAS_OK)
+            ;
+        fill(db, block, seq);
+        vegas_databuf_set_filled(db, block);
+    }
+    producing = 0;
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    struct reader *r = (struct reader *)arg;
+    long seq, last = -1;
+    int block = 0, rv;
+
+    while (1) {
+        if (r->id == 0)
+            rv = vegas_databuf_wait_filled(r->db, block);
+        else
+            rv = vegas_databuf_consumer_wait_filled(r->db, r->id, &block);
+        if (rv != VEGAS_OK) {
+            if (!producing)
+                break;
+            continue;
+        }
+        seq = check(r->db, block);
+        if (r->delay_us)
+            usleep(r->delay_us);
+        /* Still intact, and later than the last one: lossless readers
+           must see every fill, in order */
+        if (seq < 0 || check(r->db, block) != seq || seq <= last ||
+            (!r->lossy && seq != last + 1))
+            r->errors++;
+        last = seq;
+        r->nread++;
+        if (r->id == 0) {
+            vegas_databuf_set_free(r->db, block);
+            block = (block + 1) % NBLOCK;
+        } else {
+            vegas_databuf_consumer_set_free(r->db, r->id, block);
+        }
+    }
+    return NULL;
+}
+
+static void destroy(struct vegas_databuf *db)
+{
+    int shmid = db->shmid, semid = db->semid, csemid = db->csemid;
+    vegas_databuf_detach(db);
+    semctl(semid, 0, IPC_RMID);
+    semctl(csemid, 0, IPC_RMID);
+    shmctl(shmid, IPC_RMID, NULL);
+}
+
+int main(int argc, char **argv)
+{
+    struct vegas_databuf *db;
+    struct reader readers[4] = {
+        { NULL, 0, 0, 0 },      /* primary */
+        { NULL, 0, 0, 50 },     /* lossless, a little slow */
+        { NULL, 0, 1, 2000 },   /* lossy and slow: should skip */
+        { NULL, 0, 1, 0 },      /* lossy but keeping up */
+    };
+    const char *names[4] = { "primary", "lossless", "slow lossy", "fast lossy" };
+    pthread_t tid[5];
+    struct vegas_databuf_consumer *c;
+    struct vegas_databuf_stats s;
+    unsigned long long nsample = 0;
+    int i, nerr = 0;
+
+    db = vegas_databuf_create(NBLOCK, BLOCK_SIZE, TEST_DATABUF_ID, GPU_INPUT_BUF);
+    if (db == NULL) {
+        printf("could not create databuf %d\n", TEST_DATABUF_ID);
+        return 1;
+    }
+    if (db->max_consumer == 0) {
+        printf("databuf cannot fan out\n");
+        destroy(db);
+        return 1;
+    }
+    for (i=0; i<4; i++) {
+        readers[i].db = db;
+        if (i > 0)
+            readers[i].id = vegas_databuf_add_consumer(db, readers[i].lossy);
+    }
+
+    for (i=0; i<4; i++)
+        pthread_create(&tid[i], NULL, consumer, &readers[i]);
+    pthread_create(&tid[4], NULL, producer, db);
+    for (i=0; i<5; i++)
+        pthread_join(tid[i], NULL);
+
+    for (i=0; i<4; i++) {
+        long skipped = 0;
+        int ok = readers[i].errors == 0;
+        if (i > 0) {
+            c = &db->consumer[readers[i].id];
+            skipped = c->nskipped;
+            ok = ok && c->nread == (unsigned long long)readers[i].nread;
+        }
+        /* Everything is either read or skipped, and only lossy readers skip */
+        ok = ok && readers[i].nread + skipped == NFILL;
+        ok = ok && (readers[i].lossy || skipped == 0);
+        printf("%-10s read %5ld, skipped %5ld, errors %ld: %s\n", names[i],
+               readers[i].nread, skipped, readers[i].errors, ok ? "ok" : "FAILED");
+        nerr += !ok;
+    }
+    if (db->consumer[readers[2].id].nskipped == 0) {
+        printf("slow lossy reader was never skipped: FAILED\n");
+        nerr++;
+    }
+
+    /* The telemetry saw every block through, and the ring empty again */
+    if (vegas_databuf_stats(db, &s) != VEGAS_OK) {
+        printf("no telemetry: FAILED\n");
+        nerr++;
+    } else {
+        for (i=0; i<VEGAS_DATABUF_OCC_BINS; i++)
+            nsample += s.occupancy_hist[i];
+        printf("telemetry: %llu filled, %llu freed, producer waited %.0f%%: %s\n",
+               s.nfill, s.nfree, 100.0 * s.producer_wait / (s.time - s.reset_time),
+               s.nfill == NFILL && s.nfree == NFILL && s.occupancy == 0 &&
+               nsample == 2 * NFILL ? "ok" : "FAILED");
+        nerr += !(s.nfill == NFILL && s.nfree == NFILL && s.occupancy == 0 &&
+                  nsample == 2 * NFILL);
+    }
+
+    for (i=1; i<4; i++)
+        vegas_databuf_remove_consumer(db, readers[i].id);
+    for (i=0; i<NBLOCK; i++)
+        if (vegas_databuf_block_status(db, i) != 0) {
+            printf("block %d still held after the readers left: FAILED\n", i);
+            nerr++;
+        }
+
+    /* Filling a block twice would hand the primary a second token */
+    vegas_databuf_set_filled(db, 0);
+    if (vegas_databuf_set_filled(db, 0) != VEGAS_ERR_PARAM ||
+        vegas_databuf_block_status(db, 0) != 1) {
+        printf("block filled twice: FAILED\n");
+        nerr++;
+    }
+    vegas_databuf_set_free(db, 0);
+    destroy(db);
+    return nerr ? 1 : 0;
+}
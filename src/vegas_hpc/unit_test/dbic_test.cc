@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "vegas_defines.h"
+#include "vegas_databuf.h"
+#include "spead_heap.h"
+#include "pfb_gpu.h"
+#include "DataBlockInfoCache.h"
+
+#define NBLOCK 6
+
+/// Where query results go, so that they are neither dropped nor moved
+/// out of the timed loop
+static volatile int sink;
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+/// The cache as it was, shifting the upper half down for every block
+/// and scanning for every query
+class ShiftCache
+{
+public:
+    cpu_gpu_buf_index   _heap_idx[2 * MAX_HEAPS_PER_BLK];
+    time_spead_heap     _heap_hdr[2 * MAX_HEAPS_PER_BLK];
+
+    ShiftCache()
+    {
+        memset(_heap_idx, 0, sizeof(_heap_idx));
+        memset(_heap_hdr, 0, sizeof(_heap_hdr));
+    }
+    void input(time_spead_heap *hdr_base, databuf_index *idx)
+    {
+        memcpy(&_heap_hdr[0], &_heap_hdr[MAX_HEAPS_PER_BLK], MAX_HEAPS_PER_BLK * sizeof(time_spead_heap));
+        memcpy(&_heap_idx[0], &_heap_idx[MAX_HEAPS_PER_BLK], MAX_HEAPS_PER_BLK * sizeof(cpu_gpu_buf_index));
+        memcpy(&_heap_hdr[MAX_HEAPS_PER_BLK], hdr_base, MAX_HEAPS_PER_BLK * sizeof(time_spead_heap));
+        memcpy(&_heap_idx[MAX_HEAPS_PER_BLK], &idx->cpu_gpu_buf[0], MAX_HEAPS_PER_BLK * sizeof(cpu_gpu_buf_index));
+    }
+    int is_valid(int heap_start, int num_heaps)
+    {
+        for (int i = heap_start; i < (heap_start + num_heaps); ++i)
+        {
+            if (!_heap_idx[i].heap_valid)
+            {
+                return FALSE;
+            }
+        }
+        return TRUE;
+    }
+    int is_blanked(int heap_start, int num_heaps)
+    {
+        int state_changed = 0;
+        int banked_at_start = (_heap_hdr[heap_start + num_heaps- 1].status_bits & 0x8)  ? 0x2 : 0x0;
+        int is_blanked = (banked_at_start || (_heap_hdr[heap_start].status_bits & 0x8)) ? 0x1 : 0x0;
+
+        for (int i = heap_start + 1; i < (heap_start + num_heaps); ++i)
+        {
+            if ((_heap_hdr[i].status_bits & 0x3) != (_heap_hdr[i-1].status_bits & 0x3))
+            {
+                state_changed = 0x4;
+            }
+            if (_heap_hdr[i].status_bits & (BLANKING_BIT | SCAN_NOT_STARTED))
+            {
+                is_blanked = 0x1;
+            }
+        }
+        return (banked_at_start | state_changed | is_blanked);
+    }
+    int status(int heapidx)
+    {
+        return _heap_hdr[heapidx].status_bits;
+    }
+    double mjd(int heapidx)
+    {
+        return _heap_idx[heapidx].heap_rcvd_mjd;
+    }
+};
+
+struct Block
+{
+    time_spead_heap hdr[MAX_HEAPS_PER_BLK];
+    databuf_index   idx;
+};
+
+/// Status bits that mostly hold steady, with occasional switching state
+/// changes, blanking and invalid heaps, as the real input does
+static void fill(Block *b, uint64_t *seed, int flavour)
+{
+    unsigned int state = xorshift(seed) & 0x3;
+
+    memset(b, 0, sizeof(*b));
+    for (int i = 0; i < MAX_HEAPS_PER_BLK; ++i)
+    {
+        uint64_t r = xorshift(seed);
+        if (r % 97 == 0)
+            state = (state + 1) & 0x3;
+        b->hdr[i].time_cntr = i;
+        b->hdr[i].status_bits = state;
+        if (flavour & 1 && r % 61 == 0)
+            b->hdr[i].status_bits |= BLANKING_BIT;
+        if (flavour & 2 && r % 43 == 0)
+            b->hdr[i].status_bits |= SCAN_NOT_STARTED;
+        b->idx.cpu_gpu_buf[i].heap_cntr = i;
+        b->idx.cpu_gpu_buf[i].heap_valid = !(flavour & 4 && r % 211 == 0);
+        b->idx.cpu_gpu_buf[i].heap_rcvd_mjd = 56000.0 + (r % 100000) * 1e-6;
+    }
+}
+
+/// Feed the same blocks to both caches and compare every query over
+/// windows that sit in either half or straddle the boundary.
+static int test_queries(uint64_t seed)
+{
+    static Block blk;
+    static ShiftCache ref;
+    static DataBlockInfoCache dbic;
+    const int lens[] = { 1, 2, 32, 64, 513, MAX_HEAPS_PER_BLK };
+    int nerr = 0, nquery = 0;
+
+    ref = ShiftCache();
+    dbic = DataBlockInfoCache();
+    for (int b = 0; b < NBLOCK; ++b)
+    {
+        fill(&blk, &seed, b);
+        ref.input(blk.hdr, &blk.idx);
+        dbic.input(blk.hdr, &blk.idx);
+
+        for (int i = 0; i < 2 * MAX_HEAPS_PER_BLK; ++i)
+        {
+            if (ref.status(i) != dbic.status(i) || ref.mjd(i) != dbic.mjd(i) ||
+                memcmp(&ref._heap_hdr[i], dbic.header(i), sizeof(time_spead_heap)) != 0)
+                nerr++;
+        }
+        for (unsigned int l = 0; l < sizeof(lens) / sizeof(lens[0]); ++l)
+        {
+            int n = lens[l];
+            for (int start = 0; start + n <= 2 * MAX_HEAPS_PER_BLK; start += 1 + n / 3)
+            {
+                if (ref.is_valid(start, n) != dbic.is_valid(start, n) ||
+                    ref.is_blanked(start, n) != dbic.is_blanked(start, n))
+                {
+                    if (nerr < 5)
+                        printf("  block %d heaps [%d, %d): valid %d/%d blanked 0x%x/0x%x\n",
+                               b, start, start + n, ref.is_valid(start, n),
+                               dbic.is_valid(start, n), ref.is_blanked(start, n),
+                               dbic.is_blanked(start, n));
+                    nerr++;
+                }
+                nquery++;
+            }
+        }
+    }
+    printf("seed %llx: %d queries %s\n", (unsigned long long)seed, nquery,
+           nerr ? "FAILED" : "ok");
+    return nerr;
+}
+
+/// Time a block's input
+template <class Cache>
+static double time_input(Cache *c, Block *blk)
+{
+    double t0, best = 1e9;
+
+    for (int rep = 0; rep < 50; ++rep)
+    {
+        t0 = now_sec();
+        c->input(blk->hdr, &blk->idx);
+        t0 = now_sec() - t0;
+        best = t0 < best ? t0 : best;
+    }
+    return best;
+}
+
+/// Time the queries the PFB makes of a block: a window of VEGAS_NUM_TAPS
+/// spectra of nheaps heaps, at every spectrum through the older block.
+template <class Cache>
+static double time_queries(Cache *c, int nheaps)
+{
+    double t0, best = 1e9;
+
+    for (int rep = 0; rep < 50; ++rep)
+    {
+        t0 = now_sec();
+        for (int start = 0; start < MAX_HEAPS_PER_BLK; start += nheaps)
+        {
+            sink = c->is_valid(start, VEGAS_NUM_TAPS * nheaps);
+            sink = c->is_blanked(start, VEGAS_NUM_TAPS * nheaps);
+        }
+        t0 = now_sec() - t0;
+        best = t0 < best ? t0 : best;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    static Block blk;
+    static ShiftCache ref;
+    static DataBlockInfoCache dbic;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    int nerr = 0;
+
+    nerr += test_queries(0x123456789abcdefULL);
+    nerr += test_queries(0xfeedfacecafebeefULL);
+    nerr += test_queries(42);
+
+    /* Clean data, so that no scan stops early */
+    fill(&blk, &seed, 0);
+    printf("input of one block: shift %.1f us, ring %.1f us\n",
+           time_input(&ref, &blk) * 1e6, time_input(&dbic, &blk) * 1e6);
+    printf("queries through one block:\n");
+    for (int nheaps = 8; nheaps <= 512; nheaps *= 4)
+    {
+        double t_ref = time_queries(&ref, nheaps);
+        double t_new = time_queries(&dbic, nheaps);
+        printf("  %4d heaps per spectrum: shift %7.1f us, ring %7.1f us\n",
+               nheaps, t_ref * 1e6, t_new * 1e6);
+    }
+    return nerr ? 1 : 0;
+}
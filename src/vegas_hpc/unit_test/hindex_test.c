@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <ctype.h>
+#include "fitshead.h"
+#include "vegas_status.h"
+
+#define NKEY 600
+#define NSTEP 20000
+
+/// Where lookup results go, so that they are not moved out of the timed loop
+static volatile long sink;
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static void keyword(char *key, int k)
+{
+    /* Some are of mixed case, as callers pass them */
+    sprintf(key, k % 7 == 0 ? "kw%d" : "KW%d", k);
+}
+
+static void init(char *buf)
+{
+    memset(buf, 0, VEGAS_STATUS_SIZE);
+    memset(buf, ' ', VEGAS_STATUS_CARD);
+    memcpy(buf, "END", 3);
+}
+
+/// The same edits to a plain header and an indexed one, with every
+/// lookup compared between them
+static int test_edits(uint64_t seed)
+{
+    static char ref[VEGAS_STATUS_SIZE], buf[VEGAS_STATUS_SIZE];
+    static struct hindex index;
+    char key[16], *a, *b;
+    int step, k, nerr = 0, nlookup = 0;
+    uint64_t seed0 = seed;
+
+    init(ref);
+    init(buf);
+    memset(&index, 0, sizeof(index));
+    hindex_attach(buf, VEGAS_STATUS_SIZE, &index);
+    for (step = 0; step < NSTEP; step++)
+    {
+        uint64_t r = xorshift(&seed);
+        k = r % NKEY;
+        keyword(key, k);
+        switch ((r >> 32) % 16)
+        {
+        case 0:
+            hdel(ref, key);
+            hdel(buf, key);
+            break;
+        case 1:
+            /* Rarely, as they pile up */
+            if ((r >> 40) % 8 == 0)
+            {
+                hputc(ref, "COMMENT", "a comment");
+                hputc(buf, "COMMENT", "a comment");
+            }
+            break;
+        case 2:
+            hchange(ref, key, "RENAMED");
+            hchange(buf, key, "RENAMED");
+            break;
+        case 3:
+            /* Two cards swapped behind hput's back */
+            a = ksearch(ref, key);
+            if (a != NULL && a > ref)
+            {
+                char tmp[80];
+                long off = a - ref;
+                memcpy(tmp, ref + off, 80);
+                memcpy(ref + off, ref, 80);
+                memcpy(ref, tmp, 80);
+                memcpy(buf, ref, VEGAS_STATUS_SIZE);
+            }
+            break;
+        case 6:
+            /* Another program blanks a card, or fills a blank one or the
+               one at END with a keyword the header lacks, without the
+               index.  hput*() does not reuse the blanks, so they are kept
+               from filling the header. */
+            a = ksearch(ref, key);
+            b = ksearch(ref, "END");
+            if (a != NULL)
+            {
+                if (b - ref < VEGAS_STATUS_SIZE / 2)
+                {
+                    memset(a, ' ', 80);
+                    memcpy(buf, ref, VEGAS_STATUS_SIZE);
+                }
+            }
+            else
+            {
+                char card[81];
+                long off = b - ref;
+                for (a = ref; a < ref + off; a += 80)
+                    if (a[0] == ' ' && memcmp(a, a + 1, 79) == 0)
+                        break;
+                if (a == ref + off && off + 160 < VEGAS_STATUS_SIZE)
+                    memcpy(ref + off + 80, ref + off, 80);
+                else if (a == ref + off)
+                    break;
+                snprintf(card, sizeof(card), "%-8.8s= %20d%50s", key, k, "");
+                for (b = card; *b; b++)
+                    *b = toupper(*b);
+                memcpy(a, card, 80);
+                memcpy(buf, ref, VEGAS_STATUS_SIZE);
+            }
+            break;
+        case 4:
+        case 5:
+            hputs(ref, key, "a string");
+            hputs(buf, key, "a string");
+            break;
+        default:
+            hputi4(ref, key, k);
+            hputi4(buf, key, k);
+            break;
+        }
+        if (memcmp(ref, buf, VEGAS_STATUS_SIZE) != 0)
+        {
+            printf("  step %d: headers differ\n", step);
+            nerr++;
+            break;
+        }
+        /* Shared indexes are only rebuilt by writers, and not every
+           lookup comes after one */
+        if ((r >> 48) % 4 == 0)
+            hindex_refresh(buf);
+        k = (r >> 16) % (NKEY + 10);
+        if (k == NKEY)
+            strcpy(key, "RENAMED");
+        else if (k == NKEY + 1)
+            strcpy(key, "COMMENT");
+        else
+            keyword(key, k);
+        a = ksearch(ref, key);
+        b = ksearch(buf, key);
+        if ((a == NULL) != (b == NULL) || (a != NULL && b - buf != a - ref) ||
+            ksearch(buf, "END") - buf != ksearch(ref, "END") - ref)
+        {
+            if (nerr < 5)
+                printf("  step %d: %s at %ld, indexed at %ld\n", step, key,
+                       a ? (long)(a - ref) : -1L, b ? (long)(b - buf) : -1L);
+            nerr++;
+        }
+        nlookup++;
+    }
+    hindex_detach(buf);
+    printf("seed %llx: %d lookups, index built %d times: %s\n",
+           (unsigned long long)seed0, nlookup, index.nbuild, nerr ? "FAILED" : "ok");
+    return nerr;
+}
+
+/// A private index only lasts until it is closed, and is not opened
+/// twice for one header
+static int test_private()
+{
+    static char buf[VEGAS_STATUS_SIZE];
+    struct hindex *index, *again;
+    int ok;
+
+    init(buf);
+    hputi4(buf, "NPOL", 4);
+    hputs(buf, "OBJECT", "3C286");
+    index = hindex_open(buf, VEGAS_STATUS_SIZE);
+    again = hindex_open(buf, VEGAS_STATUS_SIZE);
+    ok = index != NULL && again == NULL &&
+         ksearch(buf, "OBJECT") == buf + 80 && ksearch(buf, "NOPE") == NULL &&
+         index->valid && index->nkey == 2;
+    hindex_close(again);
+    hindex_close(index);
+    ok = ok && ksearch(buf, "npol") == buf;
+    printf("private index: %s\n", ok ? "ok" : "FAILED");
+    return !ok;
+}
+
+/// Lookups of the kind vegas_read_obs_params makes, in a status buffer
+/// of nkey cards
+static void benchmark(int nkey)
+{
+    static char buf[VEGAS_STATUS_SIZE];
+    static struct hindex index;
+    char key[16];
+    double t0, t_scan = 1e9, t_index = 1e9, t;
+    int i, rep, v;
+
+    init(buf);
+    for (i = 0; i < nkey; i++)
+    {
+        keyword(key, i);
+        hputi4(buf, key, i);
+    }
+    memset(&index, 0, sizeof(index));
+    for (rep = 0; rep < 20; rep++)
+    {
+        t0 = now_sec();
+        for (i = 0; i < 50; i++)
+        {
+            keyword(key, (i * 37) % (nkey + 5));
+            v = -1;
+            hgeti4(buf, key, &v);
+            sink += v;
+        }
+        t = now_sec() - t0;
+        if (rep % 2 == 0)
+        {
+            t_scan = t < t_scan ? t : t_scan;
+            hindex_attach(buf, VEGAS_STATUS_SIZE, &index);
+            hindex_refresh(buf);
+        }
+        else
+        {
+            t_index = t < t_index ? t : t_index;
+            hindex_detach(buf);
+        }
+    }
+    printf("  %4d cards: scan %8.1f us, index %6.1f us\n", nkey, t_scan * 1e6,
+           t_index * 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    const int ncard[] = { 50, 200, 800, 2000 };
+    int nerr = 0, i;
+
+    nerr += test_edits(0x123456789abcdefULL);
+    nerr += test_edits(42);
+    nerr += test_private();
+
+    printf("50 hgeti4 lookups:\n");
+    for (i = 0; i < 4; i++)
+        benchmark(ncard[i]);
+    return nerr ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "l8lbw1_fixups.h"
+
+#define NBLOCK 8
+#define HEAP_BYTES sizeof(struct time_spead_heap_packet_l8)
+
+typedef void (*merge_fn)(struct vegas_databuf *, int *);
+
+static struct l8lbw1_merge_team *g_team;
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void team_merge(struct vegas_databuf *db, int *blks)
+{
+    fixup_l8lbw1_block_merge_team(g_team, db, blks);
+}
+
+/// A databuf laid out as vegas_databuf_create() would, in ordinary memory
+static struct vegas_databuf *make_databuf(size_t *total)
+{
+    struct vegas_databuf *db;
+    size_t struct_size = 8192, header_size = 2880 * 4;
+    size_t index_size = sizeof(struct databuf_index);
+    size_t block_size = MAX_HEAPS_PER_BLK * (sizeof(struct time_spead_heap) + HEAP_BYTES);
+
+    *total = struct_size + NBLOCK * (header_size + index_size + block_size);
+    db = (struct vegas_databuf *)calloc(1, *total);
+    if (db == NULL)
+        return NULL;
+    db->struct_size = struct_size;
+    db->header_size = header_size;
+    db->index_size = index_size;
+    db->block_size = block_size;
+    db->n_block = NBLOCK;
+    return db;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+/// Random payloads and status bits, with nheaps[b] heaps in block b
+static void fill(struct vegas_databuf *db, const int *nheaps, uint64_t seed)
+{
+    struct databuf_index *index;
+    struct time_spead_heap *hdr;
+    uint64_t *p;
+    size_t i, n;
+    int b, h;
+
+    for (b=0; b<NBLOCK; ++b)
+    {
+        index = (struct databuf_index *)vegas_databuf_index(db, b);
+        hdr = (struct time_spead_heap *)vegas_databuf_data(db, b);
+        index->num_heaps = nheaps[b];
+        index->heap_size = sizeof(struct time_spead_heap) + HEAP_BYTES;
+        for (h=0; h<nheaps[b]; ++h)
+        {
+            index->cpu_gpu_buf[h].heap_valid = 1;
+            index->cpu_gpu_buf[h].heap_cntr = b * MAX_HEAPS_PER_BLK + h;
+            hdr[h].time_cntr = b * MAX_HEAPS_PER_BLK + h;
+            hdr[h].status_bits = xorshift(&seed) % 16 == 0 ? 0x9 : 0x1;
+        }
+        p = (uint64_t *)&hdr[MAX_HEAPS_PER_BLK];
+        n = (size_t)nheaps[b] * HEAP_BYTES / sizeof(uint64_t);
+        for (i=0; i<n; ++i)
+            p[i] = xorshift(&seed);
+    }
+}
+
+/// Merge the same blocks with the scalar code and with the team, and
+/// compare every byte of the two databufs.
+static int test_merge(const char *name, const int *nheaps, int nthread)
+{
+    struct l8lbw1_merge_team team;
+    struct vegas_databuf *ref, *db;
+    size_t total;
+    int blks[NBLOCK] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    int rv;
+
+    ref = make_databuf(&total);
+    db = make_databuf(&total);
+    if (ref == NULL || db == NULL)
+    {
+        printf("%s: out of memory\n", name);
+        free(ref);
+        free(db);
+        return 1;
+    }
+    fill(ref, nheaps, 0x123456789abcdefULL);
+    memcpy(db, ref, total);
+
+    fixup_l8lbw1_block_merge_scalar(ref, blks);
+    l8lbw1_merge_team_init(&team, nthread);
+    fixup_l8lbw1_block_merge_team(&team, db, blks);
+    l8lbw1_merge_team_destroy(&team);
+
+    rv = memcmp(ref, db, total) != 0;
+    printf("%-12s %d threads: %s\n", name, nthread, rv ? "FAILED" : "bit exact");
+    free(ref);
+    free(db);
+    return rv;
+}
+
+/// Input MB/s through a merge of eight full blocks
+static void benchmark(const char *name, merge_fn merge)
+{
+    struct vegas_databuf *db;
+    size_t total;
+    int nheaps[NBLOCK], blks[NBLOCK] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    double t0, t1 = 0.0, best = 1e9;
+    int b, rep;
+
+    for (b=0; b<NBLOCK; ++b)
+        nheaps[b] = MAX_HEAPS_PER_BLK;
+    db = make_databuf(&total);
+    if (db == NULL)
+        return;
+    fill(db, nheaps, 42);
+    for (rep=0; rep<5; ++rep)
+    {
+        /* The merge rewrites the first block's index */
+        ((struct databuf_index *)vegas_databuf_index(db, 0))->num_heaps = MAX_HEAPS_PER_BLK;
+        t0 = now_sec();
+        merge(db, blks);
+        t1 = now_sec() - t0;
+        best = t1 < best ? t1 : best;
+    }
+    printf("  %-14s %8.0f MB/s\n", name,
+           NBLOCK * MAX_HEAPS_PER_BLK * HEAP_BYTES / best * 1e-6);
+    free(db);
+}
+
+int main(int argc, char **argv)
+{
+    const int full[NBLOCK] = { 4096, 4096, 4096, 4096, 4096, 4096, 4096, 4096 };
+    const int ragged[NBLOCK] = { 4093, 4096, 17, 4000, 4096, 1, 4095, 3000 };
+    const int short0[NBLOCK] = { 5, 4096, 4096, 4096, 4096, 4096, 4096, 4089 };
+    const int empty0[NBLOCK] = { 0, 100, 0, 800, 0, 0, 64, 9 };
+    struct l8lbw1_merge_team team;
+    int nerr = 0, nthread;
+    char name[32];
+
+    nerr += test_merge("full", full, 1);
+    nerr += test_merge("full", full, 3);
+    nerr += test_merge("full", full, 8);
+    nerr += test_merge("ragged", ragged, 1);
+    nerr += test_merge("ragged", ragged, 5);
+    nerr += test_merge("short first", short0, 4);
+    nerr += test_merge("empty first", empty0, 2);
+
+    printf("merge of 8 full blocks:\n");
+    benchmark("scalar", fixup_l8lbw1_block_merge_scalar);
+    for (nthread=1; nthread<=4; nthread*=2)
+    {
+        l8lbw1_merge_team_init(&team, nthread);
+        g_team = &team;
+        snprintf(name, sizeof(name), "simd %d threads", nthread);
+        benchmark(name, team_merge);
+        l8lbw1_merge_team_destroy(&team);
+    }
+    return nerr ? 1 : 0;
+}
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/sem.h>
+#include "vegas_error.h"
+#include "vegas_defines.h"
+#include "vegas_databuf.h"
+#include "vegas_udp.h"
+#include "vegas_net_blocks.h"
+#include "vegas_spead_send.h"
+#include "vegas_spead_stream.h"
+#include "spead_heap.h"
+
+/* Plays test/spead_gen_faults.prof through the net thread's receive path
+   over loopback and checks the losses it counts.  Up to the restart at
+   heap 1000 the profile drops 1 packet, then 4 (two whole heaps), sends
+   2 packets twice, moves 3 late and skips 10 heaps; the time counter
+   rolls over at heap 764.  After the restart nothing is lost. */
+
+#define TEST_DATABUF_ID 38
+#define NBLOCK 4
+#define NCHAN 1024
+#define HEAPS_PER_BLOCK 64
+#define BATCH 8             ///< Small enough for a default receive buffer
+#define HBW_HDR_SIZE sizeof(struct freq_spead_heap)
+#define HEAP_SIZE (HBW_HDR_SIZE + NCHAN*4*sizeof(int))
+#define BLOCK_SIZE (MAX_HEAPS_PER_BLK*HBW_HDR_SIZE + HEAPS_PER_BLOCK*(HEAP_SIZE - HBW_HDR_SIZE))
+
+static int run = 1;
+
+/// What an observation should have counted
+struct expect {
+    unsigned long long ndropped, nheaps_lost, ndup, nreordered;
+};
+
+static const struct expect first_obs = { 1 + 4 + 10*2, 1 + 2 + 10, 2, 3 };
+static const struct expect second_obs = { 0, 0, 0, 0 };
+
+static int check_obs(const char *name, const struct net_pipeline *np,
+                     const struct expect *e)
+{
+    int ok = np->ndropped_total == e->ndropped &&
+             np->nheaps_lost_total == e->nheaps_lost &&
+             np->ndup_total == e->ndup &&
+             np->nreordered_total >= e->nreordered;
+    printf("%s: dropped %llu (%llu), lost heaps %llu (%llu), dups %llu (%llu), "
+           "late %llu (>= %llu): %s\n", name,
+           np->ndropped_total, e->ndropped, np->nheaps_lost_total, e->nheaps_lost,
+           np->ndup_total, e->ndup, np->nreordered_total, e->nreordered,
+           ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static void destroy(struct vegas_databuf *db)
+{
+    int shmid = db->shmid, semid = db->semid, csemid = db->csemid;
+    vegas_databuf_detach(db);
+    semctl(semid, 0, IPC_RMID);
+    semctl(csemid, 0, IPC_RMID);
+    shmctl(shmid, IPC_RMID, NULL);
+}
+
+int main()
+{
+    const char *profile = "../test/spead_gen_faults.prof";
+    static struct vegas_stream_batch b;
+    static struct vegas_udp_packet p;
+    struct vegas_stream s;
+    struct vegas_udp_params up;
+    struct vegas_udp_scatter sc;
+    struct vegas_databuf *db;
+    struct datablock_stats blocks[2];
+    struct datablock_stats *lblock = &blocks[1];
+    struct net_pipeline np;
+    struct net_seq ns;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    char bw_mode[] = "high";
+    unsigned int heap_cntr, heap_offset, seq_num, nextblock_heap_cntr = 0;
+    unsigned long long nrecv = 0, nrollover = 0, last_time = 0, t;
+    uint64_t *bitmaps;
+    size_t bitmap_words;
+    int i, n, sock, pkt_class, force_new_block, nobs = 0, nerr = 0;
+
+    vegas_stream_init(&s);
+    s.depth = 4;
+    if (vegas_stream_read_profile(&s, profile) != VEGAS_OK ||
+        vegas_stream_start(&s, NCHAN) != VEGAS_OK)
+        return 1;
+
+    db = vegas_databuf_create(NBLOCK, BLOCK_SIZE, TEST_DATABUF_ID, GPU_INPUT_BUF);
+    if (db == NULL) {
+        printf("could not create databuf %d\n", TEST_DATABUF_ID);
+        return 1;
+    }
+    bitmap_words = ((size_t)HEAPS_PER_BLOCK * s.pkts_per_heap + 63) / 64;
+    bitmaps = calloc(2 * bitmap_words, sizeof(uint64_t));
+    for (i=0; i<2; i++)
+        init_block(&blocks[i], db, HEAP_SIZE, HBW_HDR_SIZE, HEAPS_PER_BLOCK,
+                   s.pkts_per_heap, &bitmaps[i * bitmap_words]);
+    memset(&np, 0, sizeof(np));
+    np.packets_per_heap = s.pkts_per_heap;
+    ns.last_seq_num = 1050;
+    ns.reorder_window = 64;
+
+    /* Receive on an ephemeral loopback port */
+    memset(&up, 0, sizeof(up));
+    strcpy(up.sender, "127.0.0.1");
+    strcpy(up.packet_format, "SPEAD");
+    up.packet_size = VEGAS_MAX_PACKET_SIZE;
+    up.is_hbw = 1;
+    up.observation_started = 1;
+    memset(&sc, 0, sizeof(sc));
+    if (vegas_udp_init(&up) != VEGAS_OK ||
+        getsockname(up.sock, (struct sockaddr *)&addr, &addrlen) != 0)
+        return 1;
+    sock = vegas_send_open("127.0.0.1", ntohs(addr.sin_port));
+    if (sock < 0)
+        return 1;
+
+    while ((n = vegas_stream_fill(&s, &b, BATCH)) > 0) {
+        if (vegas_send_batch(sock, b.msgs, n, &run) != VEGAS_OK)
+            return 1;
+        for (; n > 0; n--) {
+            if (vegas_udp_wait(&up) != VEGAS_OK ||
+                vegas_udp_recv_scatter(&up, &p, &sc, bw_mode) != VEGAS_OK) {
+                printf("lost a packet on loopback after %llu: FAILED\n", nrecv);
+                return 1;
+            }
+            nrecv++;
+
+            /* As in vegas_net_thread() */
+            heap_cntr = vegas_spead_packet_heap_cntr(&p);
+            heap_offset = vegas_spead_packet_heap_offset(&p);
+            seq_num = vegas_spead_packet_seq_num(heap_cntr, heap_offset,
+                                                 s.pkts_per_heap);
+            pkt_class = net_seq_check(&ns, &np, seq_num);
+            if (pkt_class == NET_PKT_OLD)
+                continue;
+            force_new_block = pkt_class == NET_PKT_START;
+            if (heap_cntr >= nextblock_heap_cntr || force_new_block) {
+                net_next_block(&np, blocks, 2, heap_cntr, nextblock_heap_cntr,
+                               force_new_block);
+                if (force_new_block) {
+                    /* The restart ends the first observation */
+                    if (nobs++ == 1)
+                        nerr += !check_obs("before the restart", &np, &first_obs);
+                    pipeline_reset_totals(&np);
+                }
+                nextblock_heap_cntr = lblock->heap_idx + HEAPS_PER_BLOCK;
+                /* No consumer: the block is free as soon as it is taken */
+                vegas_databuf_set_free(db, lblock->block_idx);
+            }
+            for (i=0; i<2; i++) {
+                if (blocks[i].block_idx >= 0 &&
+                    block_heap_check(&blocks[i], heap_cntr) == 0 &&
+                    write_spead_packet_to_block(&blocks[i], &p, heap_cntr,
+                            heap_offset, s.pkts_per_heap, bw_mode) &&
+                    heap_offset == 0 && pkt_class != NET_PKT_LATE) {
+                    /* The 40 bit time counter of each new heap, as it was
+                       written to the block */
+                    struct freq_spead_heap *h = (struct freq_spead_heap *)
+                        (vegas_databuf_data(db, blocks[i].block_idx) +
+                         (heap_cntr - blocks[i].heap_idx) * HBW_HDR_SIZE);
+                    t = ((unsigned long long)h->time_cntr_top8 << 32) | h->time_cntr;
+                    if (t < last_time)
+                        nrollover++;
+                    last_time = t;
+                }
+            }
+        }
+    }
+
+    /* End the second observation as a third would */
+    net_next_block(&np, blocks, 2, 0, nextblock_heap_cntr, 1);
+    nerr += !check_obs("after the restart", &np, &second_obs);
+
+    printf("received %llu of %llu packets, %llu of %llu time counter rollovers: %s\n",
+           nrecv, s.nsent, nrollover, s.nrollover,
+           nrecv == s.nsent && nrollover == s.nrollover && nobs == 2 ? "ok" : "FAILED");
+    nerr += !(nrecv == s.nsent && nrollover == s.nrollover && nobs == 2);
+
+    close(sock);
+    vegas_udp_close(&up);
+    vegas_stream_free(&s);
+    free(bitmaps);
+    destroy(db);
+    return nerr ? 1 : 0;
+}
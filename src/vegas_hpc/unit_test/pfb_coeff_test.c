@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "vegas_error.h"
+#include "vegas_pfb_coeff.h"
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/// What vegas_gencoeff.py computed, one sample at a time
+static double reference(int i, int ntaps, int nchan, int window)
+{
+    int m = ntaps * nchan;
+    double x = (double)i / nchan - ntaps / 2.0;
+    double sinc = x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+    double c = cos(2.0 * M_PI * i / (m - 1));
+
+    switch (window)
+    {
+        case VEGAS_PFB_WIN_HAMMING:
+            return sinc * (0.54 - 0.46 * c);
+        case VEGAS_PFB_WIN_BLACKMAN:
+            return sinc * (0.42 - 0.5 * c + 0.08 * cos(4.0 * M_PI * i / (m - 1)));
+        case VEGAS_PFB_WIN_RECT:
+            return sinc;
+        default:
+            return sinc * (0.5 - 0.5 * c);
+    }
+}
+
+/// Compare the generator with the reference for one geometry and window
+static int test_generator(int ntaps, int nchan, int nsubband, int window)
+{
+    size_t n = (size_t)ntaps * nchan;
+    float *coeff = (float *)malloc(n * nsubband * sizeof(float));
+    double err, maxerr = 0.0;
+    size_t i;
+    int s, errors = 0;
+
+    vegas_pfb_gen_coeff(coeff, ntaps, nchan, nsubband, window);
+    for (i=0; i<n; i++)
+    {
+        err = fabs(coeff[i * nsubband] - reference(i, ntaps, nchan, window));
+        maxerr = err > maxerr ? err : maxerr;
+        for (s=1; s<nsubband; s++)
+            if (coeff[i * nsubband + s] != coeff[i * nsubband])
+                errors++;
+    }
+    if (maxerr > 1e-7)
+        errors++;
+    printf("%-8s %d x %6d x %d: max error %.1e %s\n", vegas_pfb_window_name(window),
+           ntaps, nchan, nsubband, maxerr, errors ? "FAILED" : "ok");
+    free(coeff);
+    return errors;
+}
+
+/// Compare a shipped coefficient file with the generator, if it is there
+static int test_file(int ntaps, int nchan, int nsubband)
+{
+    size_t n = (size_t)ntaps * nchan * nsubband;
+    float *file = (float *)malloc(n * sizeof(float));
+    float *gen = (float *)malloc(n * sizeof(float));
+    char path[256];
+    double err, maxerr = 0.0;
+    size_t i;
+
+    vegas_pfb_coeff_path(path, sizeof(path), ntaps, nchan, nsubband);
+    if (access(path, R_OK) != 0)
+    {
+        printf("%s: not found, skipped\n", path);
+        free(file);
+        free(gen);
+        return 0;
+    }
+    vegas_pfb_read_coeff_file(file, ntaps, nchan, nsubband);
+    vegas_pfb_gen_coeff(gen, ntaps, nchan, nsubband, VEGAS_PFB_WIN_HANNING);
+    for (i=0; i<n; i++)
+    {
+        err = fabs(file[i] - gen[i]);
+        maxerr = err > maxerr ? err : maxerr;
+    }
+    printf("%s: max difference %.1e %s\n", path, maxerr, maxerr < 1e-6 ? "ok" : "FAILED");
+    free(file);
+    free(gen);
+    return maxerr < 1e-6 ? 0 : 1;
+}
+
+/// A set read through the cache must match the generator whether it was
+/// generated, read back, or regenerated over a corrupt file.
+static int test_cache(int ntaps, int nchan, int nsubband, int window)
+{
+    size_t n = (size_t)ntaps * nchan * nsubband;
+    float *gen = (float *)malloc(n * sizeof(float));
+    float *got = (float *)malloc(n * sizeof(float));
+    char path[256];
+    double t0, t1, t2;
+    FILE *f;
+    int errors = 0;
+
+    vegas_pfb_set_window(window);
+    vegas_pfb_gen_coeff(gen, ntaps, nchan, nsubband, window);
+    vegas_pfb_cache_path(path, sizeof(path), ntaps, nchan, window);
+    unlink(path);
+
+    t0 = now_sec();
+    if (vegas_pfb_read_coeff(got, ntaps, nchan, nsubband) != VEGAS_OK ||
+        memcmp(gen, got, n * sizeof(float)) != 0 || access(path, R_OK) != 0)
+        errors++;
+    t1 = now_sec();
+    memset(got, 0, n * sizeof(float));
+    if (vegas_pfb_read_coeff(got, ntaps, nchan, nsubband) != VEGAS_OK ||
+        memcmp(gen, got, n * sizeof(float)) != 0)
+        errors++;
+    t2 = now_sec();
+
+    /* Flip a bit in the middle of the coefficients */
+    f = fopen(path, "r+");
+    fseek(f, sizeof(struct vegas_pfb_cache_hdr) + n / nsubband * 2, SEEK_SET);
+    fputc(fgetc(f) ^ 0x10, f);
+    fclose(f);
+    memset(got, 0, n * sizeof(float));
+    if (vegas_pfb_read_coeff(got, ntaps, nchan, nsubband) != VEGAS_OK ||
+        memcmp(gen, got, n * sizeof(float)) != 0)
+        errors++;
+
+    printf("cache %-8s %d x %6d x %d: generate %.1f ms, cached %.1f ms %s\n",
+           vegas_pfb_window_name(window), ntaps, nchan, nsubband,
+           (t1 - t0) * 1e3, (t2 - t1) * 1e3, errors ? "FAILED" : "ok");
+    free(gen);
+    free(got);
+    return errors;
+}
+
+/// A cache file someone else could have written is not trusted, and a
+/// link planted at its name is replaced rather than written through.
+static int test_untrusted(int ntaps, int nchan, int window, const char *dir)
+{
+    size_t n = (size_t)ntaps * nchan;
+    float *gen = (float *)malloc(n * sizeof(float));
+    float *got = (float *)malloc(n * sizeof(float));
+    char path[256], victim[256];
+    struct stat st;
+    FILE *f;
+    int errors = 0;
+
+    vegas_pfb_set_window(window);
+    vegas_pfb_gen_coeff(gen, ntaps, nchan, 1, window);
+    vegas_pfb_cache_path(path, sizeof(path), ntaps, nchan, window);
+
+    /* A group writable file of zeros, with a good header and checksum */
+    unlink(path);
+    vegas_pfb_read_coeff(got, ntaps, nchan, 1);
+    memset(got, 0, n * sizeof(float));
+    {
+        struct vegas_pfb_cache_hdr hdr;
+        f = fopen(path, "r+");
+        if (fread(&hdr, sizeof(hdr), 1, f) != 1)
+            errors++;
+        hdr.checksum = vegas_pfb_coeff_checksum(got, n);
+        rewind(f);
+        fwrite(&hdr, sizeof(hdr), 1, f);
+        fwrite(got, sizeof(float), n, f);
+        fclose(f);
+    }
+    chmod(path, 0664);
+    if (vegas_pfb_read_coeff(got, ntaps, nchan, 1) != VEGAS_OK ||
+        memcmp(gen, got, n * sizeof(float)) != 0)
+        errors++;
+    if (stat(path, &st) != 0 || (st.st_mode & 0777) != 0644)
+        errors++;
+
+    /* A link to a file of ours */
+    snprintf(victim, sizeof(victim), "%s/victim", dir);
+    f = fopen(victim, "w");
+    fputs("precious", f);
+    fclose(f);
+    unlink(path);
+    if (symlink(victim, path) != 0)
+        errors++;
+    if (vegas_pfb_read_coeff(got, ntaps, nchan, 1) != VEGAS_OK ||
+        memcmp(gen, got, n * sizeof(float)) != 0)
+        errors++;
+    if (stat(victim, &st) != 0 || st.st_size != 8 ||
+        lstat(path, &st) != 0 || !S_ISREG(st.st_mode))
+        errors++;
+
+    printf("untrusted cache files: %s\n", errors ? "FAILED" : "ok");
+    free(gen);
+    free(got);
+    return errors;
+}
+
+int main(int argc, char **argv)
+{
+    char cache_dir[64], cmd[128];
+    int nerr = 0, w;
+
+    strcpy(cache_dir, "/tmp/pfb_coeff_testXXXXXX");
+    if (mkdtemp(cache_dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    setenv("VEGAS_PFB_CACHE", cache_dir, 1);
+
+    for (w=0; w<VEGAS_PFB_NUM_WIN; w++)
+    {
+        nerr += test_generator(8, 64, 1, w);
+        nerr += test_generator(8, 4096, 8, w);
+        nerr += test_generator(7, 1000, 2, w);
+    }
+    nerr += test_generator(8, 524288, 1, VEGAS_PFB_WIN_HANNING);
+
+    /* The two sets VEGAS used to ship */
+    nerr += test_file(8, 4096, 8);
+    nerr += test_file(8, 32768, 1);
+
+    nerr += test_cache(8, 4096, 8, VEGAS_PFB_WIN_HANNING);
+    nerr += test_cache(8, 32768, 1, VEGAS_PFB_WIN_BLACKMAN);
+    nerr += test_cache(8, 524288, 1, VEGAS_PFB_WIN_HANNING);
+    nerr += test_untrusted(8, 1024, VEGAS_PFB_WIN_HANNING, cache_dir);
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", cache_dir);
+    if (system(cmd) != 0)
+        printf("could not remove %s\n", cache_dir);
+    return nerr ? 1 : 0;
+}
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include "vegas_error.h"
+#include "vegas_pfb_coeff.h"
+#include "vegas_pfb_kernels.h"
+#include "pfb_gpu.h"
+#include "cpu_context.h"
+
+typedef void (*fir_fn)(float *, const int8_t *, const float *, int, size_t, size_t, size_t);
+typedef void (*stokes_fn)(float *, const float *, size_t, size_t);
+
+static char coeff_dir[64];
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/// Compare a kernel's bits with the scalar kernel over a range of sizes
+/// and sample ranges.
+static int test_kernels(const char *name, fir_fn fir, stokes_fn stokes)
+{
+    const size_t maxn = 600;
+    int8_t *in = (int8_t *)malloc(VEGAS_NUM_TAPS * maxn * 4);
+    float *coeff = (float *)malloc(VEGAS_NUM_TAPS * maxn * sizeof(float));
+    float *spec = (float *)malloc(maxn * 4 * sizeof(float));
+    float *ref = (float *)malloc(maxn * 4 * sizeof(float));
+    float *out = (float *)malloc(maxn * 4 * sizeof(float));
+    size_t n, i0, i1, i;
+    int errors = 0;
+
+    for (i=0; i<VEGAS_NUM_TAPS * maxn * 4; ++i)
+        in[i] = (int8_t)(rand() & 0xff);
+    for (i=0; i<VEGAS_NUM_TAPS * maxn; ++i)
+        coeff[i] = (float)rand() / RAND_MAX - 0.5f;
+    for (i=0; i<maxn * 4; ++i)
+        spec[i] = 1000.0f * ((float)rand() / RAND_MAX - 0.5f);
+
+    for (n = 1; n <= maxn; n += (n < 40 ? 1 : 37))
+    {
+        for (i0 = 0; i0 < n && i0 < 11; i0 += 3)
+        {
+            i1 = n - (n - i0) / 5;
+            memset(ref, 0, n * 4 * sizeof(float));
+            memset(out, 0, n * 4 * sizeof(float));
+            vegas_pfb_fir_scalar(ref, in, coeff, VEGAS_NUM_TAPS, n, i0, i1);
+            fir(out, in, coeff, VEGAS_NUM_TAPS, n, i0, i1);
+            if (memcmp(ref, out, n * 4 * sizeof(float)) != 0)
+                errors++;
+
+            for (i=0; i<n * 4; ++i)
+                ref[i] = out[i] = (float)i;
+            vegas_pfb_stokes_scalar(ref, spec, i0, i1);
+            stokes(out, spec, i0, i1);
+            if (memcmp(ref, out, n * 4 * sizeof(float)) != 0)
+                errors++;
+        }
+    }
+    printf("%-8s kernels: %s\n", name, errors ? "FAILED" : "bit exact");
+    free(in);
+    free(coeff);
+    free(spec);
+    free(ref);
+    free(out);
+    return errors;
+}
+
+/// Run nspec spectra through a CpuContext and compare the accumulated,
+/// fftshifted result with a double precision PFB and DFT.
+static int test_engine(int nsubband, int nchan, int nthread, int nspec)
+{
+    size_t n = (size_t)nsubband * nchan;
+    int in_block_size = (int)((nspec + VEGAS_NUM_TAPS) * n * 4);
+    CpuContext ctx(nsubband, nchan, in_block_size, in_block_size, nthread);
+    float *coeff = (float *)malloc(VEGAS_NUM_TAPS * n * sizeof(float));
+    double *fir = (double *)malloc(n * 4 * sizeof(double));
+    double *acc = (double *)calloc(n * 4, sizeof(double));
+    double *cosv = (double *)malloc(nchan * sizeof(double));
+    double *sinv = (double *)malloc(nchan * sizeof(double));
+    float *out = (float *)malloc(n * 4 * sizeof(float));
+    double maxref = 0.0, maxerr = 0.0, err, xr, xi, yr, yi, c, s;
+    size_t i, o;
+    int sp, j, k, sub, f, ch;
+
+    if (ctx.init_status() != EXIT_SUCCESS)
+    {
+        printf("engine %dx%d: context failed\n", nchan, nsubband);
+        return 1;
+    }
+    for (i=0; i<2 * (size_t)in_block_size; ++i)
+        ctx._pc4Data[i] = (int8_t)(rand() & 0xff);
+    vegas_pfb_read_coeff(coeff, VEGAS_NUM_TAPS, nchan, nsubband);
+    for (f=0; f<nchan; ++f)
+    {
+        cosv[f] = cos(2.0 * M_PI * f / nchan);
+        sinv[f] = sin(2.0 * M_PI * f / nchan);
+    }
+
+    ctx.zero_accumulator();
+    ctx.rewind();
+    for (sp=0; sp<nspec; ++sp)
+    {
+        const int8_t *win = ctx._pc4Data + sp * n * 4;
+        ctx.pfb();
+        ctx.do_fft();
+        ctx.accumulate();
+        ctx.advance(n * 4);
+
+        /* The reference */
+        for (i=0; i<n; ++i)
+            for (k=0; k<4; ++k)
+            {
+                fir[4*i+k] = 0.0;
+                for (j=0; j<VEGAS_NUM_TAPS; ++j)
+                    fir[4*i+k] += (double)win[4*(j*n+i)+k] * coeff[j*n+i];
+            }
+        for (sub=0; sub<nsubband; ++sub)
+            for (f=0; f<nchan; ++f)
+            {
+                xr = xi = yr = yi = 0.0;
+                for (ch=0; ch<nchan; ++ch)
+                {
+                    const double *p = fir + 4 * ((size_t)ch * nsubband + sub);
+                    c = cosv[((size_t)ch * f) % nchan];
+                    s = -sinv[((size_t)ch * f) % nchan];
+                    xr += p[0] * c - p[1] * s;
+                    xi += p[0] * s + p[1] * c;
+                    yr += p[2] * c - p[3] * s;
+                    yi += p[2] * s + p[3] * c;
+                }
+                double *a = acc + 4 * ((size_t)f * nsubband + sub);
+                a[0] += xr * xr + xi * xi;
+                a[1] += yr * yr + yi * yi;
+                a[2] += xr * yr + xi * yi;
+                a[3] += xi * yr - xr * yi;
+            }
+    }
+
+    ctx.get_accumulated_spectrum((char *)out);
+    for (o=0; o<n; ++o)
+    {
+        i = o < n / 2 ? o + n / 2 : o - n / 2;
+        for (k=0; k<4; ++k)
+        {
+            err = fabs(out[4*o+k] - acc[4*i+k]);
+            maxerr = err > maxerr ? err : maxerr;
+            maxref = fabs(acc[4*i+k]) > maxref ? fabs(acc[4*i+k]) : maxref;
+        }
+    }
+    printf("engine %5dx%d, %d threads: max error %.2e of %.2e %s\n", nchan, nsubband,
+           ctx.nthreads(), maxerr, maxref, maxerr < 1e-5 * maxref ? "ok" : "FAILED");
+
+    free(coeff);
+    free(fir);
+    free(acc);
+    free(cosv);
+    free(sinv);
+    free(out);
+    return maxerr < 1e-5 * maxref ? 0 : 1;
+}
+
+/// Spectra per second through the filter, FFT and accumulation
+static void benchmark(int nsubband, int nchan, int nthread)
+{
+    size_t n = (size_t)nsubband * nchan;
+    const int nspec = 64;
+    int in_block_size = (int)((nspec + VEGAS_NUM_TAPS) * n * 4);
+    CpuContext ctx(nsubband, nchan, in_block_size, in_block_size, nthread);
+    double t0, t1;
+    int sp, rep, nrep = 0;
+
+    if (ctx.init_status() != EXIT_SUCCESS)
+        return;
+    memset(ctx._pc4Data, 3, 2 * (size_t)in_block_size);
+    t0 = now_sec();
+    do
+    {
+        for (rep=0; rep<4; ++rep, ++nrep)
+        {
+            ctx.rewind();
+            for (sp=0; sp<nspec; ++sp)
+            {
+                ctx.pfb();
+                ctx.do_fft();
+                ctx.accumulate();
+                ctx.advance(n * 4);
+            }
+        }
+        t1 = now_sec();
+    } while (t1 - t0 < 0.5);
+    printf("  %5dx%d %d threads: %8.0f spectra/s, %6.1f Msamples/s"
+           " (pfb %.0f%%, fft %.0f%%, accum %.0f%%)\n", nchan, nsubband,
+           ctx.nthreads(), nrep * nspec / (t1 - t0), nrep * nspec * n / (t1 - t0) * 1e-6,
+           100 * ctx.stage_time(PfbStagePFB) / (t1 - t0),
+           100 * ctx.stage_time(PfbStageFFT) / (t1 - t0),
+           100 * ctx.stage_time(PfbStageAccum) / (t1 - t0));
+}
+
+int main(int argc, char **argv)
+{
+    /* LBW modes with 8 subbands and an HBW sized transform */
+    const int shapes[][2] = { { 64, 1 }, { 256, 2 }, { 128, 8 }, { 1024, 1 } };
+    const int bench[][2] = { { 1024, 8 }, { 4096, 8 }, { 32768, 1 } };
+    int nerr = 0;
+    unsigned i;
+
+    srand(12345);
+    strcpy(coeff_dir, "/tmp/pfb_cpu_testXXXXXX");
+    if (mkdtemp(coeff_dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    setenv("VEGAS_PFB_CACHE", coeff_dir, 1);
+    printf("dispatch selects %s\n", vegas_pfb_kernel_name());
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        nerr += test_kernels("avx2", vegas_pfb_fir_avx2, vegas_pfb_stokes_avx2);
+    nerr += test_kernels("dispatch", vegas_pfb_fir, vegas_pfb_stokes);
+
+    for (i=0; i<sizeof(shapes)/sizeof(shapes[0]); ++i)
+    {
+        nerr += test_engine(shapes[i][1], shapes[i][0], 1, 5);
+        nerr += test_engine(shapes[i][1], shapes[i][0], 3, 5);
+    }
+
+    printf("per spectrum cost:\n");
+    for (i=0; i<sizeof(bench)/sizeof(bench[0]); ++i)
+    {
+        benchmark(bench[i][1], bench[i][0], 1);
+        benchmark(bench[i][1], bench[i][0], 2);
+    }
+
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", coeff_dir);
+    if (system(cmd) != 0)
+        printf("could not remove %s\n", coeff_dir);
+    return nerr ? 1 : 0;
+}
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <semaphore.h>
+#include "fitshead.h"
+#include "vegas_error.h"
+#include "vegas_status.h"
+
+/* Well clear of the keys and semaphores the pipeline uses */
+#define TEST_STATUS_KEY "0x5e91c0de"
+#define TEST_OLD_STATUS_KEY "0x5e91c0df"
+/* Its semaphore is named for this, as vegas_status_attach() names them */
+#define TEST_KEYFILE "/vegas_seqlock_test"
+#define TEST_STATUS_SEMNAME TEST_KEYFILE "_hashpipe_status_0"
+#define NWRITE 20000
+#define NREADER 3
+
+static struct vegas_status st;
+static volatile int writing;
+/* Write as hashpipe does, without the sequence counter */
+static int plain_writer;
+
+struct reader {
+    int locking;        ///< Copy under the lock, as readers used to
+    long ncopy;
+    long torn;
+};
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Each write sets SEQA, then a run of cards, then SEQB, all to the same
+   number, so that a copy taken partway through is caught */
+static void *writer(void *arg)
+{
+    double *max_wait = (double *)arg, t;
+    char key[16];
+    int n, i;
+
+    for (n=1; n<=NWRITE; n++) {
+        t = now_sec();
+        if (plain_writer)
+            sem_wait(st.lock);
+        else
+            vegas_status_lock(&st);
+        t = now_sec() - t;
+        *max_wait = t > *max_wait ? t : *max_wait;
+        hputi4(st.buf, "SEQA", n);
+        for (i=0; i<20; i++) {
+            sprintf(key, "FILL%d", i);
+            hputi4(st.buf, key, n);
+        }
+        hputi4(st.buf, "SEQB", n);
+        if (plain_writer)
+            sem_post(st.lock);
+        else
+            vegas_status_unlock(&st);
+    }
+    writing = 0;
+    return NULL;
+}
+
+static void *reader(void *arg)
+{
+    struct reader *r = (struct reader *)arg;
+    static __thread char copy[VEGAS_STATUS_SIZE];
+    int a, b;
+
+    while (writing) {
+        if (r->locking) {
+            vegas_status_lock(&st);
+            memcpy(copy, st.buf, VEGAS_STATUS_SIZE);
+            /* Looking the copy over takes a while */
+            usleep(50);
+            vegas_status_unlock(&st);
+        } else {
+            vegas_status_snapshot(&st, copy);
+            usleep(50);
+        }
+        a = b = -1;
+        hgeti4(copy, "SEQA", &a);
+        hgeti4(copy, "SEQB", &b);
+        r->torn += a != b;
+        r->ncopy++;
+    }
+    return NULL;
+}
+
+/// Writers against readers that lock or take snapshots; returns the
+/// number of torn copies
+static long run(int locking)
+{
+    struct reader readers[NREADER];
+    pthread_t tid[NREADER + 1];
+    double max_wait = 0, t;
+    long ncopy = 0, torn = 0;
+    int i;
+
+    memset(readers, 0, sizeof(readers));
+    writing = 1;
+    t = now_sec();
+    for (i=0; i<NREADER; i++) {
+        readers[i].locking = locking;
+        pthread_create(&tid[i], NULL, reader, &readers[i]);
+    }
+    pthread_create(&tid[NREADER], NULL, writer, &max_wait);
+    for (i=0; i<=NREADER; i++)
+        pthread_join(tid[i], NULL);
+    t = now_sec() - t;
+    for (i=0; i<NREADER; i++) {
+        ncopy += readers[i].ncopy;
+        torn += readers[i].torn;
+    }
+    printf("%-9s readers, %-5s writer: %d writes in %.2f s, longest lock "
+           "wait %.0f us, %ld copies, %ld torn: %s\n",
+           locking ? "locking" : "lockless", plain_writer ? "plain" : "seq",
+           NWRITE, t, max_wait * 1e6, ncopy, torn, torn ? "FAILED" : "ok");
+    return torn;
+}
+
+static void *try_lock(void *arg)
+{
+    int *rv = (int *)arg;
+    *rv = vegas_status_lock_timeout(&st, 0.2);
+    if (*rv == VEGAS_OK)
+        vegas_status_unlock(&st);
+    return NULL;
+}
+
+/// A held lock times out, and the counter is odd only while it is held
+static int test_timeout()
+{
+    pthread_t tid;
+    int rv = -1, ok;
+
+    vegas_status_lock(&st);
+    ok = (st.seq->seq & 1) && st.seq->pid == getpid();
+    pthread_create(&tid, NULL, try_lock, &rv);
+    pthread_join(tid, NULL);
+    ok = ok && rv == VEGAS_TIMEOUT;
+    vegas_status_unlock(&st);
+    ok = ok && !(st.seq->seq & 1);
+    pthread_create(&tid, NULL, try_lock, &rv);
+    pthread_join(tid, NULL);
+    ok = ok && rv == VEGAS_OK;
+    printf("lock timeout: %s\n", ok ? "ok" : "FAILED");
+    return !ok;
+}
+
+/// A segment made with the keyword index but before the counter keeps
+/// its index where it was, and is read under the lock
+static int test_old_layout()
+{
+    struct vegas_status old;
+    struct hindex *index;
+    char copy[VEGAS_STATUS_SIZE];
+    int shmid, ok;
+
+    shmid = shmget(strtoul(TEST_OLD_STATUS_KEY, NULL, 0),
+            VEGAS_STATUS_INDEX_OFFSET + sizeof(struct hindex), 0666 | IPC_CREAT);
+    setenv("HASHPIPE_STATUS_KEY", TEST_OLD_STATUS_KEY, 1);
+    if (shmid == -1 || vegas_status_attach(&old) != VEGAS_OK) {
+        printf("old layout: could not attach: FAILED\n");
+        return 1;
+    }
+    index = (struct hindex *)(old.buf + VEGAS_STATUS_INDEX_OFFSET);
+    vegas_status_lock(&old);
+    hputi4(old.buf, "NPOL", 4);
+    vegas_status_unlock(&old);
+    ok = old.seq == NULL && old.shmid == shmid && index->valid &&
+        index->nkey == 1 &&
+        vegas_status_snapshot(&old, copy) == VEGAS_OK &&
+        ksearch(copy, "NPOL") == copy;
+    printf("old layout: %s\n", ok ? "ok" : "FAILED");
+    shmctl(shmid, IPC_RMID, NULL);
+    vegas_status_detach(&old);
+    setenv("HASHPIPE_STATUS_KEY", TEST_STATUS_KEY, 1);
+    return !ok;
+}
+
+int main(int argc, char **argv)
+{
+    int nerr = 0;
+
+    setenv("HASHPIPE_STATUS_KEY", TEST_STATUS_KEY, 1);
+    setenv("HASHPIPE_KEYFILE", TEST_KEYFILE, 1);
+    if (vegas_status_attach(&st) != VEGAS_OK) {
+        printf("could not attach the status buffer\n");
+        return 1;
+    }
+    if (st.seq == NULL) {
+        printf("status buffer has no sequence counter: FAILED\n");
+        nerr++;
+    } else {
+        nerr += test_timeout();
+        nerr += run(1) != 0;
+        nerr += run(0) != 0;
+        plain_writer = 1;
+        nerr += run(0) != 0;
+    }
+    nerr += test_old_layout();
+
+    shmctl(st.shmid, IPC_RMID, NULL);
+    vegas_status_detach(&st);
+    sem_close(st.lock);
+    sem_unlink(TEST_STATUS_SEMNAME);
+    return nerr ? 1 : 0;
+}